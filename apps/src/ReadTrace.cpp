@@ -0,0 +1,115 @@
+/**
+ * @file
+ *
+ * Print (part of) a binary trace file written by TraceWriter as
+ * space separated text, for plotting scripts.
+ *
+ * Usage: ReadTrace trace.bin [--start t0] [--end t1] [variable ...]
+ *
+ * With no variables every variable is printed. The first line holds the
+ * column names; the first column is always time. --list prints the
+ * variable names only.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+
+#include "ExecutableSupport.hpp"
+#include "Exception.hpp"
+#include "PetscTools.hpp"
+#include "PetscException.hpp"
+
+#include "TraceFile.hpp"
+
+int main(int argc, char *argv[])
+{
+    ExecutableSupport::StartupWithoutShowingCopyright(&argc, &argv);
+
+    int exit_code = ExecutableSupport::EXIT_OK;
+
+    try
+    {
+        if (argc<2)
+        {
+            ExecutableSupport::PrintError("Usage: ReadTrace trace.bin [--list] [--start t0] [--end t1] [variable ...]", true);
+            exit_code = ExecutableSupport::EXIT_BAD_ARGUMENTS;
+        }
+        else if (PetscTools::AmMaster())
+        {
+            TraceReader reader(argv[1]);
+            double start_time = -INFINITY;
+            double end_time = INFINITY;
+            bool list = false;
+            std::vector<unsigned int> variables;
+            for (int i=2; i<argc; i++)
+            {
+                std::string arg_i(argv[i]);
+                if (arg_i == "--list")
+                {
+                    list = true;
+                }
+                else if (arg_i == "--start" && i+1 < argc)
+                {
+                    start_time = std::stod(argv[++i]);
+                }
+                else if (arg_i == "--end" && i+1 < argc)
+                {
+                    end_time = std::stod(argv[++i]);
+                }
+                else
+                {
+                    variables.push_back(reader.GetVariableIndex(arg_i));
+                }
+            }
+
+            if (list)
+            {
+                for (unsigned int i=0; i<reader.rGetVariableNames().size(); i++)
+                {
+                    std::cout << reader.rGetVariableNames()[i] << "\n";
+                }
+            }
+            else
+            {
+                if (variables.empty())
+                {
+                    for (unsigned int i=0; i<reader.rGetVariableNames().size(); i++)
+                    {
+                        variables.push_back(i);
+                    }
+                }
+
+                const std::vector<double> times = reader.GetTimes(start_time, end_time);
+                std::vector<std::vector<double> > columns;
+                std::cout << "time";
+                for (unsigned int i=0; i<variables.size(); i++)
+                {
+                    std::cout << " " << reader.rGetVariableNames()[variables[i]];
+                    columns.push_back(reader.GetVariable(variables[i], start_time, end_time));
+                }
+                std::cout << "\n";
+
+                std::cout.precision(18);
+                for (unsigned int j=0; j<times.size(); j++)
+                {
+                    std::cout << times[j];
+                    for (unsigned int i=0; i<columns.size(); i++)
+                    {
+                        std::cout << " " << columns[i][j];
+                    }
+                    std::cout << "\n";
+                }
+            }
+        }
+    }
+    catch (const Exception& e)
+    {
+        ExecutableSupport::PrintError(e.GetMessage());
+        exit_code = ExecutableSupport::EXIT_ERROR;
+    }
+
+    ExecutableSupport::FinalizePetsc();
+    return exit_code;
+}
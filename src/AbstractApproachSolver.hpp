@@ -0,0 +1,52 @@
+#ifndef ABSTRACTAPPROACHSOLVER_HPP
+#define ABSTRACTAPPROACHSOLVER_HPP
+
+#include "AbstractCvodeCell.hpp"
+#include "SimulationTools.hpp"
+#include <boost/shared_ptr.hpp>
+#include <nvector/nvector_serial.h>
+
+/* A cheap, low order solver for the generated CVODE models, used for the paces
+   before the limit cycle is close (see Simulation::SetApproachSolver). Solvers
+   work on the model's own state vector through its right hand side, so CVODE
+   picks up from wherever they leave it. */
+
+class AbstractApproachSolver{
+protected:
+  boost::shared_ptr<AbstractCvodeCell> p_model;
+  unsigned long rhs_evaluations = 0;
+  unsigned long steps = 0;
+  double last_step_size = 0;
+
+  void EvaluateDerivatives(double time, N_Vector state, N_Vector r_derivatives){
+    p_model->EvaluateYDerivatives(time, state, r_derivatives);
+    rhs_evaluations++;
+  }
+public:
+  AbstractApproachSolver(boost::shared_ptr<AbstractCvodeCell> _p_model) : p_model(_p_model){
+  }
+  virtual ~AbstractApproachSolver(){
+  }
+
+  /**Advance the model's state from start_time to end_time*/
+  virtual void Solve(double start_time, double end_time) = 0;
+
+  /**A solver set up the same way for another instance of the model (see Simulation::Fork)*/
+  virtual boost::shared_ptr<AbstractApproachSolver> Clone(boost::shared_ptr<AbstractCvodeCell> p_other_model) const = 0;
+
+  /**Right hand side evaluations so far, including any used to set the solver up*/
+  unsigned long GetNumberOfRhsEvaluations() const{
+    return rhs_evaluations;
+  }
+  /**The work so far in CVODE's terms, so Simulation can count approach paces
+     alongside CVODE ones. Only steps and right hand side evaluations apply.*/
+  virtual CvodeStatistics GetStatistics() const{
+    CvodeStatistics statistics;
+    statistics.steps = steps;
+    statistics.rhs_evaluations = rhs_evaluations;
+    statistics.last_step_size = last_step_size;
+    return statistics;
+  }
+};
+
+#endif
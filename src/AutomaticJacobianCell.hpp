@@ -0,0 +1,92 @@
+#ifndef AUTOMATICJACOBIANCELL_HPP
+#define AUTOMATICJACOBIANCELL_HPP
+
+#include "AbstractCvodeCell.hpp"
+#include "DualNumber.hpp"
+#include <vector>
+#include <algorithm>
+
+#if CHASTE_SUNDIALS_VERSION >= 30000
+#include <sunmatrix/sunmatrix_dense.h>
+#else
+#include <sundials/sundials_direct.h>
+#endif
+
+/* An exact Jacobian for a generated CVODE model that PyCML has no Maple output
+   for, by forward mode automatic differentiation.
+
+   MODEL is generated from CELL's own source by GenerateAutomaticJacobianFiles.py:
+   it derives from AutomaticJacobianCell<CELL, MODEL> and provides
+
+     template<typename SCALAR>
+     void EvaluateTemplatedYDerivatives(double time, const SCALAR* p_y, SCALAR* p_dy);
+
+   which is CELL::EvaluateYDerivatives with the state and everything computed
+   from it over SCALAR. Over doubles it is the model's right hand side, and over
+   Dual<BLOCK_SIZE> seeded with BLOCK_SIZE columns of the identity it gives
+   those columns of the Jacobian, so the whole Jacobian costs
+   ceil(n/BLOCK_SIZE) evaluations, each BLOCK_SIZE wide.
+
+   The cell tells Chaste it has an analytic Jacobian, so CVODE uses it for its
+   Newton matrices as it would a Maple one. ForceUseOfNumericalJacobian still
+   switches back to CVODE's finite differences. */
+
+template<class CELL, class MODEL, unsigned int BLOCK_SIZE = 8>
+class AutomaticJacobianCell : public CELL{
+private:
+  std::vector<Dual<BLOCK_SIZE>> dual_state;
+  std::vector<Dual<BLOCK_SIZE>> dual_derivatives;
+
+  /*Call set(i, j, df_i/dy_j) for every entry of the Jacobian at state p_state*/
+  template<typename SETTER>
+  void FillJacobian(double time, const double* p_state, SETTER set){
+    const unsigned int n = this->GetNumberOfStateVariables();
+    dual_state.resize(n);
+    dual_derivatives.resize(n);
+    for(unsigned int i = 0; i < n; i++)
+      dual_state[i] = Dual<BLOCK_SIZE>(p_state[i]);
+
+    for(unsigned int first = 0; first < n; first += BLOCK_SIZE){
+      const unsigned int columns = std::min(BLOCK_SIZE, n - first);
+      for(unsigned int k = 0; k < columns; k++)
+        dual_state[first + k].derivatives[k] = 1;
+      static_cast<MODEL*>(this)->EvaluateTemplatedYDerivatives(time, dual_state.data(), dual_derivatives.data());
+      for(unsigned int k = 0; k < columns; k++)
+        dual_state[first + k].derivatives[k] = 0;
+
+      for(unsigned int i = 0; i < n; i++)
+        for(unsigned int k = 0; k < columns; k++)
+          set(i, first + k, dual_derivatives[i].derivatives[k]);
+    }
+  }
+
+public:
+  AutomaticJacobianCell(boost::shared_ptr<AbstractIvpOdeSolver> p_solver, boost::shared_ptr<AbstractStimulusFunction> p_stimulus)
+    : CELL(p_solver, p_stimulus){
+    this->mHasAnalyticJacobian = true;
+    this->mUseAnalyticJacobian = true;
+  }
+
+  /**The Jacobian df_i/dy_j at time and r_state, as rows*/
+  std::vector<std::vector<double>> GetJacobian(double time, const std::vector<double>& r_state){
+    std::vector<std::vector<double>> jacobian(r_state.size(), std::vector<double>(r_state.size()));
+    FillJacobian(time, r_state.data(), [&](unsigned int i, unsigned int j, double value){
+      jacobian[i][j] = value;
+    });
+    return jacobian;
+  }
+
+  /**Called by CVODE (through Chaste) whenever it wants a new Newton matrix*/
+  void EvaluateAnalyticJacobian(double time, N_Vector y, N_Vector ydot, CHASTE_CVODE_DENSE_MATRIX jacobian,
+                                N_Vector tmp1, N_Vector tmp2, N_Vector tmp3){
+    FillJacobian(time, NV_DATA_S(y), [&](unsigned int i, unsigned int j, double value){
+#if CHASTE_SUNDIALS_VERSION >= 30000
+      SM_ELEMENT_D(jacobian, i, j) = value;
+#else
+      DENSE_ELEM(jacobian, i, j) = value;
+#endif
+    });
+  }
+};
+
+#endif
@@ -0,0 +1,139 @@
+#include "BenchmarkTools.hpp"
+
+#include <fstream>
+#include <chrono>
+#include <ctime>
+#include <cmath>
+#include <sys/resource.h>
+#include <boost/algorithm/string.hpp>
+
+double GetWallTime(){
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double GetProcessCpuTime(){
+  timespec time;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+  return time.tv_sec + 1e-9*time.tv_nsec;
+}
+
+double GetThreadCpuTime(){
+  timespec time;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+  return time.tv_sec + 1e-9*time.tv_nsec;
+}
+
+bool ResetPeakRss(){
+  /*Writing 5 to clear_refs resets VmHWM to the current resident set*/
+  std::ofstream f_out("/proc/self/clear_refs");
+  f_out << "5";
+  f_out.close();
+  return bool(f_out);
+}
+
+long GetPeakRss(){
+  /*VmHWM follows ResetPeakRss, ru_maxrss never goes down*/
+  std::ifstream file_in("/proc/self/status");
+  std::string line;
+  while(std::getline(file_in, line)){
+    if(boost::starts_with(line, "VmHWM:"))
+      return std::stol(line.substr(6));
+  }
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  /*ru_maxrss is already in kilobytes on Linux*/
+  return usage.ru_maxrss;
+}
+
+void WriteBenchmarkCsv(const std::vector<BenchmarkRecord>& records, std::string file_path){
+  std::ofstream f_out(file_path);
+  f_out.precision(10);
+  f_out << "model,period,method,threads,wall_time,cpu_time,paces,rhs_evaluations,jacobian_evaluations,cvode_steps,peak_rss_kb\n";
+  for(auto i = records.begin(); i != records.end(); i++){
+    f_out << i->model_name << "," << i->period << "," << i->method << "," << i->threads << ","
+          << i->wall_time << "," << i->cpu_time << "," << i->paces << ","
+          << i->rhs_evaluations << "," << i->jacobian_evaluations << "," << i->cvode_steps << ","
+          << i->peak_rss << "\n";
+  }
+  f_out.close();
+}
+
+void WriteBenchmarkJson(const std::vector<BenchmarkRecord>& records, std::string file_path){
+  std::ofstream f_out(file_path);
+  f_out.precision(10);
+  f_out << "[\n";
+  for(auto i = records.begin(); i != records.end(); i++){
+    f_out << "  {\"model\": \"" << i->model_name << "\", \"period\": " << i->period
+          << ", \"method\": \"" << i->method << "\", \"threads\": " << i->threads
+          << ", \"wall_time\": " << i->wall_time << ", \"cpu_time\": " << i->cpu_time
+          << ", \"paces\": " << i->paces << ", \"rhs_evaluations\": " << i->rhs_evaluations
+          << ", \"jacobian_evaluations\": " << i->jacobian_evaluations
+          << ", \"cvode_steps\": " << i->cvode_steps << ", \"peak_rss_kb\": " << i->peak_rss << "}";
+    if(i + 1 != records.end())
+      f_out << ",";
+    f_out << "\n";
+  }
+  f_out << "]\n";
+  f_out.close();
+}
+
+std::vector<BenchmarkRecord> ReadBenchmarkCsv(std::string file_path){
+  std::vector<BenchmarkRecord> records;
+  std::ifstream file_in(file_path);
+  if(!file_in.is_open()){
+    std::cout << "Couldn't open file! " + file_path + " \n";
+    return records;
+  }
+  std::string line;
+  /*Skip the header*/
+  std::getline(file_in, line);
+  while(std::getline(file_in, line)){
+    std::vector<std::string> fields;
+    boost::split(fields, line, boost::is_any_of(","));
+    if(fields.size() < 11)
+      continue;
+    BenchmarkRecord record;
+    record.model_name = fields[0];
+    record.period = std::stod(fields[1]);
+    record.method = fields[2];
+    record.threads = std::stoul(fields[3]);
+    record.wall_time = std::stod(fields[4]);
+    record.cpu_time = std::stod(fields[5]);
+    record.paces = std::stoul(fields[6]);
+    record.rhs_evaluations = std::stol(fields[7]);
+    record.jacobian_evaluations = std::stol(fields[8]);
+    record.cvode_steps = std::stol(fields[9]);
+    record.peak_rss = std::stol(fields[10]);
+    records.push_back(record);
+  }
+  return records;
+}
+
+unsigned int CompareBenchmarks(const std::vector<BenchmarkRecord>& current, const std::vector<BenchmarkRecord>& baseline, double tolerance, std::ostream& output){
+  unsigned int regressions = 0;
+  output << "model period method threads wall_time_ratio cpu_time_ratio paces_ratio rhs_ratio steps_ratio\n";
+  for(auto i = current.begin(); i != current.end(); i++){
+    auto j = baseline.begin();
+    for(; j != baseline.end(); j++){
+      if(j->model_name == i->model_name && j->period == i->period && j->method == i->method && j->threads == i->threads)
+        break;
+    }
+    if(j == baseline.end()){
+      output << i->model_name << " " << i->period << " " << i->method << " " << i->threads << " has no baseline\n";
+      continue;
+    }
+    const double paces_ratio = double(i->paces)/j->paces;
+    const double rhs_ratio   = double(i->rhs_evaluations)/j->rhs_evaluations;
+    const double steps_ratio = double(i->cvode_steps)/j->cvode_steps;
+    output << i->model_name << " " << i->period << " " << i->method << " " << i->threads << " "
+           << i->wall_time/j->wall_time << " " << i->cpu_time/j->cpu_time << " "
+           << paces_ratio << " " << rhs_ratio << " " << steps_ratio;
+    /*Ratios are NAN or infinite when the baseline did no work, which only counts if we did*/
+    if(paces_ratio > 1 + tolerance || rhs_ratio > 1 + tolerance || steps_ratio > 1 + tolerance){
+      output << " REGRESSION";
+      regressions++;
+    }
+    output << "\n";
+  }
+  return regressions;
+}
@@ -0,0 +1,54 @@
+#ifndef BENCHMARKTOOLS_HPP
+#define BENCHMARKTOOLS_HPP
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+/** The cost of running one (model, period, method) combination to steady state */
+struct BenchmarkRecord{
+  std::string model_name;
+  double period = 0;
+  std::string method;
+  unsigned int threads = 1;
+  double wall_time = 0;
+  double cpu_time = 0;
+  unsigned int paces = 0;
+  long rhs_evaluations = 0;
+  long jacobian_evaluations = 0;
+  long cvode_steps = 0;
+  /*Peak resident set (kB) during this run alone, -1 where it can't be measured (see ResetPeakRss)*/
+  long peak_rss = -1;
+};
+
+/**Seconds since an arbitrary (but fixed) point*/
+double GetWallTime();
+
+/**CPU seconds used by the whole process*/
+double GetProcessCpuTime();
+
+/**CPU seconds used by the calling thread only*/
+double GetThreadCpuTime();
+
+/**Start the process's resident set high-water mark again from its current size,
+   so that GetPeakRss covers only what runs after this. Returns false if the
+   kernel doesn't allow it (Linux before 4.0, or no /proc), in which case the
+   mark keeps covering the whole process.*/
+bool ResetPeakRss();
+
+/**Peak resident set size of the process in kilobytes since the last ResetPeakRss*/
+long GetPeakRss();
+
+void WriteBenchmarkCsv(const std::vector<BenchmarkRecord>&, std::string file_path);
+
+void WriteBenchmarkJson(const std::vector<BenchmarkRecord>&, std::string file_path);
+
+std::vector<BenchmarkRecord> ReadBenchmarkCsv(std::string file_path);
+
+/**Print the change in cost of each record relative to the matching baseline record and return
+   the number of records whose solver work (paces, RHS evaluations or CVODE steps) grew by more
+   than the given relative tolerance. Timings are reported but never counted as regressions as
+   they are too noisy on shared machines.*/
+unsigned int CompareBenchmarks(const std::vector<BenchmarkRecord>& current, const std::vector<BenchmarkRecord>& baseline, double tolerance, std::ostream& output = std::cout);
+
+#endif
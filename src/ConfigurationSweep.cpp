@@ -0,0 +1,71 @@
+#include "ConfigurationSweep.hpp"
+#include "Simulation.hpp"
+#include "Tracing.hpp"
+
+#include <algorithm>
+
+namespace{
+  /*Pace a configuration that has split off from the shared run until it finishes*/
+  void RunTail(SmartSimulation& r_simulation, ConfigurationResult& r_result, unsigned int max_paces, unsigned int& r_paces_solved){
+    for(; r_result.paces < max_paces && !r_simulation.is_finished(); r_result.paces++){
+      r_simulation.RunPace();
+      r_paces_solved++;
+    }
+    r_result.finished = r_simulation.is_finished();
+    r_result.state_variables = r_simulation.GetStateVariables();
+  }
+}
+
+std::vector<ConfigurationResult> RunConfigurationSweep(boost::shared_ptr<AbstractCvodeCell> p_model, double period,
+                                                       const std::vector<ExtrapolationConfiguration>& configurations, unsigned int max_paces,
+                                                       unsigned int* p_paces_solved, std::string input_path,
+                                                       std::function<boost::shared_ptr<AbstractCvodeCell>()> model_factory){
+  TRACE_SCOPE("RunConfigurationSweep");
+  std::vector<ConfigurationResult> results(configurations.size());
+  unsigned int largest_buffer = 0;
+  for(unsigned int i = 0; i < configurations.size(); i++){
+    results[i].configuration = configurations[i];
+    largest_buffer = std::max(largest_buffer, configurations[i].buffer_size);
+  }
+
+  /*The shared run keeps enough history for every configuration and never jumps*/
+  SmartSimulation baseline(p_model, period, input_path);
+  if(model_factory)
+    baseline.SetModelFactory(model_factory);
+  baseline.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+  baseline.Initialise(largest_buffer, 1);
+  baseline.SetMaximumJumps(0);
+
+  unsigned int paces_solved = 0;
+  std::vector<bool> waiting(configurations.size(), true);
+  unsigned int pace;
+  for(pace = 0; pace < max_paces && !baseline.is_finished(); pace++){
+    for(unsigned int i = 0; i < configurations.size(); i++){
+      if(!waiting[i] || !baseline.WouldExtrapolate(configurations[i].buffer_size))
+        continue;
+      SmartSimulation tail = baseline.Fork();
+      tail.Rebuffer(configurations[i].buffer_size, configurations[i].extrapolation_constant);
+      /*Back to the default*/
+      tail.SetMaximumJumps(100);
+      results[i].paces = results[i].shared_paces = pace;
+      RunTail(tail, results[i], max_paces, paces_solved);
+      waiting[i] = false;
+    }
+    if(std::find(waiting.begin(), waiting.end(), true) == waiting.end())
+      break;
+    baseline.RunPace();
+    paces_solved++;
+  }
+
+  /*Configurations that never jumped are the shared run*/
+  for(unsigned int i = 0; i < configurations.size(); i++){
+    if(!waiting[i])
+      continue;
+    results[i].paces = results[i].shared_paces = pace;
+    results[i].finished = baseline.is_finished();
+    results[i].state_variables = baseline.GetStateVariables();
+  }
+  if(p_paces_solved)
+    *p_paces_solved = paces_solved;
+  return results;
+}
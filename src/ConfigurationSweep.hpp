@@ -0,0 +1,42 @@
+#ifndef CONFIGURATIONSWEEP_HPP
+#define CONFIGURATIONSWEEP_HPP
+
+#include "AbstractCvodeCell.hpp"
+#include <vector>
+#include <string>
+#include <functional>
+#include <boost/shared_ptr.hpp>
+
+/** One setting of SmartSimulation's hyper-parameters (see SmartSimulation::Initialise) */
+struct ExtrapolationConfiguration{
+  unsigned int buffer_size;
+  double extrapolation_constant;
+};
+
+struct ConfigurationResult{
+  ExtrapolationConfiguration configuration;
+  /*Paces to steady state, as if this configuration had been run on its own*/
+  unsigned int paces = 0;
+  /*Of which solved once for every configuration that hadn't jumped yet*/
+  unsigned int shared_paces = 0;
+  bool finished = false;
+  std::vector<double> state_variables;
+};
+
+/**Run SmartSimulation from the model's current state to steady state with every
+   configuration, solving the paces they have in common once. Until its first
+   jump a configuration is pacing by brute force, like all the others, so one
+   simulation that never jumps is paced for all of them. Before each of its paces
+   every configuration still waiting is asked whether it would jump now (see
+   SmartSimulation::WouldExtrapolate), and those that would are forked off,
+   rebuffered to their own settings and run to the end on their own. The
+   results are exactly those of separate runs, in the order of configurations.
+   If r_paces_solved is given it is set to the number of paces actually solved.
+   model_factory is needed for models not compiled into the project (see
+   Simulation::SetModelFactory).*/
+std::vector<ConfigurationResult> RunConfigurationSweep(boost::shared_ptr<AbstractCvodeCell> p_model, double period,
+                                                       const std::vector<ExtrapolationConfiguration>& configurations, unsigned int max_paces,
+                                                       unsigned int* p_paces_solved = nullptr, std::string input_path = "",
+                                                       std::function<boost::shared_ptr<AbstractCvodeCell>()> model_factory = nullptr);
+
+#endif
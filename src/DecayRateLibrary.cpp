@@ -0,0 +1,63 @@
+#include "DecayRateLibrary.hpp"
+#include "Exception.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <limits>
+
+bool DecayRateLibrary::SamePeriod(double a, double b){
+  return std::abs(a - b) <= 1e-9*std::max(std::abs(a), std::abs(b));
+}
+
+DecayRateLibrary::DecayRateLibrary(const std::string& file_path){
+  std::ifstream file_in(file_path);
+  if(!file_in.is_open())
+    return;
+  std::string line;
+  while(std::getline(file_in, line)){
+    if(line.empty())
+      continue;
+    std::istringstream fields(line);
+    Record record;
+    if(!(fields >> record.model >> record.period >> record.rate.variable >> record.rate.tau >> record.rate.amplitude))
+      EXCEPTION("Couldn't read decay rate record '" + line + "' in " + file_path);
+    records.push_back(record);
+  }
+}
+
+void DecayRateLibrary::Add(const std::string& model, double period, const DecayRate& rate){
+  std::lock_guard<std::mutex> lock(mutex);
+  for(auto i = records.begin(); i != records.end(); i++){
+    if(i->model == model && SamePeriod(i->period, period) && i->rate.variable == rate.variable){
+      i->rate = rate;
+      return;
+    }
+  }
+  const Record record = {model, period, rate};
+  records.push_back(record);
+}
+
+std::vector<DecayRate> DecayRateLibrary::Find(const std::string& model, double period) const{
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<DecayRate> rates;
+  for(auto i = records.begin(); i != records.end(); i++)
+    if(i->model == model && SamePeriod(i->period, period))
+      rates.push_back(i->rate);
+  return rates;
+}
+
+unsigned int DecayRateLibrary::GetNumberOfRecords() const{
+  std::lock_guard<std::mutex> lock(mutex);
+  return records.size();
+}
+
+void DecayRateLibrary::Save(const std::string& file_path) const{
+  std::lock_guard<std::mutex> lock(mutex);
+  std::ofstream file_out(file_path);
+  if(!file_out.is_open())
+    EXCEPTION("Couldn't open " + file_path + " to save decay rates");
+  file_out.precision(std::numeric_limits<double>::max_digits10);
+  for(auto i = records.begin(); i != records.end(); i++)
+    file_out << i->model << " " << i->period << " " << i->rate.variable << " " << i->rate.tau << " " << i->rate.amplitude << "\n";
+}
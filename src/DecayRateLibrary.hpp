@@ -0,0 +1,52 @@
+#ifndef DECAYRATELIBRARY_HPP
+#define DECAYRATELIBRARY_HPP
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+/* The decay rates SmartSimulation has fitted, kept between runs so that the
+   next run of the same model at the same period can jump after a few paces
+   instead of a whole buffer (see SmartSimulation::SetDecayRateLibrary).
+
+   Saved as text, one record per line:
+     model period variable tau amplitude
+   where the variable's pace-to-pace change decays like amplitude*exp(-pace/tau).
+   One record is kept per model, period and variable - the most recent fit. */
+
+struct DecayRate{
+  std::string variable;
+  double tau;
+  double amplitude;
+};
+
+class DecayRateLibrary{
+private:
+  struct Record{
+    std::string model;
+    double period;
+    DecayRate rate;
+  };
+  std::vector<Record> records;
+  /*Runs in a sweep can share one library*/
+  mutable std::mutex mutex;
+
+  static bool SamePeriod(double a, double b);
+public:
+  DecayRateLibrary(){
+  }
+  /**Load the records saved at file_path. A missing file is an empty library, so the first run of a sweep can create it.*/
+  DecayRateLibrary(const std::string& file_path);
+
+  /**Add the rate, replacing any earlier one for this model, period and variable*/
+  void Add(const std::string& model, double period, const DecayRate& rate);
+
+  /**Every rate recorded for this model and period*/
+  std::vector<DecayRate> Find(const std::string& model, double period) const;
+
+  unsigned int GetNumberOfRecords() const;
+
+  void Save(const std::string& file_path) const;
+};
+
+#endif
@@ -0,0 +1,216 @@
+#include "DenseTrace.hpp"
+#include "Tracing.hpp"
+#include "Exception.hpp"
+
+#include <algorithm>
+
+void DenseTrace::Start(double _start_time){
+  if(step_end_times.empty())
+    start_time = _start_time;
+  else if(std::abs(_start_time - end_time) > 1e-10*std::max(1.0, std::abs(end_time)))
+    EXCEPTION("A dense trace segment has to start where the trace ends");
+  end_time = _start_time;
+}
+
+void DenseTrace::Finish(double _end_time){
+  end_time = _end_time;
+}
+
+void DenseTrace::AddStep(double step_end_time, const std::vector<std::vector<double>>& derivatives){
+  if(derivatives.empty())
+    EXCEPTION("A step needs at least the solution at its end");
+  step_end_times.push_back(step_end_time);
+  step_orders.push_back(derivatives.size() - 1);
+  step_offsets.push_back(coefficients.size());
+  /*Store y^(k)/k! so evaluating is a plain polynomial in (t - t_n)*/
+  double factorial = 1;
+  for(unsigned int k = 0; k < derivatives.size(); k++){
+    if(k > 0)
+      factorial *= k;
+    if(derivatives[k].size() != number_of_variables)
+      EXCEPTION("Step has the wrong number of variables");
+    for(unsigned int i = 0; i < number_of_variables; i++)
+      coefficients.push_back(derivatives[k][i]/factorial);
+  }
+  end_time = step_end_time;
+}
+
+void DenseTrace::Clear(){
+  start_time = end_time = NAN;
+  step_end_times.clear();
+  step_orders.clear();
+  step_offsets.clear();
+  coefficients.clear();
+}
+
+unsigned int DenseTrace::FindStep(double time) const{
+  if(step_end_times.empty())
+    EXCEPTION("The dense trace is empty");
+  const double tolerance = 1e-10*std::max(1.0, std::abs(end_time));
+  if(time < start_time - tolerance || time > end_time + tolerance)
+    EXCEPTION("Time " + std::to_string(time) + " is outside the dense trace");
+  /*The first step ending at or after time. Times past the last step (at most a
+    rounding error) are taken from the last step's polynomial.*/
+  const unsigned int step = std::lower_bound(step_end_times.begin(), step_end_times.end(), time) - step_end_times.begin();
+  return std::min<unsigned int>(step, step_end_times.size() - 1);
+}
+
+double DenseTrace::GetValue(unsigned int variable_index, double time) const{
+  if(variable_index >= number_of_variables)
+    EXCEPTION("Variable index out of range");
+  const unsigned int step = FindStep(time);
+  const double s = time - step_end_times[step];
+  const double* p_coefficients = &coefficients[step_offsets[step]];
+  double value = 0;
+  for(int k = step_orders[step]; k >= 0; k--)
+    value = value*s + p_coefficients[k*number_of_variables + variable_index];
+  return value;
+}
+
+double DenseTrace::GetTimeDerivative(unsigned int variable_index, double time) const{
+  if(variable_index >= number_of_variables)
+    EXCEPTION("Variable index out of range");
+  const unsigned int step = FindStep(time);
+  const double s = time - step_end_times[step];
+  const double* p_coefficients = &coefficients[step_offsets[step]];
+  double derivative = 0;
+  for(int k = step_orders[step]; k >= 1; k--)
+    derivative = derivative*s + k*p_coefficients[k*number_of_variables + variable_index];
+  return derivative;
+}
+
+std::vector<double> DenseTrace::GetStateVariables(double time) const{
+  std::vector<double> values;
+  GetStateVariables(time, values);
+  return values;
+}
+
+void DenseTrace::GetStateVariables(double time, std::vector<double>& r_values) const{
+  const unsigned int step = FindStep(time);
+  const double s = time - step_end_times[step];
+  const double* p_coefficients = &coefficients[step_offsets[step]];
+  r_values.assign(number_of_variables, 0);
+  for(int k = step_orders[step]; k >= 0; k--){
+    for(unsigned int i = 0; i < number_of_variables; i++)
+      r_values[i] = r_values[i]*s + p_coefficients[k*number_of_variables + i];
+  }
+}
+
+std::vector<double> DenseTrace::GetVariable(unsigned int variable_index, const std::vector<double>& times) const{
+  std::vector<double> values;
+  values.reserve(times.size());
+  for(auto i = times.begin(); i != times.end(); i++)
+    values.push_back(GetValue(variable_index, *i));
+  return values;
+}
+
+std::vector<std::vector<double>> DenseTrace::GetStateVariables(const std::vector<double>& times) const{
+  std::vector<std::vector<double>> values;
+  values.reserve(times.size());
+  for(auto i = times.begin(); i != times.end(); i++)
+    values.push_back(GetStateVariables(*i));
+  return values;
+}
+
+namespace{
+  /*The integral over the traces' common interval of the summed squared
+    differences, divided by 1 + |a| if relative is true. Between consecutive step
+    times of either trace both are polynomials, so three point Gauss-Legendre on
+    each of those pieces is as good as a fine sampling.*/
+  double IntegrateSquaredDifference(const DenseTrace& first, const DenseTrace& second, bool relative, double& r_interval){
+    if(first.GetNumberOfVariables() != second.GetNumberOfVariables())
+      EXCEPTION("Traces have different numbers of variables");
+    const double start_time = std::max(first.GetStartTime(), second.GetStartTime());
+    const double end_time = std::min(first.GetEndTime(), second.GetEndTime());
+    r_interval = end_time - start_time;
+    if(!(r_interval > 0))
+      EXCEPTION("Traces don't overlap");
+
+    const double nodes[3] = {-sqrt(0.6), 0, sqrt(0.6)};
+    const double weights[3] = {5.0/9.0, 8.0/9.0, 5.0/9.0};
+    const std::vector<double>& r_first_times = first.rGetStepTimes();
+    const std::vector<double>& r_second_times = second.rGetStepTimes();
+    auto i = std::upper_bound(r_first_times.begin(), r_first_times.end(), start_time);
+    auto j = std::upper_bound(r_second_times.begin(), r_second_times.end(), start_time);
+    std::vector<double> a, b;
+    double integral = 0;
+    double piece_start = start_time;
+    while(piece_start < end_time){
+      double piece_end = end_time;
+      if(i != r_first_times.end() && *i < piece_end)
+        piece_end = *i;
+      if(j != r_second_times.end() && *j < piece_end)
+        piece_end = *j;
+      const double half_width = (piece_end - piece_start)/2;
+      const double centre = (piece_start + piece_end)/2;
+      for(unsigned int q = 0; q < 3; q++){
+        first.GetStateVariables(centre + half_width*nodes[q], a);
+        second.GetStateVariables(centre + half_width*nodes[q], b);
+        double sum = 0;
+        for(unsigned int k = 0; k < a.size(); k++){
+          const double difference = relative ? (a[k] - b[k])/(1 + std::abs(a[k])) : a[k] - b[k];
+          sum += difference*difference;
+        }
+        integral += weights[q]*half_width*sum;
+      }
+      if(i != r_first_times.end() && *i <= piece_end)
+        i++;
+      if(j != r_second_times.end() && *j <= piece_end)
+        j++;
+      piece_start = piece_end;
+    }
+    return integral;
+  }
+}
+
+double CalculateTraceMrms(const DenseTrace& first, const DenseTrace& second){
+  TRACE_SCOPE("CalculateTraceMrms");
+  double interval;
+  const double integral = IntegrateSquaredDifference(first, second, true, interval);
+  return sqrt(integral/(interval*first.GetNumberOfVariables()));
+}
+
+double CalculateTrace2Norm(const DenseTrace& first, const DenseTrace& second){
+  double interval;
+  return sqrt(IntegrateSquaredDifference(first, second, false, interval));
+}
+
+std::vector<double> GetSamplingTimes(double start_time, double end_time, double sampling_timestep){
+  std::vector<double> times;
+  /*Like Chaste's TimeStepper: multiples of the timestep from the start, and the end time itself*/
+  for(unsigned int i = 0; start_time + i*sampling_timestep < end_time - 1e-10*sampling_timestep; i++)
+    times.push_back(start_time + i*sampling_timestep);
+  times.push_back(end_time);
+  return times;
+}
+
+void SolveAndRecordSteps(boost::shared_ptr<AbstractCvodeCell> p_model, double start_time, double end_time, DenseTrace& r_trace){
+  TRACE_SCOPE("SolveAndRecordSteps");
+  const unsigned int number_of_variables = p_model->GetNumberOfStateVariables();
+  if(r_trace.GetNumberOfSteps() == 0){
+    if(r_trace.GetNumberOfVariables() != number_of_variables)
+      r_trace = DenseTrace(number_of_variables);
+  }
+  else if(r_trace.GetNumberOfVariables() != number_of_variables)
+    EXCEPTION("Dense trace belongs to a different model");
+  SolveAndObserve(p_model, start_time, end_time, {boost::shared_ptr<AbstractStepObserver>(new DenseTraceRecorder(r_trace))});
+}
+
+DenseTrace GetDensePace(std::vector<double> initial_conditions, boost::shared_ptr<AbstractCvodeCell> p_model, double period, double duration){
+  TRACE_SCOPE("GetDensePace");
+  const std::vector<double> original_states = p_model->GetStdVecStateVariables();
+  const double rel_tol = p_model->GetRelativeTolerance();
+  const double abs_tol = p_model->GetAbsoluteTolerance();
+
+  p_model->SetMaxSteps(1e5);
+  p_model->SetTolerances(1e-12, 1e-12);
+  p_model->SetStateVariables(initial_conditions);
+
+  DenseTrace trace(p_model->GetNumberOfStateVariables());
+  SolveAndRecordSteps(p_model, 0, duration, trace);
+  SolveAndRecordSteps(p_model, duration, period, trace);
+
+  p_model->SetTolerances(rel_tol, abs_tol);
+  p_model->SetStateVariables(original_states);
+  return trace;
+}
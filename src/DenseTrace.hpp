@@ -0,0 +1,120 @@
+#ifndef DENSETRACE_HPP
+#define DENSETRACE_HPP
+
+#include "AbstractCvodeCell.hpp"
+#include "StepObserver.hpp"
+#include <vector>
+#include <string>
+#include <boost/shared_ptr.hpp>
+
+/* A solution trace made of CVODE's own internal steps.
+
+   After every internal step CVODE holds a polynomial (the Nordsieck history
+   array, of the order it used for the step) that it uses for dense output
+   anywhere inside that step. We keep that polynomial, as Taylor coefficients
+   y^(k)(t_n)/k! about the end of the step, and nothing else, so the solver
+   never has to stop at sampling times and the trace costs the same however
+   finely it is read afterwards. Values are only computed when asked for.
+
+   The interpolant is the one CVODE itself uses, so it agrees with Compute()
+   to within the solver's tolerances. */
+
+class DenseTrace{
+private:
+  unsigned int number_of_variables;
+  double start_time = NAN;
+  double end_time = NAN;
+  std::vector<double> step_end_times;
+  std::vector<unsigned int> step_orders;
+  std::vector<size_t> step_offsets;
+  /*For each step, (order+1) blocks of number_of_variables coefficients*/
+  std::vector<double> coefficients;
+
+  unsigned int FindStep(double time) const;
+public:
+  DenseTrace(unsigned int _number_of_variables = 0) : number_of_variables(_number_of_variables){
+  }
+
+  /**Add a step ending at end_time. derivatives[k] is the k-th derivative of every variable at end_time.*/
+  void AddStep(double end_time, const std::vector<std::vector<double>>& derivatives);
+
+  /**Start a new segment at start_time. Must be where the trace currently ends (or the trace must be empty).*/
+  void Start(double _start_time);
+
+  /**The stopping time of the last segment, which may be a rounding error past the end of the last step*/
+  void Finish(double _end_time);
+
+  void Clear();
+
+  double GetStartTime() const{
+    return start_time;
+  }
+  double GetEndTime() const{
+    return end_time;
+  }
+  unsigned int GetNumberOfVariables() const{
+    return number_of_variables;
+  }
+  size_t GetNumberOfSteps() const{
+    return step_end_times.size();
+  }
+  const std::vector<double>& rGetStepTimes() const{
+    return step_end_times;
+  }
+
+  double GetValue(unsigned int variable_index, double time) const;
+
+  /**The time derivative of the interpolating polynomial*/
+  double GetTimeDerivative(unsigned int variable_index, double time) const;
+
+  std::vector<double> GetStateVariables(double time) const;
+
+  /**As above, into r_values (resized if needed) so repeated evaluation doesn't allocate*/
+  void GetStateVariables(double time, std::vector<double>& r_values) const;
+
+  /**One variable at each of the given (increasing) times*/
+  std::vector<double> GetVariable(unsigned int variable_index, const std::vector<double>& times) const;
+
+  /**Every variable at each of the given (increasing) times, one row per time, like OdeSolution::rGetSolutions()*/
+  std::vector<std::vector<double>> GetStateVariables(const std::vector<double>& times) const;
+};
+
+/** Adds every step of a solve to a DenseTrace */
+class DenseTraceRecorder : public AbstractStepObserver{
+private:
+  DenseTrace& r_trace;
+public:
+  DenseTraceRecorder(DenseTrace& _r_trace) : r_trace(_r_trace){
+  }
+  void Start(double time, const std::vector<double>& r_state_variables){
+    r_trace.Start(time);
+  }
+  void ObserveStep(const CvodeStep& r_step){
+    r_trace.AddStep(r_step.GetExpansionTime(), r_step.rGetDerivatives());
+  }
+  void Finish(double time, const std::vector<double>& r_state_variables){
+    r_trace.Finish(time);
+  }
+};
+
+/**The continuous version of mrmsTrace: the root of the time average over the
+   traces' common interval of the mean over variables of ((a - b)/(1 + |a|))^2,
+   with a from first and b from second. Gauss quadrature between the step times
+   of both traces, where both are smooth, so no solving or sampling is needed.*/
+double CalculateTraceMrms(const DenseTrace& first, const DenseTrace& second);
+
+/**The continuous version of TwoNormTrace: the root of the time integral of the
+   summed squared differences*/
+double CalculateTrace2Norm(const DenseTrace& first, const DenseTrace& second);
+
+/**The times Compute(start_time, end_time, sampling_timestep) would sample at*/
+std::vector<double> GetSamplingTimes(double start_time, double end_time, double sampling_timestep);
+
+/**SolveAndObserve with a DenseTraceRecorder: add every internal step of the
+   solve from start_time to end_time to r_trace*/
+void SolveAndRecordSteps(boost::shared_ptr<AbstractCvodeCell> p_model, double start_time, double end_time, DenseTrace& r_trace);
+
+/**The dense equivalent of GetPace: one pace from initial_conditions, solved in two parts either side of the stimulus. The model's state is left unchanged.*/
+DenseTrace GetDensePace(std::vector<double> initial_conditions, boost::shared_ptr<AbstractCvodeCell> p_model, double period, double duration);
+
+#endif
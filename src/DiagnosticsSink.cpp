@@ -0,0 +1,149 @@
+#include "DiagnosticsSink.hpp"
+
+#include <fstream>
+#include <chrono>
+#include <cstdlib>
+#include <boost/filesystem.hpp>
+
+namespace{
+  size_t RoundUpToPowerOfTwo(size_t n){
+    size_t power = 1;
+    while(power < n)
+      power <<= 1;
+    return power;
+  }
+
+  const size_t max_batch_size = 256;
+  const std::chrono::milliseconds idle_wait(5);
+}
+
+AsyncFileDiagnosticsSink::AsyncFileDiagnosticsSink(std::string _root, size_t capacity) :
+  root(_root), queue(RoundUpToPowerOfTwo(capacity)), queue_mask(RoundUpToPowerOfTwo(capacity) - 1),
+  enqueue_position(0), dequeue_position(0), messages_written(0), messages_dropped(0), stopping(false){
+  for(size_t i = 0; i < queue.size(); i++)
+    queue[i].sequence.store(i, std::memory_order_relaxed);
+  writer = std::thread(&AsyncFileDiagnosticsSink::WriterLoop, this);
+}
+
+AsyncFileDiagnosticsSink::~AsyncFileDiagnosticsSink(){
+  stopping.store(true);
+  writer.join();
+}
+
+/*Bounded multi-producer multi-consumer queue after D. Vyukov: each cell's sequence
+  number says whether it is free for the producer at a given position or holds a
+  message for the consumer at that position*/
+bool AsyncFileDiagnosticsSink::TryPush(Message& r_message){
+  size_t position = enqueue_position.load(std::memory_order_relaxed);
+  Cell* p_cell;
+  for(;;){
+    p_cell = &queue[position & queue_mask];
+    const size_t sequence = p_cell->sequence.load(std::memory_order_acquire);
+    const intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+    if(difference == 0){
+      if(enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+        break;
+    }
+    else if(difference < 0)
+      return false;
+    else
+      position = enqueue_position.load(std::memory_order_relaxed);
+  }
+  p_cell->message = std::move(r_message);
+  p_cell->sequence.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+bool AsyncFileDiagnosticsSink::TryPop(Message& r_message){
+  size_t position = dequeue_position.load(std::memory_order_relaxed);
+  Cell* p_cell;
+  for(;;){
+    p_cell = &queue[position & queue_mask];
+    const size_t sequence = p_cell->sequence.load(std::memory_order_acquire);
+    const intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+    if(difference == 0){
+      if(dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+        break;
+    }
+    else if(difference < 0)
+      return false;
+    else
+      position = dequeue_position.load(std::memory_order_relaxed);
+  }
+  r_message = std::move(p_cell->message);
+  p_cell->sequence.store(position + queue_mask + 1, std::memory_order_release);
+  return true;
+}
+
+void AsyncFileDiagnosticsSink::Write(const std::string& file_name, const std::string& contents, bool append){
+  Message message = {file_name, contents, append};
+  if(!TryPush(message))
+    messages_dropped++;
+}
+
+void AsyncFileDiagnosticsSink::Flush(){
+  const size_t accepted = enqueue_position.load();
+  while(messages_written.load() < accepted)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+void AsyncFileDiagnosticsSink::WriterLoop(){
+  std::vector<Message> batch;
+  batch.reserve(max_batch_size);
+  for(;;){
+    /*Read the flag before draining so nothing pushed before the destructor ran is lost*/
+    const bool stop = stopping.load();
+    Message message;
+    while(batch.size() < max_batch_size && TryPop(message))
+      batch.push_back(std::move(message));
+    if(batch.empty()){
+      if(stop)
+        return;
+      std::this_thread::sleep_for(idle_wait);
+      continue;
+    }
+    WriteBatch(batch);
+    messages_written += batch.size();
+    batch.clear();
+  }
+}
+
+void AsyncFileDiagnosticsSink::WriteBatch(std::vector<Message>& r_batch){
+  for(unsigned int i = 0; i < r_batch.size();){
+    /*Merge a run of writes to the same file. A write that replaces the file makes
+      everything before it in the run irrelevant.*/
+    const std::string& file_name = r_batch[i].file_name;
+    bool append = r_batch[i].append;
+    std::string contents = std::move(r_batch[i].contents);
+    unsigned int j = i + 1;
+    for(; j < r_batch.size() && r_batch[j].file_name == file_name; j++){
+      if(r_batch[j].append)
+        contents += r_batch[j].contents;
+      else{
+        contents = std::move(r_batch[j].contents);
+        append = false;
+      }
+    }
+
+    const boost::filesystem::path path = boost::filesystem::path(root) / file_name;
+    boost::system::error_code error;
+    boost::filesystem::create_directories(path.parent_path(), error);
+    std::ofstream f_out(path.string(), append ? std::fstream::app : std::fstream::trunc);
+    f_out << contents;
+    f_out.close();
+    i = j;
+  }
+}
+
+std::string GetDefaultDiagnosticsRoot(){
+  const char* p_root = getenv("CHASTE_DIAGNOSTICS_DIR");
+  if(p_root && *p_root)
+    return p_root;
+  const char* p_user = getenv("USER");
+  return (boost::filesystem::temp_directory_path() / (p_user ? p_user : "chaste") / "diagnostics").string();
+}
+
+boost::shared_ptr<AbstractDiagnosticsSink> GetDefaultDiagnosticsSink(){
+  static boost::shared_ptr<AbstractDiagnosticsSink> p_sink(new AsyncFileDiagnosticsSink(GetDefaultDiagnosticsRoot()));
+  return p_sink;
+}
@@ -0,0 +1,102 @@
+#ifndef DIAGNOSTICSSINK_HPP
+#define DIAGNOSTICSSINK_HPP
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <boost/shared_ptr.hpp>
+
+/* Somewhere for SmartSimulation to send the files it writes while extrapolating
+   (jump parameters, buffers and errors) so that the pacing loop itself never
+   touches the filesystem. File names are relative to the sink's root. */
+
+class AbstractDiagnosticsSink{
+public:
+  virtual ~AbstractDiagnosticsSink(){
+  }
+
+  /**Replace the contents of file_name with contents, or add them to the end if append is true*/
+  virtual void Write(const std::string& file_name, const std::string& contents, bool append = false) = 0;
+
+  /**Block until everything written so far is on disk*/
+  virtual void Flush(){
+  }
+
+  /**False if writes are thrown away, so callers can skip formatting them*/
+  virtual bool IsEnabled(){
+    return true;
+  }
+};
+
+/**Discards everything - for production runs*/
+class NullDiagnosticsSink : public AbstractDiagnosticsSink{
+public:
+  void Write(const std::string& file_name, const std::string& contents, bool append = false){
+  }
+  bool IsEnabled(){
+    return false;
+  }
+};
+
+/**Hands writes to a background thread through a bounded lock-free queue. Writes
+   made while the queue is full are dropped (and counted) rather than blocking the
+   caller. The writer thread empties the queue in batches, merging consecutive
+   writes to the same file into a single open.*/
+class AsyncFileDiagnosticsSink : public AbstractDiagnosticsSink{
+private:
+  struct Message{
+    std::string file_name;
+    std::string contents;
+    bool append;
+  };
+
+  struct Cell{
+    std::atomic<size_t> sequence;
+    Message message;
+  };
+
+  std::string root;
+  std::vector<Cell> queue;
+  const size_t queue_mask;
+  std::atomic<size_t> enqueue_position;
+  std::atomic<size_t> dequeue_position;
+  std::atomic<size_t> messages_written;
+  std::atomic<size_t> messages_dropped;
+  std::atomic<bool> stopping;
+  std::thread writer;
+
+  bool TryPush(Message& r_message);
+  bool TryPop(Message& r_message);
+  void WriterLoop();
+  void WriteBatch(std::vector<Message>& r_batch);
+
+public:
+  /**capacity is rounded up to a power of two*/
+  AsyncFileDiagnosticsSink(std::string _root, size_t capacity = 1024);
+  ~AsyncFileDiagnosticsSink();
+
+  void Write(const std::string& file_name, const std::string& contents, bool append = false);
+  void Flush();
+
+  std::string GetRoot(){
+    return root;
+  }
+  size_t GetNumberDropped(){
+    return messages_dropped.load();
+  }
+  /**Messages the writer thread has put on disk (merged writes count separately)*/
+  size_t GetNumberWritten(){
+    return messages_written.load();
+  }
+};
+
+/**Where the default sink writes: the directory named by the environment variable
+   CHASTE_DIAGNOSTICS_DIR if it is set, otherwise diagnostics under a directory
+   named after the user in the system's temporary directory*/
+std::string GetDefaultDiagnosticsRoot();
+
+/**A process wide sink writing to GetDefaultDiagnosticsRoot(), as it was when first called*/
+boost::shared_ptr<AbstractDiagnosticsSink> GetDefaultDiagnosticsSink();
+
+#endif
@@ -0,0 +1,235 @@
+#ifndef DUALNUMBER_HPP
+#define DUALNUMBER_HPP
+
+#include <cmath>
+
+/* Forward mode automatic differentiation. A Dual carries a value and its
+   derivatives along N directions at once, so evaluating a function over Duals
+   seeded with N columns of the identity gives N columns of its Jacobian from
+   one evaluation. Every operation is a loop over the N derivatives with a
+   fixed trip count, which the compiler unrolls and vectorises.
+
+   Comparisons only look at the value, so piecewise expressions take the same
+   branch they would over doubles and are differentiated within it. */
+
+template<unsigned int N>
+struct Dual{
+  double value;
+  double derivatives[N];
+
+  Dual() : value(0){
+    for(unsigned int k = 0; k < N; k++)
+      derivatives[k] = 0;
+  }
+
+  /*Constants have no derivatives. Implicit, so the generated expressions can mix doubles and Duals*/
+  Dual(double _value) : value(_value){
+    for(unsigned int k = 0; k < N; k++)
+      derivatives[k] = 0;
+  }
+
+  Dual& operator+=(const Dual& r_other){
+    value += r_other.value;
+    for(unsigned int k = 0; k < N; k++)
+      derivatives[k] += r_other.derivatives[k];
+    return *this;
+  }
+
+  Dual& operator-=(const Dual& r_other){
+    value -= r_other.value;
+    for(unsigned int k = 0; k < N; k++)
+      derivatives[k] -= r_other.derivatives[k];
+    return *this;
+  }
+
+  Dual& operator*=(const Dual& r_other){
+    for(unsigned int k = 0; k < N; k++)
+      derivatives[k] = derivatives[k]*r_other.value + value*r_other.derivatives[k];
+    value *= r_other.value;
+    return *this;
+  }
+
+  Dual& operator/=(const Dual& r_other){
+    const double inverse = 1/r_other.value;
+    value *= inverse;
+    for(unsigned int k = 0; k < N; k++)
+      derivatives[k] = (derivatives[k] - value*r_other.derivatives[k])*inverse;
+    return *this;
+  }
+};
+
+/*f(x) for x with value and derivatives, given f(value) and f'(value)*/
+template<unsigned int N>
+Dual<N> ApplyChainRule(const Dual<N>& r_x, double function, double derivative){
+  Dual<N> result(function);
+  for(unsigned int k = 0; k < N; k++)
+    result.derivatives[k] = derivative*r_x.derivatives[k];
+  return result;
+}
+
+template<unsigned int N>
+Dual<N> operator+(const Dual<N>& r_x){
+  return r_x;
+}
+
+template<unsigned int N>
+Dual<N> operator-(const Dual<N>& r_x){
+  return ApplyChainRule(r_x, -r_x.value, -1);
+}
+
+template<unsigned int N>
+Dual<N> operator+(Dual<N> x, const Dual<N>& r_y){
+  return x += r_y;
+}
+
+template<unsigned int N>
+Dual<N> operator+(Dual<N> x, double y){
+  x.value += y;
+  return x;
+}
+
+template<unsigned int N>
+Dual<N> operator+(double x, Dual<N> y){
+  y.value += x;
+  return y;
+}
+
+template<unsigned int N>
+Dual<N> operator-(Dual<N> x, const Dual<N>& r_y){
+  return x -= r_y;
+}
+
+template<unsigned int N>
+Dual<N> operator-(Dual<N> x, double y){
+  x.value -= y;
+  return x;
+}
+
+template<unsigned int N>
+Dual<N> operator-(double x, const Dual<N>& r_y){
+  return ApplyChainRule(r_y, x - r_y.value, -1);
+}
+
+template<unsigned int N>
+Dual<N> operator*(Dual<N> x, const Dual<N>& r_y){
+  return x *= r_y;
+}
+
+template<unsigned int N>
+Dual<N> operator*(const Dual<N>& r_x, double y){
+  return ApplyChainRule(r_x, r_x.value*y, y);
+}
+
+template<unsigned int N>
+Dual<N> operator*(double x, const Dual<N>& r_y){
+  return ApplyChainRule(r_y, x*r_y.value, x);
+}
+
+template<unsigned int N>
+Dual<N> operator/(Dual<N> x, const Dual<N>& r_y){
+  return x /= r_y;
+}
+
+template<unsigned int N>
+Dual<N> operator/(const Dual<N>& r_x, double y){
+  return ApplyChainRule(r_x, r_x.value/y, 1/y);
+}
+
+template<unsigned int N>
+Dual<N> operator/(double x, const Dual<N>& r_y){
+  const double value = x/r_y.value;
+  return ApplyChainRule(r_y, value, -value/r_y.value);
+}
+
+#define DUAL_COMPARISON(OPERATOR) \
+  template<unsigned int N> bool operator OPERATOR(const Dual<N>& r_x, const Dual<N>& r_y){ return r_x.value OPERATOR r_y.value; } \
+  template<unsigned int N> bool operator OPERATOR(const Dual<N>& r_x, double y){ return r_x.value OPERATOR y; } \
+  template<unsigned int N> bool operator OPERATOR(double x, const Dual<N>& r_y){ return x OPERATOR r_y.value; }
+
+DUAL_COMPARISON(<)
+DUAL_COMPARISON(<=)
+DUAL_COMPARISON(>)
+DUAL_COMPARISON(>=)
+DUAL_COMPARISON(==)
+DUAL_COMPARISON(!=)
+
+#undef DUAL_COMPARISON
+
+template<unsigned int N>
+Dual<N> exp(const Dual<N>& r_x){
+  const double value = std::exp(r_x.value);
+  return ApplyChainRule(r_x, value, value);
+}
+
+template<unsigned int N>
+Dual<N> log(const Dual<N>& r_x){
+  return ApplyChainRule(r_x, std::log(r_x.value), 1/r_x.value);
+}
+
+template<unsigned int N>
+Dual<N> log10(const Dual<N>& r_x){
+  return ApplyChainRule(r_x, std::log10(r_x.value), 1/(r_x.value*std::log(10.0)));
+}
+
+template<unsigned int N>
+Dual<N> sqrt(const Dual<N>& r_x){
+  const double value = std::sqrt(r_x.value);
+  return ApplyChainRule(r_x, value, 0.5/value);
+}
+
+template<unsigned int N>
+Dual<N> pow(const Dual<N>& r_x, double y){
+  /*Written as x^(y-1)*x so that x = 0 with y >= 1 has a finite derivative*/
+  const double power = std::pow(r_x.value, y - 1);
+  return ApplyChainRule(r_x, power*r_x.value, y*power);
+}
+
+template<unsigned int N>
+Dual<N> pow(double x, const Dual<N>& r_y){
+  const double value = std::pow(x, r_y.value);
+  return ApplyChainRule(r_y, value, value*std::log(x));
+}
+
+template<unsigned int N>
+Dual<N> pow(const Dual<N>& r_x, const Dual<N>& r_y){
+  return exp(r_y*log(r_x));
+}
+
+template<unsigned int N>
+Dual<N> fabs(const Dual<N>& r_x){
+  return r_x.value < 0 ? -r_x : r_x;
+}
+
+template<unsigned int N>
+Dual<N> abs(const Dual<N>& r_x){
+  return fabs(r_x);
+}
+
+template<unsigned int N>
+Dual<N> tanh(const Dual<N>& r_x){
+  const double value = std::tanh(r_x.value);
+  return ApplyChainRule(r_x, value, 1 - value*value);
+}
+
+template<unsigned int N>
+Dual<N> sin(const Dual<N>& r_x){
+  return ApplyChainRule(r_x, std::sin(r_x.value), std::cos(r_x.value));
+}
+
+template<unsigned int N>
+Dual<N> cos(const Dual<N>& r_x){
+  return ApplyChainRule(r_x, std::cos(r_x.value), -std::sin(r_x.value));
+}
+
+/*Piecewise constant, so zero derivatives away from the jumps*/
+template<unsigned int N>
+Dual<N> floor(const Dual<N>& r_x){
+  return Dual<N>(std::floor(r_x.value));
+}
+
+template<unsigned int N>
+Dual<N> ceil(const Dual<N>& r_x){
+  return Dual<N>(std::ceil(r_x.value));
+}
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef ENVELOPESIMULATION_HPP
+#define ENVELOPESIMULATION_HPP
+
+#include "Simulation.hpp"
+#include <boost/circular_buffer.hpp>
+
+/* Envelope following across paces: the state at the start of each pace, as a
+   function of pace number, is treated as a slow ODE of its own.
+
+   Each envelope step solves a few paces exactly and takes the drift per pace
+   from the last of them. How fast the drift shrinks from pace to pace gives the
+   rate r of the slowest mode, and the state is stepped H paces ahead along that
+   mode with the exponential integrator
+
+     x(n + H) = x(n) + d r (1 - r^H)/(1 - r),
+
+   which is exact for a single decaying mode whatever H is. That is what makes the
+   number of paces independent of the slow time constants, where forward Euler in
+   pace number would need H below about the time constant to stay stable. H is
+   the largest power of two (up to the maximum step) for which the two most
+   recent rate estimates predict steps that agree to within the tolerance. The
+   first exact pace after a step validates it. If that pace changes more than
+   the last one before the step, the state is rolled back and the maximum step
+   cut by four. */
+
+class EnvelopeSimulation : public Simulation{
+private:
+  unsigned int exact_paces = 3;
+  double tolerance = 0.25;
+  unsigned int maximum_step = 1024;
+  boost::circular_buffer<std::vector<double>> recent_states;
+  std::vector<double> pre_step_state;
+  double pre_step_mrms = NAN;
+  bool validating = false;
+  unsigned int paces_run = 0;
+  unsigned int envelope_steps = 0;
+  unsigned int rejected_steps = 0;
+  unsigned long paces_skipped = 0;
+  unsigned int last_step_paces = 0;
+
+  /*The scaled size of the difference between two states, as mrms*/
+  double Drift(unsigned int newer, unsigned int older){
+    return mrms(recent_states[older], recent_states[newer]);
+  }
+
+  /*How far (in multiples of the last drift) the exponential step H paces ahead goes*/
+  static double StepFactor(double rate, double paces){
+    return rate*(1 - std::pow(rate, paces))/(1 - rate);
+  }
+
+  void RecordState(){
+    recent_states.push_back(GetStateVariables());
+  }
+
+  /*Step ahead along the slowest mode, if its rate is settled enough*/
+  void TakeEnvelopeStep(){
+    const unsigned int last = recent_states.size() - 1;
+    const double last_drift = Drift(last, last - 1);
+    const double rate = last_drift/Drift(last - 1, last - 2);
+    const double previous_rate = Drift(last - 1, last - 2)/Drift(last - 2, last - 3);
+    if(!(rate > 0 && rate < 1 && previous_rate > 0 && previous_rate < 1))
+      return;
+
+    unsigned int paces = 0;
+    for(unsigned int H = 1; H <= maximum_step; H *= 2){
+      const double factor = StepFactor(rate, H);
+      if(std::abs(factor - StepFactor(previous_rate, H)) > tolerance*factor)
+        break;
+      paces = H;
+    }
+    if(paces == 0)
+      return;
+
+    const std::vector<double>& r_state = recent_states[last];
+    const std::vector<double>& r_previous_state = recent_states[last - 1];
+    const double factor = StepFactor(rate, paces);
+    std::vector<double> new_state(number_of_state_variables);
+    for(unsigned int i = 0; i < number_of_state_variables; i++)
+      new_state[i] = r_state[i] + factor*(r_state[i] - r_previous_state[i]);
+
+    pre_step_state = r_state;
+    pre_step_mrms = current_mrms;
+    validating = true;
+    p_model->SetStateVariables(new_state);
+    envelope_steps++;
+    paces_skipped += paces;
+    last_step_paces = paces;
+  }
+public:
+  using Simulation::Simulation;
+
+  /**Solve the exact paces of one envelope step, then step ahead. Returns true once
+     a pace meets the steady state threshold.*/
+  bool RunEnvelopeStep(){
+    TRACE_SCOPE("EnvelopeSimulation::RunEnvelopeStep");
+    if(finished)
+      return false;
+    recent_states.set_capacity(exact_paces + 1);
+    recent_states.clear();
+    RecordState();
+    for(unsigned int i = 0; i < exact_paces; i++){
+      const bool converged = RunPace();
+      paces_run++;
+      RecordState();
+      if(converged)
+        return true;
+      if(validating){
+        validating = false;
+        if(current_mrms > pre_step_mrms){
+          std::cout << "Envelope step rejected - rolling back\n";
+          p_model->SetStateVariables(pre_step_state);
+          maximum_step = std::max(1u, maximum_step/4);
+          paces_skipped -= last_step_paces;
+          rejected_steps++;
+          return false;
+        }
+      }
+    }
+    TakeEnvelopeStep();
+    return false;
+  }
+
+  /**Exact paces per envelope step (at least 3, for two rate estimates)*/
+  void SetExactPaces(unsigned int _exact_paces){
+    exact_paces = std::max(_exact_paces, 3u);
+  }
+  /**How closely (relatively) the last two rate estimates have to agree on a step*/
+  void SetTolerance(double _tolerance){
+    tolerance = _tolerance;
+  }
+  /**The longest envelope step, in paces*/
+  void SetMaximumStep(unsigned int _maximum_step){
+    maximum_step = std::max(1u, _maximum_step);
+  }
+  /**Paces actually solved*/
+  unsigned int GetNumberOfPacesRun(){
+    return paces_run;
+  }
+  /**Paces stepped over by envelope steps that were kept or are still being validated*/
+  unsigned long GetNumberOfPacesSkipped(){
+    return paces_skipped;
+  }
+  unsigned int GetNumberOfEnvelopeSteps(){
+    return envelope_steps;
+  }
+  unsigned int GetNumberOfRejectedSteps(){
+    return rejected_steps;
+  }
+};
+
+#endif
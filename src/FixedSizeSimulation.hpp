@@ -0,0 +1,71 @@
+#ifndef FIXEDSIZESIMULATION_HPP
+#define FIXEDSIZESIMULATION_HPP
+
+#include "Simulation.hpp"
+#include <array>
+#include <algorithm>
+#include <nvector/nvector_serial.h>
+
+/* Simulation for a model whose number of state variables is known at compile
+   time (N must match the generated model, which the constructor checks).
+
+   RunPace reads the state straight out of the model's own N_Vector into a
+   std::array and never hands the model a new vector, so once CVODE has been set
+   up a pace does no heap allocation at all, where Simulation::RunPace makes a
+   few (TestAllocationFreePacing counts both). That holds without step
+   observers, the trace norm or a pace recording, which keep data per step or
+   per pace.
+
+   There is no pool of N_Vectors: the pace loop only ever needs the model's own
+   state vector, which is reused, so there is nothing to pool. Nor is there a
+   fixed-size SmartSimulation: it recycles its buffers' storage instead, so it
+   doesn't allocate between jumps either, and a jump allocates only once per
+   buffer's worth of paces. */
+
+template<unsigned int N>
+class FixedSizeSimulation : public Simulation
+{
+private:
+  std::array<double, N> previous_state_variables;
+
+  void CopyStateVariables(std::array<double, N>& r_state_variables){
+    const double* p_state = NV_DATA_S(p_model->rGetStateVariables());
+    std::copy(p_state, p_state + N, r_state_variables.begin());
+  }
+public:
+  FixedSizeSimulation(boost::shared_ptr<AbstractCvodeCell> _p_model, double _period, std::string input_path = "", double _tol_abs=1e-7, double _tol_rel=1e-7) :
+    Simulation(_p_model, _period, input_path, _tol_abs, _tol_rel){
+    if(number_of_state_variables != N)
+      EXCEPTION("FixedSizeSimulation<" + std::to_string(N) + "> used for " + p_model->GetSystemInformation()->GetSystemName() +
+                ", which has " + std::to_string(number_of_state_variables) + " state variables");
+  }
+
+  bool RunPace(){
+    TRACE_SCOPE("FixedSizeSimulation::RunPace");
+    if(finished)
+      return false;
+    /*Solve in two parts*/
+    CopyStateVariables(previous_state_variables);
+    SolvePart(0, p_stimulus->GetDuration());
+    RecordStimulusCvodeStatistics();
+    p_stimulus->SetPeriod(period*2);
+    SolvePart(p_stimulus->GetDuration(), period);
+    p_stimulus->SetPeriod(period);
+    RecordCvodeStatistics();
+    UpdateTraceNorm();
+    current_mrms = mrms(previous_state_variables.data(), NV_DATA_S(p_model->rGetStateVariables()), N);
+    if(p_pace_recording)
+      p_pace_recording->AddRow(paces_solved, GetStateVariables());
+    if(ApproachPace())
+      return false;
+    return CheckConvergence();
+  }
+
+  std::array<double, N> GetStateArray(){
+    std::array<double, N> state_variables;
+    CopyStateVariables(state_variables);
+    return state_variables;
+  }
+};
+
+#endif
@@ -0,0 +1,309 @@
+#include "FloquetAnalysis.hpp"
+#include "SimulationTools.hpp"
+#include "Tracing.hpp"
+#include "Exception.hpp"
+
+#include <random>
+#include <thread>
+#include <exception>
+#include <algorithm>
+
+typedef std::complex<double> Complex;
+
+namespace{
+  double Dot(const std::vector<double>& a, const std::vector<double>& b){
+    double dot = 0;
+    for(unsigned int i = 0; i < a.size(); i++)
+      dot += a[i]*b[i];
+    return dot;
+  }
+
+  /*Orthogonalise r_vector against every basis vector (twice, for stability), adding
+    the coefficients into column `column` of r_hessenberg, and return what's left's norm*/
+  double Orthogonalise(std::vector<double>& r_vector, const std::vector<std::vector<double>>& r_basis,
+                       std::vector<std::vector<double>>& r_hessenberg, unsigned int column){
+    for(unsigned int pass = 0; pass < 2; pass++){
+      for(unsigned int i = 0; i < r_basis.size(); i++){
+        const double coefficient = Dot(r_vector, r_basis[i]);
+        if(column < r_hessenberg[i].size())
+          r_hessenberg[i][column] += coefficient;
+        for(unsigned int j = 0; j < r_vector.size(); j++)
+          r_vector[j] -= coefficient*r_basis[i][j];
+      }
+    }
+    return sqrt(Dot(r_vector, r_vector));
+  }
+
+  /*Householder reduction to upper Hessenberg form, which keeps the eigenvalues*/
+  void ReduceToHessenberg(std::vector<std::vector<double>>& r_matrix){
+    const unsigned int n = r_matrix.size();
+    std::vector<double> v(n);
+    for(unsigned int column = 0; column + 2 < n; column++){
+      double norm = 0;
+      for(unsigned int i = column + 1; i < n; i++)
+        norm += r_matrix[i][column]*r_matrix[i][column];
+      norm = sqrt(norm);
+      if(norm == 0)
+        continue;
+      const double alpha = r_matrix[column + 1][column] > 0 ? -norm : norm;
+      std::fill(v.begin(), v.end(), 0);
+      for(unsigned int i = column + 1; i < n; i++)
+        v[i] = r_matrix[i][column];
+      v[column + 1] -= alpha;
+      const double v_norm = sqrt(Dot(v, v));
+      for(unsigned int i = column + 1; i < n; i++)
+        v[i] /= v_norm;
+      /*A <- (I - 2vv')A(I - 2vv')*/
+      for(unsigned int j = 0; j < n; j++){
+        double dot = 0;
+        for(unsigned int i = column + 1; i < n; i++)
+          dot += v[i]*r_matrix[i][j];
+        for(unsigned int i = column + 1; i < n; i++)
+          r_matrix[i][j] -= 2*v[i]*dot;
+      }
+      for(unsigned int i = 0; i < n; i++){
+        double dot = 0;
+        for(unsigned int j = column + 1; j < n; j++)
+          dot += r_matrix[i][j]*v[j];
+        for(unsigned int j = column + 1; j < n; j++)
+          r_matrix[i][j] -= 2*dot*v[j];
+      }
+    }
+  }
+
+  /*Solve r_matrix x = r_rhs in place by Gaussian elimination with partial pivoting*/
+  void Solve(std::vector<std::vector<Complex>>& r_matrix, std::vector<Complex>& r_rhs){
+    const unsigned int n = r_matrix.size();
+    for(unsigned int k = 0; k < n; k++){
+      unsigned int pivot = k;
+      for(unsigned int i = k + 1; i < n; i++)
+        if(std::abs(r_matrix[i][k]) > std::abs(r_matrix[pivot][k]))
+          pivot = i;
+      std::swap(r_matrix[k], r_matrix[pivot]);
+      std::swap(r_rhs[k], r_rhs[pivot]);
+      /*Exactly singular means the shift hit the eigenvalue, and any tiny pivot gives the same direction*/
+      if(r_matrix[k][k] == 0.0)
+        r_matrix[k][k] = 1e-300;
+      for(unsigned int i = k + 1; i < n; i++){
+        const Complex factor = r_matrix[i][k]/r_matrix[k][k];
+        for(unsigned int j = k; j < n; j++)
+          r_matrix[i][j] -= factor*r_matrix[k][j];
+        r_rhs[i] -= factor*r_rhs[k];
+      }
+    }
+    for(int k = int(n) - 1; k >= 0; k--){
+      for(unsigned int j = k + 1; j < n; j++)
+        r_rhs[k] -= r_matrix[k][j]*r_rhs[j];
+      r_rhs[k] /= r_matrix[k][k];
+    }
+  }
+
+  void Normalise(std::vector<Complex>& r_vector){
+    double norm = 0;
+    for(auto i = r_vector.begin(); i != r_vector.end(); i++)
+      norm += std::norm(*i);
+    norm = sqrt(norm);
+    for(auto i = r_vector.begin(); i != r_vector.end(); i++)
+      *i /= norm;
+  }
+}
+
+std::vector<Complex> CalculateEigenvalues(std::vector<std::vector<double>> matrix){
+  const unsigned int n = matrix.size();
+  ReduceToHessenberg(matrix);
+  std::vector<std::vector<Complex>> T(n, std::vector<Complex>(n));
+  for(unsigned int i = 0; i < n; i++)
+    for(unsigned int j = 0; j < n; j++)
+      T[i][j] = matrix[i][j];
+
+  /*Shifted QR on the unreduced block [low, high], deflating eigenvalues off the bottom*/
+  std::vector<Complex> eigenvalues;
+  std::vector<Complex> cosines(n), sines(n);
+  int high = int(n) - 1;
+  unsigned int iterations = 0;
+  while(high >= 0){
+    int low = high;
+    while(low > 0 && std::abs(T[low][low - 1]) > 1e-14*(std::abs(T[low][low]) + std::abs(T[low - 1][low - 1])))
+      low--;
+    if(low == high){
+      eigenvalues.push_back(T[high][high]);
+      high--;
+      iterations = 0;
+      continue;
+    }
+    if(++iterations > 100*n)
+      EXCEPTION("QR iteration didn't converge");
+
+    /*Wilkinson shift, with an occasional kick in case it stalls*/
+    const Complex a = T[high - 1][high - 1], b = T[high - 1][high], c = T[high][high - 1], d = T[high][high];
+    const Complex half_trace = (a + d)/2.0;
+    const Complex discriminant = sqrt(half_trace*half_trace - (a*d - b*c));
+    Complex shift = std::abs(half_trace + discriminant - d) < std::abs(half_trace - discriminant - d) ? half_trace + discriminant : half_trace - discriminant;
+    if(iterations % 10 == 0)
+      shift += std::abs(c);
+
+    for(int i = low; i <= high; i++)
+      T[i][i] -= shift;
+    for(int i = low; i < high; i++){
+      const Complex x = T[i][i], y = T[i + 1][i];
+      const double r = sqrt(std::norm(x) + std::norm(y));
+      cosines[i] = r > 0 ? x/r : 1.0;
+      sines[i] = r > 0 ? y/r : 0.0;
+      for(int j = i; j <= high; j++){
+        const Complex upper = T[i][j], lower = T[i + 1][j];
+        T[i][j] = std::conj(cosines[i])*upper + std::conj(sines[i])*lower;
+        T[i + 1][j] = -sines[i]*upper + cosines[i]*lower;
+      }
+    }
+    for(int i = low; i < high; i++){
+      for(int j = low; j <= std::min(i + 2, high); j++){
+        const Complex left = T[j][i], right = T[j][i + 1];
+        T[j][i] = left*cosines[i] + right*sines[i];
+        T[j][i + 1] = -left*std::conj(sines[i]) + right*std::conj(cosines[i]);
+      }
+    }
+    for(int i = low; i <= high; i++)
+      T[i][i] += shift;
+  }
+  return eigenvalues;
+}
+
+std::vector<Complex> CalculateEigenvector(const std::vector<std::vector<double>>& r_matrix, Complex eigenvalue){
+  const unsigned int n = r_matrix.size();
+  /*Just off the eigenvalue so the system is nearly, not exactly, singular*/
+  const Complex shift = eigenvalue + 1e-10*(1 + std::abs(eigenvalue));
+  std::vector<Complex> vector(n, 1.0);
+  for(unsigned int iteration = 0; iteration < 3; iteration++){
+    std::vector<std::vector<Complex>> shifted(n, std::vector<Complex>(n));
+    for(unsigned int i = 0; i < n; i++){
+      for(unsigned int j = 0; j < n; j++)
+        shifted[i][j] = r_matrix[i][j];
+      shifted[i][i] -= shift;
+    }
+    Solve(shifted, vector);
+    Normalise(vector);
+  }
+  return vector;
+}
+
+std::vector<FloquetMode> CalculateFloquetModes(Simulation& r_simulation, unsigned int number_of_modes, unsigned int krylov_dimension,
+                                               unsigned int threads, double perturbation, double tolerance){
+  TRACE_SCOPE("CalculateFloquetModes");
+  const std::vector<double> fixed_point = r_simulation.GetStateVariables();
+  const unsigned int n = fixed_point.size();
+  const unsigned int block_size = std::max(1u, std::min(threads, n));
+  const unsigned int blocks = std::max(1u, std::min((krylov_dimension + block_size - 1)/block_size, n/block_size));
+  const unsigned int dimension = blocks*block_size;
+  if(number_of_modes > dimension)
+    EXCEPTION("Asked for more Floquet modes than the Krylov space has room for");
+
+  std::vector<double> scale(n);
+  for(unsigned int i = 0; i < n; i++)
+    scale[i] = 1 + std::abs(fixed_point[i]);
+
+  /*One fork per thread, each solving more tightly than the finite difference step*/
+  std::vector<Simulation> forks;
+  for(unsigned int i = 0; i < block_size; i++){
+    forks.push_back(r_simulation.Fork());
+    forks.back().SetTolerances(tolerance, tolerance);
+  }
+  const std::vector<double> image = forks[0].ApplyPaceMap(fixed_point);
+
+  /*J w in the relative scale: (P(x + e S w) - P(x))/e, scaled back down*/
+  auto multiply = [&](Simulation& r_fork, const std::vector<double>& r_vector){
+    std::vector<double> perturbed_state = fixed_point;
+    for(unsigned int i = 0; i < n; i++)
+      perturbed_state[i] += perturbation*scale[i]*r_vector[i];
+    const std::vector<double> perturbed_image = r_fork.ApplyPaceMap(perturbed_state);
+    std::vector<double> product(n);
+    for(unsigned int i = 0; i < n; i++)
+      product[i] = (perturbed_image[i] - image[i])/(perturbation*scale[i]);
+    return product;
+  };
+
+  /*Start from a random (but repeatable) orthonormal block*/
+  std::mt19937 generator(0);
+  std::normal_distribution<double> distribution;
+  std::vector<std::vector<double>> basis;
+  std::vector<std::vector<double>> hessenberg(dimension + block_size, std::vector<double>(dimension, 0.0));
+  std::vector<std::vector<double>> discarded(dimension + block_size, std::vector<double>());
+  for(unsigned int i = 0; i < block_size; i++){
+    std::vector<double> vector(n);
+    for(unsigned int j = 0; j < n; j++)
+      vector[j] = distribution(generator);
+    const double norm = Orthogonalise(vector, basis, discarded, 0);
+    for(unsigned int j = 0; j < n; j++)
+      vector[j] /= norm;
+    basis.push_back(vector);
+  }
+
+  unsigned int columns = 0;
+  for(unsigned int block = 0; block < blocks && columns == block*block_size; block++){
+    std::vector<std::vector<double>> products(block_size);
+    std::vector<std::exception_ptr> errors(block_size);
+    std::vector<std::thread> workers;
+    for(unsigned int i = 0; i < block_size; i++){
+      workers.push_back(std::thread([&, i](){
+        try{
+          products[i] = multiply(forks[i], basis[block*block_size + i]);
+        }
+        catch(...){
+          errors[i] = std::current_exception();
+        }
+      }));
+    }
+    for(auto i = workers.begin(); i != workers.end(); i++)
+      i->join();
+    for(auto i = errors.begin(); i != errors.end(); i++)
+      if(*i)
+        std::rethrow_exception(*i);
+
+    /*Each product is orthogonalised against everything so far, including the
+      new vectors from earlier in the block, which makes the Hessenberg matrix
+      banded with block_size subdiagonals*/
+    for(unsigned int i = 0; i < block_size; i++){
+      const unsigned int column = block*block_size + i;
+      const double norm = Orthogonalise(products[i], basis, hessenberg, column);
+      hessenberg[column + block_size][column] = norm;
+      /*The Krylov space is invariant: the eigenvalues so far are exact*/
+      if(norm < 1e-12)
+        break;
+      for(unsigned int j = 0; j < n; j++)
+        products[i][j] /= norm;
+      basis.push_back(products[i]);
+      columns++;
+    }
+  }
+
+  const unsigned int k = columns - columns % block_size;
+  std::vector<std::vector<double>> arnoldi_matrix(k, std::vector<double>(k));
+  for(unsigned int i = 0; i < k; i++)
+    for(unsigned int j = 0; j < k; j++)
+      arnoldi_matrix[i][j] = hessenberg[i][j];
+  std::vector<Complex> multipliers = CalculateEigenvalues(arnoldi_matrix);
+  std::sort(multipliers.begin(), multipliers.end(), [](Complex a, Complex b){return std::abs(a) > std::abs(b);});
+  multipliers.resize(std::min<unsigned int>(number_of_modes, multipliers.size()));
+
+  std::vector<FloquetMode> modes;
+  for(auto i = multipliers.begin(); i != multipliers.end(); i++){
+    FloquetMode mode;
+    mode.multiplier = *i;
+    const std::vector<Complex> ritz_vector = CalculateEigenvector(arnoldi_matrix, *i);
+    /*What the basis vectors past the last block add to J V y*/
+    double residual = 0;
+    for(unsigned int row = k; row < k + block_size && row < hessenberg.size(); row++){
+      Complex sum = 0;
+      for(unsigned int column = 0; column < k; column++)
+        sum += hessenberg[row][column]*ritz_vector[column];
+      residual += std::norm(sum);
+    }
+    mode.residual = sqrt(residual);
+    mode.eigenvector.assign(n, 0.0);
+    for(unsigned int column = 0; column < k; column++)
+      for(unsigned int j = 0; j < n; j++)
+        mode.eigenvector[j] += basis[column][j]*ritz_vector[column];
+    Normalise(mode.eigenvector);
+    modes.push_back(mode);
+  }
+  return modes;
+}
@@ -0,0 +1,49 @@
+#ifndef FLOQUETANALYSIS_HPP
+#define FLOQUETANALYSIS_HPP
+
+#include "Simulation.hpp"
+#include <vector>
+#include <complex>
+
+/* The leading Floquet multipliers of a steady state: the eigenvalues of the
+   Jacobian of the pace map (the state one pace on, as a function of the state
+   at the start of the pace) at its fixed point. Perturbations along a mode
+   shrink by its multiplier every pace, so the largest multiplier sets how many
+   paces brute-force pacing needs, and its eigenvector says which combination
+   of variables is left to settle (and is worth extrapolating).
+
+   Found by block Arnoldi iteration. Each product with the Jacobian is a finite
+   difference of two paces, and the products in a block are solved in
+   parallel, one thread each, on forks of the simulation. Everything is done in
+   the relative scale mrms uses, variable i divided by 1 + |x_i|, so the
+   perturbations are the same size relative to every variable. */
+
+struct FloquetMode{
+  std::complex<double> multiplier;
+  /*Unit length, in the relative scale*/
+  std::vector<std::complex<double>> eigenvector;
+  /*||J v - multiplier v|| for the eigenvector of the Arnoldi matrix, an estimate of the error*/
+  double residual;
+
+  /**Paces for a perturbation along this mode to shrink by a factor of e*/
+  double GetDecayPaces() const{
+    return -1/log(std::abs(multiplier));
+  }
+};
+
+/**The number_of_modes multipliers of largest magnitude (largest first) of the
+   pace map at r_simulation's current state, which should be its steady state.
+   krylov_dimension is the size of the Krylov space to build (rounded up to
+   whole blocks of `threads` vectors); perturbation is the finite difference
+   step and tolerance the CVODE tolerance the forks solve with, which needs to
+   be well below it.*/
+std::vector<FloquetMode> CalculateFloquetModes(Simulation& r_simulation, unsigned int number_of_modes, unsigned int krylov_dimension = 20,
+                                               unsigned int threads = 4, double perturbation = 1e-4, double tolerance = 1e-10);
+
+/**Eigenvalues of a small dense real matrix (by Hessenberg reduction and shifted QR), in no particular order*/
+std::vector<std::complex<double>> CalculateEigenvalues(std::vector<std::vector<double>> matrix);
+
+/**A unit eigenvector of a small dense real matrix for a known eigenvalue, by inverse iteration*/
+std::vector<std::complex<double>> CalculateEigenvector(const std::vector<std::vector<double>>& r_matrix, std::complex<double> eigenvalue);
+
+#endif
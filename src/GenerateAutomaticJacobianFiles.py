@@ -0,0 +1,159 @@
+"""Copyright (c) 2005-2019, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+"""
+
+"""
+Script to generate automatic differentiation Jacobians for cell models that have no Maple output.
+
+Usage: GenerateAutomaticJacobianFiles.py <directory> <model> [<model> ...]
+
+Finds each model's PyCML output <model>Cvode.cpp under <directory> (the build tree) and writes
+<model>CvodeAutomaticJacobian.hpp beside it, defining Cell<model>FromCellMLCvodeAutomaticJacobian.
+Its EvaluateTemplatedYDerivatives is the model's EvaluateYDerivatives with every variable that
+depends on the state declared as a template SCALAR rather than a double, and everything else
+(constants, parameters, the stimulus) left as it was, and fails on any declaration of or assignment
+to a var_ or d_dt_ variable it can't rewrite that way. See src/AutomaticJacobianCell.hpp.
+"""
+
+import os, re, sys
+
+derivatives_pattern = re.compile(r'void (Cell\w+FromCellMLCvode)::EvaluateYDerivatives\(double (\w+), const N_Vector rY, N_Vector rDY\)\s*\{')
+declaration_pattern = re.compile(r'^(\s*)(const\s+)?double\s+(\w+)\s*(=\s*(.*?))?;(\s*//.*)?$')
+identifier_pattern = re.compile(r'\b(?:var|d_dt)_\w+\b')
+assignment_pattern = re.compile(r'^\s*((?:var|d_dt)_\w+)\s*[-+*/]?=(?!=)')
+declared_pattern = re.compile(r'\bdouble\b.*\b(?:var|d_dt)_\w+')
+
+header_template = """#ifdef CHASTE_CVODE
+#ifndef %(guard)s
+#define %(guard)s
+
+// Generated by GenerateAutomaticJacobianFiles.py from %(source)s. Do not edit.
+
+%(includes)s
+#include "AutomaticJacobianCell.hpp"
+
+class %(name)s : public AutomaticJacobianCell<%(cell)s, %(name)s>
+{
+public:
+    %(name)s(boost::shared_ptr<AbstractIvpOdeSolver> pOdeSolver, boost::shared_ptr<AbstractStimulusFunction> pIntracellularStimulus)
+        : AutomaticJacobianCell<%(cell)s, %(name)s>(pOdeSolver, pIntracellularStimulus)
+    {
+    }
+
+    template<typename SCALAR>
+    void EvaluateTemplatedYDerivatives(double %(time)s, const SCALAR* pY, SCALAR* pDY)
+    {
+%(body)s
+    }
+};
+
+#endif // %(guard)s
+#endif // CHASTE_CVODE
+"""
+
+
+def find_source(directory, model):
+    for root, dirs, files in os.walk(directory):
+        if model + 'Cvode.cpp' in files:
+            return os.path.join(root, model + 'Cvode.cpp')
+    raise RuntimeError('No PyCML output for ' + model + ' under ' + directory)
+
+
+def extract_body(source):
+    match = derivatives_pattern.search(source)
+    if not match:
+        raise RuntimeError('No EvaluateYDerivatives in the PyCML output')
+    depth = 1
+    position = match.end()
+    while depth > 0:
+        if source[position] == '{':
+            depth += 1
+        elif source[position] == '}':
+            depth -= 1
+        position += 1
+    return match.group(1), match.group(2), source[match.end():position - 1]
+
+
+def template_body(body):
+    """Declare everything computed from the state as SCALAR, following the assignments in order"""
+    scalar_names = set()
+    lines = []
+    for line in body.strip('\n').split('\n'):
+        line = re.sub(r'NV_Ith_S\(rY, (\d+)\)', r'pY[\1]', line)
+        line = re.sub(r'NV_Ith_S\(rDY, (\d+)\)', r'pDY[\1]', line)
+        match = declaration_pattern.match(line)
+        if match:
+            indent, const, name, assignment, value, comment = match.groups()
+            depends_on_state = value is None or 'pY[' in value or \
+                any(identifier in scalar_names for identifier in identifier_pattern.findall(value))
+            if depends_on_state:
+                scalar_names.add(name)
+                line = indent + (const or '') + 'SCALAR ' + name + (' = ' + value if value is not None else '') + ';' + (comment or '')
+        elif not line.strip().startswith('//'):
+            # Several names or a declaration split over lines would be left as double, as would a double
+            # assigned later. Assigning to a SCALAR declared without a value (PyCML's d_dt_ for the voltage) is fine.
+            assignment = assignment_pattern.match(line)
+            if declared_pattern.search(line) or (assignment and assignment.group(1) not in scalar_names):
+                raise RuntimeError('Cannot rewrite ' + line.strip())
+        lines.append(line)
+    return '\n'.join(lines)
+
+
+def generate(directory, model):
+    source_path = find_source(directory, model)
+    with open(source_path) as source_file:
+        source = source_file.read()
+    cell, time, body = extract_body(source)
+    # The class is exported for serialization by its own source, not again here
+    includes = [line for line in source.split('\n')
+                if line.startswith('#include') and 'SerializationExportWrapperForCpp' not in line]
+    name = cell + 'AutomaticJacobian'
+    header = header_template % {'guard': name.upper() + '_HPP_',
+                                'source': os.path.basename(source_path),
+                                'includes': '\n'.join(includes),
+                                'name': name,
+                                'cell': cell,
+                                'time': time,
+                                'body': template_body(body)}
+
+    # Always written, so the build sees it as newer than the PyCML output it came from
+    header_path = os.path.join(os.path.dirname(source_path), model + 'CvodeAutomaticJacobian.hpp')
+    print('Writing ' + header_path)
+    with open(header_path, 'w') as header_file:
+        header_file.write(header)
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 3:
+        print('Usage: GenerateAutomaticJacobianFiles.py <directory> <model> [<model> ...]')
+        sys.exit(1)
+    for model in sys.argv[2:]:
+        generate(sys.argv[1], model)
@@ -0,0 +1,197 @@
+#include "MultirateSolver.hpp"
+#include "RushLarsen.hpp"
+#include "Tracing.hpp"
+#include "Exception.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace{
+  /*Steps are never allowed below this (ms), rather than looping forever*/
+  const double minimum_step = 1e-8;
+
+  /*The next step size after a step of step_size with scaled error `error`, for a method with a second order error estimate*/
+  double NextStepSize(double step_size, double error, double maximum_growth){
+    return step_size*std::max(0.2, std::min(maximum_growth, 0.9/std::sqrt(std::max(error, 1e-10))));
+  }
+}
+
+MultirateSolver::MultirateSolver(boost::shared_ptr<AbstractCvodeCell> _p_model, double slow_timescale, double _relative_tolerance,
+                                 double _absolute_tolerance, double _maximum_macro_step) :
+  AbstractApproachSolver(_p_model), relative_tolerance(_relative_tolerance), absolute_tolerance(_absolute_tolerance), maximum_macro_step(_maximum_macro_step){
+  number_of_variables = p_model->GetNumberOfStateVariables();
+  std::vector<double> jacobian_diagonal;
+  const std::vector<unsigned int> gates = FindGates(p_model, jacobian_diagonal);
+  rhs_evaluations += 2*number_of_variables + 1;
+  std::vector<bool> is_slow(number_of_variables);
+  for(unsigned int i = 0; i < number_of_variables; i++)
+    is_slow[i] = i != p_model->GetVoltageIndex() && std::abs(jacobian_diagonal[i])*slow_timescale < 1;
+  Partition(is_slow, gates);
+}
+
+MultirateSolver::MultirateSolver(boost::shared_ptr<AbstractCvodeCell> _p_model, const std::vector<std::string>& slow_variable_names, double _relative_tolerance,
+                                 double _absolute_tolerance, double _maximum_macro_step) :
+  AbstractApproachSolver(_p_model), relative_tolerance(_relative_tolerance), absolute_tolerance(_absolute_tolerance), maximum_macro_step(_maximum_macro_step){
+  number_of_variables = p_model->GetNumberOfStateVariables();
+  std::vector<bool> is_slow(number_of_variables, false);
+  for(auto i = slow_variable_names.begin(); i != slow_variable_names.end(); i++)
+    is_slow[p_model->GetSystemInformation()->GetStateVariableIndex(*i)] = true;
+  const std::vector<unsigned int> gates = FindGates(p_model);
+  rhs_evaluations += 2*number_of_variables + 1;
+  Partition(is_slow, gates);
+}
+
+void MultirateSolver::Partition(const std::vector<bool>& is_slow, const std::vector<unsigned int>& gates){
+  if(!(maximum_macro_step > 0))
+    EXCEPTION("The multirate solver's maximum macro step has to be positive");
+  for(unsigned int i = 0; i < number_of_variables; i++){
+    if(is_slow[i])
+      slow_indices.push_back(i);
+    else if(std::find(gates.begin(), gates.end(), i) != gates.end())
+      fast_gate_indices.push_back(i);
+    else
+      fast_other_indices.push_back(i);
+  }
+  derivatives = N_VNew_Serial(number_of_variables);
+  new_derivatives = N_VNew_Serial(number_of_variables);
+  perturbed_state = N_VNew_Serial(number_of_variables);
+  perturbed_derivatives = N_VNew_Serial(number_of_variables);
+  macro_start_state.resize(number_of_variables);
+  macro_start_derivatives.resize(number_of_variables);
+  micro_start_state.resize(number_of_variables);
+  gate_slopes.resize(number_of_variables);
+  macro_step = std::min(0.1, maximum_macro_step);
+  micro_step = std::min(0.01, macro_step);
+}
+
+MultirateSolver::~MultirateSolver(){
+  N_VDestroy_Serial(derivatives);
+  N_VDestroy_Serial(new_derivatives);
+  N_VDestroy_Serial(perturbed_state);
+  N_VDestroy_Serial(perturbed_derivatives);
+}
+
+boost::shared_ptr<AbstractApproachSolver> MultirateSolver::Clone(boost::shared_ptr<AbstractCvodeCell> p_other_model) const{
+  std::vector<std::string> slow_variable_names;
+  for(auto i = slow_indices.begin(); i != slow_indices.end(); i++)
+    slow_variable_names.push_back(p_model->rGetStateVariableNames()[*i]);
+  return boost::shared_ptr<AbstractApproachSolver>(new MultirateSolver(p_other_model, slow_variable_names, relative_tolerance, absolute_tolerance, maximum_macro_step));
+}
+
+CvodeStatistics MultirateSolver::GetStatistics() const{
+  CvodeStatistics statistics = AbstractApproachSolver::GetStatistics();
+  statistics.steps = macro_steps + micro_steps;
+  statistics.error_test_failures = rejected_steps;
+  return statistics;
+}
+
+/*Take the fast variables from start_time to end_time in micro steps, with the
+  slow ones on the line from the start of the macro step. Starts with
+  derivatives at start_time and leaves them at end_time.*/
+void MultirateSolver::SubCycle(double start_time, double end_time){
+  double* p_state = NV_DATA_S(p_model->rGetStateVariables());
+  double* p_perturbed_state = NV_DATA_S(perturbed_state);
+  const double* p_perturbed_derivatives = NV_DATA_S(perturbed_derivatives);
+  const double macro_start_time = start_time;
+  double time = start_time;
+  while(time < end_time){
+    double step_size = micro_step;
+    if(time + step_size*(1 + 1e-10) >= end_time)
+      step_size = end_time - time;
+    const double* p_derivatives = NV_DATA_S(derivatives);
+    const double* p_new_derivatives = NV_DATA_S(new_derivatives);
+    std::copy(p_state, p_state + number_of_variables, micro_start_state.begin());
+
+    /*Every fast gate's slope from one evaluation, as no gate depends on another*/
+    if(!fast_gate_indices.empty()){
+      std::copy(p_state, p_state + number_of_variables, p_perturbed_state);
+      for(auto i = fast_gate_indices.begin(); i != fast_gate_indices.end(); i++)
+        p_perturbed_state[*i] += GetGatePerturbation(p_state[*i]);
+      EvaluateDerivatives(time, perturbed_state, perturbed_derivatives);
+    }
+    for(auto i = fast_gate_indices.begin(); i != fast_gate_indices.end(); i++){
+      const double slope = (p_perturbed_derivatives[*i] - p_derivatives[*i])/(p_perturbed_state[*i] - p_state[*i]);
+      gate_slopes[*i] = slope;
+      if(slope < 0)
+        p_state[*i] += p_derivatives[*i]*std::expm1(slope*step_size)/slope;
+      else
+        p_state[*i] += step_size*p_derivatives[*i];
+    }
+    for(auto i = fast_other_indices.begin(); i != fast_other_indices.end(); i++)
+      p_state[*i] += step_size*p_derivatives[*i];
+    for(auto i = slow_indices.begin(); i != slow_indices.end(); i++)
+      p_state[*i] = macro_start_state[*i] + (time + step_size - macro_start_time)*macro_start_derivatives[*i];
+    EvaluateDerivatives(time + step_size, p_model->rGetStateVariables(), new_derivatives);
+
+    /*How far the derivative moved away from what the step assumed: constant for
+      forward Euler, decaying at the frozen rate for a gate*/
+    double error = 0;
+    for(auto i = fast_gate_indices.begin(); i != fast_gate_indices.end(); i++){
+      const double slope = gate_slopes[*i];
+      const double assumed = slope < 0 ? p_derivatives[*i]*std::exp(slope*step_size) : p_derivatives[*i];
+      error = std::max(error, std::abs(step_size/2*(p_new_derivatives[*i] - assumed))/GetWeight(p_state[*i]));
+    }
+    for(auto i = fast_other_indices.begin(); i != fast_other_indices.end(); i++)
+      error = std::max(error, std::abs(step_size/2*(p_new_derivatives[*i] - p_derivatives[*i]))/GetWeight(p_state[*i]));
+
+    if(error > 1 && step_size > minimum_step){
+      std::copy(micro_start_state.begin(), micro_start_state.end(), p_state);
+      micro_step = std::max(minimum_step, NextStepSize(step_size, error, 1));
+      rejected_steps++;
+      continue;
+    }
+    if(error > 1)
+      EXCEPTION("Multirate solver micro step fell below " + std::to_string(minimum_step) + " ms at t = " + std::to_string(time));
+    std::swap(derivatives, new_derivatives);
+    time += step_size;
+    micro_steps++;
+    /*A step cut short by the end of the macro step says nothing about the step size*/
+    const double next_step = NextStepSize(step_size, error, 2);
+    micro_step = step_size < micro_step ? std::max(micro_step, next_step) : next_step;
+  }
+}
+
+void MultirateSolver::Solve(double start_time, double end_time){
+  TRACE_SCOPE("MultirateSolver::Solve");
+  if(end_time <= start_time)
+    return;
+  N_Vector& r_state = p_model->rGetStateVariables();
+  double* p_state = NV_DATA_S(r_state);
+  EvaluateDerivatives(start_time, r_state, derivatives);
+
+  double time = start_time;
+  while(time < end_time){
+    double step_size = macro_step;
+    if(time + step_size*(1 + 1e-10) >= end_time)
+      step_size = end_time - time;
+    std::copy(p_state, p_state + number_of_variables, macro_start_state.begin());
+    std::copy(NV_DATA_S(derivatives), NV_DATA_S(derivatives) + number_of_variables, macro_start_derivatives.begin());
+    SubCycle(time, time + step_size);
+
+    /*Heun's method: the difference from the predictor is the error estimate*/
+    const double* p_derivatives = NV_DATA_S(derivatives);
+    double error = 0;
+    for(auto i = slow_indices.begin(); i != slow_indices.end(); i++)
+      error = std::max(error, std::abs(step_size/2*(p_derivatives[*i] - macro_start_derivatives[*i]))/GetWeight(p_state[*i]));
+
+    if(error > 1 && step_size > minimum_step){
+      std::copy(macro_start_state.begin(), macro_start_state.end(), p_state);
+      std::copy(macro_start_derivatives.begin(), macro_start_derivatives.end(), NV_DATA_S(derivatives));
+      macro_step = std::max(minimum_step, NextStepSize(step_size, error, 1));
+      micro_step = std::min(micro_step, macro_step);
+      rejected_steps++;
+      continue;
+    }
+    if(error > 1)
+      EXCEPTION("Multirate solver macro step fell below " + std::to_string(minimum_step) + " ms at t = " + std::to_string(time));
+    for(auto i = slow_indices.begin(); i != slow_indices.end(); i++)
+      p_state[*i] = macro_start_state[*i] + step_size/2*(macro_start_derivatives[*i] + p_derivatives[*i]);
+    time += step_size;
+    macro_steps++;
+    last_step_size = step_size;
+    if(!slow_indices.empty() && time < end_time)
+      EvaluateDerivatives(time, r_state, derivatives);
+    const double next_step = std::min(maximum_macro_step, NextStepSize(step_size, error, 5));
+    macro_step = step_size < macro_step ? std::max(macro_step, next_step) : next_step;
+  }
+}
@@ -0,0 +1,91 @@
+#ifndef MULTIRATESOLVER_HPP
+#define MULTIRATESOLVER_HPP
+
+#include "AbstractApproachSolver.hpp"
+#include <vector>
+#include <string>
+
+/* A multirate solver for the generated CVODE models, which splits the state
+   variables into fast ones (gates, the voltage) and slow ones (ion
+   concentrations) and steps each group at its own rate.
+
+   Slow variables take macro steps with Heun's method. Across a macro step they
+   follow the line from their starting derivative, while the fast variables are
+   sub-cycled in micro steps: gates exponentially as in RushLarsenSolver, the
+   rest with forward Euler. At the end of the macro step the slow variables are
+   corrected with the trapezium rule. Both step sizes are adapted to keep a local
+   error estimate within the tolerances, the macro step's from the slow
+   variables only and the micro steps' from the fast variables only, so quiet
+   fast variables in diastole don't hold the slow ones back and vice versa.
+
+   The split is either by timescale, where a variable is slow if 1/|df_i/dy_i| at
+   the model's current state is longer than slow_timescale, or given by name.
+
+   The generated models only give the right hand side of the whole system, so a
+   micro step still evaluates every derivative and the saving is in the number of
+   steps, not the cost of each. Like RushLarsenSolver this is low order and
+   meant for the paces before the limit cycle is close (see
+   Simulation::SetMultirateApproach). */
+
+class MultirateSolver : public AbstractApproachSolver{
+private:
+  unsigned int number_of_variables;
+  double relative_tolerance;
+  double absolute_tolerance;
+  double maximum_macro_step;
+  std::vector<unsigned int> fast_gate_indices;
+  std::vector<unsigned int> fast_other_indices;
+  std::vector<unsigned int> slow_indices;
+  N_Vector derivatives;
+  N_Vector new_derivatives;
+  N_Vector perturbed_state;
+  N_Vector perturbed_derivatives;
+  std::vector<double> macro_start_state;
+  std::vector<double> macro_start_derivatives;
+  std::vector<double> micro_start_state;
+  std::vector<double> gate_slopes;
+  double macro_step;
+  double micro_step;
+  unsigned long macro_steps = 0;
+  unsigned long micro_steps = 0;
+  unsigned long rejected_steps = 0;
+
+  void Partition(const std::vector<bool>& is_slow, const std::vector<unsigned int>& gates);
+  double GetWeight(double value) const{
+    return absolute_tolerance + relative_tolerance*std::abs(value);
+  }
+  void SubCycle(double start_time, double end_time);
+public:
+  /**Split by timescale (in ms) at the model's current state*/
+  MultirateSolver(boost::shared_ptr<AbstractCvodeCell> _p_model, double slow_timescale = 10, double _relative_tolerance = 1e-4,
+                  double _absolute_tolerance = 1e-7, double _maximum_macro_step = 10);
+  /**Step the named state variables slowly and the rest fast*/
+  MultirateSolver(boost::shared_ptr<AbstractCvodeCell> _p_model, const std::vector<std::string>& slow_variable_names, double _relative_tolerance = 1e-4,
+                  double _absolute_tolerance = 1e-7, double _maximum_macro_step = 10);
+  ~MultirateSolver();
+  MultirateSolver(const MultirateSolver&) = delete;
+  MultirateSolver& operator=(const MultirateSolver&) = delete;
+
+  void Solve(double start_time, double end_time);
+
+  boost::shared_ptr<AbstractApproachSolver> Clone(boost::shared_ptr<AbstractCvodeCell> p_other_model) const;
+
+  /**Macro and micro steps both count as steps, and rejected ones as error test failures*/
+  CvodeStatistics GetStatistics() const;
+
+  const std::vector<unsigned int>& rGetSlowIndices() const{
+    return slow_indices;
+  }
+  unsigned long GetNumberOfMacroSteps() const{
+    return macro_steps;
+  }
+  unsigned long GetNumberOfMicroSteps() const{
+    return micro_steps;
+  }
+  /**Macro and micro steps thrown away for failing the error test*/
+  unsigned long GetNumberOfRejectedSteps() const{
+    return rejected_steps;
+  }
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include "PaceReplay.hpp"
+#include "Simulation.hpp"
+#include "SimulationTools.hpp"
+#include "TraceFile.hpp"
+#include "Tracing.hpp"
+#include "Exception.hpp"
+
+bool BufferReplayStrategy::Jump(const std::vector<std::vector<double>>& r_states, std::vector<double>& r_state){
+  /*A buffer of mrms needs one more state than a buffer of states*/
+  if(r_states.size() < buffer_size + 1)
+    return false;
+  const auto first = r_states.end() - buffer_size;
+  std::vector<double> mrms_buffer;
+  mrms_buffer.reserve(buffer_size);
+  for(auto i = first; i != r_states.end(); i++)
+    mrms_buffer.push_back(mrms(*i, *(i - 1)));
+  if(!(CalculatePMCC(mrms_buffer) < trigger))
+    return false;
+
+  const std::vector<std::vector<double>> window(first, r_states.end());
+  bool extrapolated = false;
+  std::vector<double> x_vals;
+  std::vector<double> y_vals;
+  for(unsigned int i = 0; i < r_state.size(); i++){
+    const std::vector<double> values = GetNthVariable(window, i);
+    x_vals.clear();
+    y_vals.clear();
+    GetLogDifferences(values, x_vals, y_vals);
+    double alpha, beta;
+    if(!FitLine(x_vals, y_vals, alpha, beta) || !IsGeometricDecay(CalculatePMCC(x_vals, y_vals), alpha, beta, values.back(), relative_tolerance))
+      continue;
+    const double new_value = GeometricJump(values, alpha, beta, extrapolation_coefficient);
+    if(std::isfinite(new_value)){
+      r_state[i] = new_value;
+      extrapolated = true;
+    }
+  }
+  return extrapolated;
+}
+
+PaceReplay::PaceReplay(const std::string& file_path, boost::shared_ptr<AbstractCvodeCell> _p_model, double _period, unsigned int _verification_paces) :
+  p_model(_p_model), period(_period), verification_paces(_verification_paces){
+  TraceReader reader(file_path);
+  if(reader.rGetVariableNames() != p_model->rGetStateVariableNames())
+    EXCEPTION(file_path + " wasn't recorded with this model");
+  const unsigned int number_of_variables = reader.rGetVariableNames().size();
+  states.assign(reader.GetNumberOfRows(), std::vector<double>(number_of_variables));
+  for(unsigned int i = 0; i < number_of_variables; i++){
+    const std::vector<double> column = reader.GetVariable(i);
+    for(unsigned int j = 0; j < column.size(); j++)
+      states[j][i] = column[j];
+  }
+  if(states.size() < 2)
+    EXCEPTION(file_path + " has no paces recorded");
+}
+
+unsigned int PaceReplay::FindNearestPace(const std::vector<double>& r_state, unsigned int first_pace, double& r_distance) const{
+  unsigned int nearest = first_pace;
+  r_distance = INFINITY;
+  for(unsigned int i = first_pace; i < states.size(); i++){
+    const double distance = mrms(states[i], r_state);
+    if(distance < r_distance){
+      r_distance = distance;
+      nearest = i;
+    }
+  }
+  return nearest;
+}
+
+ReplayResult PaceReplay::Replay(AbstractReplayStrategy& r_strategy, unsigned int max_jumps){
+  TRACE_SCOPE("PaceReplay::Replay");
+  ReplayResult result;
+  const unsigned int voltage_index = p_model->GetVoltageIndex();
+  std::vector<std::vector<double>> history(1, states[0]);
+  std::vector<double> final_state = states[0];
+  unsigned int pace = 0;
+  while(pace + 1 < states.size()){
+    pace++;
+    result.paces++;
+    history.push_back(states[pace]);
+    final_state = states[pace];
+    if(mrms(states[pace - 1], states[pace]) < Simulation::GetConvergenceThreshold()){
+      result.converged = true;
+      break;
+    }
+    if(result.jumps >= max_jumps)
+      continue;
+    std::vector<double> jumped_state = states[pace];
+    if(!r_strategy.Jump(history, jumped_state))
+      continue;
+
+    /*SmartSimulation's check on the jump, then a few real paces from it*/
+    p_model->SetStateVariables(jumped_state);
+    bool accepted = std::abs(p_model->CalculateAnalyticVoltage() - states[pace][voltage_index]) <= 5;
+    bool finished = false;
+    if(accepted){
+      Simulation verification(p_model, period);
+      try{
+        for(unsigned int i = 0; i < verification_paces && !finished; i++){
+          finished = verification.RunPace();
+          result.paces++;
+          result.verification_paces++;
+        }
+      }
+      catch(Exception &e){
+        accepted = false;
+      }
+    }
+    history.assign(1, states[pace]);
+    if(!accepted){
+      result.rejected_jumps++;
+      continue;
+    }
+
+    if(result.jumps == 0)
+      result.first_jump_pace = pace;
+    result.jumps++;
+    final_state = p_model->GetStdVecStateVariables();
+    if(finished){
+      result.converged = true;
+      break;
+    }
+    double distance;
+    pace = FindNearestPace(final_state, pace, distance);
+    result.max_mapping_error = std::max(result.max_mapping_error, distance);
+    history.assign(1, states[pace]);
+  }
+  result.error = mrms(final_state, states.back());
+  return result;
+}
@@ -0,0 +1,86 @@
+#ifndef PACEREPLAY_HPP
+#define PACEREPLAY_HPP
+
+#include "AbstractCvodeCell.hpp"
+#include <vector>
+#include <string>
+#include <cmath>
+#include <boost/shared_ptr.hpp>
+
+/* Trying out extrapolation strategies without pacing to steady state again.
+
+   Simulation::StartPaceRecording stores the state at the end of every pace of
+   an ordinary run. PaceReplay plays a strategy against that recording: the
+   strategy sees the paces since its last jump as if it had solved them, and the
+   recorded paces cost nothing to replay. When it jumps, the model is paced from
+   the jumped state for a few verification paces - the only solves in a replay -
+   and the replay carries on from the recorded pace nearest to where they end
+   up. The cost reported is what a real run of the strategy would have solved:
+   the recorded paces replayed plus the verification paces. */
+
+class AbstractReplayStrategy{
+public:
+  virtual ~AbstractReplayStrategy(){
+  }
+  /**r_states holds the state at the end of every pace since the last jump,
+     oldest first. Return true, with r_state set to where to jump, to jump.
+     r_state starts as the latest state.*/
+  virtual bool Jump(const std::vector<std::vector<double>>& r_states, std::vector<double>& r_state) = 0;
+};
+
+/** SmartSimulation's strategy: wait until the mrms between paces has fallen
+    steadily over a whole buffer (PMCC below trigger), then extrapolate every
+    variable whose log differences over the buffer decay geometrically */
+class BufferReplayStrategy : public AbstractReplayStrategy{
+private:
+  unsigned int buffer_size;
+  double extrapolation_coefficient;
+  double trigger;
+  double relative_tolerance;
+public:
+  BufferReplayStrategy(unsigned int _buffer_size, double _extrapolation_coefficient, double _trigger = -0.975, double _relative_tolerance = 1e-7) :
+    buffer_size(_buffer_size), extrapolation_coefficient(_extrapolation_coefficient), trigger(_trigger), relative_tolerance(_relative_tolerance){
+  }
+  bool Jump(const std::vector<std::vector<double>>& r_states, std::vector<double>& r_state);
+};
+
+struct ReplayResult{
+  /*Paces a real run of the strategy would have solved*/
+  unsigned int paces = 0;
+  /*Of which solved to check jumps*/
+  unsigned int verification_paces = 0;
+  unsigned int jumps = 0;
+  /*Jumps that moved the voltage too far or failed to solve*/
+  unsigned int rejected_jumps = 0;
+  /*The pace at the end of which the first accepted jump was made, 0 if none was*/
+  unsigned int first_jump_pace = 0;
+  bool converged = false;
+  /*mrms between where the replay finished and the end of the recording*/
+  double error = NAN;
+  /*The furthest (mrms) a verified jump ended up from every recorded pace*/
+  double max_mapping_error = 0;
+};
+
+class PaceReplay{
+private:
+  std::vector<std::vector<double>> states;
+  boost::shared_ptr<AbstractCvodeCell> p_model;
+  double period;
+  unsigned int verification_paces;
+
+  /*The recorded pace from first_pace on that is closest to r_state*/
+  unsigned int FindNearestPace(const std::vector<double>& r_state, unsigned int first_pace, double& r_distance) const;
+public:
+  /**Load the recording at file_path. p_model is only solved to verify jumps, and
+     must be the model the recording was made with.*/
+  PaceReplay(const std::string& file_path, boost::shared_ptr<AbstractCvodeCell> _p_model, double _period, unsigned int _verification_paces = 2);
+
+  unsigned int GetNumberOfRecordedPaces() const{
+    return states.size() - 1;
+  }
+
+  /**Play r_strategy against the recording, allowing it at most max_jumps jumps*/
+  ReplayResult Replay(AbstractReplayStrategy& r_strategy, unsigned int max_jumps = 100);
+};
+
+#endif
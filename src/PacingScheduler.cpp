@@ -0,0 +1,137 @@
+#include "PacingScheduler.hpp"
+#include "BenchmarkTools.hpp"
+#include "Tracing.hpp"
+#include "Exception.hpp"
+
+#include <thread>
+
+double PacingScheduler::GetPredictedWork(const Job& r_job){
+  if(r_job.paces == 0 || std::isnan(r_job.estimate.remaining))
+    return INFINITY;
+  return r_job.estimate.remaining*r_job.wall_time/r_job.paces;
+}
+
+unsigned int PacingScheduler::ChooseJob(){
+  unsigned int chosen = jobs.size();
+  for(unsigned int i = 0; i < jobs.size(); i++){
+    if(jobs[i].running || jobs[i].status != JobStatus::Waiting)
+      continue;
+    /*Ties, such as several jobs without estimates, go to the one added first*/
+    if(chosen == jobs.size() || GetPredictedWork(jobs[i]) > GetPredictedWork(jobs[chosen]))
+      chosen = i;
+  }
+  return chosen;
+}
+
+unsigned int PacingScheduler::GetNumberOfWaitingJobs(){
+  unsigned int waiting = 0;
+  for(auto i = jobs.begin(); i != jobs.end(); i++)
+    if(i->status == JobStatus::Waiting)
+      waiting++;
+  return waiting;
+}
+
+void PacingScheduler::UpdateStatus(Job& r_job){
+  if(r_job.status != JobStatus::Waiting)
+    return;
+  if(r_job.is_finished()){
+    r_job.status = JobStatus::Converged;
+    return;
+  }
+  if(r_job.paces >= r_job.budget){
+    r_job.status = JobStatus::OutOfBudget;
+    return;
+  }
+  r_job.estimate = r_job.estimate_remaining_paces();
+  const double elapsed_time = GetWallTime() - start_time;
+  if(elapsed_time > deadline){
+    r_job.status = JobStatus::Abandoned;
+    return;
+  }
+  /*Pacing without jumps says nothing about when a job that jumps will finish*/
+  if(r_job.can_jump || !std::isfinite(r_job.estimate.lower))
+    return;
+  const double finish_time = elapsed_time + r_job.estimate.lower*r_job.wall_time/r_job.paces;
+  if(r_job.paces + r_job.estimate.lower > r_job.budget || finish_time > deadline)
+    r_job.status = JobStatus::Abandoned;
+}
+
+bool PacingScheduler::RunSlice(Job& r_job, std::string& r_error){
+  TRACE_SCOPE("PacingScheduler::RunSlice");
+  const double slice_start = GetWallTime();
+  bool succeeded = true;
+  try{
+    for(unsigned int i = 0; i < slice_paces && r_job.paces < r_job.budget && !r_job.is_finished(); i++){
+      r_job.run_pace();
+      r_job.paces++;
+    }
+  }
+  catch(Exception &e){
+    succeeded = false;
+    r_error = e.GetMessage();
+  }
+  r_job.wall_time += GetWallTime() - slice_start;
+  return succeeded;
+}
+
+void PacingScheduler::Work(){
+  std::unique_lock<std::mutex> lock(mutex);
+  while(true){
+    const unsigned int chosen = ChooseJob();
+    if(chosen == jobs.size() || threads_in_use >= threads){
+      /*Everything left is running on other threads, or helpers are using this
+        thread's share. Wait for one of them to come back.*/
+      if(GetNumberOfWaitingJobs() == 0)
+        return;
+      job_released.wait(lock);
+      continue;
+    }
+    Job& r_job = jobs[chosen];
+    r_job.running = true;
+    /*A spare thread for every job once there are few enough of them, as long as
+      there is one free*/
+    const bool helper = 2*GetNumberOfWaitingJobs() <= threads && threads_in_use + 2 <= threads;
+    if(helper != r_job.helper){
+      r_job.set_helper_thread(helper);
+      r_job.helper = helper;
+    }
+    threads_in_use += helper ? 2 : 1;
+    const PacingSlice slice = {chosen, helper};
+    slices.push_back(slice);
+
+    /*Only this thread touches a running job's simulation, paces and times*/
+    lock.unlock();
+    std::string error;
+    const bool succeeded = RunSlice(r_job, error);
+    lock.lock();
+    threads_in_use -= helper ? 2 : 1;
+
+    if(!succeeded){
+      r_job.status = JobStatus::Failed;
+      r_job.error = error;
+    }
+    UpdateStatus(r_job);
+    r_job.running = false;
+    job_released.notify_all();
+  }
+}
+
+std::vector<PacingJobReport> PacingScheduler::Run(unsigned int _threads){
+  TRACE_SCOPE("PacingScheduler::Run");
+  threads = std::max(1u, _threads);
+  threads_in_use = 0;
+  slices.clear();
+  start_time = GetWallTime();
+  std::vector<std::thread> workers;
+  for(unsigned int i = 0; i < threads; i++)
+    workers.push_back(std::thread(&PacingScheduler::Work, this));
+  for(auto i = workers.begin(); i != workers.end(); i++)
+    i->join();
+
+  std::vector<PacingJobReport> reports;
+  for(auto i = jobs.begin(); i != jobs.end(); i++){
+    const PacingJobReport report = {i->name, i->status, i->paces, i->wall_time, i->estimate, i->error};
+    reports.push_back(report);
+  }
+  return reports;
+}
@@ -0,0 +1,143 @@
+#ifndef PACINGSCHEDULER_HPP
+#define PACINGSCHEDULER_HPP
+
+#include "Simulation.hpp"
+#include <vector>
+#include <string>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <boost/shared_ptr.hpp>
+
+/* Running a batch of pacing jobs on a fixed number of threads.
+
+   Jobs are paced a slice at a time. Whenever a thread is free it takes the job
+   with the most predicted work left (remaining paces from
+   Simulation::EstimateRemainingPaces times its time per pace), so the longest
+   jobs start first and nothing long is left until the end; jobs without an
+   estimate yet count as longest. Once fewer jobs are left than there are
+   threads to run them on, SmartSimulations are given a second thread for
+   speculative jumps (see SmartSimulation::SetSpeculativePaces). A helper counts
+   against the threads like a job does: a job only gets one when a thread is
+   free for it, and one of the scheduler's threads sits out while it runs. A job stops
+   when it converges, uses up its pace budget, or when even the optimistic end
+   of its estimate has it missing the budget or the batch's deadline. The
+   estimate extrapolates pacing without jumps, so jobs that can jump are only
+   stopped once they have actually run out of paces or time. */
+
+enum class JobStatus{
+  Waiting,
+  Converged,
+  /*Ran out of paces*/
+  OutOfBudget,
+  /*Stopped early, predicted to miss its budget or the deadline*/
+  Abandoned,
+  /*RunPace threw*/
+  Failed
+};
+
+struct PacingJobReport{
+  std::string name;
+  JobStatus status;
+  unsigned int paces;
+  double wall_time;
+  PaceEstimate estimate;
+  std::string error;
+};
+
+/*One slice of pacing, in the order they started*/
+struct PacingSlice{
+  /*Index of the job, in the order they were added*/
+  unsigned int job;
+  bool helper;
+};
+
+/*What a SmartSimulation does with a spare thread. Anything else has no use for one.*/
+inline void SetHelperThread(Simulation& r_simulation, bool helper){
+}
+inline void SetHelperThread(SmartSimulation& r_simulation, bool helper){
+  r_simulation.SetSpeculativePaces(helper ? 20 : 0);
+}
+
+/*Whether it can jump ahead of the estimate of its remaining paces*/
+inline bool CanJump(const Simulation& r_simulation){
+  return false;
+}
+inline bool CanJump(const SmartSimulation& r_simulation){
+  return true;
+}
+
+class PacingScheduler{
+private:
+  struct Job{
+    std::string name;
+    unsigned int budget;
+    std::function<bool()> run_pace;
+    std::function<bool()> is_finished;
+    std::function<PaceEstimate()> estimate_remaining_paces;
+    std::function<void(bool)> set_helper_thread;
+    bool can_jump = false;
+    JobStatus status = JobStatus::Waiting;
+    bool running = false;
+    bool helper = false;
+    unsigned int paces = 0;
+    double wall_time = 0;
+    PaceEstimate estimate;
+    std::string error;
+  };
+  std::vector<Job> jobs;
+  unsigned int slice_paces;
+  double deadline = INFINITY;
+  unsigned int threads = 1;
+  /*Running jobs plus their helpers*/
+  unsigned int threads_in_use = 0;
+  std::vector<PacingSlice> slices;
+  double start_time = 0;
+  std::mutex mutex;
+  std::condition_variable job_released;
+
+  /*Predicted seconds of work left*/
+  static double GetPredictedWork(const Job& r_job);
+  /*The waiting job to run next, or jobs.size() if none is free*/
+  unsigned int ChooseJob();
+  unsigned int GetNumberOfWaitingJobs();
+  /*After a slice: stop the job if it has finished or can't make it*/
+  void UpdateStatus(Job& r_job);
+  /*Pace the job for a slice, without the lock. False, with the message, if it threw.*/
+  bool RunSlice(Job& r_job, std::string& r_error);
+  void Work();
+public:
+  /**Jobs are paced _slice_paces paces at a time between decisions*/
+  PacingScheduler(unsigned int _slice_paces = 20) : slice_paces(_slice_paces){
+  }
+
+  /**Pace p_simulation until it finishes, for at most budget paces. The
+     simulation is used from the scheduler's threads, one at a time.*/
+  template<typename SIMULATION>
+  void AddJob(const std::string& name, boost::shared_ptr<SIMULATION> p_simulation, unsigned int budget){
+    Job job;
+    job.name = name;
+    job.budget = budget;
+    job.run_pace = [p_simulation](){return p_simulation->RunPace();};
+    job.is_finished = [p_simulation](){return p_simulation->is_finished();};
+    job.estimate_remaining_paces = [p_simulation](){return p_simulation->EstimateRemainingPaces();};
+    job.set_helper_thread = [p_simulation](bool helper){SetHelperThread(*p_simulation, helper);};
+    job.can_jump = CanJump(*p_simulation);
+    jobs.push_back(job);
+  }
+
+  /**Stop jobs predicted to still be running this many seconds after Run starts*/
+  void SetDeadline(double seconds){
+    deadline = seconds;
+  }
+
+  /**Run every job on _threads threads and report how each ended, in the order they were added*/
+  std::vector<PacingJobReport> Run(unsigned int _threads);
+
+  /**Every slice the last Run paced*/
+  const std::vector<PacingSlice>& rGetSlices() const{
+    return slices;
+  }
+};
+
+#endif
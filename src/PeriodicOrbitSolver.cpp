@@ -0,0 +1,379 @@
+#include "PeriodicOrbitSolver.hpp"
+#include "Simulation.hpp"
+#include "SimulationTools.hpp"
+#include "DenseTrace.hpp"
+#include "Tracing.hpp"
+#include "Exception.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace{
+  const unsigned int number_of_stages = 3;
+  /*Gauss-Legendre points on [0, 1], and the weights of the quadrature rule they make*/
+  const double collocation_points[number_of_stages] = {0.5 - sqrt(15.0)/10, 0.5, 0.5 + sqrt(15.0)/10};
+  const double quadrature_weights[number_of_stages] = {5.0/18, 4.0/9, 5.0/18};
+
+  /*The Lagrange polynomials through the collocation points, at theta*/
+  std::vector<double> GetBasis(double theta){
+    std::vector<double> basis(number_of_stages, 1);
+    for(unsigned int l = 0; l < number_of_stages; l++)
+      for(unsigned int m = 0; m < number_of_stages; m++)
+        if(m != l)
+          basis[l] *= (theta - collocation_points[m])/(collocation_points[l] - collocation_points[m]);
+    return basis;
+  }
+
+  /*Their integrals from 0 to theta, which the quadrature rule gets exactly. At
+    the collocation points these are the Runge-Kutta matrix, and at 1 the weights.*/
+  std::vector<double> GetIntegratedBasis(double theta){
+    std::vector<double> integrals(number_of_stages, 0);
+    for(unsigned int q = 0; q < number_of_stages; q++){
+      const std::vector<double> basis = GetBasis(theta*collocation_points[q]);
+      for(unsigned int l = 0; l < number_of_stages; l++)
+        integrals[l] += theta*quadrature_weights[q]*basis[l];
+    }
+    return integrals;
+  }
+
+  typedef std::vector<std::vector<double>> Matrix;
+
+  Matrix Multiply(const Matrix& a, const Matrix& b){
+    Matrix product(a.size(), std::vector<double>(b[0].size(), 0));
+    for(unsigned int i = 0; i < a.size(); i++)
+      for(unsigned int k = 0; k < b.size(); k++)
+        if(a[i][k] != 0)
+          for(unsigned int j = 0; j < b[0].size(); j++)
+            product[i][j] += a[i][k]*b[k][j];
+    return product;
+  }
+
+  std::vector<double> Multiply(const Matrix& a, const std::vector<double>& x){
+    std::vector<double> product(a.size(), 0);
+    for(unsigned int i = 0; i < a.size(); i++)
+      for(unsigned int k = 0; k < x.size(); k++)
+        product[i] += a[i][k]*x[k];
+    return product;
+  }
+
+}
+
+PeriodicOrbitSolver::PeriodicOrbitSolver(boost::shared_ptr<AbstractCvodeCell> _p_model, double _period, unsigned int initial_paces,
+                                         double _tolerance, double _mesh_tolerance) :
+  p_model(_p_model), period(_period), tolerance(_tolerance), mesh_tolerance(_mesh_tolerance){
+  TRACE_SCOPE("PeriodicOrbitSolver::PeriodicOrbitSolver");
+  number_of_variables = p_model->GetNumberOfStateVariables();
+  {
+    Simulation simulation(p_model, period);
+    for(unsigned int i = 1; i < initial_paces; i++)
+      simulation.RunPace();
+    initial_rhs_evaluations = simulation.GetTotalCvodeStatistics().rhs_evaluations;
+  }
+  /*A stimulus of our own, set up like Simulation's*/
+  p_stimulus = p_model->UseCellMLDefaultStimulus();
+  p_stimulus->SetStartTime(0);
+  p_stimulus->SetPeriod(period);
+  duration = p_stimulus->GetDuration();
+
+  /*The last pace, recording CVODE's steps*/
+  const std::vector<double> initial_state = p_model->GetStdVecStateVariables();
+  DenseTrace trace(number_of_variables);
+  SolveAndRecordSteps(p_model, 0, duration, trace);
+  p_stimulus->SetPeriod(period*2);
+  SolveAndRecordSteps(p_model, duration, period, trace);
+  p_stimulus->SetPeriod(period);
+  /*CVODE starts again at t=0, so its counters are this pace's*/
+  initial_rhs_evaluations += GetCvodeStatistics(p_model).rhs_evaluations;
+  p_model->SetStateVariables(initial_state);
+
+  /*Every other step of CVODE's on either side of the end of the stimulus,
+    leaving out any that would make a tiny interval against it*/
+  const std::vector<double>& r_step_times = trace.rGetStepTimes();
+  const double minimum_interval = 1e-6*period;
+  mesh.push_back(0);
+  for(double end : {duration, period}){
+    const double start = mesh.back();
+    unsigned int steps = 0;
+    for(auto i = r_step_times.begin(); i != r_step_times.end(); i++)
+      if(*i > start + minimum_interval && *i < end - minimum_interval && ++steps % 2 == 0)
+        mesh.push_back(*i);
+    mesh.push_back(end);
+  }
+
+  state = N_VNew_Serial(number_of_variables);
+  derivatives = N_VNew_Serial(number_of_variables);
+  perturbed_derivatives = N_VNew_Serial(number_of_variables);
+
+  /*Start from the paced trace, with the stage derivatives the right hand side along it*/
+  const unsigned int intervals = mesh.size() - 1;
+  mesh_states.resize(intervals);
+  stage_derivatives.assign(intervals, std::vector<double>(number_of_stages*number_of_variables));
+  std::vector<double> stage_state(number_of_variables), stage_derivative(number_of_variables);
+  for(unsigned int i = 0; i < intervals; i++){
+    mesh_states[i] = i == 0 ? initial_state : trace.GetStateVariables(mesh[i]);
+    const double h = mesh[i + 1] - mesh[i];
+    for(unsigned int j = 0; j < number_of_stages; j++){
+      const double time = mesh[i] + collocation_points[j]*h;
+      trace.GetStateVariables(time, stage_state);
+      EvaluateDerivatives(time, stage_state, stage_derivative);
+      std::copy(stage_derivative.begin(), stage_derivative.end(), stage_derivatives[i].begin() + j*number_of_variables);
+    }
+  }
+}
+
+PeriodicOrbitSolver::~PeriodicOrbitSolver(){
+  N_VDestroy_Serial(state);
+  N_VDestroy_Serial(derivatives);
+  N_VDestroy_Serial(perturbed_derivatives);
+}
+
+void PeriodicOrbitSolver::EvaluateDerivatives(double time, const std::vector<double>& r_state, std::vector<double>& r_derivatives){
+  std::copy(r_state.begin(), r_state.end(), NV_DATA_S(state));
+  p_model->EvaluateYDerivatives(time, state, derivatives);
+  rhs_evaluations++;
+  r_derivatives.assign(NV_DATA_S(derivatives), NV_DATA_S(derivatives) + number_of_variables);
+}
+
+void PeriodicOrbitSolver::EvaluateJacobian(double time, const std::vector<double>& r_state, Matrix& r_jacobian){
+  double* p_state = NV_DATA_S(state);
+  const double* p_derivatives = NV_DATA_S(derivatives);
+  const double* p_perturbed_derivatives = NV_DATA_S(perturbed_derivatives);
+  std::copy(r_state.begin(), r_state.end(), p_state);
+  p_model->EvaluateYDerivatives(time, state, derivatives);
+  const double root_epsilon = sqrt(std::numeric_limits<double>::epsilon());
+  for(unsigned int k = 0; k < number_of_variables; k++){
+    const double perturbation = root_epsilon*std::max(std::abs(r_state[k]), 1e-6);
+    p_state[k] = r_state[k] + perturbation;
+    p_model->EvaluateYDerivatives(time, state, perturbed_derivatives);
+    p_state[k] = r_state[k];
+    for(unsigned int i = 0; i < number_of_variables; i++)
+      r_jacobian[i][k] = (p_perturbed_derivatives[i] - p_derivatives[i])/perturbation;
+  }
+  rhs_evaluations += number_of_variables + 1;
+}
+
+std::vector<double> PeriodicOrbitSolver::GetStageState(unsigned int interval, unsigned int stage) const{
+  return GetState(interval, collocation_points[stage]);
+}
+
+std::vector<double> PeriodicOrbitSolver::GetState(unsigned int interval, double theta) const{
+  const double h = mesh[interval + 1] - mesh[interval];
+  const std::vector<double> integrals = GetIntegratedBasis(theta);
+  std::vector<double> result = mesh_states[interval];
+  for(unsigned int l = 0; l < number_of_stages; l++)
+    for(unsigned int k = 0; k < number_of_variables; k++)
+      result[k] += h*integrals[l]*stage_derivatives[interval][l*number_of_variables + k];
+  return result;
+}
+
+double PeriodicOrbitSolver::NewtonStep(double& r_step_size){
+  const unsigned int intervals = mesh.size() - 1;
+  const unsigned int n = number_of_variables;
+  const unsigned int m = number_of_stages*n;
+  std::vector<std::vector<double>> runge_kutta_matrix(number_of_stages);
+  for(unsigned int j = 0; j < number_of_stages; j++)
+    runge_kutta_matrix[j] = GetIntegratedBasis(collocation_points[j]);
+
+  /*Per interval, the stage corrections in terms of the correction to the state
+    at its start (dK = P dx + p), and the correction to the state at its end
+    (dx' = G dx + g)*/
+  std::vector<Matrix> stage_maps(intervals);
+  std::vector<Matrix> transfers(intervals);
+  std::vector<std::vector<double>> transfer_offsets(intervals);
+
+  double residual = 0;
+  Matrix jacobian(n, std::vector<double>(n));
+  Matrix stage_matrix(m, std::vector<double>(m));
+  std::vector<double> f(n);
+  for(unsigned int i = 0; i < intervals; i++){
+    const double h = mesh[i + 1] - mesh[i];
+    const std::vector<double>& r_stages = stage_derivatives[i];
+    /*The last column is the stage residual*/
+    Matrix& r_map = stage_maps[i];
+    r_map.assign(m, std::vector<double>(n + 1));
+    for(unsigned int j = 0; j < number_of_stages; j++){
+      const double time = mesh[i] + collocation_points[j]*h;
+      const std::vector<double> stage_state = GetStageState(i, j);
+      EvaluateDerivatives(time, stage_state, f);
+      EvaluateJacobian(time, stage_state, jacobian);
+      for(unsigned int r = 0; r < n; r++){
+        const double stage_residual = r_stages[j*n + r] - f[r];
+        residual = std::max(residual, h*std::abs(stage_residual)/(1 + std::abs(stage_state[r])));
+        std::copy(jacobian[r].begin(), jacobian[r].end(), r_map[j*n + r].begin());
+        r_map[j*n + r][n] = -stage_residual;
+        for(unsigned int l = 0; l < number_of_stages; l++)
+          for(unsigned int k = 0; k < n; k++)
+            stage_matrix[j*n + r][l*n + k] = (j == l && r == k ? 1 : 0) - h*runge_kutta_matrix[j][l]*jacobian[r][k];
+      }
+    }
+    SolveLinearSystem(stage_matrix, r_map);
+
+    /*Continuity with the next interval, which for the last is periodicity*/
+    const std::vector<double>& r_next_state = mesh_states[(i + 1) % intervals];
+    const std::vector<double> end_state = GetState(i, 1);
+    transfers[i].assign(n, std::vector<double>(n, 0));
+    transfer_offsets[i].resize(n);
+    for(unsigned int r = 0; r < n; r++){
+      const double gap = end_state[r] - r_next_state[r];
+      residual = std::max(residual, std::abs(gap)/(1 + std::abs(r_next_state[r])));
+      transfers[i][r][r] = 1;
+      transfer_offsets[i][r] = gap;
+      for(unsigned int j = 0; j < number_of_stages; j++){
+        const double weight = h*quadrature_weights[j];
+        for(unsigned int k = 0; k < n; k++)
+          transfers[i][r][k] += weight*r_map[j*n + r][k];
+        transfer_offsets[i][r] += weight*r_map[j*n + r][n];
+      }
+    }
+  }
+
+  /*Chain the intervals together: the correction at the end of the pace is M dx0 + q*/
+  Matrix monodromy(n, std::vector<double>(n, 0));
+  for(unsigned int r = 0; r < n; r++)
+    monodromy[r][r] = 1;
+  std::vector<double> offset(n, 0);
+  for(unsigned int i = 0; i < intervals; i++){
+    monodromy = Multiply(transfers[i], monodromy);
+    offset = Multiply(transfers[i], offset);
+    for(unsigned int r = 0; r < n; r++)
+      offset[r] += transfer_offsets[i][r];
+  }
+
+  /*Periodicity, (I - M) dx0 = q, in the relative scale, holding any conserved quantities where they are*/
+  std::vector<double> scale(n);
+  for(unsigned int r = 0; r < n; r++)
+    scale[r] = 1 + std::abs(mesh_states[0][r]);
+  Matrix periodicity(n, std::vector<double>(n));
+  std::vector<double> periodicity_rhs(n);
+  for(unsigned int r = 0; r < n; r++){
+    for(unsigned int k = 0; k < n; k++)
+      periodicity[r][k] = (r == k ? 1 : 0) - monodromy[r][k]*scale[k]/scale[r];
+    periodicity_rhs[r] = offset[r]/scale[r];
+  }
+  const std::vector<double> scaled_correction = SolveKeepingConservedQuantities(periodicity, periodicity_rhs);
+
+  /*Apply the corrections interval by interval*/
+  std::vector<double> correction(n);
+  for(unsigned int r = 0; r < n; r++)
+    correction[r] = scaled_correction[r]*scale[r];
+  r_step_size = 0;
+  for(unsigned int i = 0; i < intervals; i++){
+    for(unsigned int row = 0; row < m; row++){
+      double stage_correction = stage_maps[i][row][n];
+      for(unsigned int k = 0; k < n; k++)
+        stage_correction += stage_maps[i][row][k]*correction[k];
+      stage_derivatives[i][row] += stage_correction;
+    }
+    std::vector<double> next_correction = Multiply(transfers[i], correction);
+    for(unsigned int r = 0; r < n; r++){
+      next_correction[r] += transfer_offsets[i][r];
+      r_step_size = std::max(r_step_size, std::abs(correction[r])/(1 + std::abs(mesh_states[i][r])));
+      mesh_states[i][r] += correction[r];
+    }
+    correction = next_correction;
+  }
+  return residual;
+}
+
+bool PeriodicOrbitSolver::Newton(){
+  TRACE_SCOPE("PeriodicOrbitSolver::Newton");
+  for(unsigned int iteration = 0; iteration < max_newton_iterations; iteration++){
+    double step_size;
+    const double residual = NewtonStep(step_size);
+    newton_iterations++;
+    if(!std::isfinite(residual) || !std::isfinite(step_size))
+      return false;
+    /*Converged, or as close as the damped slow modes let it get*/
+    if(residual < tolerance || step_size < tolerance)
+      return true;
+  }
+  return false;
+}
+
+bool PeriodicOrbitSolver::RefineMesh(){
+  TRACE_SCOPE("PeriodicOrbitSolver::RefineMesh");
+  const unsigned int intervals = mesh.size() - 1;
+  const unsigned int n = number_of_variables;
+  std::vector<double> new_mesh = {0};
+  std::vector<std::vector<double>> new_mesh_states, new_stage_derivatives;
+  std::vector<double> f(n);
+  bool refined = false;
+  for(unsigned int i = 0; i < intervals; i++){
+    const double h = mesh[i + 1] - mesh[i];
+    /*How far the collocation polynomial is from solving the equations between
+      the collocation points, times the interval length*/
+    double defect = 0;
+    for(double theta : {0.25, 0.75}){
+      const std::vector<double> basis = GetBasis(theta);
+      const std::vector<double> u = GetState(i, theta);
+      EvaluateDerivatives(mesh[i] + theta*h, u, f);
+      for(unsigned int r = 0; r < n; r++){
+        double derivative = 0;
+        for(unsigned int l = 0; l < number_of_stages; l++)
+          derivative += basis[l]*stage_derivatives[i][l*n + r];
+        defect = std::max(defect, h*std::abs(derivative - f[r])/(1 + std::abs(u[r])));
+      }
+    }
+    if(defect <= mesh_tolerance || h < 2e-8){
+      new_mesh_states.push_back(mesh_states[i]);
+      new_stage_derivatives.push_back(stage_derivatives[i]);
+      new_mesh.push_back(mesh[i + 1]);
+      continue;
+    }
+    /*Halve it, starting each half from the polynomial*/
+    refined = true;
+    for(double start : {0.0, 0.5}){
+      new_mesh_states.push_back(GetState(i, start));
+      std::vector<double> stages(number_of_stages*n, 0);
+      for(unsigned int j = 0; j < number_of_stages; j++){
+        const std::vector<double> basis = GetBasis(start + 0.5*collocation_points[j]);
+        for(unsigned int l = 0; l < number_of_stages; l++)
+          for(unsigned int r = 0; r < n; r++)
+            stages[j*n + r] += basis[l]*stage_derivatives[i][l*n + r];
+      }
+      new_stage_derivatives.push_back(stages);
+      new_mesh.push_back(mesh[i] + (start + 0.5)*h);
+    }
+  }
+  mesh = new_mesh;
+  mesh_states = new_mesh_states;
+  stage_derivatives = new_stage_derivatives;
+  return refined;
+}
+
+void PeriodicOrbitSolver::Solve(){
+  TRACE_SCOPE("PeriodicOrbitSolver::Solve");
+  while(true){
+    if(!Newton())
+      EXCEPTION("Newton's method didn't converge on the periodic orbit, with " + std::to_string(mesh.size() - 1) + " mesh intervals");
+    if(!RefineMesh())
+      break;
+    if(refinements == max_refinements)
+      EXCEPTION("The periodic orbit's mesh still wasn't within the mesh tolerance after " + std::to_string(max_refinements)
+                + " refinements, with " + std::to_string(mesh.size() - 1) + " mesh intervals");
+    refinements++;
+  }
+  p_model->SetStateVariables(mesh_states[0]);
+}
+
+std::vector<double> PeriodicOrbitSolver::GetStateVariables() const{
+  return mesh_states[0];
+}
+
+std::vector<double> PeriodicOrbitSolver::GetStateVariables(double time) const{
+  unsigned int interval = std::upper_bound(mesh.begin(), mesh.end(), time) - mesh.begin();
+  interval = std::min(std::max(interval, 1u), (unsigned int)mesh.size() - 1) - 1;
+  return GetState(interval, (time - mesh[interval])/(mesh[interval + 1] - mesh[interval]));
+}
+
+std::vector<std::vector<double>> PeriodicOrbitSolver::GetTrace(std::vector<double>& r_times, double sampling_timestep) const{
+  r_times.clear();
+  std::vector<std::vector<double>> trace;
+  const unsigned int samples = (unsigned int)(period/sampling_timestep + 1e-9);
+  for(unsigned int i = 0; i <= samples; i++){
+    r_times.push_back(i*sampling_timestep);
+    trace.push_back(GetStateVariables(r_times.back()));
+  }
+  return trace;
+}
@@ -0,0 +1,120 @@
+#ifndef PERIODICORBITSOLVER_HPP
+#define PERIODICORBITSOLVER_HPP
+
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <nvector/nvector_serial.h>
+
+/* Finds the periodic steady state directly, as a boundary value problem over
+   one pace, rather than by pacing until it stops changing.
+
+   The pace is split into mesh intervals, with the end of the stimulus always a
+   mesh point so the right hand side is smooth inside every interval. On each
+   interval the solution is a polynomial collocated at the three Gauss-Legendre
+   points (sixth order at the mesh points), and the state at the end of the pace
+   has to equal the state at the start. That's one nonlinear system for every
+   mesh state and stage derivative at once, solved by Newton's method. The
+   Jacobian is block structured (each interval only couples to its neighbours,
+   plus the periodic wrap-around), so each Newton step eliminates the stages
+   interval by interval, leaving one small system for the state at the start of
+   the pace, and never forms the whole matrix.
+
+   The initial guess and mesh come from a few paces solved by CVODE: the mesh
+   points are every other one of CVODE's steps in the last pace, so they're
+   already fine around the upstroke. Once Newton has converged, intervals whose
+   collocation polynomial doesn't satisfy the equations well enough between the
+   collocation points are halved and Newton is run again.
+
+   When a model conserves some combination of its variables the periodic states
+   form a family. Newton then stays as close as it can to the paced beats' value
+   of the conserved quantity, which is the one pacing would have kept. */
+
+class PeriodicOrbitSolver{
+private:
+  boost::shared_ptr<AbstractCvodeCell> p_model;
+  boost::shared_ptr<RegularStimulus> p_stimulus;
+  double period;
+  double duration;
+  unsigned int number_of_variables;
+  double tolerance;
+  double mesh_tolerance;
+  unsigned int max_newton_iterations = 50;
+  unsigned int max_refinements = 6;
+
+  /*mesh.size() - 1 intervals, from 0 to period*/
+  std::vector<double> mesh;
+  /*The state at the start of each interval (the end of the last one wraps round to the first)*/
+  std::vector<std::vector<double>> mesh_states;
+  /*The derivatives at the three collocation points of each interval, one after another*/
+  std::vector<std::vector<double>> stage_derivatives;
+
+  N_Vector state;
+  N_Vector derivatives;
+  N_Vector perturbed_derivatives;
+  unsigned long rhs_evaluations = 0;
+  unsigned long initial_rhs_evaluations = 0;
+  unsigned int newton_iterations = 0;
+  unsigned int refinements = 0;
+
+  void EvaluateDerivatives(double time, const std::vector<double>& r_state, std::vector<double>& r_derivatives);
+  void EvaluateJacobian(double time, const std::vector<double>& r_state, std::vector<std::vector<double>>& r_jacobian);
+  std::vector<double> GetStageState(unsigned int interval, unsigned int stage) const;
+  std::vector<double> GetState(unsigned int interval, double theta) const;
+  bool Newton();
+  double NewtonStep(double& r_step_size);
+  bool RefineMesh();
+public:
+  /**Set up from the model's current state, pacing it initial_paces times with
+     CVODE for the mesh and the initial guess. tolerance is for Newton, on the
+     residuals scaled like mrms (divided by 1 + |x|); mesh_tolerance is for the
+     collocation error on each interval, in the same scale.*/
+  PeriodicOrbitSolver(boost::shared_ptr<AbstractCvodeCell> _p_model, double _period, unsigned int initial_paces = 5,
+                      double _tolerance = 1e-10, double _mesh_tolerance = 1e-7);
+  ~PeriodicOrbitSolver();
+
+  /**Find the periodic steady state, refining the mesh until it's within the
+     mesh tolerance, and leave the model at it. Throws if Newton diverges, or if
+     the mesh still needs refining after max_refinements refinements (the model
+     is left as it was).*/
+  void Solve();
+
+  /**The state at the start (and end) of the periodic pace, like Simulation::GetStateVariables at steady state*/
+  std::vector<double> GetStateVariables() const;
+
+  /**The periodic pace sampled every sampling_timestep from 0 to period, one
+     row per time, like OdeSolution::rGetSolutions(). The times are put in
+     r_times.*/
+  std::vector<std::vector<double>> GetTrace(std::vector<double>& r_times, double sampling_timestep = 1) const;
+
+  /**The state at any time in the pace, from the collocation polynomials*/
+  std::vector<double> GetStateVariables(double time) const;
+
+  const std::vector<double>& rGetMesh() const{
+    return mesh;
+  }
+  unsigned int GetNumberOfMeshIntervals() const{
+    return mesh.size() - 1;
+  }
+  unsigned int GetNumberOfNewtonIterations() const{
+    return newton_iterations;
+  }
+  unsigned int GetNumberOfRefinements() const{
+    return refinements;
+  }
+  /**Right hand side evaluations, not counting the initial paces*/
+  unsigned long GetNumberOfRhsEvaluations() const{
+    return rhs_evaluations;
+  }
+  /**CVODE's right hand side evaluations for the initial paces*/
+  unsigned long GetNumberOfInitialRhsEvaluations() const{
+    return initial_rhs_evaluations;
+  }
+  /**Refine the mesh at most this many times before giving up (6 by default)*/
+  void SetMaxRefinements(unsigned int _max_refinements){
+    max_refinements = _max_refinements;
+  }
+};
+
+#endif
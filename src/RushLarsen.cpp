@@ -0,0 +1,146 @@
+#include "RushLarsen.hpp"
+#include "Tracing.hpp"
+#include "Exception.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+double GetGatePerturbation(double value){
+  return 1e-3*std::max(std::abs(value), 1e-3);
+}
+
+std::vector<unsigned int> FindGates(boost::shared_ptr<AbstractCvodeCell> p_model, std::vector<double>& r_jacobian_diagonal){
+  TRACE_SCOPE("FindGates");
+  const unsigned int number_of_variables = p_model->GetNumberOfStateVariables();
+  N_Vector& r_state = p_model->rGetStateVariables();
+  N_Vector derivatives = N_VNew_Serial(number_of_variables);
+  N_Vector perturbed_state = N_VNew_Serial(number_of_variables);
+  N_Vector perturbed_derivatives = N_VNew_Serial(number_of_variables);
+  const double* p_state = NV_DATA_S(r_state);
+  const double* p_derivatives = NV_DATA_S(derivatives);
+  double* p_perturbed_state = NV_DATA_S(perturbed_state);
+  const double* p_perturbed_derivatives = NV_DATA_S(perturbed_derivatives);
+  const unsigned int voltage_index = p_model->GetVoltageIndex();
+  const double epsilon = std::numeric_limits<double>::epsilon();
+
+  p_model->EvaluateYDerivatives(0, r_state, derivatives);
+
+  /*depends[i][j] when the derivative of variable i changes with variable j. The
+    generated code only touches the variables it uses, so a derivative that
+    doesn't depend on a variable comes out bit for bit the same.*/
+  std::vector<std::vector<bool>> depends(number_of_variables, std::vector<bool>(number_of_variables, false));
+  std::vector<bool> is_gate(number_of_variables, false);
+  r_jacobian_diagonal.resize(number_of_variables);
+  for(unsigned int j = 0; j < number_of_variables; j++){
+    const double perturbation = GetGatePerturbation(p_state[j]);
+    std::copy(p_state, p_state + number_of_variables, p_perturbed_state);
+    p_perturbed_state[j] += perturbation;
+    p_model->EvaluateYDerivatives(0, perturbed_state, perturbed_derivatives);
+    for(unsigned int i = 0; i < number_of_variables; i++)
+      depends[i][j] = p_perturbed_derivatives[i] != p_derivatives[i];
+    const double change = p_perturbed_derivatives[j] - p_derivatives[j];
+    r_jacobian_diagonal[j] = change/perturbation;
+
+    /*Twice as far should change the derivative twice as much*/
+    p_perturbed_state[j] = p_state[j] + 2*perturbation;
+    p_model->EvaluateYDerivatives(0, perturbed_state, perturbed_derivatives);
+    const double double_change = p_perturbed_derivatives[j] - p_derivatives[j];
+    const double tolerance = 1e-6*std::abs(double_change) + 64*epsilon*(std::abs(p_derivatives[j]) + std::abs(p_perturbed_derivatives[j]));
+    is_gate[j] = j != voltage_index && change < 0 && std::abs(double_change - 2*change) <= tolerance;
+  }
+  N_VDestroy_Serial(derivatives);
+  N_VDestroy_Serial(perturbed_state);
+  N_VDestroy_Serial(perturbed_derivatives);
+
+  /*Drop any gate whose derivative depends on another gate, until none do*/
+  bool dropped = true;
+  while(dropped){
+    dropped = false;
+    for(unsigned int i = 0; i < number_of_variables; i++){
+      if(!is_gate[i])
+        continue;
+      for(unsigned int j = 0; j < number_of_variables; j++){
+        if(j != i && is_gate[j] && depends[i][j]){
+          is_gate[i] = false;
+          dropped = true;
+          break;
+        }
+      }
+    }
+  }
+
+  std::vector<unsigned int> gate_indices;
+  for(unsigned int i = 0; i < number_of_variables; i++)
+    if(is_gate[i])
+      gate_indices.push_back(i);
+  return gate_indices;
+}
+
+std::vector<unsigned int> FindGates(boost::shared_ptr<AbstractCvodeCell> p_model){
+  std::vector<double> jacobian_diagonal;
+  return FindGates(p_model, jacobian_diagonal);
+}
+
+RushLarsenSolver::RushLarsenSolver(boost::shared_ptr<AbstractCvodeCell> _p_model, double _timestep) : AbstractApproachSolver(_p_model), timestep(_timestep){
+  if(!(timestep > 0))
+    EXCEPTION("The Rush-Larsen timestep has to be positive");
+  number_of_variables = p_model->GetNumberOfStateVariables();
+  derivatives = N_VNew_Serial(number_of_variables);
+  perturbed_state = N_VNew_Serial(number_of_variables);
+  perturbed_derivatives = N_VNew_Serial(number_of_variables);
+  gate_indices = FindGates(p_model);
+  rhs_evaluations += 2*number_of_variables + 1;
+  for(unsigned int i = 0; i < number_of_variables; i++)
+    if(std::find(gate_indices.begin(), gate_indices.end(), i) == gate_indices.end())
+      other_indices.push_back(i);
+}
+
+RushLarsenSolver::~RushLarsenSolver(){
+  N_VDestroy_Serial(derivatives);
+  N_VDestroy_Serial(perturbed_state);
+  N_VDestroy_Serial(perturbed_derivatives);
+}
+
+boost::shared_ptr<AbstractApproachSolver> RushLarsenSolver::Clone(boost::shared_ptr<AbstractCvodeCell> p_other_model) const{
+  return boost::shared_ptr<AbstractApproachSolver>(new RushLarsenSolver(p_other_model, timestep));
+}
+
+void RushLarsenSolver::Step(double time, double step_size){
+  N_Vector& r_state = p_model->rGetStateVariables();
+  double* p_state = NV_DATA_S(r_state);
+  const double* p_derivatives = NV_DATA_S(derivatives);
+  EvaluateDerivatives(time, r_state, derivatives);
+
+  if(!gate_indices.empty()){
+    /*Every gate's slope from one evaluation, as no gate depends on another*/
+    double* p_perturbed_state = NV_DATA_S(perturbed_state);
+    const double* p_perturbed_derivatives = NV_DATA_S(perturbed_derivatives);
+    std::copy(p_state, p_state + number_of_variables, p_perturbed_state);
+    for(auto i = gate_indices.begin(); i != gate_indices.end(); i++)
+      p_perturbed_state[*i] += GetGatePerturbation(p_state[*i]);
+    EvaluateDerivatives(time, perturbed_state, perturbed_derivatives);
+    for(auto i = gate_indices.begin(); i != gate_indices.end(); i++){
+      const double slope = (p_perturbed_derivatives[*i] - p_derivatives[*i])/(p_perturbed_state[*i] - p_state[*i]);
+      if(slope < 0)
+        p_state[*i] += p_derivatives[*i]*std::expm1(slope*step_size)/slope;
+      else
+        p_state[*i] += step_size*p_derivatives[*i];
+    }
+  }
+
+  for(auto i = other_indices.begin(); i != other_indices.end(); i++)
+    p_state[*i] += step_size*p_derivatives[*i];
+  steps++;
+  last_step_size = step_size;
+}
+
+void RushLarsenSolver::Solve(double start_time, double end_time){
+  TRACE_SCOPE("RushLarsenSolver::Solve");
+  if(end_time <= start_time)
+    return;
+  const unsigned int number_of_steps = std::max(1u, (unsigned int)std::ceil((end_time - start_time)/timestep - 1e-10));
+  const double step_size = (end_time - start_time)/number_of_steps;
+  for(unsigned int k = 0; k < number_of_steps; k++)
+    Step(start_time + k*step_size, step_size);
+}
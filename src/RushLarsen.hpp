@@ -0,0 +1,69 @@
+#ifndef RUSHLARSEN_HPP
+#define RUSHLARSEN_HPP
+
+#include "AbstractApproachSolver.hpp"
+#include <vector>
+
+/* A fixed-step Rush-Larsen solver for the generated CVODE models.
+
+   Gating variables follow dy/dt = a(V,...)*y + b(V,...), so over a short step
+   with everything else held fixed they relax exponentially and can be stepped
+   exactly, at any step size, with y + f*(exp(a*dt) - 1)/a. Every other variable
+   (the voltage, concentrations) takes a forward Euler step.
+
+   The models only give us their right hand side, so the gates are found
+   numerically (see FindGates) and every gate's slope a is found from one extra
+   right hand side evaluation with all the gates perturbed at once, so a step
+   costs two evaluations.
+
+   Steps are first order accurate and forward Euler limits the step size (about
+   0.01 ms for the models here), so this is meant for getting close to the limit
+   cycle, not for the steady state itself (see Simulation::SetRushLarsenApproach).
+   At that step a pace costs far more right hand side evaluations than CVODE
+   needs for one, so it only pays when CVODE's own steps are expensive (a large
+   Newton system) or it struggles far from the limit cycle. */
+
+/**The state variables that can be stepped as gates, at the model's current
+   state: those whose derivative is affine in the variable itself with a negative
+   slope, that aren't the voltage, and whose derivative doesn't depend on any
+   other gate. The last condition is what lets every gate's slope come from one
+   evaluation. r_jacobian_diagonal is set to df_i/dy_i for every variable.*/
+std::vector<unsigned int> FindGates(boost::shared_ptr<AbstractCvodeCell> p_model, std::vector<double>& r_jacobian_diagonal);
+
+std::vector<unsigned int> FindGates(boost::shared_ptr<AbstractCvodeCell> p_model);
+
+/**The perturbation used to find the slope of a gate's derivative at value*/
+double GetGatePerturbation(double value);
+
+class RushLarsenSolver : public AbstractApproachSolver{
+private:
+  double timestep;
+  unsigned int number_of_variables;
+  std::vector<unsigned int> gate_indices;
+  std::vector<unsigned int> other_indices;
+  N_Vector derivatives;
+  N_Vector perturbed_state;
+  N_Vector perturbed_derivatives;
+
+  void Step(double time, double step_size);
+public:
+  RushLarsenSolver(boost::shared_ptr<AbstractCvodeCell> _p_model, double _timestep = 0.01);
+  ~RushLarsenSolver();
+  RushLarsenSolver(const RushLarsenSolver&) = delete;
+  RushLarsenSolver& operator=(const RushLarsenSolver&) = delete;
+
+  /**Advance the model's state from start_time to end_time, in equal steps no longer than the timestep*/
+  void Solve(double start_time, double end_time);
+
+  boost::shared_ptr<AbstractApproachSolver> Clone(boost::shared_ptr<AbstractCvodeCell> p_other_model) const;
+
+  double GetTimestep() const{
+    return timestep;
+  }
+  /**The state variables stepped exponentially*/
+  const std::vector<unsigned int>& rGetGateIndices() const{
+    return gate_indices;
+  }
+};
+
+#endif
@@ -10,12 +10,46 @@
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <functional>
+#include <thread>
+#include <exception>
+#include <algorithm>
 
 #include "beeler_reuter_model_1977Cvode.hpp"
 #include "ten_tusscher_model_2004_epiCvode.hpp"
 #include "ohara_rudy_2011_endoCvode.hpp"
 #include "shannon_wang_puglisi_weber_bers_2004Cvode.hpp"
 #include "SimulationTools.hpp"
+#include "Tracing.hpp"
+#include "DiagnosticsSink.hpp"
+#include "TraceFile.hpp"
+#include "DenseTrace.hpp"
+#include "RushLarsen.hpp"
+#include "MultirateSolver.hpp"
+#include "DecayRateLibrary.hpp"
+
+/** How pacing ended, if it has (see Simulation::SetOrbitDetection) */
+enum class PacingOutcome{
+  Running,
+  /*Period-1 steady state*/
+  Converged,
+  /*Period-k orbit, k > 1 (alternans for k = 2)*/
+  PeriodicOrbit,
+  /*The state blew up, or the changes between paces kept growing*/
+  Diverged,
+  /*The changes between paces stopped shrinking without settling into an orbit*/
+  Irregular
+};
+
+/** How many more paces a simulation needs for the mrms between paces to fall
+    below the convergence threshold, if it carries on decaying as it has
+    lately, with a rough 95% band. NaN while there isn't enough history yet, and
+    infinite when the mrms isn't decaying. */
+struct PaceEstimate{
+  double remaining = NAN;
+  double lower = NAN;
+  double upper = NAN;
+};
 
 class Simulation
 {
@@ -25,15 +59,210 @@ protected:
   boost::shared_ptr<AbstractCvodeCell> p_model;
   unsigned int number_of_state_variables;
   std::vector<double> state_variables;
-  std::ofstream output_file;
   double period = 1000;
   // double TolAbs = 1e-8, TolRel = 1e-8;
   double TolAbs;
   double TolRel;
   double sampling_timestep = 1;
   double current_mrms = NAN;
-  const double threshold = 1.8e-07;
+  static constexpr double threshold = 1.8e-07;
   boost::shared_ptr<RegularStimulus> p_stimulus;
+  CvodeStatistics cvode_statistics;
+  PaceCvodeStatistics last_pace_statistics;
+  boost::circular_buffer<PaceCvodeStatistics> pace_statistics_history;
+  unsigned int paces_solved = 0;
+  bool trace_norm = false;
+  DenseTrace current_trace;
+  DenseTrace previous_trace;
+  double current_trace_mrms = NAN;
+  std::vector<boost::shared_ptr<AbstractStepObserver>> step_observers;
+  std::function<boost::shared_ptr<AbstractCvodeCell>()> model_factory;
+  unsigned int max_orbit_period = 0;
+  unsigned int stall_window = 0;
+  boost::circular_buffer<std::vector<double>> orbit_states;
+  unsigned int orbit_period = 0;
+  PacingOutcome outcome = PacingOutcome::Running;
+  double window_best_mrms = INFINITY;
+  double previous_window_best_mrms = INFINITY;
+  unsigned int window_paces = 0;
+  boost::shared_ptr<AbstractApproachSolver> p_approach_solver;
+  double approach_handoff = 0;
+  unsigned int approach_paces = 0;
+  unsigned int rush_larsen_paces = 0;
+  CvodeStatistics approach_statistics_at_pace_start;
+  boost::shared_ptr<TraceWriter> p_pace_recording;
+  boost::circular_buffer<double> mrms_history = boost::circular_buffer<double>(50);
+
+  /*CVODE is re-initialised at the start of every pace (t=0 never matches the
+    last stopping time) and carries straight on after the stimulus, so its
+    counters cover exactly the part of the pace solved so far. CVODE doesn't
+    run on an approach pace and its counters are left over from before, so
+    those paces count the approach solver's work instead, from where its
+    running totals stood at the end of the last pace.*/
+  CvodeStatistics GetPaceSolverStatistics(){
+    if(p_approach_solver)
+      return p_approach_solver->GetStatistics() - approach_statistics_at_pace_start;
+    return ::GetCvodeStatistics(p_model);
+  }
+  void RecordStimulusCvodeStatistics(){
+    last_pace_statistics.during_stimulus = GetPaceSolverStatistics();
+  }
+  void RecordCvodeStatistics(){
+    last_pace_statistics.pace = paces_solved++;
+    last_pace_statistics.after_stimulus = GetPaceSolverStatistics() - last_pace_statistics.during_stimulus;
+    cvode_statistics += last_pace_statistics.GetTotal();
+    if(pace_statistics_history.capacity() > 0)
+      pace_statistics_history.push_back(last_pace_statistics);
+    if(p_approach_solver)
+      approach_statistics_at_pace_start = p_approach_solver->GetStatistics();
+  }
+
+  /*Solve part of a pace, showing it to the step observers and recording CVODE's
+    steps when the trace norm is on. The pace's trace starts again at t=0.*/
+  void SolvePart(double start_time, double end_time){
+    if(p_approach_solver){
+      /*No CVODE steps to show anyone, and an empty trace, so the trace norm is
+        NaN until CVODE has solved two paces*/
+      if(start_time == 0)
+        current_trace.Clear();
+      p_approach_solver->Solve(start_time, end_time);
+      return;
+    }
+    if(!trace_norm && step_observers.empty()){
+      p_model->SolveAndUpdateState(start_time, end_time);
+      return;
+    }
+    std::vector<boost::shared_ptr<AbstractStepObserver>> observers = step_observers;
+    if(trace_norm){
+      if(start_time == 0)
+        current_trace.Clear();
+      observers.push_back(boost::shared_ptr<AbstractStepObserver>(new DenseTraceRecorder(current_trace)));
+    }
+    SolveAndObserve(p_model, start_time, end_time, observers);
+  }
+  /*Give a copy of this simulation its own model and stimulus, set up the same
+    way, so it can be paced (on another thread) without touching the original.
+    Observers belong to the original and aren't copied.*/
+  void CloneModel(){
+    boost::shared_ptr<AbstractCvodeCell> p_clone = model_factory ? model_factory() : CreateCvodeCell(p_model->GetSystemInformation()->GetSystemName());
+    for(unsigned int i = 0; i < p_model->GetNumberOfParameters(); i++)
+      p_clone->SetParameter(i, p_model->GetParameter(i));
+    p_clone->SetMaxSteps(p_model->GetMaxSteps());
+    p_clone->SetMaxTimestep(p_model->GetTimestep());
+    p_clone->SetTolerances(p_model->GetRelativeTolerance(), p_model->GetAbsoluteTolerance());
+    p_clone->SetMinimalReset(p_model->GetMinimalReset());
+    p_clone->SetStateVariables(p_model->GetStdVecStateVariables());
+
+    boost::shared_ptr<RegularStimulus> p_clone_stimulus = p_clone->UseCellMLDefaultStimulus();
+    p_clone_stimulus->SetMagnitude(p_stimulus->GetMagnitude());
+    p_clone_stimulus->SetDuration(p_stimulus->GetDuration());
+    p_clone_stimulus->SetStartTime(p_stimulus->GetStartTime());
+    p_clone_stimulus->SetPeriod(p_stimulus->GetPeriod());
+
+    p_model = p_clone;
+    p_stimulus = p_clone_stimulus;
+    step_observers.clear();
+    if(p_approach_solver){
+      p_approach_solver = p_approach_solver->Clone(p_model);
+      approach_statistics_at_pace_start = CvodeStatistics();
+    }
+  }
+  /*Compare the pace just solved with the one before, then keep it for the next
+    comparison. Swapping keeps both traces' storage, so this doesn't allocate once
+    the paces settle down.*/
+  void UpdateTraceNorm(){
+    if(!trace_norm)
+      return;
+    if(previous_trace.GetNumberOfSteps() > 0 && current_trace.GetNumberOfSteps() > 0)
+      current_trace_mrms = CalculateTraceMrms(previous_trace, current_trace);
+    std::swap(previous_trace, current_trace);
+  }
+  /*After a pace, whether it finished the simulation: at the steady state, or
+    with orbit detection on, in a period-k orbit. Orbit detection also gives up
+    early on paces that blow up or stop improving, which finishes the simulation
+    without reaching a steady state.*/
+  bool CheckConvergence(){
+    if(std::isfinite(current_mrms) && current_mrms > 0)
+      mrms_history.push_back(current_mrms);
+    if(current_mrms < threshold){
+      finished = true;
+      outcome = PacingOutcome::Converged;
+      orbit_period = 1;
+      return true;
+    }
+    if(max_orbit_period == 0)
+      return false;
+
+    /*Keep the states at the start of the last max_orbit_period + 1 paces, reusing the oldest's storage*/
+    std::vector<double> state;
+    if(orbit_states.full()){
+      state = std::move(orbit_states.front());
+      orbit_states.pop_front();
+    }
+    const double* p_state = NV_DATA_S(p_model->rGetStateVariables());
+    state.assign(p_state, p_state + number_of_state_variables);
+    orbit_states.push_back(std::move(state));
+    const std::vector<double>& r_latest = orbit_states.back();
+    const unsigned int latest = orbit_states.size() - 1;
+
+    if(!std::all_of(r_latest.begin(), r_latest.end(), [](double x){return std::isfinite(x);})){
+      finished = true;
+      outcome = PacingOutcome::Diverged;
+      return false;
+    }
+
+    double best_mrms = current_mrms;
+    for(unsigned int k = 2; k <= max_orbit_period && k <= latest; k++){
+      const double distance = mrms(orbit_states[latest - k], r_latest);
+      best_mrms = std::min(best_mrms, distance);
+      if(distance >= threshold)
+        continue;
+      /*A damped oscillation passes close to where it was k paces ago too, so
+        every shorter period that divides k has to be well clear of the threshold*/
+      bool shorter_period = false;
+      for(unsigned int j = 1; j < k; j++)
+        if(k % j == 0 && mrms(orbit_states[latest - j], r_latest) < 100*threshold)
+          shorter_period = true;
+      if(!shorter_period){
+        finished = true;
+        outcome = PacingOutcome::PeriodicOrbit;
+        orbit_period = k;
+        return true;
+      }
+    }
+
+    if(stall_window > 0){
+      window_best_mrms = std::min(window_best_mrms, best_mrms);
+      if(++window_paces == stall_window){
+        if(window_best_mrms > 10*previous_window_best_mrms){
+          finished = true;
+          outcome = PacingOutcome::Diverged;
+        }
+        else if(!(window_best_mrms < 0.5*previous_window_best_mrms) && std::isfinite(previous_window_best_mrms)){
+          finished = true;
+          outcome = PacingOutcome::Irregular;
+        }
+        previous_window_best_mrms = window_best_mrms;
+        window_best_mrms = INFINITY;
+        window_paces = 0;
+      }
+    }
+    return false;
+  }
+  /*Whether the pace just solved was an approach solver's, which can't finish the
+    simulation. CVODE takes over from the next pace once they've settled.*/
+  bool ApproachPace(){
+    if(!p_approach_solver)
+      return false;
+    approach_paces++;
+    if(IsUsingRushLarsen())
+      rush_larsen_paces++;
+    if(current_mrms < approach_handoff){
+      p_approach_solver.reset();
+      p_model->ResetSolver();
+    }
+    return true;
+  }
 public:
   Simulation(){
     return;
@@ -55,23 +284,27 @@ public:
   }
 
   bool RunPace(){
+    TRACE_SCOPE("Simulation::RunPace");
     if(finished)
       return false;
     /*Solve in two parts*/
     std::vector<double> tmp_state_variables = p_model->GetStdVecStateVariables();
-    p_model->SolveAndUpdateState(0, p_stimulus->GetDuration());
+    SolvePart(0, p_stimulus->GetDuration());
+    RecordStimulusCvodeStatistics();
     p_stimulus->SetPeriod(period*2);
-    p_model->SolveAndUpdateState(p_stimulus->GetDuration(), period);
+    SolvePart(p_stimulus->GetDuration(), period);
     p_stimulus->SetPeriod(period);
+    RecordCvodeStatistics();
+    UpdateTraceNorm();
     std::vector<double> new_state_variables = p_model->GetStdVecStateVariables();
     current_mrms = mrms(tmp_state_variables, new_state_variables);
     p_model->SetStateVariables(new_state_variables);
+    if(p_pace_recording)
+      p_pace_recording->AddRow(paces_solved, new_state_variables);
     // p_model->SetVoltage(p_model->CalculateAnalyticVoltage());
-    if(current_mrms < threshold){
-      finished = true;
-      return true;
-    }
-    return false;
+    if(ApproachPace())
+      return false;
+    return CheckConvergence();
   }
 
   /**Output a pace to file*/
@@ -83,6 +316,17 @@ public:
     return;
   }
 
+  /**Output a pace to a compressed binary trace file (see TraceFile.hpp)*/
+  void WriteToTraceFile(std::string file_path, double sampling_timestep = 1){
+    boost::shared_ptr<TraceFileObserver> p_writer(new TraceFileObserver(file_path, p_model->rGetStateVariableNames(), sampling_timestep));
+    const std::vector<boost::shared_ptr<AbstractStepObserver>> observers = {p_writer};
+    /*Samples come from CVODE's interpolant, so the solver doesn't stop at each one*/
+    SolveAndObserve(p_model, 0, p_stimulus->GetDuration(), observers);
+    SolveAndObserve(p_model, p_stimulus->GetDuration(), period, observers);
+    p_writer->Close();
+    return;
+  }
+
   double GetMrms(){
     if(finished)
       return NAN;
@@ -92,9 +336,264 @@ public:
   bool is_finished(){
     return finished;
   }
+  /**Record each pace's CVODE steps and compare whole traces from pace to pace
+     (see GetTraceMrms). Costs no extra solves, only memory for two paces of steps.*/
+  void SetTraceNorm(bool _trace_norm){
+    trace_norm = _trace_norm;
+    current_trace = DenseTrace(number_of_state_variables);
+    previous_trace = DenseTrace(number_of_state_variables);
+    current_trace_mrms = NAN;
+  }
+  /**How to make another instance of this simulation's model for Fork(). Models
+     compiled into the project are found by name without one.*/
+  void SetModelFactory(std::function<boost::shared_ptr<AbstractCvodeCell>()> _model_factory){
+    model_factory = _model_factory;
+  }
+  /**An independent copy of this simulation, with its own model in the same state*/
+  Simulation Fork() const{
+    Simulation fork(*this);
+    fork.CloneModel();
+    /*Only the original carries on recording*/
+    fork.p_pace_recording.reset();
+    return fork;
+  }
+  /**Show every step of every pace from now on to p_observer, alongside any other
+     observers. Times run from 0 to the period in every pace.*/
+  void AddStepObserver(boost::shared_ptr<AbstractStepObserver> p_observer){
+    step_observers.push_back(p_observer);
+  }
+  void ClearStepObservers(){
+    step_observers.clear();
+  }
+  /**Also stop at a period-k orbit for k up to max_period (comparing the state
+     with the one k paces before), or when the state stops being finite. With a
+     stall_window, also give up once the smallest change over a window of that
+     many paces hasn't halved since the window before (Irregular), or has grown
+     tenfold (Diverged); it wants to be long enough for the slowest convergence
+     expected, a few hundred paces. See GetOutcome.*/
+  void SetOrbitDetection(unsigned int max_period, unsigned int _stall_window = 0){
+    max_orbit_period = max_period;
+    stall_window = _stall_window;
+    orbit_states.set_capacity(max_period + 1);
+    orbit_states.clear();
+    window_best_mrms = previous_window_best_mrms = INFINITY;
+    window_paces = 0;
+  }
+  PacingOutcome GetOutcome(){
+    return outcome;
+  }
+  /**The period of the orbit found, in paces: 1 at a steady state, 0 before one is found*/
+  unsigned int GetOrbitPeriod(){
+    return orbit_period;
+  }
+  /**Biomarkers for each beat of the orbit found, in the order they were paced*/
+  std::vector<BeatBiomarkers> GetOrbitBiomarkers(double percentage = 90){
+    if(orbit_period == 0)
+      EXCEPTION("No orbit has been found");
+    std::vector<BeatBiomarkers> biomarkers;
+    if(orbit_period == 1){
+      biomarkers.push_back(CalculateBiomarkers(p_model, period, p_stimulus->GetDuration(), percentage));
+      return biomarkers;
+    }
+    const std::vector<double> current_state = GetStateVariables();
+    for(unsigned int i = orbit_period; i > 0; i--){
+      p_model->SetStateVariables(orbit_states[orbit_states.size() - i]);
+      biomarkers.push_back(CalculateBiomarkers(p_model, period, p_stimulus->GetDuration(), percentage));
+    }
+    p_model->SetStateVariables(current_state);
+    return biomarkers;
+  }
+  /**Solve paces with p_solver until the mrms between paces falls below
+     handoff_mrms, then carry on with CVODE. The approach solver's limit cycle is
+     a little off CVODE's, so the handoff level wants to be well above the steady
+     state threshold (1e-4 or so).
+
+     The approach solver's steps and right hand side evaluations (including
+     setting it up) count towards the CVODE statistics of the paces it solves.
+     It has no CVODE steps to show, so the step observers see nothing of those
+     paces and the trace norm stays NaN until CVODE has solved two.*/
+  void SetApproachSolver(boost::shared_ptr<AbstractApproachSolver> p_solver, double handoff_mrms){
+    p_approach_solver = p_solver;
+    approach_handoff = handoff_mrms;
+    approach_statistics_at_pace_start = CvodeStatistics();
+  }
+  /**SetApproachSolver with a fixed-step Rush-Larsen solver (see RushLarsen.hpp)*/
+  void SetRushLarsenApproach(double handoff_mrms, double timestep = 0.01){
+    SetApproachSolver(boost::shared_ptr<AbstractApproachSolver>(new RushLarsenSolver(p_model, timestep)), handoff_mrms);
+  }
+  /**SetApproachSolver with a multirate solver (see MultirateSolver.hpp)*/
+  void SetMultirateApproach(double handoff_mrms, double slow_timescale = 10){
+    SetApproachSolver(boost::shared_ptr<AbstractApproachSolver>(new MultirateSolver(p_model, slow_timescale)), handoff_mrms);
+  }
+  bool IsUsingApproachSolver(){
+    return bool(p_approach_solver);
+  }
+  unsigned int GetNumberOfApproachPaces(){
+    return approach_paces;
+  }
+  /**Whether the approach solver still in use is a Rush-Larsen one*/
+  bool IsUsingRushLarsen(){
+    return bool(boost::dynamic_pointer_cast<RushLarsenSolver>(p_approach_solver));
+  }
+  /**The approach paces solved by a Rush-Larsen solver*/
+  unsigned int GetNumberOfRushLarsenPaces(){
+    return rush_larsen_paces;
+  }
+  /**CalculateTraceMrms between the last two paces solved, or NaN before there have been two*/
+  double GetTraceMrms(){
+    return current_trace_mrms;
+  }
+  /**The last pace solved, when the trace norm is on*/
+  const DenseTrace& rGetLastPaceTrace(){
+    return previous_trace;
+  }
+  /**Paces solved so far, as numbered in the CVODE statistics*/
+  unsigned int GetNumberOfPacesSolved(){
+    return paces_solved;
+  }
+  /**Solver work summed over every pace run so far*/
+  CvodeStatistics GetTotalCvodeStatistics(){
+    return cvode_statistics;
+  }
+  /**Solver work for the most recently solved pace*/
+  const PaceCvodeStatistics& rGetLastPaceCvodeStatistics(){
+    return last_pace_statistics;
+  }
+  /**Keep the solver work of the last `capacity` paces (0 turns the history off)*/
+  void SetPaceCvodeStatisticsHistory(unsigned int capacity){
+    pace_statistics_history.set_capacity(capacity);
+  }
+  const boost::circular_buffer<PaceCvodeStatistics>& rGetPaceCvodeStatisticsHistory(){
+    return pace_statistics_history;
+  }
   std::vector<double> GetStateVariables(){
     return p_model->GetStdVecStateVariables();
   }
+  /**Write the state at the end of every pace RunPace solves to a binary trace
+     file (see TraceFile.hpp), with the number of paces solved as the time and
+     the current state as pace 0, for replaying extrapolation strategies against
+     (see PaceReplay). The file is complete once StopPaceRecording is called or
+     the simulation is destroyed.*/
+  void StartPaceRecording(const std::string& file_path){
+    p_pace_recording.reset(new TraceWriter(file_path, p_model->rGetStateVariableNames()));
+    p_pace_recording->AddRow(paces_solved, GetStateVariables());
+  }
+  void StopPaceRecording(){
+    if(p_pace_recording)
+      p_pace_recording->Close();
+    p_pace_recording.reset();
+  }
+  /**The state one pace on from r_state, solved like RunPace but leaving this
+     simulation (and its model's state) as it was. Evaluates the pace map for
+     analysing the steady state (see CalculateFloquetModes).*/
+  std::vector<double> ApplyPaceMap(const std::vector<double>& r_state){
+    const std::vector<double> saved_state = GetStateVariables();
+    p_model->SetStateVariables(r_state);
+    p_model->SolveAndUpdateState(0, p_stimulus->GetDuration());
+    p_stimulus->SetPeriod(period*2);
+    p_model->SolveAndUpdateState(p_stimulus->GetDuration(), period);
+    p_stimulus->SetPeriod(period);
+    const std::vector<double> new_state = GetStateVariables();
+    p_model->SetStateVariables(saved_state);
+    return new_state;
+  }
+  /**Biomarkers of the pace from r_state (see ::CalculateBiomarkers), leaving the model's state as it was*/
+  BeatBiomarkers GetBiomarkers(const std::vector<double>& r_state, double percentage = 90){
+    const std::vector<double> saved_state = GetStateVariables();
+    p_model->SetStateVariables(r_state);
+    const BeatBiomarkers biomarkers = ::CalculateBiomarkers(p_model, period, p_stimulus->GetDuration(), percentage);
+    p_model->SetStateVariables(saved_state);
+    return biomarkers;
+  }
+  double GetParameter(const std::string& name){
+    return p_model->GetParameter(name);
+  }
+  /**Change one of the model's parameters. Forks made afterwards copy it.*/
+  void SetParameter(const std::string& name, double value){
+    p_model->SetParameter(name, value);
+  }
+  /**Solve from now on with these CVODE tolerances*/
+  void SetTolerances(double _tol_abs, double _tol_rel){
+    TolAbs = _tol_abs;
+    TolRel = _tol_rel;
+    p_model->SetTolerances(TolAbs, TolRel);
+  }
+  /**Paces left to convergence, from a least squares fit of log(mrms) against
+     the pace over the last few paces (see SetEstimateWindow). The band comes
+     from two standard errors either side of the fitted decay rate.*/
+  PaceEstimate EstimateRemainingPaces() const{
+    PaceEstimate estimate;
+    if(finished){
+      estimate.remaining = estimate.lower = estimate.upper = 0;
+      return estimate;
+    }
+    const unsigned int N = mrms_history.size();
+    if(N < 5)
+      return estimate;
+    double sum_x = 0, sum_y = 0, sum_x2 = 0, sum_xy = 0;
+    for(unsigned int i = 0; i < N; i++){
+      const double y = log(mrms_history[i]);
+      sum_x += i;
+      sum_y += y;
+      sum_x2 += i*i;
+      sum_xy += i*y;
+    }
+    const double s_xx = sum_x2 - sum_x*sum_x/N;
+    const double beta = (sum_xy - sum_x*sum_y/N)/s_xx;
+    const double alpha = (sum_y - beta*sum_x)/N;
+    double residuals = 0;
+    for(unsigned int i = 0; i < N; i++)
+      residuals += pow(log(mrms_history[i]) - alpha - beta*i, 2);
+    const double standard_error = sqrt(residuals/(N - 2)/s_xx);
+
+    /*How far the fitted log(mrms) still has to fall*/
+    const double distance = std::max(0.0, alpha + beta*(N - 1) - log(threshold));
+    auto paces_at_rate = [distance](double rate){
+      return rate < 0 ? distance/-rate : INFINITY;
+    };
+    estimate.remaining = paces_at_rate(beta);
+    estimate.lower = paces_at_rate(beta - 2*standard_error);
+    estimate.upper = paces_at_rate(beta + 2*standard_error);
+    return estimate;
+  }
+  /**Estimate remaining paces from the mrms of this many of the latest paces (50 by default)*/
+  void SetEstimateWindow(unsigned int window){
+    mrms_history.rset_capacity(window);
+  }
+  /**The mrms between consecutive paces below which a run has converged*/
+  static double GetConvergenceThreshold(){
+    return threshold;
+  }
+};
+
+/** What SmartSimulation does when CVODE fails on a pace, strategy by strategy
+    until one works (see SmartSimulation::Recover) */
+struct RecoveryPolicy{
+  /*Retry the pace with at most this maximum timestep (ms)...*/
+  double max_timestep = 1;
+  /*...and the tolerances multiplied by this*/
+  double tolerance_factor = 0.1;
+  /*If a recent jump led here, retry from this fraction of the way along it*/
+  double jump_damping = 0.5;
+  /*Otherwise go back to before the last jump and don't extrapolate for this many paces (0 for a buffer's worth)*/
+  unsigned int suspension_paces = 0;
+  /*After this many failures, stop extrapolating for good*/
+  unsigned int max_failures = 3;
+};
+
+enum class RecoveryStrategy{
+  Refine,
+  DampJump,
+  Suspend,
+  Disable
+};
+
+/** One attempt at recovering from a failed pace */
+struct RecoveryEvent{
+  unsigned int pace;
+  RecoveryStrategy strategy;
+  bool succeeded;
+  std::string error;
 };
 
 class SmartSimulation : public Simulation{
@@ -108,83 +607,78 @@ private:
   unsigned int max_jumps = 100;
   std::vector<double> safe_state_variables;
   unsigned int pace = 0;
-  std::ofstream errors;
+  boost::shared_ptr<AbstractDiagnosticsSink> p_diagnostics = GetDefaultDiagnosticsSink();
+  std::string jump_parameters;
+  unsigned int speculative_paces = 0;
+  bool speculating = false;
+  bool pace_failed = false;
+  RecoveryPolicy recovery_policy;
+  std::vector<RecoveryEvent> recovery_log;
+  std::vector<double> pace_start_state;
+  std::vector<double> last_jump_state;
+  unsigned int paces_since_jump = 0;
+  unsigned int failures = 0;
+  unsigned int suspended_until = 0;
+  bool constrained_jumps = false;
+  bool charge_conservation = false;
+  double positivity_floor = 0.1;
+  std::vector<unsigned int> gate_indices;
+  bool found_gates = false;
+  unsigned int rejected_jumps = 0;
+  bool adaptive_windows = false;
+  unsigned int minimum_window = 20;
+  double fit_quality = 0.95;
+  std::vector<unsigned int> windows;
+  std::vector<unsigned int> history_lengths;
+  boost::shared_ptr<DecayRateLibrary> p_decay_rates;
+  std::vector<DecayRate> seed_rates;
+  std::vector<DecayRate> fitted_rates;
+  unsigned int confirmation_paces = 5;
+  double rate_tolerance = 0.5;
+  unsigned int seeded_jumps = 0;
+  unsigned int max_seeded_jumps = 3;
 
-  bool ExtrapolateState(unsigned int state_index){
-    /* Calculate the log absolute differences of the state and store these in y_vals. Store the corresponding x values in x_vals*/
+  /*The last window buffered values of one variable, oldest first*/
+  std::vector<double> GetWindow(unsigned int state_index, unsigned int window){
+    std::vector<double> state = cGetNthVariable(states_buffer, state_index);
+    if(window < state.size())
+      state.erase(state.begin(), state.end() - window);
+    return state;
+  }
+
+  /*Fit a geometric decay to the last window values of a variable and jump it
+    to where the fit says it ends up*/
+  bool ExtrapolateState(unsigned int state_index, unsigned int window){
+    TRACE_SCOPE("SmartSimulation::ExtrapolateState");
     std::vector<double> y_vals;
     std::vector<double> x_vals;
-
-    y_vals.reserve(buffer_size);
-    x_vals.reserve(buffer_size);
-
-    std::vector<double> state = cGetNthVariable(states_buffer, state_index);
-    for(unsigned int i = 0; i < buffer_size - 1; i++){
-      double tmp = abs(state[i] - state[i+1]);
-      if(tmp != 0){
-        y_vals.push_back(log(tmp));
-        x_vals.push_back(i);
-      }
-    }
+    const std::vector<double> state = GetWindow(state_index, window);
+    GetLogDifferences(state, x_vals, y_vals);
     const double pmcc = CalculatePMCC(x_vals, y_vals);
 
-    /*Compute the required sums*/
-
-    double sum_x = 0, sum_y = 0, sum_x2 = 0, sum_xy = 0;
-    const unsigned int N = x_vals.size();
-
-    if(N<=2){
+    double alpha, beta;
+    if(!FitLine(x_vals, y_vals, alpha, beta))
       return false;
-    }
-
-    for(unsigned int i = 0; i < N; i++){
-      sum_x += x_vals[i];
-      sum_y += y_vals[i];
-      sum_x2+= x_vals[i]*x_vals[i];
-      sum_xy+= x_vals[i]*y_vals[i];
-    }
-
-    const double beta  = (N*sum_xy - sum_x*sum_y) / (N*sum_x2 - sum_x*sum_x);
-
-    const double alpha = (sum_y*sum_x2 - sum_x*sum_xy) / (N*sum_x2 - sum_x*sum_x);
-
 
-    output_file << state_index << " " << beta << " " << alpha << "\n";
 
-    if(pmcc>-0.75){  //return the unchanged value if there is no negative correlation (PMCC > -0.9 or PMCC = NAN) 
-      //      std::cout <<  p_model->GetSystemInformation()->rGetStateVariableNames()[state_index]<< ": PMCC was " << pmcc << " Ignoring. \n";
-      return false;
+    if(p_diagnostics->IsEnabled()){
+      std::ostringstream line;
+      line << state_index << " " << beta << " " << alpha << "\n";
+      jump_parameters += line.str();
     }
 
-    if(exp(alpha) < 100*TolRel*state.back()){
-      //The difference will be about as small as solver tolerances so there is no point going any further
-      //std::cout << p_model->GetSystemInformation()->rGetStateVariableNames()[state_index] << ": Alpha too small!\n";
+    if(!IsGeometricDecay(pmcc, alpha, beta, state.back(), TolRel))
       return false;
-    }
-
-    if(beta > 0){
-      //The difference is increasing
-      //std::cout << p_model->GetSystemInformation()->rGetStateVariableNames()[state_index] << ": Beta is positive\n";
-      return false;
-    }
-
 
     const double tau = -1/beta;
-    double change_in_variable =  abs(extrapolation_coefficient * exp(alpha - buffer_size/tau + 1/tau) / (exp(1/tau) - 1));
-
-    /*Is V(t) increasing or decreasing?*/
-
-    if(state.back() - state.front() < 0)
-      change_in_variable = - change_in_variable;
-
-    // std::cout << "(Gradient, Intercept) = (" << beta << "," << alpha << ")\n";
+    const double new_value = GeometricJump(state, alpha, beta, extrapolation_coefficient);
 
-    double new_value = state.back() + change_in_variable;
-
-    // std::cout << "Change in " << p_model->GetSystemInformation()->rGetStateVariableNames()[state_index] << " is: " << change_in_variable << "\n" << "New value is " << new_value << "\n";
-    //std::cout << "Old value: " << state.back() << "\n";
     if(std::isfinite(new_value)){
       state_variables[state_index] = new_value;
+      if(p_decay_rates){
+        const DecayRate rate = {p_model->GetSystemInformation()->rGetStateVariableNames()[state_index], tau, exp(alpha)};
+        fitted_rates.push_back(rate);
+      }
       return true;
     }
     else{
@@ -192,71 +686,87 @@ private:
     }
   }
 
-  bool ExtrapolateStates(){
+  /*Only a jump that is kept says anything about the rates, so the ones fitted
+    for it wait in fitted_rates until then*/
+  void RecordFittedRates(){
+    for(auto i = fitted_rates.begin(); i != fitted_rates.end(); i++)
+      p_decay_rates->Add(p_model->GetSystemInformation()->GetSystemName(), period, *i);
+    fitted_rates.clear();
+  }
+  /*What the library had for this model and period before this run, so that
+    the run's own fits never seed its jumps*/
+  void TakeSeedRates(){
+    seed_rates.clear();
+    if(p_decay_rates)
+      seed_rates = p_decay_rates->Find(p_model->GetSystemInformation()->GetSystemName(), period);
+  }
+
+  /*The mrms has been falling steadily for a whole buffer*/
+  bool ReadyToExtrapolate(){
     if(jumps>=max_jumps)
       return false;
-    if(!mrms_buffer.full())
-      return false;
-    double mrms_pmcc = CalculatePMCC(mrms_buffer);
-    std::vector<double> new_state_variables;
+    return WouldExtrapolate(buffer_size);
+  }
+
+  bool ExtrapolateStates(){
+    TRACE_SCOPE("SmartSimulation::ExtrapolateStates");
     bool extrapolated = false;
-    std::ofstream f_out;
-    std::string model_name = p_model->GetSystemInformation()->GetSystemName();
-    if(mrms_pmcc < -0.975){
+    if(ReadyToExtrapolate()){
+      const bool diagnostics = p_diagnostics->IsEnabled();
+      const std::string model_name = p_model->GetSystemInformation()->GetSystemName();
+      std::ostringstream jump;
+      std::ostringstream buffer;
       safe_state_variables = state_variables;
-      if(period == 500)
-        f_out.open("/tmp/joey/"+ model_name + "/1Hz2HzJump.dat");
-      else
-        f_out.open("/tmp/joey/"+p_model->GetSystemInformation()->GetSystemName() + "/2Hz1HzJump.dat");
       std::cout << "start of buffer " << pace - buffer_size + 1<< "\n";
       pace++;
-      output_file.open("/tmp/joey/"+p_model->GetSystemInformation()->GetSystemName()+"/"+ std::to_string(int(period)) + "JumpParameters.dat");
-      output_file << pace << " " << buffer_size << " " << extrapolation_coefficient << "\n";
-
-      WriteStatesToFile(state_variables, f_out);
-
-      std::ofstream f_buffer;
-      f_buffer.open("/tmp/joey/"+model_name+"/Buffer.dat");
+      jump_parameters.clear();
+      if(diagnostics){
+        std::ostringstream header;
+        header << pace << " " << buffer_size << " " << extrapolation_coefficient << "\n";
+        jump_parameters = header.str();
+        WriteStatesToFile(state_variables, jump);
+      }
 
       for(unsigned int i = 0; i < number_of_state_variables; i++){
-        if(ExtrapolateState(i))
+        if(ExtrapolateState(i, buffer_size))
           extrapolated = true;
-        WriteStatesToFile(cGetNthVariable(states_buffer, i), f_buffer);
+        if(diagnostics)
+          WriteStatesToFile(cGetNthVariable(states_buffer, i), buffer);
       }
+      if(extrapolated && constrained_jumps)
+        ConstrainState(state_variables);
 
-      output_file.close();
-
-      WriteStatesToFile(state_variables, f_out);
-
-      f_buffer.close();
-
-      f_out.close();
-
-      /*Write new variables to file*/
-      std::ofstream output;
-      for(unsigned int i = 0; i < state_variables.size(); i++){
-        output << state_variables[i] << " ";
-      }
-      for(unsigned int i = 0; i < state_variables.size(); i++){
-        output << state_variables[i] << " ";
+      if(diagnostics){
+        WriteStatesToFile(state_variables, jump);
+        p_diagnostics->Write(model_name + (period == 500 ? "/1Hz2HzJump.dat" : "/2Hz1HzJump.dat"), jump.str());
+        p_diagnostics->Write(model_name + "/" + std::to_string(int(period)) + "JumpParameters.dat", jump_parameters);
+        p_diagnostics->Write(model_name + "/Buffer.dat", buffer.str());
       }
-      output.close();
+
       if(extrapolated){
         mrms_buffer.clear();
         states_buffer.clear();
+        last_jump_state = state_variables;
+        paces_since_jump = 0;
 
         //	std::cout << "Jumped to new variables\n";
         jumps++;
       }
       p_model->SetStateVariables(state_variables);
       // p_model->SetVoltage(p_model->CalculateAnalyticVoltage());
-      if(std::abs(p_model->CalculateAnalyticVoltage() - safe_state_variables[0]) > 5){
+      /*When speculating the baseline is kept anyway if the jump turns out badly*/
+      if(speculative_paces == 0 && std::abs(p_model->CalculateAnalyticVoltage() - safe_state_variables[0]) > 5){
         /* Reset back to old vars and try again later */
         p_model->SetStateVariables(safe_state_variables);
         mrms_buffer.clear();
         states_buffer.clear();
         extrapolated = false;
+        rejected_jumps++;
+        fitted_rates.clear();
       }
+      /*A speculative jump's rates wait to see if it wins (see RunSpeculativeJump)*/
+      if(extrapolated && speculative_paces == 0)
+        RecordFittedRates();
 
       return extrapolated;
     }
@@ -264,54 +774,634 @@ private:
       return false;
   }
 
-public:
-
-  using Simulation::Simulation;
+  /*Jump using decay rates from the library instead of waiting for a buffer's
+    worth of paces to fit them. After confirmation_paces paces, each variable
+    with a recorded tau whose differences have kept one sign and whose rate over
+    those paces is within rate_tolerance of the recorded one is moved on by the
+    geometric sum of its remaining changes, scaled from its latest change. Only
+    the first max_seeded_jumps jumps are seeded; after that the buffers take
+    over. The rates are the library's from before the run (see TakeSeedRates).*/
+  bool SeededJump(){
+    TRACE_SCOPE("SmartSimulation::SeededJump");
+    if(seed_rates.empty() || seeded_jumps >= max_seeded_jumps || jumps >= max_jumps || pace < suspended_until)
+      return false;
+    if(states_buffer.size() < confirmation_paces)
+      return false;
+    const std::vector<DecayRate>& rates = seed_rates;
 
-  bool RunPace(){
+    safe_state_variables = state_variables;
     bool extrapolated = false;
-    extrapolated = ExtrapolateStates();
-    if(!extrapolated){
-      /*Solve in two parts*/
-      try{
-        p_model->SolveAndUpdateState(0, p_stimulus->GetDuration());
-        p_model->SolveAndUpdateState(p_stimulus->GetDuration(), period);
-        pace++;
+    std::vector<double> x_vals;
+    std::vector<double> y_vals;
+    for(auto i = rates.begin(); i != rates.end(); i++){
+      const unsigned int state_index = p_model->GetSystemInformation()->GetStateVariableIndex(i->variable);
+      const std::vector<double> state = GetWindow(state_index, confirmation_paces);
+      x_vals.clear();
+      y_vals.clear();
+      GetLogDifferences(state, x_vals, y_vals);
+      double alpha, beta;
+      if(x_vals.size() + 1 < state.size() || !FitLine(x_vals, y_vals, alpha, beta))
+        continue;
+      bool monotonic = true;
+      for(unsigned int j = 1; j + 1 < state.size(); j++)
+        if((state[j+1] - state[j])*(state[1] - state[0]) <= 0)
+          monotonic = false;
+      if(!monotonic || std::abs(beta + 1/i->tau) > rate_tolerance/i->tau)
+        continue;
+      const double last_change = state.back() - state[state.size() - 2];
+      if(std::abs(last_change) < 100*TolRel*std::abs(state.back()))
+        continue;
+      const double new_value = state.back() + extrapolation_coefficient*last_change/(exp(1/i->tau) - 1);
+      if(std::isfinite(new_value)){
+        state_variables[state_index] = new_value;
+        extrapolated = true;
       }
-      catch(Exception &e){
-        std::cout << "RunPaces failed - returning to old state_variables\n";
-        state_variables = safe_state_variables;
-        p_model->SetStateVariables(state_variables);
-        std::ofstream errors;
-        errors.open("/tmp/joey/ExtrapolationErrors.dat", std::fstream::app);
-        errors << p_model->GetSystemInformation()->GetSystemName() << " " << period << " " << buffer_size << " " << extrapolation_coefficient << "\n \n \n";
-        errors << e.GetMessage();
-        errors << "\n\n\n\n";
-        errors.close();
+    }
+    if(!extrapolated)
+      return false;
+    if(constrained_jumps)
+      ConstrainState(state_variables);
+    p_model->SetStateVariables(state_variables);
+
+    /*Seeded jumps aren't raced (see SetSpeculativePaces), so always checked*/
+    if(std::abs(p_model->CalculateAnalyticVoltage() - safe_state_variables[0]) > 5){
+      /*The recorded rates don't suit this run, so leave it to the buffers*/
+      state_variables = safe_state_variables;
+      p_model->SetStateVariables(state_variables);
+      max_seeded_jumps = seeded_jumps;
+      rejected_jumps++;
+      return false;
+    }
+    seeded_jumps++;
+    std::cout << "Seeded jump after " << states_buffer.size() - 1 << " paces\n";
+    mrms_buffer.clear();
+    states_buffer.clear();
+    states_buffer.push_back(state_variables);
+    last_jump_state = state_variables;
+    paces_since_jump = 0;
+    jumps++;
+    return true;
+  }
+
+  /*Adaptive windows: every variable has its own window, starting at
+    minimum_window. Once a variable has been buffered for a whole window since
+    it last jumped, fit log|difference| over the window. A good fit (PMCC below
+    -fit_quality) means it's ready; a poor one doubles the window, up to
+    buffer_size, to average out more of the noise. The ready variables jump
+    together and start again with half the window, while the others keep their
+    history and carry on filling.*/
+  bool ExtrapolateReadyVariables(){
+    TRACE_SCOPE("SmartSimulation::ExtrapolateReadyVariables");
+    if(jumps >= max_jumps || pace < suspended_until)
+      return false;
+    if(windows.size() != number_of_state_variables){
+      windows.assign(number_of_state_variables, std::min(minimum_window, buffer_size));
+      history_lengths.assign(number_of_state_variables, states_buffer.size());
+    }
+
+    std::vector<unsigned int> ready;
+    std::vector<double> x_vals;
+    std::vector<double> y_vals;
+    for(unsigned int i = 0; i < number_of_state_variables; i++){
+      /*Clearing the buffer throws away everyone's history*/
+      const unsigned int history = std::min<unsigned int>(history_lengths[i], states_buffer.size());
+      if(history < windows[i])
+        continue;
+      x_vals.clear();
+      y_vals.clear();
+      GetLogDifferences(GetWindow(i, windows[i]), x_vals, y_vals);
+      if(CalculatePMCC(x_vals, y_vals) < -fit_quality)
+        ready.push_back(i);
+      else
+        windows[i] = std::min(2*windows[i], buffer_size);
+    }
+    if(ready.empty())
+      return false;
+
+    safe_state_variables = state_variables;
+    jump_parameters.clear();
+    std::vector<unsigned int> jumped;
+    for(auto i = ready.begin(); i != ready.end(); i++)
+      if(ExtrapolateState(*i, windows[*i]))
+        jumped.push_back(*i);
+    if(jumped.empty())
+      return false;
+    if(constrained_jumps)
+      ConstrainState(state_variables);
+    p_model->SetStateVariables(state_variables);
+
+    /*Adaptive jumps aren't raced (see SetSpeculativePaces), so always checked*/
+    if(std::abs(p_model->CalculateAnalyticVoltage() - safe_state_variables[0]) > 5){
+      /*Keep the history and wait for a longer window to give a better fit*/
+      state_variables = safe_state_variables;
+      p_model->SetStateVariables(state_variables);
+      for(auto i = jumped.begin(); i != jumped.end(); i++)
+        windows[*i] = std::min(2*windows[*i], buffer_size);
+      rejected_jumps++;
+      fitted_rates.clear();
+      return false;
+    }
+    RecordFittedRates();
+
+    if(p_diagnostics->IsEnabled()){
+      std::ostringstream line;
+      line << pace;
+      for(auto i = jumped.begin(); i != jumped.end(); i++)
+        line << " " << *i << ":" << windows[*i];
+      line << "\n";
+      p_diagnostics->Write(p_model->GetSystemInformation()->GetSystemName() + "/AdaptiveJumps.dat", line.str(), true);
+    }
+    /*The buffer's newest entry is the state the next pace starts from*/
+    states_buffer.back() = state_variables;
+    for(auto i = jumped.begin(); i != jumped.end(); i++){
+      history_lengths[*i] = 1;
+      windows[*i] = std::max(windows[*i]/2, std::min(minimum_window, buffer_size));
+    }
+    mrms_buffer.clear();
+    last_jump_state = state_variables;
+    paces_since_jump = 0;
+    jumps++;
+    return true;
+  }
+
+  /*Clamp a gate that was in [0,1] before the jump back into it. FindGates
+    also picks up buffers (Shannon's calsequestrin sits above 1 mM), so one
+    that wasn't is treated like any other variable (bar the voltage): if it was
+    positive before the jump and has been taken to zero or below it goes to
+    positivity_floor times its old value instead. Whatever the jump left in
+    bounds is untouched.*/
+  void ApplyBounds(std::vector<double>& r_state){
+    for(unsigned int i = 0; i < number_of_state_variables; i++){
+      if(i == p_model->GetVoltageIndex())
+        continue;
+      const double before = safe_state_variables[i];
+      if(before >= 0 && before <= 1 && std::find(gate_indices.begin(), gate_indices.end(), i) != gate_indices.end()){
+        if(!(r_state[i] >= 0 && r_state[i] <= 1))
+          r_state[i] = r_state[i] > 1 ? 1 : 0;
+      }
+      else if(before > 0 && !(r_state[i] > 0))
+        r_state[i] = positivity_floor*before;
+    }
+  }
+
+  /*The voltage is fixed by the total charge held in the concentrations
+    (CalculateAnalyticVoltage, from the constant set by SetIntegrationConstant),
+    so V - V_analytic is conserved. Move r_state the shortest way, in the
+    relative scale mrms uses, back onto the states with the value it had before
+    the jump: a few Newton steps with the gradient by finite differences.*/
+  void ConserveCharge(std::vector<double>& r_state){
+    const unsigned int voltage_index = p_model->GetVoltageIndex();
+    auto charge = [&](const std::vector<double>& r_x){
+      p_model->SetStateVariables(r_x);
+      return r_x[voltage_index] - p_model->CalculateAnalyticVoltage();
+    };
+    const double conserved_charge = charge(safe_state_variables);
+    auto mismatch = [&](const std::vector<double>& r_x){
+      return charge(r_x) - conserved_charge;
+    };
+    std::vector<double> gradient(number_of_state_variables);
+    std::vector<double> perturbed_state;
+    for(unsigned int iteration = 0; iteration < 3; iteration++){
+      const double g = mismatch(r_state);
+      if(!std::isfinite(g) || std::abs(g) < 1e-6)
+        break;
+      double denominator = 0;
+      for(unsigned int j = 0; j < number_of_state_variables; j++){
+        perturbed_state = r_state;
+        const double perturbation = 1e-6*(1 + std::abs(r_state[j]));
+        perturbed_state[j] += perturbation;
+        gradient[j] = (mismatch(perturbed_state) - g)/perturbation;
+        const double weight = (1 + std::abs(r_state[j]))*(1 + std::abs(r_state[j]));
+        denominator += weight*gradient[j]*gradient[j];
+      }
+      if(!(denominator > 0))
+        break;
+      for(unsigned int j = 0; j < number_of_state_variables; j++){
+        const double weight = (1 + std::abs(r_state[j]))*(1 + std::abs(r_state[j]));
+        r_state[j] -= g*weight*gradient[j]/denominator;
+      }
+    }
+  }
+
+  void RecordRecovery(RecoveryStrategy strategy, bool succeeded, const std::string& error){
+    const RecoveryEvent event = {pace, strategy, succeeded, error};
+    recovery_log.push_back(event);
+    if(p_diagnostics->IsEnabled()){
+      std::string message = error;
+      std::replace(message.begin(), message.end(), '\n', ' ');
+      std::ostringstream line;
+      line << p_model->GetSystemInformation()->GetSystemName() << " " << period << " " << pace << " "
+           << int(strategy) << " " << succeeded << " " << message << "\n";
+      p_diagnostics->Write("RecoveryLog.dat", line.str(), true);
+    }
+  }
+
+  /*Try the pace again from start_state, with a smaller maximum timestep and
+    tighter tolerances if refine is set. The model's settings are put back
+    afterwards either way.*/
+  bool RetryPace(const std::vector<double>& start_state, RecoveryStrategy strategy, bool refine){
+    const double max_timestep = p_model->GetTimestep();
+    p_model->SetStateVariables(start_state);
+    if(refine){
+      p_model->SetMaxTimestep(std::min(max_timestep, recovery_policy.max_timestep));
+      p_model->SetTolerances(TolAbs*recovery_policy.tolerance_factor, TolRel*recovery_policy.tolerance_factor);
+    }
+    bool succeeded = true;
+    std::string error;
+    try{
+      SolvePaceParts();
+    }
+    catch(Exception &e){
+      succeeded = false;
+      error = e.GetMessage();
+    }
+    p_model->SetMaxTimestep(max_timestep);
+    p_model->SetTolerances(TolAbs, TolRel);
+    RecordRecovery(strategy, succeeded, error);
+    return succeeded;
+  }
+
+  /*CVODE failed on this pace. Escalate until something works: the same pace
+    more carefully, then (if a jump led here) a smaller jump, then back to
+    before the jump (or the start of the pace if there wasn't one) with
+    extrapolation suspended for a while, and only after repeated failures with
+    extrapolation off for good. Returns true if the pace was solved in the end.*/
+  bool Recover(Exception &e){
+    TRACE_SCOPE("SmartSimulation::Recover");
+    std::cout << "Pace failed - trying to recover\n";
+    failures++;
+    if(p_diagnostics->IsEnabled()){
+      std::ostringstream errors;
+      errors << p_model->GetSystemInformation()->GetSystemName() << " " << period << " " << buffer_size << " " << extrapolation_coefficient << "\n \n \n";
+      errors << e.GetMessage();
+      errors << "\n\n\n\n";
+      p_diagnostics->Write("ExtrapolationErrors.dat", errors.str(), true);
+    }
+
+    if(RetryPace(pace_start_state, RecoveryStrategy::Refine, true))
+      return true;
+
+    const bool after_jump = jumps > 0 && paces_since_jump < buffer_size && !last_jump_state.empty();
+    if(after_jump){
+      std::vector<double> damped_state = safe_state_variables;
+      for(unsigned int i = 0; i < number_of_state_variables; i++)
+        damped_state[i] += recovery_policy.jump_damping*(last_jump_state[i] - safe_state_variables[i]);
+      if(RetryPace(damped_state, RecoveryStrategy::DampJump, true)){
         mrms_buffer.clear();
         states_buffer.clear();
-        max_jumps = 0;
+        state_variables = damped_state;
+        return true;
+      }
+    }
+
+    /*Only a jump is worth undoing. Otherwise the last pace solved is as good a
+      place to carry on from as any, and its buffers still hold.*/
+    if(after_jump){
+      state_variables = safe_state_variables;
+      mrms_buffer.clear();
+      states_buffer.clear();
+    }
+    p_model->SetStateVariables(state_variables);
+    pace_failed = true;
+    if(failures >= recovery_policy.max_failures){
+      max_jumps = 0;
+      RecordRecovery(RecoveryStrategy::Disable, true, e.GetMessage());
+    }
+    else{
+      suspended_until = pace + (recovery_policy.suspension_paces > 0 ? recovery_policy.suspension_paces : buffer_size);
+      RecordRecovery(RecoveryStrategy::Suspend, true, e.GetMessage());
+    }
+    return false;
+  }
+
+  void SolvePaceParts(){
+    SolvePart(0, p_stimulus->GetDuration());
+    RecordStimulusCvodeStatistics();
+    SolvePart(p_stimulus->GetDuration(), period);
+    RecordCvodeStatistics();
+  }
+
+  /*Solve one pace without extrapolating*/
+  bool SolvePace(){
+    const double* p_start_state = NV_DATA_S(p_model->rGetStateVariables());
+    pace_start_state.assign(p_start_state, p_start_state + number_of_state_variables);
+    /*Solve in two parts*/
+    try{
+      TRACE_SCOPE("SmartSimulation::Solve");
+      SolvePaceParts();
+    }
+    catch(Exception &e){
+      if(!Recover(e))
         return false;
+    }
+    UpdateTraceNorm();
+    pace++;
+    paces_since_jump++;
+    for(auto i = history_lengths.begin(); i != history_lengths.end(); i++)
+      (*i)++;
+    /*Reuse the oldest buffered state's storage once the buffer is full, and read
+      the model's N_Vector directly, so a pace doesn't allocate*/
+    std::vector<double> new_state_variables;
+    if(states_buffer.full() && !states_buffer.empty()){
+      new_state_variables = std::move(states_buffer.front());
+      states_buffer.pop_front();
+    }
+    const double* p_state = NV_DATA_S(p_model->rGetStateVariables());
+    new_state_variables.assign(p_state, p_state + number_of_state_variables);
+    current_mrms = mrms(new_state_variables, state_variables);
+    mrms_buffer.push_back(current_mrms);
+    state_variables = new_state_variables;
+    states_buffer.push_back(std::move(new_state_variables));
+    if(ApproachPace()){
+      /*Don't extrapolate across the change of solver*/
+      if(!p_approach_solver){
+        mrms_buffer.clear();
+        states_buffer.clear();
       }
-      std::vector<double> new_state_variables = GetStateVariables();
-      states_buffer.push_back(new_state_variables);
-      current_mrms = mrms(new_state_variables, state_variables);
-      mrms_buffer.push_back(current_mrms);
-      state_variables = new_state_variables;
-      if(current_mrms < threshold){
-        finished = true;
-        return true;
+      return false;
+    }
+    return CheckConvergence();
+  }
+
+  /*Race a jump against carrying on without it. The baseline is a fork taken
+    before the jump, paced on another thread while this simulation paces the
+    jumped candidate. After speculative_paces paces whichever changed less over
+    its last pace is kept (a candidate that fails to solve always loses), so a
+    bad jump costs time on a second core rather than wall-clock time, and the
+    baseline's buffers carry on filling instead of starting again. A rejected
+    jump still counts towards max_jumps, and the paces both sides solved count
+    towards the CVODE statistics and paces solved.*/
+  bool RunSpeculativeJump(){
+    TRACE_SCOPE("SmartSimulation::RunSpeculativeJump");
+    /*The baseline shares the model until there is a jump to race, and only then
+      gets its own, which is the expensive part of a fork*/
+    SmartSimulation baseline(*this);
+    const CvodeStatistics statistics_before = cvode_statistics;
+    const unsigned int paces_before = paces_solved;
+    if(!ExtrapolateStates())
+      return SolvePace();
+    baseline.CloneModel();
+    baseline.p_model->SetStateVariables(baseline.state_variables);
+    baseline.p_pace_recording.reset();
+    baseline.speculating = true;
+    baseline.max_jumps = baseline.jumps;
+    states_buffer.clear();
+    mrms_buffer.clear();
+    current_mrms = 0;
+    mrms_history.clear();
+
+    /*Observers only see the paces that are kept*/
+    const std::vector<boost::shared_ptr<AbstractStepObserver>> observers = step_observers;
+    const unsigned int original_max_jumps = max_jumps;
+    step_observers.clear();
+    speculating = true;
+    pace_failed = false;
+
+    std::exception_ptr p_baseline_error;
+    std::thread baseline_thread([&baseline, &p_baseline_error, this](){
+      try{
+        for(unsigned int i = 0; i < speculative_paces && !baseline.finished; i++)
+          baseline.RunPace();
+      }
+      catch(...){
+        p_baseline_error = std::current_exception();
+      }
+    });
+    for(unsigned int i = 0; i < speculative_paces && !finished && !pace_failed; i++)
+      RunPace();
+    baseline_thread.join();
+
+    speculating = false;
+    step_observers = observers;
+    if(p_baseline_error)
+      std::rethrow_exception(p_baseline_error);
+
+    const bool keep_candidate = !pace_failed && (finished || (!baseline.finished && current_mrms <= baseline.current_mrms));
+    if(keep_candidate)
+      RecordFittedRates();
+    if(!keep_candidate){
+      std::cout << "Speculative jump rejected - keeping the baseline\n";
+      /*The candidate's paces were solved all the same, so they stay in the totals
+        and the history, and the baseline's are numbered after them*/
+      const CvodeStatistics candidate_statistics = cvode_statistics - statistics_before;
+      const unsigned int candidate_paces = paces_solved - paces_before;
+      boost::circular_buffer<PaceCvodeStatistics> history = pace_statistics_history;
+      const unsigned int baseline_paces = baseline.paces_solved - paces_before;
+      for(auto i = baseline.pace_statistics_history.end() - std::min<size_t>(baseline_paces, baseline.pace_statistics_history.size());
+          i != baseline.pace_statistics_history.end(); i++){
+        history.push_back(*i);
+        history.back().pace += candidate_paces;
+      }
+
+      /*Take everything else from the baseline except the model itself, which
+        callers may hold on to, and the recording. The baseline's approach solver
+        works on the baseline's model, so this one gets its own copy.*/
+      const boost::shared_ptr<AbstractCvodeCell> p_own_model = p_model;
+      const boost::shared_ptr<RegularStimulus> p_own_stimulus = p_stimulus;
+      const boost::shared_ptr<TraceWriter> p_own_recording = p_pace_recording;
+      *this = baseline;
+      p_model = p_own_model;
+      p_stimulus = p_own_stimulus;
+      p_pace_recording = p_own_recording;
+      p_model->SetStateVariables(state_variables);
+      if(p_approach_solver){
+        p_approach_solver = p_approach_solver->Clone(p_model);
+        approach_statistics_at_pace_start = CvodeStatistics();
       }
+      fitted_rates.clear();
+      step_observers = observers;
+      speculating = false;
+      max_jumps = original_max_jumps;
+      jumps++;
+      rejected_jumps++;
+
+      CvodeStatistics total = candidate_statistics;
+      total += cvode_statistics;
+      cvode_statistics = total;
+      paces_solved += candidate_paces;
+      if(baseline_paces > 0)
+        last_pace_statistics.pace += candidate_paces;
+      pace_statistics_history = history;
+    }
+    return finished;
+  }
+
+public:
+
+  using Simulation::Simulation;
+
+  bool RunPace(){
+    TRACE_SCOPE("SmartSimulation::RunPace");
+    if(SeededJump()){
+      current_mrms = 0;
+      mrms_history.clear();
+      return false;
+    }
+    if(adaptive_windows){
+      if(!ExtrapolateReadyVariables())
+        return SolvePace();
+      current_mrms = 0;
+      mrms_history.clear();
+      return false;
+    }
+    if(speculative_paces > 0 && !speculating && ReadyToExtrapolate())
+      return RunSpeculativeJump();
+    bool extrapolated = false;
+    extrapolated = ExtrapolateStates();
+    if(!extrapolated){
+      return SolvePace();
     }
     else{
       states_buffer.clear();
       mrms_buffer.clear();
       current_mrms = 0;
+      mrms_history.clear();
     }
     // p_model->SetVoltage(p_model->CalculateAnalyticVoltage());
     return false;
   }
 
+  /**An independent copy of this simulation, buffers and all, with its own model in the same state*/
+  SmartSimulation Fork() const{
+    SmartSimulation fork(*this);
+    fork.CloneModel();
+    /*Only the original carries on recording*/
+    fork.p_pace_recording.reset();
+    return fork;
+  }
+
+  /**Race each jump from a full buffer against a fork that doesn't jump for this
+     many paces, on two threads, and keep the better (see RunSpeculativeJump)
+     instead of checking the voltage. Seeded and adaptive jumps are still checked.
+     0, the default, jumps unconditionally as before.*/
+  void SetSpeculativePaces(unsigned int _speculative_paces){
+    speculative_paces = _speculative_paces;
+  }
+
+  /**Project jumped states back onto physical ones (see ConstrainState).
+     charge_conservation also keeps the voltage consistent with the
+     concentrations, for models with CalculateAnalyticVoltage set up.*/
+  void SetConstrainedJumps(bool _constrained_jumps, bool _charge_conservation = false){
+    constrained_jumps = _constrained_jumps;
+    charge_conservation = _charge_conservation;
+  }
+  /**Move r_state onto the physical set: gates (see FindGates) that were in
+     [0,1] staying there, positive variables staying positive and, with charge
+     conservation, V - V_analytic (the total charge) as it was before the jump.
+     Alternates between the bounds
+     and the charge constraint and finishes with the bounds, so they always
+     hold. The state before the last jump (the current one if there hasn't been
+     a jump) is the reference for both. The model's state is left at r_state.*/
+  void ConstrainState(std::vector<double>& r_state){
+    TRACE_SCOPE("SmartSimulation::ConstrainState");
+    if(!found_gates){
+      gate_indices = FindGates(p_model);
+      found_gates = true;
+    }
+    if(safe_state_variables.size() != number_of_state_variables)
+      safe_state_variables = GetStateVariables();
+    for(unsigned int round = 0; round < 3 && charge_conservation; round++){
+      ApplyBounds(r_state);
+      ConserveCharge(r_state);
+    }
+    ApplyBounds(r_state);
+    p_model->SetStateVariables(r_state);
+  }
+  /**Give every variable its own extrapolation window, from _minimum_window up
+     to the buffer size set by Initialise, and let each jump as soon as its own
+     fit is good enough (see ExtrapolateReadyVariables) instead of waiting for
+     the whole state to settle. _fit_quality is the PMCC magnitude a window's
+     log differences need to reach. These jumps aren't raced even with
+     SetSpeculativePaces, so the voltage check always decides them.*/
+  void SetAdaptiveWindows(unsigned int _minimum_window = 20, double _fit_quality = 0.95){
+    if(_minimum_window < 4)
+      EXCEPTION("Adaptive windows need at least 4 paces to fit");
+    adaptive_windows = true;
+    minimum_window = _minimum_window;
+    fit_quality = _fit_quality;
+    windows.clear();
+  }
+  /**Record every decay rate fitted in a jump that is kept to p_library, and
+     seed the first jumps from the rates already there for this model and
+     period (see SeededJump), so runs of the same model can jump after a few
+     paces. The seeds are what the library holds when this is called or at
+     Initialise, whichever is later, so a run never seeds from its own fits.
+     Confirming a recorded rate takes _confirmation_paces paces, and the rate
+     seen over them must be within _rate_tolerance (relative) of it.*/
+  void SetDecayRateLibrary(boost::shared_ptr<DecayRateLibrary> p_library, unsigned int _confirmation_paces = 5, double _rate_tolerance = 0.5){
+    if(_confirmation_paces < 4)
+      EXCEPTION("Confirming a decay rate needs at least 4 paces");
+    p_decay_rates = p_library;
+    confirmation_paces = _confirmation_paces;
+    rate_tolerance = _rate_tolerance;
+    TakeSeedRates();
+  }
+  /**Jumps made from the decay rate library rather than a full buffer*/
+  unsigned int GetNumberOfSeededJumps(){
+    return seeded_jumps;
+  }
+  /**The current window of each variable when using adaptive windows*/
+  const std::vector<unsigned int>& rGetWindows(){
+    return windows;
+  }
+  unsigned int GetNumberOfJumps(){
+    return jumps;
+  }
+  /**Whether a simulation initialised with _buffer_size instead, that had
+     solved the same paces without jumping, would try to jump now. Only the latest _buffer_size
+     paces are looked at, so _buffer_size can't be more than this simulation's.*/
+  bool WouldExtrapolate(unsigned int _buffer_size){
+    if(pace < suspended_until)
+      return false;
+    if(mrms_buffer.size() < _buffer_size)
+      return false;
+    if(mrms_buffer.size() == _buffer_size)
+      return CalculatePMCC(mrms_buffer) < -0.975;
+    const std::vector<double> latest(mrms_buffer.end() - _buffer_size, mrms_buffer.end());
+    return CalculatePMCC(latest) < -0.975;
+  }
+  /**Carry on as if Initialise had been called with these at the start: keep
+     only the latest _buffer_size paces (no more than are kept now) and use the
+     new coefficient from the next jump on. Lets a sweep over settings share the
+     paces before their first jumps (see RunConfigurationSweep).*/
+  void Rebuffer(unsigned int _buffer_size, double _extrapolation_constant){
+    if(_buffer_size > buffer_size)
+      EXCEPTION("Can't rebuffer to a larger buffer than the one initialised");
+    buffer_size = _buffer_size;
+    states_buffer.rset_capacity(buffer_size);
+    mrms_buffer.rset_capacity(buffer_size);
+    extrapolation_coefficient = _extrapolation_constant;
+  }
+  /**At most this many jumps (100 by default); 0 turns extrapolation off*/
+  void SetMaximumJumps(unsigned int _max_jumps){
+    max_jumps = _max_jumps;
+  }
+  /**Jumps rolled back for moving the voltage too far, or that lost the race
+     against their baseline (see SetSpeculativePaces)*/
+  unsigned int GetNumberOfRejectedJumps(){
+    return rejected_jumps;
+  }
+  /**How to recover when CVODE fails on a pace (see RecoveryPolicy)*/
+  void SetRecoveryPolicy(const RecoveryPolicy& _recovery_policy){
+    recovery_policy = _recovery_policy;
+  }
+  /**No jumps until GetPace reaches this, after a failure (see RecoveryPolicy::suspension_paces)*/
+  unsigned int GetSuspendedUntil(){
+    return suspended_until;
+  }
+  /**The pace number recovery events are logged against: paces solved plus jumps made from a full buffer*/
+  unsigned int GetPace(){
+    return pace;
+  }
+  /**Every recovery attempt so far, in order. Also written to RecoveryLog.dat in the diagnostics sink.*/
+  const std::vector<RecoveryEvent>& rGetRecoveryLog(){
+    return recovery_log;
+  }
+  /**Where jump diagnostics are sent. Use a NullDiagnosticsSink to turn them off.*/
+  void SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink> _p_diagnostics){
+    p_diagnostics = _p_diagnostics;
+  }
+
   void Initialise(unsigned int _buffer_size, double _extrapolation_constant){
     buffer_size = _buffer_size;
     states_buffer.set_capacity(buffer_size);
@@ -319,6 +1409,7 @@ public:
     states_buffer.push_back(GetStateVariables());
     extrapolation_coefficient = _extrapolation_constant;
     safe_state_variables = state_variables;
+    TakeSeedRates();
   }
 };
 
@@ -1,9 +1,27 @@
 #include "SimulationTools.hpp"
+#include "Tracing.hpp"
+#include "DenseTrace.hpp"
+#include "Exception.hpp"
 
 #include "beeler_reuter_model_1977Cvode.hpp"
 #include "ten_tusscher_model_2004_epiCvode.hpp"
 #include "ohara_rudy_2011_endoCvode.hpp"
 #include "shannon_wang_puglisi_weber_bers_2004Cvode.hpp"
+#include "ohara_rudy_cipa_v1_2017Cvode.hpp"
+
+#include <cvode/cvode.h>
+#include <cvode/cvode_direct.h>
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+/* AbstractCvodeSystem keeps its CVODE memory protected. Naming the member through a derived class lets us read it without modifying the generated cells. */
+class CvodeMemoryAccessor : public AbstractCvodeCell{
+public:
+  static void* Get(AbstractCvodeSystem& r_system){
+    return r_system.*(&CvodeMemoryAccessor::mpCvodeMem);
+  }
+};
 
 void RunSimulation(boost::shared_ptr<AbstractCvodeCell> p_model, unsigned int paces, unsigned int period, double tolerances){
   boost::shared_ptr<RegularStimulus> p_stimulus;
@@ -39,7 +57,7 @@ int LoadStatesFromFile(boost::shared_ptr<AbstractCvodeCell> p_model, std::string
   return 0;
 }
 
-std::vector<double> GetNthVariable(std::vector<std::vector<double>> states, unsigned int index){
+std::vector<double> GetNthVariable(const std::vector<std::vector<double>>& states, unsigned int index){
   std::vector<double> vec;
   vec.reserve(states.size());
   for(auto i = states.begin(); i!=states.end(); i++){
@@ -48,7 +66,7 @@ std::vector<double> GetNthVariable(std::vector<std::vector<double>> states, unsi
   return vec;
 }
 
-std::vector<double> cGetNthVariable(boost::circular_buffer<std::vector<double>> states, unsigned int index){
+std::vector<double> cGetNthVariable(const boost::circular_buffer<std::vector<double>>& states, unsigned int index){
   std::vector<double> vec;
   vec.reserve(states.size());
   for(auto i = states.begin(); i != states.end(); i++){
@@ -57,7 +75,7 @@ std::vector<double> cGetNthVariable(boost::circular_buffer<std::vector<double>>
   return vec;
 }
 
-double TwoNorm(std::vector<double> A, std::vector<double> B){
+double TwoNorm(const std::vector<double>& A, const std::vector<double>& B){
   double norm = 0;
   for(unsigned int i=0; i < A.size(); i++){
     double a = A[i];
@@ -67,18 +85,23 @@ double TwoNorm(std::vector<double> A, std::vector<double> B){
   return sqrt(norm);
 }
 
-double mrms(std::vector<double> A, std::vector<double> B){
+double mrms(const std::vector<double>& A, const std::vector<double>& B){
+  return mrms(A.data(), B.data(), A.size());
+}
+
+double mrms(const double* A, const double* B, unsigned int size){
+  TRACE_SCOPE("mrms");
   double norm = 0;
   
-  for(unsigned int i=0; i < A.size(); i++){
+  for(unsigned int i=0; i < size; i++){
     double a = A[i];
     double b = B[i];
     norm += pow((a - b)/(1 + abs(a)), 2);   
   }
-  return sqrt(norm/A.size());
+  return sqrt(norm/size);
 }
 
-double TwoNormTrace(std::vector<std::vector<double>> A, std::vector<std::vector<double>> B){
+double TwoNormTrace(const std::vector<std::vector<double>>& A, const std::vector<std::vector<double>>& B){
   double norm = 0;
   for(unsigned int i = 0; i < A.size(); i++){
     for(unsigned int j = 0; j < A[0].size(); j++){
@@ -88,7 +111,7 @@ double TwoNormTrace(std::vector<std::vector<double>> A, std::vector<std::vector<
   return sqrt(norm);  
 }
 
-double mrmsTrace(std::vector<std::vector<double>> A, std::vector<std::vector<double>> B){
+double mrmsTrace(const std::vector<std::vector<double>>& A, const std::vector<std::vector<double>>& B){
   double norm = 0;
   for(unsigned int i = 0; i < A.size(); i++){
     for(unsigned int j = 0; j < A[0].size(); j++){
@@ -100,7 +123,44 @@ double mrmsTrace(std::vector<std::vector<double>> A, std::vector<std::vector<dou
   return sqrt(norm/(A.size() * A[0].size()));
 }
 
+namespace{
+  /*The times GetPace has always sampled at: both halves of the pace, with the end of the stimulus once*/
+  std::vector<double> GetPaceSamplingTimes(double period, double duration, double sampling_timestep){
+    std::vector<double> times = GetSamplingTimes(0, duration, sampling_timestep);
+    const std::vector<double> after_stimulus = GetSamplingTimes(duration, period, sampling_timestep);
+    times.insert(times.end(), ++after_stimulus.begin(), after_stimulus.end());
+    return times;
+  }
+
+  /*The largest value of f between start_time and end_time, by golden section search, for an f with one maximum there*/
+  double MaximiseOnInterval(std::function<double(double)> f, double start_time, double end_time){
+    const double ratio = (sqrt(5.0) - 1)/2;
+    double lower = end_time - ratio*(end_time - start_time);
+    double upper = start_time + ratio*(end_time - start_time);
+    double f_lower = f(lower);
+    double f_upper = f(upper);
+    while(end_time - start_time > 1e-12*std::max(1.0, std::abs(end_time))){
+      if(f_lower < f_upper){
+        start_time = lower;
+        lower = upper;
+        f_lower = f_upper;
+        upper = start_time + ratio*(end_time - start_time);
+        f_upper = f(upper);
+      }
+      else{
+        end_time = upper;
+        upper = lower;
+        f_upper = f_lower;
+        lower = end_time - ratio*(end_time - start_time);
+        f_lower = f(lower);
+      }
+    }
+    return std::max({f(start_time), f(end_time), f_lower, f_upper});
+  }
+}
+
 double CalculateAPD(boost::shared_ptr<AbstractCvodeCell> p_model, double period, double duration, double percentage){
+  TRACE_SCOPE("CalculateAPD");
   double apd;
 
   double sampling_timestep = 0.1;
@@ -131,7 +191,42 @@ double CalculateAPD(boost::shared_ptr<AbstractCvodeCell> p_model, double period,
   return apd;
 }
 
+BeatBiomarkers CalculateBiomarkers(boost::shared_ptr<AbstractCvodeCell> p_model, double period, double duration, double percentage){
+  TRACE_SCOPE("CalculateBiomarkers");
+  const double sampling_timestep = 0.1;
+  const DenseTrace trace = GetDensePace(p_model->GetStdVecStateVariables(), p_model, period, duration);
+  const std::vector<double> times = GetPaceSamplingTimes(period, duration, sampling_timestep);
+  const unsigned int voltage_index = p_model->GetSystemInformation()->GetStateVariableIndex("membrane_voltage");
+  const std::vector<double> voltages = trace.GetVariable(voltage_index, times);
+
+  BeatBiomarkers biomarkers;
+  try{
+    CellProperties cell_props = CellProperties(voltages, times);
+    biomarkers.apd = cell_props.GetLastActionPotentialDuration(percentage);
+    biomarkers.resting_voltage = cell_props.GetLastRestingPotential();
+
+    /*The sampled maxima move in jumps as the peak and the upstroke slide between
+      samples, so refine them on the trace's polynomials, which are smooth in the
+      state and the parameters, a sample either side of where the samples put them*/
+    const unsigned int peak = std::max_element(voltages.begin(), voltages.end()) - voltages.begin();
+    biomarkers.peak_voltage = MaximiseOnInterval([&](double time){ return trace.GetValue(voltage_index, time); },
+                                                 times[peak > 0 ? peak - 1 : 0], times[std::min<size_t>(peak + 1, times.size() - 1)]);
+    unsigned int upstroke = 0;
+    for(unsigned int i = 1; i + 1 < times.size(); i++){
+      if((voltages[i + 1] - voltages[i])/(times[i + 1] - times[i]) > (voltages[upstroke + 1] - voltages[upstroke])/(times[upstroke + 1] - times[upstroke]))
+        upstroke = i;
+    }
+    biomarkers.max_upstroke_velocity = MaximiseOnInterval([&](double time){ return trace.GetTimeDerivative(voltage_index, time); },
+                                                          times[upstroke > 0 ? upstroke - 1 : 0], times[std::min<size_t>(upstroke + 2, times.size() - 1)]);
+  }
+  catch(Exception &e){
+    /*No action potential (a blocked beat), so no biomarkers*/
+  }
+  return biomarkers;
+}
+
 std::vector<std::vector<double>> GetPace(std::vector<double> initial_conditions, boost::shared_ptr<AbstractCvodeCell> p_model, double period, double duration){ 
+  TRACE_SCOPE("GetPace");
   double sampling_timestep = 0.1;
   const std::vector<double> original_states = p_model->GetStdVecStateVariables();
   const double rel_tol = p_model->GetRelativeTolerance();
@@ -169,7 +264,8 @@ double CalculatePaceMrms(boost::shared_ptr<AbstractCvodeCell> p_model, std::vect
 
 
 
-double CalculatePMCC(std::vector<double> x, std::vector<double> y){
+double CalculatePMCC(const std::vector<double>& x, const std::vector<double>& y){
+  TRACE_SCOPE("CalculatePMCC");
   const unsigned int N = x.size();
   // const double sum_x = N*(N-1)/2;
   // const double sum_x2 = (N-1)*N*(2*N-1)/6;
@@ -193,10 +289,250 @@ double CalculatePMCC(std::vector<double> x, std::vector<double> y){
   return pmcc;
 }
 
-void WriteStatesToFile(std::vector<double> states, std::ofstream &f_out){
+void GetLogDifferences(const std::vector<double>& values, std::vector<double>& x_vals, std::vector<double>& y_vals){
+  y_vals.reserve(values.size());
+  x_vals.reserve(values.size());
+  for(unsigned int i = 0; i + 1 < values.size(); i++){
+    double tmp = abs(values[i] - values[i+1]);
+    if(tmp != 0){
+      y_vals.push_back(log(tmp));
+      x_vals.push_back(i);
+    }
+  }
+}
+
+bool FitLine(const std::vector<double>& x_vals, const std::vector<double>& y_vals, double& r_alpha, double& r_beta){
+  /*Compute the required sums*/
+  double sum_x = 0, sum_y = 0, sum_x2 = 0, sum_xy = 0;
+  const unsigned int N = x_vals.size();
+
+  if(N<=2){
+    return false;
+  }
+
+  for(unsigned int i = 0; i < N; i++){
+    sum_x += x_vals[i];
+    sum_y += y_vals[i];
+    sum_x2+= x_vals[i]*x_vals[i];
+    sum_xy+= x_vals[i]*y_vals[i];
+  }
+
+  r_beta  = (N*sum_xy - sum_x*sum_y) / (N*sum_x2 - sum_x*sum_x);
+  r_alpha = (sum_y*sum_x2 - sum_x*sum_xy) / (N*sum_x2 - sum_x*sum_x);
+  return true;
+}
+
+bool IsGeometricDecay(double pmcc, double alpha, double beta, double last_value, double relative_tolerance){
+  /*No negative correlation*/
+  if(pmcc > -0.75)
+    return false;
+  /*The difference will be about as small as solver tolerances so there is no point going any further*/
+  if(exp(alpha) < 100*relative_tolerance*last_value)
+    return false;
+  /*The difference is increasing*/
+  return beta <= 0;
+}
+
+double GeometricJump(const std::vector<double>& values, double alpha, double beta, double coefficient){
+  const double tau = -1/beta;
+  const double length = values.size();
+  double change_in_variable = abs(coefficient * exp(alpha - length/tau + 1/tau) / (exp(1/tau) - 1));
+  /*Is V(t) increasing or decreasing?*/
+  if(values.back() - values.front() < 0)
+    change_in_variable = - change_in_variable;
+  return values.back() + change_in_variable;
+}
+
+void WriteStatesToFile(const std::vector<double>& states, std::ostream &f_out){
+  TRACE_SCOPE("WriteStatesToFile");
   for(auto i = states.begin(); i!=states.end(); ++i){
     f_out << *i << " ";
   }
   f_out << "\n";
   return;
 }
+
+void* GetCvodeMemory(boost::shared_ptr<AbstractCvodeCell> p_model){
+  return CvodeMemoryAccessor::Get(*p_model);
+}
+
+CvodeStatistics GetCvodeStatistics(boost::shared_ptr<AbstractCvodeCell> p_model){
+  CvodeStatistics statistics;
+  void* p_cvode_mem = GetCvodeMemory(p_model);
+  if(!p_cvode_mem)
+    return statistics;
+
+  long rhs_evaluations = 0, jacobian_rhs_evaluations = 0;
+  CVodeGetNumSteps(p_cvode_mem, &statistics.steps);
+  CVodeGetNumRhsEvals(p_cvode_mem, &rhs_evaluations);
+  CVodeGetNumNonlinSolvIters(p_cvode_mem, &statistics.nonlinear_iterations);
+  CVodeGetNumErrTestFails(p_cvode_mem, &statistics.error_test_failures);
+  CVodeGetLastStep(p_cvode_mem, &statistics.last_step_size);
+#if CHASTE_SUNDIALS_VERSION >= 40000
+  CVodeGetNumJacEvals(p_cvode_mem, &statistics.jacobian_evaluations);
+  CVodeGetNumLinRhsEvals(p_cvode_mem, &jacobian_rhs_evaluations);
+#else
+  CVDlsGetNumJacEvals(p_cvode_mem, &statistics.jacobian_evaluations);
+  CVDlsGetNumRhsEvals(p_cvode_mem, &jacobian_rhs_evaluations);
+#endif
+  /*Count the evaluations used to build finite difference Jacobians as well*/
+  statistics.rhs_evaluations = rhs_evaluations + jacobian_rhs_evaluations;
+  return statistics;
+}
+
+boost::shared_ptr<AbstractCvodeCell> CreateCvodeCell(const std::string& system_name){
+  typedef boost::shared_ptr<AbstractCvodeCell> (*CellFactory)();
+  static const std::vector<CellFactory> factories = {&CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>,
+                                                     &CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>,
+                                                     &CreateCvodeCell<Cellohara_rudy_2011_endoFromCellMLCvode>,
+                                                     &CreateCvodeCell<Cellshannon_wang_puglisi_weber_bers_2004FromCellMLCvode>,
+                                                     &CreateCvodeCell<Cellohara_rudy_cipa_v1_2017FromCellMLCvode>};
+  /*Ask each model its name once rather than keeping a second copy of the names*/
+  static const std::vector<std::string> names = [](){
+    std::vector<std::string> factory_names;
+    for(auto i = factories.begin(); i != factories.end(); i++)
+      factory_names.push_back((*i)()->GetSystemInformation()->GetSystemName());
+    return factory_names;
+  }();
+  for(unsigned int i = 0; i < names.size(); i++){
+    if(names[i] == system_name)
+      return factories[i]();
+  }
+  EXCEPTION("No model called " + system_name + " is compiled into this project");
+}
+
+void SolveLinearSystem(std::vector<std::vector<double>>& r_matrix, std::vector<std::vector<double>>& r_rhs){
+  const unsigned int n = r_matrix.size();
+  for(unsigned int k = 0; k < n; k++){
+    unsigned int pivot = k;
+    for(unsigned int i = k + 1; i < n; i++)
+      if(std::abs(r_matrix[i][k]) > std::abs(r_matrix[pivot][k]))
+        pivot = i;
+    std::swap(r_matrix[k], r_matrix[pivot]);
+    std::swap(r_rhs[k], r_rhs[pivot]);
+    if(r_matrix[k][k] == 0)
+      EXCEPTION("Singular matrix");
+    for(unsigned int i = k + 1; i < n; i++){
+      const double factor = r_matrix[i][k]/r_matrix[k][k];
+      if(factor == 0)
+        continue;
+      for(unsigned int j = k; j < n; j++)
+        r_matrix[i][j] -= factor*r_matrix[k][j];
+      for(unsigned int j = 0; j < r_rhs[i].size(); j++)
+        r_rhs[i][j] -= factor*r_rhs[k][j];
+    }
+  }
+  for(int k = int(n) - 1; k >= 0; k--){
+    for(unsigned int j = k + 1; j < n; j++)
+      for(unsigned int c = 0; c < r_rhs[k].size(); c++)
+        r_rhs[k][c] -= r_matrix[k][j]*r_rhs[j][c];
+    for(unsigned int c = 0; c < r_rhs[k].size(); c++)
+      r_rhs[k][c] /= r_matrix[k][k];
+  }
+}
+
+namespace{
+  /*The singular values of matrix by one-sided Jacobi rotations, with the
+    right singular vectors as the columns of r_vectors*/
+  std::vector<double> CalculateSingularValues(std::vector<std::vector<double>> matrix, std::vector<std::vector<double>>& r_vectors){
+    const unsigned int n = matrix.size();
+    r_vectors.assign(n, std::vector<double>(n, 0));
+    for(unsigned int i = 0; i < n; i++)
+      r_vectors[i][i] = 1;
+    const double epsilon = std::numeric_limits<double>::epsilon();
+    for(unsigned int sweep = 0; sweep < 60; sweep++){
+      bool rotated = false;
+      for(unsigned int p = 0; p + 1 < n; p++)
+        for(unsigned int q = p + 1; q < n; q++){
+          double alpha = 0, beta = 0, gamma = 0;
+          for(unsigned int i = 0; i < n; i++){
+            alpha += matrix[i][p]*matrix[i][p];
+            beta += matrix[i][q]*matrix[i][q];
+            gamma += matrix[i][p]*matrix[i][q];
+          }
+          if(std::abs(gamma) <= epsilon*sqrt(alpha*beta))
+            continue;
+          rotated = true;
+          const double zeta = (beta - alpha)/(2*gamma);
+          const double t = (zeta >= 0 ? 1 : -1)/(std::abs(zeta) + sqrt(1 + zeta*zeta));
+          const double c = 1/sqrt(1 + t*t);
+          const double s = c*t;
+          for(std::vector<std::vector<double>>* p_columns : {&matrix, &r_vectors})
+            for(unsigned int i = 0; i < n; i++){
+              const double a = (*p_columns)[i][p];
+              const double b = (*p_columns)[i][q];
+              (*p_columns)[i][p] = c*a - s*b;
+              (*p_columns)[i][q] = s*a + c*b;
+            }
+        }
+      if(!rotated)
+        break;
+    }
+    std::vector<double> singular_values(n, 0);
+    for(unsigned int j = 0; j < n; j++){
+      for(unsigned int i = 0; i < n; i++)
+        singular_values[j] += matrix[i][j]*matrix[i][j];
+      singular_values[j] = sqrt(singular_values[j]);
+    }
+    return singular_values;
+  }
+
+}
+
+std::vector<double> SolveKeepingConservedQuantities(const std::vector<std::vector<double>>& a, const std::vector<double>& b){
+  const unsigned int n = a.size();
+  std::vector<std::vector<double>> right_vectors, left_vectors;
+  const std::vector<double> singular_values = CalculateSingularValues(a, right_vectors);
+  std::vector<std::vector<double>> transpose(n, std::vector<double>(n));
+  for(unsigned int i = 0; i < n; i++)
+    for(unsigned int j = 0; j < n; j++)
+      transpose[i][j] = a[j][i];
+  std::vector<double> left_singular_values = CalculateSingularValues(transpose, left_vectors);
+  const double cutoff = 1e-6*(*std::max_element(singular_values.begin(), singular_values.end()));
+
+  /*The least squares solution on the well determined part: v (a'b).v/s^2*/
+  std::vector<double> x(n, 0);
+  std::vector<unsigned int> null_right, null_left;
+  for(unsigned int k = 0; k < n; k++){
+    if(singular_values[k] <= cutoff){
+      null_right.push_back(k);
+      continue;
+    }
+    double projection = 0;
+    for(unsigned int i = 0; i < n; i++)
+      for(unsigned int j = 0; j < n; j++)
+        projection += b[i]*a[i][j]*right_vectors[j][k];
+    for(unsigned int j = 0; j < n; j++)
+      x[j] += right_vectors[j][k]*projection/(singular_values[k]*singular_values[k]);
+  }
+  if(null_right.empty())
+    return x;
+  std::vector<unsigned int> order(n);
+  for(unsigned int k = 0; k < n; k++)
+    order[k] = k;
+  std::sort(order.begin(), order.end(), [&](unsigned int i, unsigned int j){return left_singular_values[i] < left_singular_values[j];});
+  null_left.assign(order.begin(), order.begin() + null_right.size());
+
+  /*x + sum of c_k v_k with u_j.(x + sum of c_k v_k) = 0 for every null u_j*/
+  const unsigned int nullity = null_right.size();
+  std::vector<std::vector<double>> overlaps(nullity, std::vector<double>(nullity, 0));
+  std::vector<std::vector<double>> coefficients(nullity, std::vector<double>(1, 0));
+  for(unsigned int j = 0; j < nullity; j++){
+    for(unsigned int i = 0; i < n; i++){
+      coefficients[j][0] -= left_vectors[i][null_left[j]]*x[i];
+      for(unsigned int k = 0; k < nullity; k++)
+        overlaps[j][k] += left_vectors[i][null_left[j]]*right_vectors[i][null_right[k]];
+    }
+  }
+  try{
+    SolveLinearSystem(overlaps, coefficients);
+  }
+  catch(Exception &e){
+    /*No way to correct along the null space without changing a conserved quantity*/
+    return x;
+  }
+  for(unsigned int k = 0; k < nullity; k++)
+    for(unsigned int i = 0; i < n; i++)
+      x[i] += coefficients[k][0]*right_vectors[i][null_right[k]];
+  return x;
+}
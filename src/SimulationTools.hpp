@@ -1,3 +1,6 @@
+#ifndef SIMULATIONTOOLS_HPP
+#define SIMULATIONTOOLS_HPP
+
 #include "CellProperties.hpp"
 #include "AbstractCvodeCell.hpp"
 #include "RegularStimulus.hpp"
@@ -10,6 +13,50 @@
 #include <sstream>
 #include <iostream>
 
+/** Counters of the work CVODE has done since it was last (re)initialised */
+struct CvodeStatistics{
+  long steps = 0;
+  long rhs_evaluations = 0;
+  long jacobian_evaluations = 0;
+  long nonlinear_iterations = 0;
+  long error_test_failures = 0;
+  /*Not a counter - sums and differences keep the most recent value*/
+  double last_step_size = 0;
+
+  CvodeStatistics& operator+=(const CvodeStatistics& other){
+    steps += other.steps;
+    rhs_evaluations += other.rhs_evaluations;
+    jacobian_evaluations += other.jacobian_evaluations;
+    nonlinear_iterations += other.nonlinear_iterations;
+    error_test_failures += other.error_test_failures;
+    last_step_size = other.last_step_size;
+    return *this;
+  }
+
+  CvodeStatistics operator-(const CvodeStatistics& other) const{
+    CvodeStatistics difference = *this;
+    difference.steps -= other.steps;
+    difference.rhs_evaluations -= other.rhs_evaluations;
+    difference.jacobian_evaluations -= other.jacobian_evaluations;
+    difference.nonlinear_iterations -= other.nonlinear_iterations;
+    difference.error_test_failures -= other.error_test_failures;
+    return difference;
+  }
+};
+
+/** Solver work for one pace, split at the end of the stimulus so the upstroke can be told apart from the rest of the beat */
+struct PaceCvodeStatistics{
+  unsigned int pace = 0;
+  CvodeStatistics during_stimulus;
+  CvodeStatistics after_stimulus;
+
+  CvodeStatistics GetTotal() const{
+    CvodeStatistics total = during_stimulus;
+    total += after_stimulus;
+    return total;
+  }
+};
+
 const std::vector<std::string> model_names = {"beeler_reuter_model_1997", "ten_tusscher_model_2004_epi", "ohara_rudy_2011_endo", "shannon_wang_puglisi_weber_bers_2004"};
 
 void RunSimulation(boost::shared_ptr<AbstractCvodeCell>, unsigned int paces, double tolerances);
@@ -18,34 +65,72 @@ int LoadStatesFromFile(boost::shared_ptr<AbstractCvodeCell>, std::string file_pa
 
 void OutputVariablesToFile(boost::shared_ptr<AbstractCvodeCell>, std::string file_path);
 
-std::vector<double> GetNthVariable(std::vector<std::vector<double>>, unsigned int);
+std::vector<double> GetNthVariable(const std::vector<std::vector<double>>&, unsigned int);
+
+std::vector<double> cGetNthVariable(const boost::circular_buffer<std::vector<double>>&, unsigned int);
 
-std::vector<double> cGetNthVariable(boost::circular_buffer<std::vector<double>>, unsigned int);
+double mrms(const std::vector<double>&, const std::vector<double>&);
 
-double mrms(std::vector<double>, std::vector<double>);
+/**mrms of two arrays of length size, for callers that don't keep their states in a std::vector*/
+double mrms(const double* A, const double* B, unsigned int size);
 
-double TwoNorm(std::vector<double>, std::vector<double>);
+double TwoNorm(const std::vector<double>&, const std::vector<double>&);
 
-double mrmsTrace(std::vector<std::vector<double>>, std::vector<std::vector<double>>);
+double mrmsTrace(const std::vector<std::vector<double>>&, const std::vector<std::vector<double>>&);
 
-double TwoNormTrace(std::vector<std::vector<double>>, std::vector<std::vector<double>>);
+double TwoNormTrace(const std::vector<std::vector<double>>&, const std::vector<std::vector<double>>&);
 
 double CalculateAPD(boost::shared_ptr<AbstractCvodeCell>, double, double, double);
 
+/** Biomarkers of one beat, from the voltage trace of a pace */
+struct BeatBiomarkers{
+  double apd = NAN;
+  double peak_voltage = NAN;
+  double resting_voltage = NAN;
+  double max_upstroke_velocity = NAN;
+};
+
+/** The biomarkers of a pace from the model's current state, like CalculateAPD, or NaNs for a beat without an action potential. The peak voltage and the maximum upstroke velocity are the maxima of the pace's dense output rather than of its samples. The model's state is left unchanged. */
+BeatBiomarkers CalculateBiomarkers(boost::shared_ptr<AbstractCvodeCell>, double period, double duration, double percentage);
+
 std::vector<double> FitExponential(std::vector<double> x_vals, std::vector<double> y_vals);
 
 double CalculatePace2Norm(boost::shared_ptr<AbstractCvodeCell> p_model, std::vector<double> first_states, std::vector<double> second_states, double period, double duration);
 
 double CalculatePaceMrms(boost::shared_ptr<AbstractCvodeCell> p_model, std::vector<double> first_states, std::vector<double> second_states, double period, double duration);
 
-void WriteStatesToFile(std::vector<double> states, std::ofstream &f_out);
+void WriteStatesToFile(const std::vector<double>& states, std::ostream &f_out);
 
 std::vector<std::vector<double>> GetPace(std::vector<double> initial_conditions, boost::shared_ptr<AbstractCvodeCell> p_model, double period, double duration); 
 
-double CalculatePMCC(std::vector<double>, std::vector<double>);
+double CalculatePMCC(const std::vector<double>&, const std::vector<double>&);
+
+/**The log absolute differences between consecutive values in y_vals, against their position in x_vals. Zero differences are skipped.*/
+void GetLogDifferences(const std::vector<double>& values, std::vector<double>& x_vals, std::vector<double>& y_vals);
+
+/**Least squares fit of y = alpha + beta*x. False if there are too few points.*/
+bool FitLine(const std::vector<double>& x_vals, const std::vector<double>& y_vals, double& r_alpha, double& r_beta);
+
+/**Whether a fit of log differences (see GetLogDifferences) is a decay worth extrapolating: strongly correlated, decreasing, and with differences well above the solver's relative tolerance*/
+bool IsGeometricDecay(double pmcc, double alpha, double beta, double last_value, double relative_tolerance);
+
+/**Where values ends up if its differences carry on decaying as fitted, moving coefficient of the way there from the last value*/
+double GeometricJump(const std::vector<double>& values, double alpha, double beta, double coefficient);
+
+/**Solve r_matrix X = r_rhs in place, for every column of r_rhs at once, by Gaussian elimination with partial pivoting*/
+void SolveLinearSystem(std::vector<std::vector<double>>& r_matrix, std::vector<std::vector<double>>& r_rhs);
+
+/**Solve a x = b for a = I - J, J the Jacobian of a pace map (in the relative
+   scale), which is (close to) singular when the model conserves something.
+   Along singular values below 1e-6 of the largest (multipliers within about
+   1e-6 of 1, which pacing can't resolve either, and the exact 1s of conserved
+   quantities) there is nothing to solve for, so x is made up there of the
+   right singular vectors that leave the matching left singular vectors'
+   combinations of the state, the conserved quantities, unchanged.*/
+std::vector<double> SolveKeepingConservedQuantities(const std::vector<std::vector<double>>& a, const std::vector<double>& b);
 
 template<typename Container>
-double CalculatePMCC(Container values){
+double CalculatePMCC(const Container& values){
   const unsigned int N = values.size();
   // const double sum_x = N*(N-1)/2;
   //const double sum_x2 = (N-1)*N*(2*N-1)/6;
@@ -67,4 +152,21 @@ double CalculatePMCC(Container values){
   return pmcc;
 }
 
+/**The model's CVODE memory, or NULL if it has not been solved yet*/
+void* GetCvodeMemory(boost::shared_ptr<AbstractCvodeCell>);
+
+CvodeStatistics GetCvodeStatistics(boost::shared_ptr<AbstractCvodeCell>);
+
+/** Make a fresh instance of a generated Cvode cell, for when each thread or run needs its own model */
+template<class CELL>
+boost::shared_ptr<AbstractCvodeCell> CreateCvodeCell(){
+  boost::shared_ptr<RegularStimulus> p_stimulus;
+  boost::shared_ptr<AbstractIvpOdeSolver> p_solver;
+  return boost::shared_ptr<AbstractCvodeCell>(new CELL(p_solver, p_stimulus));
+}
+
+/**A fresh instance of one of the models compiled into this project, by the name
+   GetSystemInformation()->GetSystemName() gives*/
+boost::shared_ptr<AbstractCvodeCell> CreateCvodeCell(const std::string& system_name);
 
+#endif
@@ -0,0 +1,130 @@
+#include "SteadyStateSensitivity.hpp"
+#include "SimulationTools.hpp"
+#include "Tracing.hpp"
+#include "Exception.hpp"
+
+#include <thread>
+#include <exception>
+#include <functional>
+#include <algorithm>
+
+namespace{
+  /*Call task(fork, i) for every i below count, each fork on its own thread taking every forks.size()-th i*/
+  void RunInParallel(std::vector<Simulation>& r_forks, unsigned int count, std::function<void(Simulation&, unsigned int)> task){
+    std::vector<std::exception_ptr> errors(r_forks.size());
+    std::vector<std::thread> workers;
+    for(unsigned int t = 0; t < r_forks.size(); t++){
+      workers.push_back(std::thread([&, t](){
+        try{
+          for(unsigned int i = t; i < count; i += r_forks.size())
+            task(r_forks[t], i);
+        }
+        catch(...){
+          errors[t] = std::current_exception();
+        }
+      }));
+    }
+    for(auto i = workers.begin(); i != workers.end(); i++)
+      i->join();
+    for(auto i = errors.begin(); i != errors.end(); i++)
+      if(*i)
+        std::rethrow_exception(*i);
+  }
+
+  BeatBiomarkers GetDerivatives(const BeatBiomarkers& r_base, const BeatBiomarkers& r_perturbed, double step){
+    BeatBiomarkers derivatives;
+    derivatives.apd = (r_perturbed.apd - r_base.apd)/step;
+    derivatives.peak_voltage = (r_perturbed.peak_voltage - r_base.peak_voltage)/step;
+    derivatives.resting_voltage = (r_perturbed.resting_voltage - r_base.resting_voltage)/step;
+    derivatives.max_upstroke_velocity = (r_perturbed.max_upstroke_velocity - r_base.max_upstroke_velocity)/step;
+    return derivatives;
+  }
+}
+
+SteadyStateSensitivities CalculateSteadyStateSensitivities(Simulation& r_simulation, const std::vector<std::string>& parameter_names,
+                                                           unsigned int threads, double perturbation, double tolerance, double percentage){
+  TRACE_SCOPE("CalculateSteadyStateSensitivities");
+  const std::vector<double> fixed_point = r_simulation.GetStateVariables();
+  const unsigned int n = fixed_point.size();
+  const unsigned int number_of_parameters = parameter_names.size();
+
+  std::vector<double> scale(n);
+  for(unsigned int i = 0; i < n; i++)
+    scale[i] = 1 + std::abs(fixed_point[i]);
+  std::vector<double> values(number_of_parameters), steps(number_of_parameters);
+  for(unsigned int k = 0; k < number_of_parameters; k++){
+    values[k] = r_simulation.GetParameter(parameter_names[k]);
+    steps[k] = perturbation*(values[k] != 0 ? std::abs(values[k]) : 1);
+  }
+
+  /*One fork per thread, each solving more tightly than the finite difference steps*/
+  std::vector<Simulation> forks;
+  for(unsigned int i = 0; i < std::max(1u, std::min(threads, n + number_of_parameters)); i++){
+    forks.push_back(r_simulation.Fork());
+    forks.back().SetTolerances(tolerance, tolerance);
+  }
+  const std::vector<double> image = forks[0].ApplyPaceMap(fixed_point);
+
+  /*The pace map with each variable perturbed in turn, then each parameter*/
+  std::vector<std::vector<double>> perturbed_images(n + number_of_parameters);
+  RunInParallel(forks, n + number_of_parameters, [&](Simulation& r_fork, unsigned int i){
+    if(i < n){
+      std::vector<double> perturbed_state = fixed_point;
+      perturbed_state[i] += perturbation*scale[i];
+      perturbed_images[i] = r_fork.ApplyPaceMap(perturbed_state);
+      return;
+    }
+    const unsigned int k = i - n;
+    r_fork.SetParameter(parameter_names[k], values[k] + steps[k]);
+    perturbed_images[i] = r_fork.ApplyPaceMap(fixed_point);
+    r_fork.SetParameter(parameter_names[k], values[k]);
+  });
+
+  /*I - dP/dx, in the relative scale*/
+  std::vector<std::vector<double>> matrix(n, std::vector<double>(n));
+  for(unsigned int i = 0; i < n; i++)
+    for(unsigned int j = 0; j < n; j++)
+      matrix[i][j] = (i == j ? 1 : 0) - (perturbed_images[j][i] - image[i])/(perturbation*scale[i]);
+
+  SteadyStateSensitivities sensitivities;
+  std::vector<double> rhs(n);
+  for(unsigned int i = 0; i < n; i++)
+    rhs[i] = (image[i] - fixed_point[i])/scale[i];
+  const std::vector<double> correction = SolveKeepingConservedQuantities(matrix, rhs);
+  sensitivities.steady_state = fixed_point;
+  for(unsigned int i = 0; i < n; i++)
+    sensitivities.steady_state[i] += correction[i]*scale[i];
+
+  for(unsigned int k = 0; k < number_of_parameters; k++){
+    for(unsigned int i = 0; i < n; i++)
+      rhs[i] = (perturbed_images[n + k][i] - image[i])/(steps[k]*scale[i]);
+    const std::vector<double> derivatives = SolveKeepingConservedQuantities(matrix, rhs);
+    ParameterSensitivity sensitivity;
+    sensitivity.parameter = parameter_names[k];
+    sensitivity.value = values[k];
+    sensitivity.state_derivatives.resize(n);
+    for(unsigned int i = 0; i < n; i++)
+      sensitivity.state_derivatives[i] = derivatives[i]*scale[i];
+    sensitivities.parameters.push_back(sensitivity);
+  }
+
+  /*Biomarkers at the steady state, then a step along each parameter's path of steady states*/
+  std::vector<BeatBiomarkers> biomarkers(number_of_parameters + 1);
+  RunInParallel(forks, number_of_parameters + 1, [&](Simulation& r_fork, unsigned int i){
+    if(i == 0){
+      biomarkers[0] = r_fork.GetBiomarkers(sensitivities.steady_state, percentage);
+      return;
+    }
+    const unsigned int k = i - 1;
+    std::vector<double> state = sensitivities.steady_state;
+    for(unsigned int j = 0; j < n; j++)
+      state[j] += steps[k]*sensitivities.parameters[k].state_derivatives[j];
+    r_fork.SetParameter(parameter_names[k], values[k] + steps[k]);
+    biomarkers[i] = r_fork.GetBiomarkers(state, percentage);
+    r_fork.SetParameter(parameter_names[k], values[k]);
+  });
+  sensitivities.biomarkers = biomarkers[0];
+  for(unsigned int k = 0; k < number_of_parameters; k++)
+    sensitivities.parameters[k].biomarker_derivatives = GetDerivatives(biomarkers[0], biomarkers[k + 1], steps[k]);
+  return sensitivities;
+}
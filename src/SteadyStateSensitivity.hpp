@@ -0,0 +1,50 @@
+#ifndef STEADYSTATESENSITIVITY_HPP
+#define STEADYSTATESENSITIVITY_HPP
+
+#include "Simulation.hpp"
+#include <vector>
+#include <string>
+
+/* How the steady state and its biomarkers move with the model's parameters,
+   from one steady state rather than re-pacing a perturbed model to steady
+   state for every parameter.
+
+   The steady state x is a fixed point of the pace map, x = P(x, p), so
+   differentiating along a parameter gives (I - dP/dx) dx/dp = dP/dp. The pace
+   map's Jacobian dP/dx (one pace per state variable) is shared by every
+   parameter, and each parameter costs one more pace for dP/dp and one for its
+   biomarkers, whose derivative is taken along the steady state's path,
+   (B(x + e dx/dp, p + e) - B(x, p))/e. All the paces are finite differences,
+   solved on forks of the simulation with tight tolerances, in parallel. The
+   peak voltage and upstroke velocity are maxima of the dense output (see
+   ::CalculateBiomarkers), so they move smoothly with such small steps. A
+   conserved quantity (a multiplier of exactly 1) has no steady state value
+   of its own, so it is held where the simulation has it, as pacing from the
+   same start would. */
+
+struct ParameterSensitivity{
+  std::string parameter;
+  double value;
+  /*d(steady state)/d(parameter)*/
+  std::vector<double> state_derivatives;
+  /*d(biomarker)/d(parameter) for each biomarker*/
+  BeatBiomarkers biomarker_derivatives;
+};
+
+struct SteadyStateSensitivities{
+  /*The simulation's state, improved by one Newton step on the pace map*/
+  std::vector<double> steady_state;
+  BeatBiomarkers biomarkers;
+  std::vector<ParameterSensitivity> parameters;
+};
+
+/**Sensitivities of r_simulation's steady state (its current state, which
+   should be converged) to each of the named parameters. perturbation is the
+   finite difference step relative to each variable and parameter, tolerance
+   the CVODE tolerance the forks solve with, which needs to be well below it,
+   and percentage the APD's repolarisation level.*/
+SteadyStateSensitivities CalculateSteadyStateSensitivities(Simulation& r_simulation, const std::vector<std::string>& parameter_names,
+                                                           unsigned int threads = 4, double perturbation = 1e-4, double tolerance = 1e-10,
+                                                           double percentage = 90);
+
+#endif
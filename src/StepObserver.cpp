@@ -0,0 +1,276 @@
+#include "StepObserver.hpp"
+#include "SimulationTools.hpp"
+#include "Tracing.hpp"
+#include "Exception.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <cvode/cvode.h>
+#include <nvector/nvector_serial.h>
+
+namespace{
+  /*The m-th derivative of one variable's Taylor polynomial, a distance s from the
+    expansion point: sum over k >= m of y^(k) s^(k-m)/(k-m)!*/
+  double EvaluateTaylor(const std::vector<std::vector<double>>& r_derivatives, unsigned int variable_index, double s, unsigned int m = 0){
+    const unsigned int order = r_derivatives.size() - 1;
+    if(m > order)
+      return 0;
+    double value = r_derivatives[order][variable_index];
+    for(int k = int(order) - 1; k >= int(m); k--)
+      value = value*s/(k - m + 1) + r_derivatives[k][variable_index];
+    return value;
+  }
+
+  /*Bisect for a sign change of f between a and b, where f(a) and f(b) differ in sign*/
+  template<typename FUNCTION>
+  double Bisect(FUNCTION f, double a, double b, double tolerance){
+    double f_a = f(a);
+    while(b - a > tolerance){
+      const double middle = (a + b)/2;
+      const double f_middle = f(middle);
+      if((f_middle > 0) == (f_a > 0)){
+        a = middle;
+        f_a = f_middle;
+      }
+      else
+        b = middle;
+    }
+    return (a + b)/2;
+  }
+}
+
+void CvodeStep::Interpolate(double time, std::vector<double>& r_state_variables) const{
+  const unsigned int number_of_variables = r_derivatives[0].size();
+  r_state_variables.resize(number_of_variables);
+  const double s = time - expansion_time;
+  for(unsigned int i = 0; i < number_of_variables; i++)
+    r_state_variables[i] = EvaluateTaylor(r_derivatives, i, s);
+}
+
+double CvodeStep::Interpolate(unsigned int variable_index, double time) const{
+  return EvaluateTaylor(r_derivatives, variable_index, time - expansion_time);
+}
+
+void AbstractStepObserver::Sample(double time, const std::vector<double>& r_state_variables){
+  /*Times closer than this are the same sample: the end of one solve and the start of the next, or a
+    multiple of the timestep a rounding error away from a solve's end*/
+  const double tolerance = 1e-10*std::max(1.0, std::abs(time));
+  if(std::abs(time - last_sample_time) <= tolerance)
+    return;
+  last_sample_time = time;
+  Observe(time, r_state_variables);
+}
+
+void AbstractStepObserver::Start(double time, const std::vector<double>& r_state_variables){
+  Sample(time, r_state_variables);
+}
+
+void AbstractStepObserver::ObserveStep(const CvodeStep& r_step){
+  if(sampling_timestep <= 0){
+    Sample(r_step.GetEndTime(), r_step.rGetStateVariables());
+    return;
+  }
+  /*Multiples of the timestep in (start, end). The end of the solve is sampled by Finish.*/
+  for(double k = std::floor(r_step.GetStartTime()/sampling_timestep) + 1; k*sampling_timestep < r_step.GetEndTime(); k++){
+    r_step.Interpolate(k*sampling_timestep, sample);
+    Sample(k*sampling_timestep, sample);
+  }
+  if(std::abs(r_step.GetEndTime()/sampling_timestep - std::round(r_step.GetEndTime()/sampling_timestep)) < 1e-10){
+    r_step.Interpolate(r_step.GetEndTime(), sample);
+    Sample(r_step.GetEndTime(), sample);
+  }
+}
+
+void AbstractStepObserver::Finish(double time, const std::vector<double>& r_state_variables){
+  Sample(time, r_state_variables);
+}
+
+namespace{
+  /*What RecordStep needs to hand the steps of the current solve to its observers*/
+  class StepRecorder{
+  public:
+    void* p_cvode_mem;
+    double end_time;
+    double step_start_time;
+    long last_step = 0;
+    N_Vector derivative;
+    std::vector<std::vector<double>> derivatives;
+    const std::vector<boost::shared_ptr<AbstractStepObserver>>& r_observers;
+    std::exception_ptr p_exception;
+
+    StepRecorder(void* _p_cvode_mem, double start_time, double _end_time, unsigned int number_of_variables,
+                 const std::vector<boost::shared_ptr<AbstractStepObserver>>& _r_observers);
+    ~StepRecorder();
+  };
+
+  thread_local StepRecorder* p_current_recorder = NULL;
+
+  /*CVODE evaluates its root functions once after every step it takes, while its
+    history array still describes that step, so this one hands the step to the
+    observers. It is always positive and only decreasing roots are looked for,
+    so it can never have a root and CVODE steps exactly as it would without it.*/
+  int RecordStep(realtype t, N_Vector y, realtype* p_g, void* p_user_data){
+    p_g[0] = 1;
+    StepRecorder* p_recorder = p_current_recorder;
+    if(!p_recorder || p_recorder->p_exception)
+      return 0;
+    /*It is also evaluated at the start of a solve after CVODE is (re)initialised, before any step*/
+    long steps;
+    CVodeGetNumSteps(p_recorder->p_cvode_mem, &steps);
+    if(steps == 0 || steps == p_recorder->last_step)
+      return 0;
+    p_recorder->last_step = steps;
+    try{
+      /*The Nordsieck array is about the end of the step just taken, which for the
+        last step can be a rounding error either side of the stopping time*/
+      double expansion_time;
+      int order;
+      CVodeGetCurrentTime(p_recorder->p_cvode_mem, &expansion_time);
+      CVodeGetLastOrder(p_recorder->p_cvode_mem, &order);
+      std::vector<std::vector<double>>& r_derivatives = p_recorder->derivatives;
+      const unsigned int number_of_variables = r_derivatives[0].size();
+      r_derivatives.resize(order + 1, std::vector<double>(number_of_variables));
+      for(int k = 0; k <= order; k++){
+        CVodeGetDky(p_recorder->p_cvode_mem, expansion_time, k, p_recorder->derivative);
+        std::copy(NV_DATA_S(p_recorder->derivative), NV_DATA_S(p_recorder->derivative) + number_of_variables, r_derivatives[k].begin());
+      }
+      const double end_time = p_recorder->end_time;
+      const bool last = expansion_time >= end_time - 1e-10*std::max(1.0, std::abs(end_time));
+      const CvodeStep step(p_recorder->step_start_time, last ? end_time : expansion_time, expansion_time, r_derivatives);
+      for(auto i = p_recorder->r_observers.begin(); i != p_recorder->r_observers.end(); i++)
+        (*i)->ObserveStep(step);
+      p_recorder->step_start_time = step.GetEndTime();
+    }
+    catch(...){
+      /*Stop CVODE, and rethrow once we are out of it*/
+      p_recorder->p_exception = std::current_exception();
+      return -1;
+    }
+    return 0;
+  }
+
+  StepRecorder::StepRecorder(void* _p_cvode_mem, double start_time, double _end_time, unsigned int number_of_variables,
+                             const std::vector<boost::shared_ptr<AbstractStepObserver>>& _r_observers) :
+    p_cvode_mem(_p_cvode_mem), end_time(_end_time), step_start_time(start_time),
+    derivative(N_VNew_Serial(number_of_variables)), derivatives(1, std::vector<double>(number_of_variables)), r_observers(_r_observers){
+    /*Carrying on from an earlier solve, the step count doesn't restart*/
+    CVodeGetNumSteps(p_cvode_mem, &last_step);
+    int direction = -1;
+    CVodeRootInit(p_cvode_mem, 1, RecordStep);
+    CVodeSetRootDirection(p_cvode_mem, &direction);
+    p_current_recorder = this;
+  }
+
+  StepRecorder::~StepRecorder(){
+    p_current_recorder = NULL;
+    CVodeRootInit(p_cvode_mem, 0, NULL);
+    N_VDestroy_Serial(derivative);
+  }
+}
+
+void SolveAndObserve(boost::shared_ptr<AbstractCvodeCell> p_model, double start_time, double end_time,
+                     const std::vector<boost::shared_ptr<AbstractStepObserver>>& observers){
+  TRACE_SCOPE("SolveAndObserve");
+  const std::vector<double> initial_conditions = p_model->GetStdVecStateVariables();
+
+  if(!GetCvodeMemory(p_model)){
+    /*The model only creates its CVODE memory when it first solves, and the root
+      function has to be attached to it beforehand. After a tiny solve with the
+      state put back, the model re-initialises CVODE for the real solve, which
+      is the same integration as from a freshly created CVODE.*/
+    p_model->SolveAndUpdateState(start_time, start_time + 1e-6);
+    p_model->SetStateVariables(initial_conditions);
+  }
+
+  for(auto i = observers.begin(); i != observers.end(); i++)
+    (*i)->Start(start_time, initial_conditions);
+
+  /*The model sets CVODE up, decides whether to re-initialise it and records where
+    it stopped as it always does; we only watch the steps go by*/
+  std::exception_ptr p_observer_exception;
+  {
+    StepRecorder recorder(GetCvodeMemory(p_model), start_time, end_time, p_model->GetNumberOfStateVariables(), observers);
+    try{
+      p_model->SolveAndUpdateState(start_time, end_time);
+    }
+    catch(...){
+      if(!recorder.p_exception)
+        throw;
+    }
+    p_observer_exception = recorder.p_exception;
+  }
+  if(p_observer_exception)
+    std::rethrow_exception(p_observer_exception);
+
+  const std::vector<double> final_state = p_model->GetStdVecStateVariables();
+  for(auto i = observers.begin(); i != observers.end(); i++)
+    (*i)->Finish(end_time, final_state);
+}
+
+void ExtremaObserver::Update(double time, double value){
+  if(value < minimum){
+    minimum = value;
+    minimum_time = time;
+  }
+  if(value > maximum){
+    maximum = value;
+    maximum_time = time;
+  }
+}
+
+void ExtremaObserver::Start(double time, const std::vector<double>& r_state_variables){
+  Update(time, r_state_variables[variable_index]);
+}
+
+void ExtremaObserver::ObserveStep(const CvodeStep& r_step){
+  const double start_time = r_step.GetStartTime();
+  const double end_time = r_step.GetEndTime();
+  Update(end_time, r_step.Interpolate(variable_index, end_time));
+  /*A turning point inside the step shows up as a sign change in the derivative*/
+  auto derivative = [&](double t){
+    return EvaluateTaylor(r_step.rGetDerivatives(), variable_index, t - r_step.GetExpansionTime(), 1);
+  };
+  if((derivative(start_time) > 0) != (derivative(end_time) > 0)){
+    const double turning_time = Bisect(derivative, start_time, end_time, 1e-10*std::max(1.0, end_time - start_time));
+    Update(turning_time, r_step.Interpolate(variable_index, turning_time));
+  }
+}
+
+void ExtremaObserver::Reset(){
+  minimum = INFINITY;
+  maximum = -INFINITY;
+  minimum_time = maximum_time = NAN;
+}
+
+void ThresholdCrossingObserver::ObserveStep(const CvodeStep& r_step){
+  auto distance = [&](double t){
+    return r_step.Interpolate(variable_index, t) - threshold;
+  };
+  auto derivative = [&](double t){
+    return EvaluateTaylor(r_step.rGetDerivatives(), variable_index, t - r_step.GetExpansionTime(), 1);
+  };
+  /*Split the step at a turning point, so a peak that pokes above the threshold
+    and comes back within one step still gives both crossings*/
+  std::vector<double> pieces = {r_step.GetStartTime(), r_step.GetEndTime()};
+  if((derivative(pieces[0]) > 0) != (derivative(pieces[1]) > 0))
+    pieces.insert(pieces.begin() + 1, Bisect(derivative, pieces[0], pieces[1], 1e-10*std::max(1.0, pieces[1] - pieces[0])));
+  for(unsigned int i = 0; i + 1 < pieces.size(); i++){
+    const double start_distance = distance(pieces[i]);
+    const double end_distance = distance(pieces[i+1]);
+    if((start_distance < 0) == (end_distance < 0))
+      continue;
+    const double crossing = Bisect(distance, pieces[i], pieces[i+1], tolerance);
+    if(end_distance >= 0)
+      upward_crossings.push_back(crossing);
+    else
+      downward_crossings.push_back(crossing);
+  }
+}
+
+void RunningMrmsObserver::Observe(double time, const std::vector<double>& r_state_variables){
+  for(unsigned int i = 0; i < reference.size(); i++){
+    const double difference = (reference[i] - r_state_variables[i])/(1 + std::abs(reference[i]));
+    sum += difference*difference;
+  }
+  count++;
+}
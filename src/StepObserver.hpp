@@ -0,0 +1,195 @@
+#ifndef STEPOBSERVER_HPP
+#define STEPOBSERVER_HPP
+
+#include "AbstractCvodeCell.hpp"
+#include "TraceFile.hpp"
+#include <vector>
+#include <string>
+#include <cmath>
+#include <boost/shared_ptr.hpp>
+
+/* Streaming analysis of a solve.
+
+   SolveAndObserve solves through the model's own SolveAndUpdateState and hands
+   every accepted CVODE step to each observer, so any number of reductions can
+   share one integration and none of them needs the whole solution in memory.
+   The integration is exactly the one SolveAndUpdateState would do on its own. A step
+   carries CVODE's interpolating polynomial, so an observer can also ask for the
+   state anywhere inside it; observers constructed with a sampling timestep are
+   called at multiples of it (and at the ends of each solve, like Compute)
+   without CVODE ever stopping there. */
+
+/** One accepted CVODE step: from GetStartTime() to GetEndTime(), with the
+    derivatives of the solution at the end of the step */
+class CvodeStep{
+private:
+  double start_time;
+  double end_time;
+  double expansion_time;
+  const std::vector<std::vector<double>>& r_derivatives;
+public:
+  CvodeStep(double _start_time, double _end_time, double _expansion_time, const std::vector<std::vector<double>>& _r_derivatives) :
+    start_time(_start_time), end_time(_end_time), expansion_time(_expansion_time), r_derivatives(_r_derivatives){
+  }
+  double GetStartTime() const{
+    return start_time;
+  }
+  double GetEndTime() const{
+    return end_time;
+  }
+  /**The time the derivatives are taken at. CVODE's last step before a stopping
+     time can end a rounding error short of it, so this may differ from GetEndTime().*/
+  double GetExpansionTime() const{
+    return expansion_time;
+  }
+  unsigned int GetOrder() const{
+    return r_derivatives.size() - 1;
+  }
+  /**r_derivatives[k] is the k-th derivative of every state variable*/
+  const std::vector<std::vector<double>>& rGetDerivatives() const{
+    return r_derivatives;
+  }
+  const std::vector<double>& rGetStateVariables() const{
+    return r_derivatives[0];
+  }
+  /**The state at any time within the step, from CVODE's polynomial*/
+  void Interpolate(double time, std::vector<double>& r_state_variables) const;
+  double Interpolate(unsigned int variable_index, double time) const;
+};
+
+class AbstractStepObserver{
+private:
+  double sampling_timestep;
+  double last_sample_time = NAN;
+  std::vector<double> sample;
+
+  void Sample(double time, const std::vector<double>& r_state_variables);
+public:
+  /**A sampling timestep of 0 means Observe is called at the end of every step*/
+  AbstractStepObserver(double _sampling_timestep = 0) : sampling_timestep(_sampling_timestep){
+  }
+  virtual ~AbstractStepObserver(){
+  }
+
+  double GetSamplingTimestep() const{
+    return sampling_timestep;
+  }
+
+  /**Called once before the first step of each solve*/
+  virtual void Start(double time, const std::vector<double>& r_state_variables);
+
+  /**Called for every accepted step. Override this to use the whole step; by
+     default it calls Observe at the sampling times it covers.*/
+  virtual void ObserveStep(const CvodeStep& r_step);
+
+  /**Called once when a solve reaches its end time*/
+  virtual void Finish(double time, const std::vector<double>& r_state_variables);
+
+  /**The state at a sampling time. A time shared by the end of one solve and the
+     start of the next is only observed once.*/
+  virtual void Observe(double time, const std::vector<double>& r_state_variables){
+  }
+};
+
+/**Solve the model from start_time to end_time with its SolveAndUpdateState,
+   and show every step to each observer in turn*/
+void SolveAndObserve(boost::shared_ptr<AbstractCvodeCell> p_model, double start_time, double end_time,
+                     const std::vector<boost::shared_ptr<AbstractStepObserver>>& observers);
+
+/** The smallest and largest values one variable reaches, found from each step's
+    polynomial rather than from samples */
+class ExtremaObserver : public AbstractStepObserver{
+private:
+  unsigned int variable_index;
+  double minimum = INFINITY;
+  double maximum = -INFINITY;
+  double minimum_time = NAN;
+  double maximum_time = NAN;
+
+  void Update(double time, double value);
+public:
+  ExtremaObserver(unsigned int _variable_index) : variable_index(_variable_index){
+  }
+  void Start(double time, const std::vector<double>& r_state_variables);
+  void ObserveStep(const CvodeStep& r_step);
+  void Reset();
+
+  double GetMinimum() const{
+    return minimum;
+  }
+  double GetMaximum() const{
+    return maximum;
+  }
+  double GetMinimumTime() const{
+    return minimum_time;
+  }
+  double GetMaximumTime() const{
+    return maximum_time;
+  }
+};
+
+/** The times one variable crosses a threshold, each located to within
+    `tolerance` by bisection on the step's polynomial */
+class ThresholdCrossingObserver : public AbstractStepObserver{
+private:
+  unsigned int variable_index;
+  double threshold;
+  double tolerance;
+  std::vector<double> upward_crossings;
+  std::vector<double> downward_crossings;
+public:
+  ThresholdCrossingObserver(unsigned int _variable_index, double _threshold, double _tolerance = 1e-8) :
+    variable_index(_variable_index), threshold(_threshold), tolerance(_tolerance){
+  }
+  void ObserveStep(const CvodeStep& r_step);
+  void Reset(){
+    upward_crossings.clear();
+    downward_crossings.clear();
+  }
+  const std::vector<double>& rGetUpwardCrossings() const{
+    return upward_crossings;
+  }
+  const std::vector<double>& rGetDownwardCrossings() const{
+    return downward_crossings;
+  }
+};
+
+/** The running mrms of the sampled states against a reference state, as mrmsTrace
+    would give against a trace holding that state at every sample */
+class RunningMrmsObserver : public AbstractStepObserver{
+private:
+  std::vector<double> reference;
+  double sum = 0;
+  unsigned long count = 0;
+public:
+  RunningMrmsObserver(const std::vector<double>& _reference, double _sampling_timestep) :
+    AbstractStepObserver(_sampling_timestep), reference(_reference){
+  }
+  void Observe(double time, const std::vector<double>& r_state_variables);
+  double GetMrms() const{
+    return count > 0 ? sqrt(sum/(count*reference.size())) : NAN;
+  }
+  void Reset(){
+    sum = 0;
+    count = 0;
+  }
+};
+
+/** Write samples straight to a binary trace file (see TraceFile.hpp). Times
+    must not decrease, so use one for a single run of solves, not every pace. */
+class TraceFileObserver : public AbstractStepObserver{
+private:
+  TraceWriter writer;
+public:
+  TraceFileObserver(std::string file_path, const std::vector<std::string>& variable_names, double _sampling_timestep) :
+    AbstractStepObserver(_sampling_timestep), writer(file_path, variable_names){
+  }
+  void Observe(double time, const std::vector<double>& r_state_variables){
+    writer.AddRow(time, r_state_variables);
+  }
+  void Close(){
+    writer.Close();
+  }
+};
+
+#endif
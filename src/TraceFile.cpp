@@ -0,0 +1,319 @@
+#include "TraceFile.hpp"
+#include "Exception.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+namespace{
+  const char header_magic[] = "CHTRACE1";
+  const char index_magic[]  = "CHTRIDX1";
+
+  template<typename T>
+  void WriteValue(std::ostream& r_out, T value){
+    r_out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  template<typename T>
+  T ReadValue(std::istream& r_in){
+    T value;
+    r_in.read(reinterpret_cast<char*>(&value), sizeof(T));
+    return value;
+  }
+
+  uint64_t ToBits(double value){
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+  }
+
+  double FromBits(uint64_t bits){
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  class BitWriter{
+  private:
+    std::vector<uint8_t> bytes;
+    unsigned int bits_in_last_byte = 8;
+  public:
+    void Write(uint64_t value, unsigned int number_of_bits){
+      /*Fill the last byte from the most significant end, a byte at a time*/
+      while(number_of_bits > 0){
+        if(bits_in_last_byte == 8){
+          bytes.push_back(0);
+          bits_in_last_byte = 0;
+        }
+        const unsigned int space = 8 - bits_in_last_byte;
+        const unsigned int take = std::min(space, number_of_bits);
+        const uint8_t bits = (value >> (number_of_bits - take)) & ((1u << take) - 1);
+        bytes.back() |= bits << (space - take);
+        bits_in_last_byte += take;
+        number_of_bits -= take;
+      }
+    }
+    const std::vector<uint8_t>& rGetBytes() const{
+      return bytes;
+    }
+  };
+
+  class BitReader{
+  private:
+    const std::vector<uint8_t>& r_bytes;
+    size_t position = 0;
+  public:
+    BitReader(const std::vector<uint8_t>& _r_bytes) : r_bytes(_r_bytes){
+    }
+    uint64_t Read(unsigned int number_of_bits){
+      uint64_t value = 0;
+      while(number_of_bits > 0){
+        if(position/8 >= r_bytes.size())
+          EXCEPTION("Trace file column is truncated");
+        const unsigned int available = 8 - position%8;
+        const unsigned int take = std::min(available, number_of_bits);
+        const uint8_t bits = (r_bytes[position/8] >> (available - take)) & ((1u << take) - 1);
+        value = (value << take) | bits;
+        position += take;
+        number_of_bits -= take;
+      }
+      return value;
+    }
+  };
+
+  /*XOR each value with the previous one. A zero XOR costs one bit. Otherwise the
+    meaningful bits are stored either inside the previous leading/trailing zero
+    window, or with a new window (5 bits of leading zeros, 6 bits of length).*/
+  std::vector<uint8_t> CompressColumn(const std::vector<double>& r_values){
+    BitWriter writer;
+    if(r_values.empty())
+      return writer.rGetBytes();
+    uint64_t previous = ToBits(r_values[0]);
+    writer.Write(previous, 64);
+    unsigned int previous_leading = 65, previous_trailing = 0;
+    for(unsigned int i = 1; i < r_values.size(); i++){
+      const uint64_t current = ToBits(r_values[i]);
+      const uint64_t xor_value = current ^ previous;
+      previous = current;
+      if(xor_value == 0){
+        writer.Write(0, 1);
+        continue;
+      }
+      writer.Write(1, 1);
+      unsigned int leading = __builtin_clzll(xor_value);
+      const unsigned int trailing = __builtin_ctzll(xor_value);
+      if(leading > 31)
+        leading = 31;
+      if(previous_leading <= leading && previous_trailing <= trailing){
+        writer.Write(0, 1);
+        writer.Write(xor_value >> previous_trailing, 64 - previous_leading - previous_trailing);
+      }
+      else{
+        const unsigned int length = 64 - leading - trailing;
+        writer.Write(1, 1);
+        writer.Write(leading, 5);
+        /*A length of 64 does not fit in 6 bits, store it as 0*/
+        writer.Write(length & 63, 6);
+        writer.Write(xor_value >> trailing, length);
+        previous_leading = leading;
+        previous_trailing = trailing;
+      }
+    }
+    return writer.rGetBytes();
+  }
+
+  std::vector<double> DecompressColumn(const std::vector<uint8_t>& r_bytes, unsigned int rows){
+    std::vector<double> values;
+    values.reserve(rows);
+    if(rows == 0)
+      return values;
+    BitReader reader(r_bytes);
+    uint64_t previous = reader.Read(64);
+    values.push_back(FromBits(previous));
+    unsigned int leading = 0, trailing = 0;
+    for(unsigned int i = 1; i < rows; i++){
+      if(reader.Read(1) == 1){
+        if(reader.Read(1) == 1){
+          leading = reader.Read(5);
+          unsigned int length = reader.Read(6);
+          if(length == 0)
+            length = 64;
+          trailing = 64 - leading - length;
+        }
+        previous ^= reader.Read(64 - leading - trailing) << trailing;
+      }
+      values.push_back(FromBits(previous));
+    }
+    return values;
+  }
+}
+
+TraceWriter::TraceWriter(std::string file_path, const std::vector<std::string>& _variable_names, unsigned int _chunk_size) :
+  variable_names(_variable_names), chunk_size(_chunk_size), columns(_variable_names.size() + 1){
+  file.open(file_path, std::ios::binary | std::ios::trunc);
+  if(!file.is_open())
+    EXCEPTION("Couldn't open trace file " + file_path);
+  file.write(header_magic, 8);
+  WriteValue<uint32_t>(file, variable_names.size());
+  for(auto i = variable_names.begin(); i != variable_names.end(); i++){
+    WriteValue<uint32_t>(file, i->size());
+    file.write(i->data(), i->size());
+  }
+  for(auto i = columns.begin(); i != columns.end(); i++)
+    i->reserve(chunk_size);
+}
+
+TraceWriter::~TraceWriter(){
+  if(file.is_open())
+    Close();
+}
+
+void TraceWriter::AddRow(double time, const std::vector<double>& values){
+  if(values.size() != variable_names.size())
+    EXCEPTION("Trace row has the wrong number of variables");
+  if(!(time >= last_time))
+    EXCEPTION("Trace row times must not decrease");
+  last_time = time;
+  columns[0].push_back(time);
+  for(unsigned int i = 0; i < values.size(); i++)
+    columns[i+1].push_back(values[i]);
+  if(columns[0].size() == chunk_size)
+    WriteChunk();
+}
+
+void TraceWriter::WriteChunk(){
+  if(columns[0].empty())
+    return;
+  ChunkInfo chunk = {uint64_t(file.tellp()), uint32_t(columns[0].size()), columns[0].front(), columns[0].back()};
+  chunks.push_back(chunk);
+
+  std::vector<std::vector<uint8_t>> compressed;
+  compressed.reserve(columns.size());
+  for(auto i = columns.begin(); i != columns.end(); i++)
+    compressed.push_back(CompressColumn(*i));
+
+  WriteValue<uint32_t>(file, chunk.rows);
+  WriteValue<double>(file, chunk.first_time);
+  WriteValue<double>(file, chunk.last_time);
+  for(auto i = compressed.begin(); i != compressed.end(); i++)
+    WriteValue<uint32_t>(file, i->size());
+  for(auto i = compressed.begin(); i != compressed.end(); i++)
+    file.write(reinterpret_cast<const char*>(i->data()), i->size());
+
+  for(auto i = columns.begin(); i != columns.end(); i++)
+    i->clear();
+}
+
+void TraceWriter::Close(){
+  WriteChunk();
+  const uint64_t index_offset = file.tellp();
+  WriteValue<uint32_t>(file, chunks.size());
+  for(auto i = chunks.begin(); i != chunks.end(); i++){
+    WriteValue<uint64_t>(file, i->offset);
+    WriteValue<uint32_t>(file, i->rows);
+    WriteValue<double>(file, i->first_time);
+    WriteValue<double>(file, i->last_time);
+  }
+  WriteValue<uint64_t>(file, index_offset);
+  file.write(index_magic, 8);
+  file.close();
+}
+
+TraceReader::TraceReader(std::string file_path){
+  file.open(file_path, std::ios::binary);
+  if(!file.is_open())
+    EXCEPTION("Couldn't open trace file " + file_path);
+
+  char magic[8];
+  file.read(magic, 8);
+  if(!file || std::memcmp(magic, header_magic, 8) != 0)
+    EXCEPTION(file_path + " is not a trace file");
+  const uint32_t number_of_variables = ReadValue<uint32_t>(file);
+  for(unsigned int i = 0; i < number_of_variables; i++){
+    std::string name(ReadValue<uint32_t>(file), ' ');
+    file.read(&name[0], name.size());
+    variable_names.push_back(name);
+  }
+
+  file.seekg(-16, std::ios::end);
+  const uint64_t index_offset = ReadValue<uint64_t>(file);
+  file.read(magic, 8);
+  if(!file || std::memcmp(magic, index_magic, 8) != 0)
+    EXCEPTION(file_path + " has no index - was the writer closed?");
+  file.seekg(index_offset);
+  const uint32_t number_of_chunks = ReadValue<uint32_t>(file);
+  for(unsigned int i = 0; i < number_of_chunks; i++){
+    ChunkInfo chunk;
+    chunk.offset = ReadValue<uint64_t>(file);
+    chunk.rows = ReadValue<uint32_t>(file);
+    chunk.first_time = ReadValue<double>(file);
+    chunk.last_time = ReadValue<double>(file);
+    chunks.push_back(chunk);
+  }
+}
+
+unsigned int TraceReader::GetVariableIndex(const std::string& name) const{
+  for(unsigned int i = 0; i < variable_names.size(); i++){
+    if(variable_names[i] == name)
+      return i;
+  }
+  EXCEPTION("No variable called " + name + " in trace");
+}
+
+unsigned long TraceReader::GetNumberOfRows() const{
+  unsigned long rows = 0;
+  for(auto i = chunks.begin(); i != chunks.end(); i++)
+    rows += i->rows;
+  return rows;
+}
+
+std::vector<double> TraceReader::ReadColumn(const ChunkInfo& r_chunk, unsigned int column){
+  /*Skip the row count and time range, then use the column sizes to seek straight to the column*/
+  file.seekg(r_chunk.offset + sizeof(uint32_t) + 2*sizeof(double));
+  std::vector<uint32_t> sizes(variable_names.size() + 1);
+  file.read(reinterpret_cast<char*>(sizes.data()), sizes.size()*sizeof(uint32_t));
+  uint64_t column_offset = 0;
+  for(unsigned int i = 0; i < column; i++)
+    column_offset += sizes[i];
+  file.seekg(column_offset, std::ios::cur);
+  std::vector<uint8_t> bytes(sizes[column]);
+  file.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+  if(!file)
+    EXCEPTION("Trace file is truncated");
+  return DecompressColumn(bytes, r_chunk.rows);
+}
+
+std::vector<double> TraceReader::GetTimes(double start_time, double end_time){
+  std::vector<double> times;
+  for(auto i = chunks.begin(); i != chunks.end(); i++){
+    if(i->last_time < start_time || i->first_time > end_time)
+      continue;
+    const std::vector<double> chunk_times = ReadColumn(*i, 0);
+    for(auto t = chunk_times.begin(); t != chunk_times.end(); t++){
+      if(*t >= start_time && *t <= end_time)
+        times.push_back(*t);
+    }
+  }
+  return times;
+}
+
+std::vector<double> TraceReader::GetVariable(unsigned int variable_index, double start_time, double end_time){
+  if(variable_index >= variable_names.size())
+    EXCEPTION("Variable index out of range");
+  std::vector<double> values;
+  for(auto i = chunks.begin(); i != chunks.end(); i++){
+    if(i->last_time < start_time || i->first_time > end_time)
+      continue;
+    const std::vector<double> chunk_values = ReadColumn(*i, variable_index + 1);
+    /*Only decompress the time column when the chunk is not entirely inside the range*/
+    if(i->first_time >= start_time && i->last_time <= end_time){
+      values.insert(values.end(), chunk_values.begin(), chunk_values.end());
+      continue;
+    }
+    const std::vector<double> chunk_times = ReadColumn(*i, 0);
+    for(unsigned int j = 0; j < chunk_times.size(); j++){
+      if(chunk_times[j] >= start_time && chunk_times[j] <= end_time)
+        values.push_back(chunk_values[j]);
+    }
+  }
+  return values;
+}
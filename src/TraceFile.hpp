@@ -0,0 +1,88 @@
+#ifndef TRACEFILE_HPP
+#define TRACEFILE_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cmath>
+
+/* A compact binary format for state variable traces.
+
+   Rows (a time and one value per variable) are collected into chunks. Within a
+   chunk every column - time first, then each variable - is stored on its own,
+   compressed losslessly by XOR-ing each value with the previous one and
+   storing only the meaningful bits (as in Facebook's Gorilla), which works
+   well for the smooth, finely sampled traces we produce. An index of chunk
+   offsets and time ranges at the end of the file lets a reader decompress only
+   the chunks and columns it needs.
+
+   Layout (native byte order, which is little endian on every machine we use):
+     "CHTRACE1", uint32 number of variables, then each name as uint32 length + bytes
+     chunks: uint32 rows, double first time, double last time,
+             uint32 compressed size of each column, then the columns
+     index: uint32 number of chunks, then per chunk uint64 offset, uint32 rows,
+            double first time, double last time
+     uint64 offset of the index, "CHTRIDX1"
+*/
+
+class TraceWriter{
+private:
+  std::ofstream file;
+  std::vector<std::string> variable_names;
+  unsigned int chunk_size;
+  double last_time = -INFINITY;
+  std::vector<std::vector<double>> columns;
+  struct ChunkInfo{
+    uint64_t offset;
+    uint32_t rows;
+    double first_time;
+    double last_time;
+  };
+  std::vector<ChunkInfo> chunks;
+
+  void WriteChunk();
+public:
+  TraceWriter(std::string file_path, const std::vector<std::string>& _variable_names, unsigned int _chunk_size = 4096);
+  ~TraceWriter();
+
+  /**Add one row. Times must not decrease (or be NaN), since readers select
+     chunks by their time range.*/
+  void AddRow(double time, const std::vector<double>& values);
+
+  /**Write any buffered rows and the index. Called by the destructor if needed.*/
+  void Close();
+};
+
+class TraceReader{
+private:
+  std::ifstream file;
+  std::vector<std::string> variable_names;
+  struct ChunkInfo{
+    uint64_t offset;
+    uint32_t rows;
+    double first_time;
+    double last_time;
+  };
+  std::vector<ChunkInfo> chunks;
+
+  std::vector<double> ReadColumn(const ChunkInfo& r_chunk, unsigned int column);
+public:
+  TraceReader(std::string file_path);
+
+  const std::vector<std::string>& rGetVariableNames() const{
+    return variable_names;
+  }
+
+  unsigned int GetVariableIndex(const std::string& name) const;
+
+  unsigned long GetNumberOfRows() const;
+
+  /**The times of the rows with start_time <= t <= end_time*/
+  std::vector<double> GetTimes(double start_time = -INFINITY, double end_time = INFINITY);
+
+  /**The values of one variable for the rows with start_time <= t <= end_time*/
+  std::vector<double> GetVariable(unsigned int variable_index, double start_time = -INFINITY, double end_time = INFINITY);
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include "Tracing.hpp"
+
+#include <fstream>
+#include <iostream>
+
+#ifdef CHASTE_PROJECT_TRACING
+
+#include <mutex>
+#include <vector>
+
+namespace{
+  std::mutex registry_mutex;
+  std::vector<std::unique_ptr<TraceBuffer>> registry;
+}
+
+TraceBuffer& GetThreadTraceBuffer(){
+  /*The registry owns the buffers so that events outlive the threads that recorded them*/
+  thread_local TraceBuffer* p_buffer = nullptr;
+  if(!p_buffer){
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry.emplace_back(new TraceBuffer(registry.size()));
+    p_buffer = registry.back().get();
+  }
+  return *p_buffer;
+}
+
+void WriteChromeTrace(std::string file_path){
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  std::ofstream f_out(file_path);
+  f_out.precision(15);
+  f_out << "{\"traceEvents\": [\n";
+  bool first = true;
+  for(auto i = registry.begin(); i != registry.end(); i++){
+    const TraceBuffer& r_buffer = **i;
+    const size_t size = r_buffer.GetSize();
+    for(size_t j = 0; j < size; j++){
+      const TraceEvent& r_event = r_buffer.rGetEvent(j);
+      if(!first)
+        f_out << ",\n";
+      first = false;
+      /*Complete events with times in microseconds*/
+      f_out << "{\"name\": \"" << r_event.name << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << r_buffer.GetThreadIndex()
+            << ", \"ts\": " << r_event.start*1e-3 << ", \"dur\": " << r_event.duration*1e-3 << "}";
+    }
+    if(r_buffer.GetNumberDropped() > 0)
+      std::cout << "Trace buffer " << r_buffer.GetThreadIndex() << " was full - dropped " << r_buffer.GetNumberDropped() << " events\n";
+  }
+  f_out << "\n]}\n";
+  f_out.close();
+}
+
+void ClearTrace(){
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  for(auto i = registry.begin(); i != registry.end(); i++)
+    (*i)->Clear();
+}
+
+#else
+
+void WriteChromeTrace(std::string file_path){
+  std::ofstream f_out(file_path);
+  f_out << "{\"traceEvents\": []}\n";
+  f_out.close();
+}
+
+void ClearTrace(){
+}
+
+#endif
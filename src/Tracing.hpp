@@ -0,0 +1,130 @@
+#ifndef TRACING_HPP
+#define TRACING_HPP
+
+#include <string>
+
+/* Scoped timing of the pacing hot path.
+
+   Put TRACE_SCOPE("name") at the top of a block to record how long the block
+   took. Events go into a buffer owned by the calling thread, which grows in
+   chunks up to a fixed maximum, so recording never takes a lock; the buffers
+   are only shared when WriteChromeTrace is called. The output can be opened with chrome://tracing
+   or ui.perfetto.dev.
+
+   Tracing is only compiled in when CHASTE_PROJECT_TRACING is defined (see the
+   CMake option of the same name); otherwise TRACE_SCOPE expands to nothing.
+   The name must be a string literal, or otherwise outlive the export. */
+
+#ifdef CHASTE_PROJECT_TRACING
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+struct TraceEvent{
+  const char* name;
+  uint64_t start;
+  uint64_t duration;
+};
+
+class TraceBuffer{
+public:
+  /*Events are stored in chunks allocated as the thread records them, so an idle
+    or lightly traced thread costs a few kilobytes rather than the maximum*/
+  static const size_t chunk_size = 1 << 12;
+  static const size_t max_chunks = 1 << 8;
+private:
+  std::unique_ptr<TraceEvent[]> chunks[max_chunks];
+  /*Written by the owning thread only and published with release semantics so
+    that the exporter sees complete events, and the chunks holding them*/
+  std::atomic<size_t> size;
+  std::atomic<size_t> dropped;
+  unsigned int thread_index;
+public:
+  TraceBuffer(unsigned int _thread_index) : size(0), dropped(0), thread_index(_thread_index){
+  }
+
+  void Record(const char* name, uint64_t start, uint64_t duration){
+    const size_t index = size.load(std::memory_order_relaxed);
+    if(index == GetCapacity()){
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    std::unique_ptr<TraceEvent[]>& r_chunk = chunks[index/chunk_size];
+    if(!r_chunk)
+      r_chunk.reset(new TraceEvent[chunk_size]);
+    r_chunk[index % chunk_size] = TraceEvent{name, start, duration};
+    size.store(index + 1, std::memory_order_release);
+  }
+
+  size_t GetSize() const{
+    return size.load(std::memory_order_acquire);
+  }
+  size_t GetNumberDropped() const{
+    return dropped.load(std::memory_order_relaxed);
+  }
+  /*Enough for several thousand paces of a SmartSimulation run*/
+  static size_t GetCapacity(){
+    return chunk_size*max_chunks;
+  }
+  /**The number of events there is storage for so far. Only for the owning
+     thread, or while it isn't tracing*/
+  size_t GetAllocatedSize() const{
+    size_t allocated = 0;
+    for(size_t i = 0; i < max_chunks && chunks[i]; i++)
+      allocated += chunk_size;
+    return allocated;
+  }
+  const TraceEvent& rGetEvent(size_t index) const{
+    return chunks[index/chunk_size][index % chunk_size];
+  }
+  unsigned int GetThreadIndex() const{
+    return thread_index;
+  }
+  /*Keeps the chunks for reuse*/
+  void Clear(){
+    size.store(0, std::memory_order_release);
+    dropped.store(0, std::memory_order_relaxed);
+  }
+};
+
+/**The calling thread's buffer, created and registered on first use*/
+TraceBuffer& GetThreadTraceBuffer();
+
+inline uint64_t GetTraceTime(){
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class TraceScope{
+private:
+  const char* name;
+  uint64_t start;
+public:
+  explicit TraceScope(const char* _name) : name(_name), start(GetTraceTime()){
+  }
+  ~TraceScope(){
+    /*Read the clock first so that creating the buffer is not timed*/
+    const uint64_t end = GetTraceTime();
+    GetThreadTraceBuffer().Record(name, start, end - start);
+  }
+};
+
+#define TRACE_CONCATENATE_DETAIL(a, b) a##b
+#define TRACE_CONCATENATE(a, b) TRACE_CONCATENATE_DETAIL(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCATENATE(trace_scope_, __LINE__)(name)
+
+#else
+
+#define TRACE_SCOPE(name)
+
+#endif
+
+/**Write every event recorded so far, on all threads, in Chrome trace (JSON) format.
+   Writes an empty trace when tracing is compiled out.*/
+void WriteChromeTrace(std::string file_path);
+
+/**Forget all recorded events. Only call this while no other thread is tracing.*/
+void ClearTrace();
+
+#endif
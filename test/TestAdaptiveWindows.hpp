@@ -0,0 +1,108 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "Simulation.hpp"
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "ten_tusscher_model_2004_epiCvode.hpp"
+
+/*Pace ten Tusscher to steady state with one buffer for the whole state and
+  with a window per variable. The per-variable windows should let the first
+  jump happen much sooner and reach the same steady state. Jumps that move
+  the voltage too far are rolled back even when speculating.*/
+
+class TestAdaptiveWindows : public CxxTest::TestSuite
+{
+private:
+  const double period = 1000;
+  const double duration = 2;
+  const unsigned int buffer_size = 200;
+  const unsigned int max_paces = 10000;
+
+  /*Returns the number of paces, and sets r_first_jump to the pace the first jump came after*/
+  unsigned int PaceUntilFinished(SmartSimulation& r_simulation, unsigned int& r_first_jump){
+    unsigned int paces;
+    r_first_jump = max_paces;
+    for(paces = 0; paces < max_paces && !r_simulation.is_finished(); paces++){
+      r_simulation.RunPace();
+      if(r_simulation.GetNumberOfJumps() > 0 && r_first_jump == max_paces)
+        r_first_jump = paces;
+    }
+    return paces;
+  }
+public:
+  void TestEarlierJumps(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>();
+    SmartSimulation simulation(p_model, period);
+    simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    const std::vector<double> initial_conditions = simulation.GetStateVariables();
+    simulation.Initialise(buffer_size, 0.9);
+    unsigned int first_jump;
+    const unsigned int paces = PaceUntilFinished(simulation, first_jump);
+    const double apd = CalculateAPD(p_model, period, duration, 90);
+    const std::vector<double> steady_state = simulation.GetStateVariables();
+
+    p_model->SetStateVariables(initial_conditions);
+    SmartSimulation adaptive_simulation(p_model, period);
+    adaptive_simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    adaptive_simulation.Initialise(buffer_size, 0.9);
+    adaptive_simulation.SetAdaptiveWindows();
+    unsigned int adaptive_first_jump;
+    const unsigned int adaptive_paces = PaceUntilFinished(adaptive_simulation, adaptive_first_jump);
+    const double adaptive_apd = CalculateAPD(p_model, period, duration, 90);
+
+    std::cout << "One buffer: " << paces << " paces, first jump after " << first_jump << ", " << simulation.GetNumberOfJumps() << " jumps\n"
+              << "Adaptive windows: " << adaptive_paces << " paces, first jump after " << adaptive_first_jump << ", "
+              << adaptive_simulation.GetNumberOfJumps() << " jumps\n";
+    const std::vector<unsigned int>& r_windows = adaptive_simulation.rGetWindows();
+    const std::vector<std::string>& r_names = p_model->GetSystemInformation()->rGetStateVariableNames();
+    for(unsigned int i = 0; i < r_windows.size(); i++)
+      std::cout << "  " << r_names[i] << ": window " << r_windows[i] << "\n";
+
+    TS_ASSERT(simulation.is_finished());
+    TS_ASSERT(adaptive_simulation.is_finished());
+    TS_ASSERT_LESS_THAN(adaptive_first_jump, first_jump);
+    TS_ASSERT_LESS_THAN(mrms(steady_state, adaptive_simulation.GetStateVariables()), 1e-3);
+    TS_ASSERT_DELTA(apd, adaptive_apd, 1);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestMinimumWindow(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>();
+    SmartSimulation simulation(p_model, period);
+    TS_ASSERT_THROWS_ANYTHING(simulation.SetAdaptiveWindows(2));
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestCheckedWhenSpeculating(){
+#ifdef CHASTE_CVODE
+    /*An integration constant 100mV out puts the analytic voltage far from the
+      real one, so the voltage check rolls back every jump*/
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>();
+    p_model->SetIntegrationConstant(p_model->CalculateAnalyticVoltage() + 100);
+    SmartSimulation simulation(p_model, period);
+    simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    simulation.Initialise(buffer_size, 0.9);
+    simulation.SetAdaptiveWindows();
+    simulation.SetSpeculativePaces(5);
+    for(unsigned int pace = 0; pace < buffer_size && !simulation.is_finished(); pace++)
+      simulation.RunPace();
+    TS_ASSERT_LESS_THAN(0u, simulation.GetNumberOfRejectedJumps());
+    TS_ASSERT_EQUALS(simulation.GetNumberOfJumps(), 0u);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
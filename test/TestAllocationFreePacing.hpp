@@ -0,0 +1,121 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "FixedSizeSimulation.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "beeler_reuter_model_1977Cvode.hpp"
+
+/*Count every allocation made through operator new in this test executable, and
+  check pacing makes none once the first few paces have set everything up, where
+  the same paces with Simulation do allocate. SUNDIALS allocates with malloc,
+  but only when CVODE is created.*/
+
+namespace{
+  std::atomic<unsigned long> number_of_allocations(0);
+}
+
+void* operator new(std::size_t size){
+  number_of_allocations++;
+  void* p = std::malloc(size ? size : 1);
+  if(!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept{
+  std::free(p);
+}
+
+class TestAllocationFreePacing : public CxxTest::TestSuite
+{
+private:
+  const unsigned int warm_up_paces = 5;
+  const unsigned int paces = 20;
+public:
+  void TestFixedSizeSimulation(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    TS_ASSERT_THROWS_ANYTHING(FixedSizeSimulation<3>(p_model, 1000));
+
+    FixedSizeSimulation<8> simulation(p_model, 1000);
+    for(unsigned int i = 0; i < warm_up_paces; i++)
+      simulation.RunPace();
+
+    const unsigned long allocations_before = number_of_allocations.load();
+    for(unsigned int i = 0; i < paces; i++)
+      simulation.RunPace();
+    const unsigned long allocations = number_of_allocations.load() - allocations_before;
+    std::cout << "FixedSizeSimulation made " << allocations << " allocations in " << paces << " paces\n";
+    TS_ASSERT_EQUALS(allocations, 0u);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestAllocationSaving(){
+#ifdef CHASTE_CVODE
+    /*The same paces of the same model, with and without the fixed size*/
+    Simulation simulation(CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>(), 1000);
+    FixedSizeSimulation<8> fixed_size_simulation(CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>(), 1000);
+    for(unsigned int i = 0; i < warm_up_paces; i++){
+      simulation.RunPace();
+      fixed_size_simulation.RunPace();
+    }
+
+    unsigned long allocations_before = number_of_allocations.load();
+    for(unsigned int i = 0; i < paces; i++)
+      simulation.RunPace();
+    const unsigned long allocations = number_of_allocations.load() - allocations_before;
+    allocations_before = number_of_allocations.load();
+    for(unsigned int i = 0; i < paces; i++)
+      fixed_size_simulation.RunPace();
+    const unsigned long fixed_size_allocations = number_of_allocations.load() - allocations_before;
+    std::cout << "Simulation made " << allocations << " allocations in " << paces << " paces, FixedSizeSimulation "
+              << fixed_size_allocations << "\n";
+    /*Simulation copies the state out into a new vector before and after every pace*/
+    TS_ASSERT_LESS_THAN_EQUALS(2*paces, allocations);
+    TS_ASSERT_EQUALS(fixed_size_allocations, 0u);
+    TS_ASSERT_LESS_THAN(mrms(simulation.GetStateVariables(), fixed_size_simulation.GetStateVariables()), 1e-10);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestSmartSimulation(){
+#ifdef CHASTE_CVODE
+    /*Between jumps SmartSimulation recycles its buffer, so once the buffer is full it doesn't allocate either*/
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    const unsigned int buffer_size = 10;
+    SmartSimulation simulation(p_model, 1000);
+    simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    simulation.Initialise(buffer_size, 0.9);
+    for(unsigned int i = 0; i < buffer_size + warm_up_paces; i++)
+      simulation.RunPace();
+
+    const unsigned long allocations_before = number_of_allocations.load();
+    unsigned int jumps = 0;
+    for(unsigned int i = 0; i < paces; i++){
+      const unsigned long allocations_before_pace = number_of_allocations.load();
+      simulation.RunPace();
+      /*A jump (or the pace after one, while the buffer refills) may allocate*/
+      if(simulation.GetMrms() == 0)
+        jumps++;
+      else if(jumps == 0)
+        TS_ASSERT_EQUALS(number_of_allocations.load() - allocations_before_pace, 0u);
+    }
+    std::cout << "SmartSimulation made " << number_of_allocations.load() - allocations_before << " allocations in " << paces << " paces with " << jumps << " jumps\n";
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
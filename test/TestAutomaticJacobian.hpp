@@ -0,0 +1,159 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "Simulation.hpp"
+#include "BenchmarkTools.hpp"
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml,
+   and the AutomaticJacobian ones from those by src/GenerateAutomaticJacobianFiles.py */
+
+#include "ohara_rudy_2011_endoCvodeAutomaticJacobian.hpp"
+#include "ohara_rudy_cipa_v1_2017CvodeAutomaticJacobian.hpp"
+#include "ten_tusscher_model_2006_epiCvodeAutomaticJacobian.hpp"
+
+/*Check the dual number Jacobians against central differences of the models'
+  own right hand sides, at rest and during the upstroke, and that CVODE paces
+  to the same state with them as with its own finite difference Jacobians for
+  less work. A finite difference Jacobian costs CVODE n right hand side
+  evaluations, which it counts; a dual number one is timed against the right
+  hand side to put it in the same units.*/
+
+class TestAutomaticJacobian : public CxxTest::TestSuite
+{
+private:
+  const double period = 1000;
+  const unsigned int paces = 10;
+
+  template<class CELL>
+  void CompareWithFiniteDifferences(){
+    boost::shared_ptr<AbstractIvpOdeSolver> p_solver;
+    boost::shared_ptr<AbstractStimulusFunction> p_stimulus;
+    boost::shared_ptr<CELL> p_model(new CELL(p_solver, p_stimulus));
+    p_model->UseCellMLDefaultStimulus();
+    const std::string model_name = p_model->GetSystemInformation()->GetSystemName();
+    const unsigned int n = p_model->GetNumberOfStateVariables();
+    TS_ASSERT(p_model->GetUseAnalyticJacobian());
+
+    N_Vector state = N_VNew_Serial(n);
+    N_Vector derivatives = N_VNew_Serial(n);
+    N_Vector forward_derivatives = N_VNew_Serial(n);
+    N_Vector backward_derivatives = N_VNew_Serial(n);
+    /*At rest, then 2ms into the first pace*/
+    for(double time : {0.0, 2.0}){
+      if(time > 0)
+        p_model->SolveAndUpdateState(0, time);
+      const std::vector<double> y = p_model->GetStdVecStateVariables();
+      std::copy(y.begin(), y.end(), NV_DATA_S(state));
+
+      /*Over doubles the templated right hand side is the model's own*/
+      std::vector<double> templated_derivatives(n);
+      p_model->EvaluateYDerivatives(time, state, derivatives);
+      p_model->EvaluateTemplatedYDerivatives(time, y.data(), templated_derivatives.data());
+      for(unsigned int i = 0; i < n; i++)
+        TS_ASSERT_EQUALS(templated_derivatives[i], NV_Ith_S(derivatives, i));
+
+      const std::vector<std::vector<double>> jacobian = p_model->GetJacobian(time, y);
+      std::vector<std::vector<double>> differences(n, std::vector<double>(n));
+      for(unsigned int j = 0; j < n; j++){
+        const double step = 1e-6*std::max(std::abs(y[j]), 1e-6);
+        NV_Ith_S(state, j) = y[j] + step;
+        p_model->EvaluateYDerivatives(time, state, forward_derivatives);
+        NV_Ith_S(state, j) = y[j] - step;
+        p_model->EvaluateYDerivatives(time, state, backward_derivatives);
+        NV_Ith_S(state, j) = y[j];
+        for(unsigned int i = 0; i < n; i++)
+          differences[i][j] = (NV_Ith_S(forward_derivatives, i) - NV_Ith_S(backward_derivatives, i))/(2*step);
+      }
+
+      /*Relative to the largest entry in each row, in the variables' own scale,
+        so that rounding in the differences of tiny entries doesn't count*/
+      double worst = 0;
+      for(unsigned int i = 0; i < n; i++){
+        double row_scale = 0;
+        for(unsigned int j = 0; j < n; j++)
+          row_scale = std::max(row_scale, std::abs(jacobian[i][j]*std::max(std::abs(y[j]), 1e-6)));
+        for(unsigned int j = 0; j < n; j++)
+          worst = std::max(worst, std::abs(jacobian[i][j] - differences[i][j])*std::max(std::abs(y[j]), 1e-6)/(row_scale + 1e-300));
+      }
+      std::cout << model_name << " at " << time << "ms: largest relative difference from central differences " << worst << "\n";
+      TS_ASSERT_LESS_THAN(worst, 1e-4);
+    }
+
+    /*What one dual number Jacobian (ceil(n/8) evaluations, each 8 wide) costs
+      in right hand side evaluations, at the upstroke state*/
+    const std::vector<double> y = p_model->GetStdVecStateVariables();
+    std::copy(y.begin(), y.end(), NV_DATA_S(state));
+    const unsigned int repetitions = 1000;
+    double checksum = 0;
+    double start_time = GetWallTime();
+    for(unsigned int i = 0; i < repetitions*n; i++){
+      p_model->EvaluateYDerivatives(2.0, state, derivatives);
+      checksum += NV_Ith_S(derivatives, 0);
+    }
+    const double rhs_time = (GetWallTime() - start_time)/(repetitions*n);
+    start_time = GetWallTime();
+    for(unsigned int i = 0; i < repetitions; i++)
+      checksum += p_model->GetJacobian(2.0, y)[0][0];
+    const double jacobian_cost = (GetWallTime() - start_time)/repetitions/rhs_time;
+    std::cout << model_name << ": a dual number Jacobian costs " << jacobian_cost << " right hand side evaluations, against "
+              << n << " for finite differences (checksum " << checksum << ")\n";
+    TS_ASSERT_LESS_THAN(jacobian_cost, n);
+
+    N_VDestroy_Serial(state);
+    N_VDestroy_Serial(derivatives);
+    N_VDestroy_Serial(forward_derivatives);
+    N_VDestroy_Serial(backward_derivatives);
+
+    /*Pace with the dual number Jacobian, and with CVODE's own from the same start*/
+    boost::shared_ptr<AbstractCvodeCell> p_automatic = CreateCvodeCell<CELL>();
+    boost::shared_ptr<AbstractCvodeCell> p_numerical = CreateCvodeCell<CELL>();
+    p_numerical->ForceUseOfNumericalJacobian();
+    Simulation automatic(p_automatic, period);
+    Simulation numerical(p_numerical, period);
+    for(unsigned int pace = 0; pace < paces; pace++){
+      automatic.RunPace();
+      numerical.RunPace();
+    }
+    const CvodeStatistics automatic_statistics = automatic.GetTotalCvodeStatistics();
+    const CvodeStatistics numerical_statistics = numerical.GetTotalCvodeStatistics();
+    std::cout << model_name << ": " << automatic_statistics.rhs_evaluations << " rhs evaluations with "
+              << automatic_statistics.jacobian_evaluations << " automatic Jacobians, " << numerical_statistics.rhs_evaluations
+              << " with " << numerical_statistics.jacobian_evaluations << " finite difference Jacobians\n";
+    const double difference = mrms(automatic.GetStateVariables(), numerical.GetStateVariables());
+    std::cout << "mrms between the final states " << difference << "\n";
+    TS_ASSERT_LESS_THAN(difference, 1e-4);
+    /*CVODE's count already includes its finite difference Jacobians, but not the dual number ones*/
+    const double automatic_cost = automatic_statistics.rhs_evaluations + automatic_statistics.jacobian_evaluations*jacobian_cost;
+    std::cout << "pacing cost " << automatic_cost << " right hand side evaluations with automatic Jacobians\n";
+    TS_ASSERT_LESS_THAN(automatic_cost, numerical_statistics.rhs_evaluations);
+  }
+public:
+  void TestOharaRudy2011(){
+#ifdef CHASTE_CVODE
+    CompareWithFiniteDifferences<Cellohara_rudy_2011_endoFromCellMLCvodeAutomaticJacobian>();
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestOharaRudyCipa(){
+#ifdef CHASTE_CVODE
+    CompareWithFiniteDifferences<Cellohara_rudy_cipa_v1_2017FromCellMLCvodeAutomaticJacobian>();
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestTenTusscher2006(){
+#ifdef CHASTE_CVODE
+    CompareWithFiniteDifferences<Cellten_tusscher_model_2006_epiFromCellMLCvodeAutomaticJacobian>();
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
@@ -7,6 +7,7 @@
 #include "Shannon2004Cvode.hpp"
 #include "FakePetscSetup.hpp"
 #include "Simulation.hpp"
+#include "ConfigurationSweep.hpp"
 #include <boost/filesystem.hpp>
 #include <fstream>
 
@@ -32,7 +33,10 @@ private:
   const std::vector<double>       extrapolation_constants = {0.9};
   const std::vector<double> apds = {231.87874670168091, 186.378828929472235, 228.391097821924944, 186.568452124915893, 268.928719750840457, 212.495013520340706, 268.49004986811957, 211.93350538338558};
 public:
-  unsigned int RunModel(boost::shared_ptr<AbstractCvodeCell> p_model, double period, unsigned int buffer_size, double extrapolation_constant, unsigned int index){
+  /*Run every configuration on one model, sharing the paces before their first jumps, and return the paces each took*/
+  std::vector<unsigned int> RunModel(std::function<boost::shared_ptr<AbstractCvodeCell>()> model_factory, double period,
+                                     const std::vector<ExtrapolationConfiguration>& configurations, unsigned int index){
+      boost::shared_ptr<AbstractCvodeCell> p_model = model_factory();
       const std::string model_name = p_model->GetSystemInformation()->GetSystemName();
       std::cout << "Testing " << model_name << " with period " << period << "\n";
       const double duration = p_model->UseCellMLDefaultStimulus()->GetDuration();      
@@ -43,29 +47,31 @@ public:
       else if(period == 1000)
 	input_path = "/home/"+username+"/code/chaste-project-data/"+model_name+"/GroundTruth2Hz/final_state_variables.dat";
       
-      unsigned int j;
       /*Run the simulations*/
-      SmartSimulation simulation(p_model, period, input_path);
-      simulation.Initialise(buffer_size, extrapolation_constant);
-      for(j = 0; j < paces; j++){
-	if(simulation.RunPace())
-	  std::cout << "Model " << model_name << " period " << period << " Extrapolation method finished after " << j << " paces \n";
-	
-	if(simulation.is_finished()){
-	  break;
-	}	
-      }
+      unsigned int paces_solved;
+      const std::vector<ConfigurationResult> results = RunConfigurationSweep(p_model, period, configurations, paces, &paces_solved, input_path, model_factory);
+      std::vector<unsigned int> scores;
+      unsigned int separate_paces = 0;
+      for(auto i = results.begin(); i != results.end(); i++){
+	std::cout << "Model " << model_name << " period " << period << " buffer " << i->configuration.buffer_size << " constant "
+		  << i->configuration.extrapolation_constant << " Extrapolation method finished after " << i->paces << " paces ("
+		  << i->shared_paces << " shared)\n";
+	scores.push_back(i->paces);
+	separate_paces += i->paces;
 
-      /*Check that the methods have converged to the same place*/
-      std::vector<double> vec1 = simulation.GetStateVariables();
-      output_file << model_name << " " << period << " ";
-      WriteStatesToFile(vec1, output_file);
-      output_file << CalculateAPD(p_model, period, duration, 90) << "\n";
-      double apd = CalculateAPD(p_model, period, duration, 90);
-      double apd_error = CalculateAPD(p_model, period, duration, 90) - apds[index];
-      std::cout << "apd error " << apds[index] << " " << apd_error << " " <<apd <<  "\n";
-      TS_ASSERT(abs(CalculateAPD(p_model, period, duration, 90) - apds[index]) < 0.1);
-      return j;
+	/*Check that the methods have converged to the same place*/
+	p_model->SetStateVariables(i->state_variables);
+	output_file << model_name << " " << period << " ";
+	WriteStatesToFile(i->state_variables, output_file);
+	double apd = CalculateAPD(p_model, period, duration, 90);
+	output_file << apd << "\n";
+	double apd_error = apd - apds[index];
+	std::cout << "apd error " << apds[index] << " " << apd_error << " " <<apd <<  "\n";
+	TS_ASSERT(abs(apd - apds[index]) < 0.1);
+      }
+      std::cout << "Solved " << paces_solved << " paces for the sweep rather than " << separate_paces << "\n";
+      TS_ASSERT_LESS_THAN_EQUALS(paces_solved, separate_paces);
+      return scores;
   }
   
   void TestMain(){
@@ -74,16 +80,16 @@ public:
     boost::shared_ptr<RegularStimulus> p_stimulus;
     boost::shared_ptr<AbstractIvpOdeSolver> p_solver;
 
-    std::vector<boost::shared_ptr<AbstractCvodeCell>> models;
+    std::vector<std::function<boost::shared_ptr<AbstractCvodeCell>()>> models;
       
-    models.push_back(boost::shared_ptr<AbstractCvodeCell>(new Cellohara_rudy_2011_endoFromCellMLCvode(p_solver, p_stimulus)));
-    models.push_back(boost::shared_ptr<AbstractCvodeCell>(new Celldecker_2009FromCellMLCvode(p_solver, p_stimulus)));
-    models.push_back(boost::shared_ptr<AbstractCvodeCell>(new Cellten_tusscher_model_2004_epiFromCellMLCvode(p_solver, p_stimulus)));
-    models.push_back(boost::shared_ptr<AbstractCvodeCell>(new Cellshannon_wang_puglisi_weber_bers_2004FromCellMLCvode(p_solver, p_stimulus)));
-    models.push_back(boost::shared_ptr<AbstractCvodeCell>(new Cellohara_rudy_2011_endoFromCellMLCvode(p_solver, p_stimulus)));
-    models.push_back(boost::shared_ptr<AbstractCvodeCell>(new Celldecker_2009FromCellMLCvode(p_solver, p_stimulus)));
-    models.push_back(boost::shared_ptr<AbstractCvodeCell>(new Cellten_tusscher_model_2004_epiFromCellMLCvode(p_solver, p_stimulus)));
-    models.push_back(boost::shared_ptr<AbstractCvodeCell>(new Cellshannon_wang_puglisi_weber_bers_2004FromCellMLCvode(p_solver, p_stimulus)));
+    models.push_back([=](){return boost::shared_ptr<AbstractCvodeCell>(new Cellohara_rudy_2011_endoFromCellMLCvode(p_solver, p_stimulus));});
+    models.push_back([=](){return boost::shared_ptr<AbstractCvodeCell>(new Celldecker_2009FromCellMLCvode(p_solver, p_stimulus));});
+    models.push_back([=](){return boost::shared_ptr<AbstractCvodeCell>(new Cellten_tusscher_model_2004_epiFromCellMLCvode(p_solver, p_stimulus));});
+    models.push_back([=](){return boost::shared_ptr<AbstractCvodeCell>(new Cellshannon_wang_puglisi_weber_bers_2004FromCellMLCvode(p_solver, p_stimulus));});
+    models.push_back([=](){return boost::shared_ptr<AbstractCvodeCell>(new Cellohara_rudy_2011_endoFromCellMLCvode(p_solver, p_stimulus));});
+    models.push_back([=](){return boost::shared_ptr<AbstractCvodeCell>(new Celldecker_2009FromCellMLCvode(p_solver, p_stimulus));});
+    models.push_back([=](){return boost::shared_ptr<AbstractCvodeCell>(new Cellten_tusscher_model_2004_epiFromCellMLCvode(p_solver, p_stimulus));});
+    models.push_back([=](){return boost::shared_ptr<AbstractCvodeCell>(new Cellshannon_wang_puglisi_weber_bers_2004FromCellMLCvode(p_solver, p_stimulus));});
     
     boost::filesystem::create_directory("/tmp/"+username);
     output_file.open("/tmp/"+username+"/BenchmarkStates.dat");
@@ -96,20 +102,29 @@ public:
     }
 
     f_results << "\n";
-    
+
+    /*Every (buffer_size, extrapolation_constant) pair, buffer sizes outermost*/
+    std::vector<ExtrapolationConfiguration> configurations;
+    for(unsigned int j = 0; j < buffer_sizes.size(); j++)
+      for(unsigned int k = 0; k < extrapolation_constants.size(); k++)
+	configurations.push_back({buffer_sizes[j], extrapolation_constants[k]});
+
+    std::vector<unsigned int> benchmarks(configurations.size(), 0);
+    for(unsigned int i = 0; i < 8; i++){
+      double period = 1000;
+      if(i<4)
+	period = 500;
+      const std::vector<unsigned int> scores = RunModel(models[i], period, configurations, i);
+      for(unsigned int c = 0; c < configurations.size(); c++)
+	benchmarks[c] += scores[c];
+    }
+    TS_ASSERT(output_file.is_open());
+
     for(unsigned int j = 0; j < buffer_sizes.size(); j++){
       f_results << buffer_sizes[j] << " ";
       for(unsigned int k = 0; k < extrapolation_constants.size(); k++){
-	unsigned int benchmark = 0;
-	for(unsigned int i = 0; i < 8; i++){
-	  double period = 1000;
-	  if(i<4)
-	    period = 500;
-	  benchmark += RunModel(models[i], period, buffer_sizes[j], extrapolation_constants[k], i);
-	}
-	std::cout << "Score is: " << benchmark << "\n";
-	f_results << benchmark << "\t";
-	TS_ASSERT(output_file.is_open());
+	std::cout << "Score is: " << benchmarks[j*extrapolation_constants.size() + k] << "\n";
+	f_results << benchmarks[j*extrapolation_constants.size() + k] << "\t";
       }
         f_results <<"\n";
     }
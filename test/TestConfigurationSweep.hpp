@@ -0,0 +1,58 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "Simulation.hpp"
+#include "ConfigurationSweep.hpp"
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "beeler_reuter_model_1977Cvode.hpp"
+
+/*A sweep sharing the paces before each configuration's first jump should give
+  exactly what running each configuration separately gives, for fewer paces*/
+
+class TestConfigurationSweep : public CxxTest::TestSuite
+{
+private:
+  const double period = 1000;
+  const unsigned int max_paces = 5000;
+public:
+  void TestSameAsSeparateRuns(){
+#ifdef CHASTE_CVODE
+    const std::vector<ExtrapolationConfiguration> configurations = {{25, 0.9}, {50, 0.9}, {50, 0.5}, {100, 0.9}};
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    const std::vector<double> initial_conditions = p_model->GetStdVecStateVariables();
+    unsigned int paces_solved;
+    const std::vector<ConfigurationResult> results = RunConfigurationSweep(p_model, period, configurations, max_paces, &paces_solved);
+    TS_ASSERT_EQUALS(results.size(), configurations.size());
+
+    unsigned int separate_paces = 0;
+    for(unsigned int i = 0; i < configurations.size(); i++){
+      p_model->SetStateVariables(initial_conditions);
+      SmartSimulation simulation(p_model, period);
+      simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+      simulation.Initialise(configurations[i].buffer_size, configurations[i].extrapolation_constant);
+      unsigned int paces;
+      for(paces = 0; paces < max_paces && !simulation.is_finished(); paces++)
+        simulation.RunPace();
+      separate_paces += paces;
+
+      std::cout << "Buffer " << configurations[i].buffer_size << ", constant " << configurations[i].extrapolation_constant << ": "
+                << results[i].paces << " paces, " << results[i].shared_paces << " shared\n";
+      TS_ASSERT(results[i].finished);
+      TS_ASSERT_EQUALS(results[i].paces, paces);
+      TS_ASSERT_LESS_THAN_EQUALS(results[i].shared_paces, results[i].paces);
+      TS_ASSERT_DELTA(mrms(results[i].state_variables, simulation.GetStateVariables()), 0, 1e-12);
+    }
+    std::cout << "Sweep solved " << paces_solved << " paces, separate runs " << separate_paces << "\n";
+    TS_ASSERT_LESS_THAN(paces_solved, separate_paces);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
@@ -0,0 +1,181 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "Simulation.hpp"
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "ten_tusscher_model_2004_epiCvode.hpp"
+#include "shannon_wang_puglisi_weber_bers_2004Cvode.hpp"
+
+/*Push a state out of bounds and check ConstrainState brings it back without
+  touching what was in bounds, check a jump that moves charge is put back onto
+  the same total charge, and that Shannon's buffers, which step like gates but
+  sit above 1, aren't clamped as gates, then pace to steady state with overshooting jumps with
+  and without constraints and compare the number that had to be rolled back*/
+
+class TestConstrainedJumps : public CxxTest::TestSuite
+{
+private:
+  const double period = 1000;
+  const unsigned int buffer_size = 100;
+  const unsigned int max_paces = 10000;
+
+  unsigned int PaceUntilFinished(SmartSimulation& r_simulation){
+    unsigned int paces;
+    for(paces = 0; paces < max_paces && !r_simulation.is_finished(); paces++)
+      r_simulation.RunPace();
+    return paces;
+  }
+
+  /*V - V_analytic, which only a change in the charge held in the concentrations moves*/
+  double GetCharge(boost::shared_ptr<AbstractCvodeCell> p_model, const std::vector<double>& r_state){
+    p_model->SetStateVariables(r_state);
+    return r_state[p_model->GetVoltageIndex()] - p_model->CalculateAnalyticVoltage();
+  }
+public:
+  void TestBounds(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>();
+    SmartSimulation simulation(p_model, period);
+    simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    simulation.Initialise(buffer_size, 0.9);
+
+    const std::vector<double> initial_conditions = simulation.GetStateVariables();
+    const std::vector<unsigned int> gates = FindGates(p_model);
+    TS_ASSERT_LESS_THAN(2u, gates.size());
+    std::vector<double> state = initial_conditions;
+    state[gates[0]] = 1.5;
+    state[gates[1]] = -0.5;
+    const unsigned int sodium_index = p_model->GetSystemInformation()->GetStateVariableIndex("cytosolic_sodium_concentration");
+    state[sodium_index] = -1;
+    const unsigned int voltage_index = p_model->GetVoltageIndex();
+    state[voltage_index] = -200;
+    /*Big drops that stay in bounds are left alone, for gates and concentrations alike*/
+    state[gates[2]] = 1e-3*initial_conditions[gates[2]];
+    const unsigned int potassium_index = p_model->GetSystemInformation()->GetStateVariableIndex("cytosolic_potassium_concentration");
+    state[potassium_index] = 1e-3*initial_conditions[potassium_index];
+    const std::vector<double> unconstrained_state = state;
+
+    simulation.ConstrainState(state);
+    TS_ASSERT_EQUALS(state[gates[0]], 1);
+    TS_ASSERT_EQUALS(state[gates[1]], 0);
+    TS_ASSERT_LESS_THAN(0, state[sodium_index]);
+    TS_ASSERT_LESS_THAN(state[sodium_index], initial_conditions[sodium_index]);
+    /*The voltage isn't bounded*/
+    TS_ASSERT_EQUALS(state[voltage_index], -200);
+    for(unsigned int i = 0; i < state.size(); i++)
+      if(i != gates[0] && i != gates[1] && i != sodium_index)
+        TS_ASSERT_EQUALS(state[i], unconstrained_state[i]);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestChargeConservation(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>();
+    p_model->SetIntegrationConstant(p_model->CalculateAnalyticVoltage());
+    SmartSimulation simulation(p_model, period);
+    simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    simulation.SetConstrainedJumps(true, true);
+    simulation.Initialise(buffer_size, 0.9);
+    /*Not enough paces to jump, so the reference is the current state*/
+    for(unsigned int pace = 0; pace < 10; pace++)
+      simulation.RunPace();
+    TS_ASSERT_EQUALS(simulation.GetNumberOfJumps(), 0u);
+    const std::vector<double> before = simulation.GetStateVariables();
+    const double charge_before = GetCharge(p_model, before);
+
+    /*A jump that moves sodium and potassium without the voltage following*/
+    std::vector<double> state = before;
+    const unsigned int sodium_index = p_model->GetSystemInformation()->GetStateVariableIndex("cytosolic_sodium_concentration");
+    const unsigned int potassium_index = p_model->GetSystemInformation()->GetStateVariableIndex("cytosolic_potassium_concentration");
+    state[sodium_index] *= 1.05;
+    state[potassium_index] *= 0.99;
+    TS_ASSERT_LESS_THAN(1, std::abs(GetCharge(p_model, state) - charge_before));
+
+    simulation.ConstrainState(state);
+    std::cout << "Charge before the jump " << charge_before << ", after constraining " << GetCharge(p_model, state) << "\n";
+    TS_ASSERT_DELTA(GetCharge(p_model, state), charge_before, 1e-4);
+    /*Still a jump, not a return to where it started*/
+    TS_ASSERT_LESS_THAN(1e-3, mrms(before, state));
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestBuffersAreNotGates(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellshannon_wang_puglisi_weber_bers_2004FromCellMLCvode>();
+    p_model->SetIntegrationConstant(p_model->CalculateAnalyticVoltage());
+    SmartSimulation simulation(p_model, period);
+    simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    simulation.SetConstrainedJumps(true, true);
+    simulation.Initialise(buffer_size, 0.9);
+    const std::vector<double> before = simulation.GetStateVariables();
+    const double charge_before = GetCharge(p_model, before);
+
+    /*Calsequestrin, at about 1.2 mM, is one of the variables FindGates takes for a gate*/
+    const unsigned int calsequestrin_index = p_model->GetSystemInformation()->GetStateVariableIndex("Ca_buffer__Ca_Calsequestrin");
+    const std::vector<unsigned int> gates = FindGates(p_model);
+    std::vector<unsigned int> buffers;
+    for(auto i = gates.begin(); i != gates.end(); i++)
+      if(before[*i] > 1)
+        buffers.push_back(*i);
+    TS_ASSERT(std::find(buffers.begin(), buffers.end(), calsequestrin_index) != buffers.end());
+
+    /*A jump that moves calsequestrin up a little and sodium along with it*/
+    std::vector<double> state = before;
+    const unsigned int sodium_index = p_model->GetSystemInformation()->GetStateVariableIndex("cytosolic_sodium_concentration");
+    state[calsequestrin_index] *= 1.01;
+    state[sodium_index] *= 1.01;
+    simulation.ConstrainState(state);
+    std::cout << "Calsequestrin " << before[calsequestrin_index] << " jumped to " << state[calsequestrin_index]
+              << ", charge before the jump " << charge_before << ", after constraining " << GetCharge(p_model, state) << "\n";
+    for(auto i = buffers.begin(); i != buffers.end(); i++)
+      TS_ASSERT_LESS_THAN(1, state[*i]);
+    TS_ASSERT_DELTA(GetCharge(p_model, state), charge_before, 1e-4);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestFewerRejectedJumps(){
+#ifdef CHASTE_CVODE
+    /*Jumps twice as far as the fits say, which move enough charge for the
+      voltage check to roll some back unless it's conserved*/
+    const double extrapolation_coefficient = 2;
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>();
+    p_model->SetIntegrationConstant(p_model->CalculateAnalyticVoltage());
+    SmartSimulation simulation(p_model, period);
+    simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    const std::vector<double> initial_conditions = simulation.GetStateVariables();
+    simulation.Initialise(buffer_size, extrapolation_coefficient);
+    const unsigned int paces = PaceUntilFinished(simulation);
+
+    p_model->SetStateVariables(initial_conditions);
+    SmartSimulation constrained_simulation(p_model, period);
+    constrained_simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    constrained_simulation.SetConstrainedJumps(true, true);
+    constrained_simulation.Initialise(buffer_size, extrapolation_coefficient);
+    const unsigned int constrained_paces = PaceUntilFinished(constrained_simulation);
+
+    std::cout << "Unconstrained: " << paces << " paces, " << simulation.GetNumberOfJumps() << " jumps, "
+              << simulation.GetNumberOfRejectedJumps() << " rejected\n"
+              << "Constrained: " << constrained_paces << " paces, " << constrained_simulation.GetNumberOfJumps() << " jumps, "
+              << constrained_simulation.GetNumberOfRejectedJumps() << " rejected\n";
+    TS_ASSERT(simulation.is_finished());
+    TS_ASSERT(constrained_simulation.is_finished());
+    TS_ASSERT_LESS_THAN(0u, simulation.GetNumberOfRejectedJumps());
+    TS_ASSERT_LESS_THAN(constrained_simulation.GetNumberOfRejectedJumps(), simulation.GetNumberOfRejectedJumps());
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
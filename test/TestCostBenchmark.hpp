@@ -0,0 +1,194 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "Simulation.hpp"
+#include "BenchmarkTools.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "ten_tusscher_model_2004_epiCvode.hpp"
+#include "ohara_rudy_2011_endoCvode.hpp"
+#include "shannon_wang_puglisi_weber_bers_2004Cvode.hpp"
+#include "decker_2009Cvode.hpp"
+
+/*Measure what it really costs to reach steady state - wall time, CPU time, paces, solver work and
+  memory - for each model, period and method, and how the brute force runs scale over threads.
+
+  Memory is the peak resident set during each run alone (the process's high-water mark is reset
+  before it), or during the whole threaded run for the thread scaling records.
+
+  Results are written to /tmp/$USER/Benchmark/cost.csv and cost.json. If the environment variable
+  BENCHMARK_BASELINE names a csv file written by a previous run, the results are compared with it
+  and any growth in solver work of more than 5% fails the test.*/
+
+class TestCostBenchmark : public CxxTest::TestSuite
+{
+private:
+  const unsigned int paces = 5000;
+  const unsigned int buffer_size = 50;
+  const double extrapolation_constant = 0.9;
+  std::string username;
+  std::vector<std::function<boost::shared_ptr<AbstractCvodeCell>()>> model_factories = {
+    CreateCvodeCell<Cellohara_rudy_2011_endoFromCellMLCvode>,
+    CreateCvodeCell<Celldecker_2009FromCellMLCvode>,
+    CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>,
+    CreateCvodeCell<Cellshannon_wang_puglisi_weber_bers_2004FromCellMLCvode>};
+
+  std::string GetInputPath(std::string model_name, double period){
+    /*Start from the limit cycle of the other pacing frequency*/
+    if(period == 500)
+      return "/home/"+username+"/code/chaste-project-data/"+model_name+"/GroundTruth1Hz/final_state_variables.dat";
+    else
+      return "/home/"+username+"/code/chaste-project-data/"+model_name+"/GroundTruth2Hz/final_state_variables.dat";
+  }
+
+  /*Run one model to steady state and time it. Only the calling thread's CPU time is counted so that
+    the numbers are meaningful when several of these run at once*/
+  BenchmarkRecord RunModel(boost::shared_ptr<AbstractCvodeCell> p_model, double period, bool smart){
+    BenchmarkRecord record;
+    record.model_name = p_model->GetSystemInformation()->GetSystemName();
+    record.period = period;
+    record.method = smart ? "SmartSimulation" : "BruteForce";
+
+    const double start_wall_time = GetWallTime();
+    const double start_cpu_time  = GetThreadCpuTime();
+    CvodeStatistics statistics;
+    unsigned int j;
+    if(smart){
+      SmartSimulation simulation(p_model, period, GetInputPath(record.model_name, period));
+      simulation.Initialise(buffer_size, extrapolation_constant);
+      for(j = 0; j < paces; j++){
+        simulation.RunPace();
+        if(simulation.is_finished())
+          break;
+      }
+      statistics = simulation.GetTotalCvodeStatistics();
+    }
+    else{
+      Simulation simulation(p_model, period, GetInputPath(record.model_name, period));
+      simulation.SetPaceCvodeStatisticsHistory(paces);
+      for(j = 0; j < paces; j++){
+        simulation.RunPace();
+        if(simulation.is_finished())
+          break;
+      }
+      statistics = simulation.GetTotalCvodeStatistics();
+      /*The totals are the sum of what every pace recorded*/
+      CvodeStatistics sum;
+      const boost::circular_buffer<PaceCvodeStatistics>& r_history = simulation.rGetPaceCvodeStatisticsHistory();
+      for(auto i = r_history.begin(); i != r_history.end(); i++)
+        sum += i->GetTotal();
+      TS_ASSERT_EQUALS(r_history.size(), std::min(j + 1, paces));
+      TS_ASSERT_EQUALS(sum.rhs_evaluations, statistics.rhs_evaluations);
+      TS_ASSERT_EQUALS(sum.steps, statistics.steps);
+      TS_ASSERT_EQUALS(sum.jacobian_evaluations, statistics.jacobian_evaluations);
+    }
+    record.wall_time = GetWallTime() - start_wall_time;
+    record.cpu_time  = GetThreadCpuTime() - start_cpu_time;
+    /*A run that converged broke out of the loop after solving pace j*/
+    record.paces = std::min(j + 1, paces);
+    record.rhs_evaluations = statistics.rhs_evaluations;
+    record.jacobian_evaluations = statistics.jacobian_evaluations;
+    record.cvode_steps = statistics.steps;
+    return record;
+  }
+
+  /*Run every brute force (model, period) job over a pool of threads, each with its own model instance*/
+  BenchmarkRecord RunThreaded(unsigned int number_of_threads, const std::vector<double>& periods){
+    BenchmarkRecord total;
+    total.model_name = "all";
+    total.method = "BruteForce";
+    total.threads = number_of_threads;
+    std::atomic<unsigned int> next_job(0);
+    std::mutex total_mutex;
+    const unsigned int number_of_jobs = model_factories.size()*periods.size();
+
+    const bool measure_rss = ResetPeakRss();
+    const double start_wall_time = GetWallTime();
+    const double start_cpu_time  = GetProcessCpuTime();
+    std::vector<std::thread> threads;
+    for(unsigned int i = 0; i < number_of_threads; i++){
+      threads.push_back(std::thread([&](){
+            for(unsigned int job = next_job++; job < number_of_jobs; job = next_job++){
+              BenchmarkRecord record = RunModel(model_factories[job % model_factories.size()](), periods[job / model_factories.size()], false);
+              std::lock_guard<std::mutex> lock(total_mutex);
+              total.paces += record.paces;
+              total.rhs_evaluations += record.rhs_evaluations;
+              total.jacobian_evaluations += record.jacobian_evaluations;
+              total.cvode_steps += record.cvode_steps;
+            }
+          }));
+    }
+    for(auto i = threads.begin(); i != threads.end(); i++)
+      i->join();
+    total.wall_time = GetWallTime() - start_wall_time;
+    total.cpu_time  = GetProcessCpuTime() - start_cpu_time;
+    if(measure_rss)
+      total.peak_rss = GetPeakRss();
+    return total;
+  }
+
+public:
+  void TestCost(){
+#ifdef CHASTE_CVODE
+    username = std::string(getenv("USER"));
+    boost::filesystem::create_directory("/tmp/"+username);
+    boost::filesystem::create_directory("/tmp/"+username+"/Benchmark");
+
+    const std::vector<double> periods = {500, 1000};
+    std::vector<BenchmarkRecord> records;
+
+    for(unsigned int i = 0; i < periods.size(); i++){
+      for(unsigned int j = 0; j < model_factories.size(); j++){
+        for(unsigned int smart = 0; smart < 2; smart++){
+          const bool measure_rss = ResetPeakRss();
+          BenchmarkRecord record = RunModel(model_factories[j](), periods[i], smart);
+          if(measure_rss)
+            record.peak_rss = GetPeakRss();
+          std::cout << record.model_name << " " << record.period << " " << record.method << " took " << record.wall_time << "s and " << record.paces << " paces\n";
+          records.push_back(record);
+        }
+      }
+    }
+
+    const unsigned int max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for(unsigned int threads = 1; threads <= max_threads && threads <= 8; threads *= 2){
+      records.push_back(RunThreaded(threads, periods));
+      std::cout << threads << " threads took " << records.back().wall_time << "s\n";
+    }
+
+    /*Every run did some work, and memory is measured wherever the kernel lets us*/
+    for(auto i = records.begin(); i != records.end(); i++){
+      TS_ASSERT_LESS_THAN(0u, i->paces);
+      TS_ASSERT_LESS_THAN(0, i->cvode_steps);
+      TS_ASSERT_LESS_THAN_EQUALS(i->cvode_steps, i->rhs_evaluations);
+      TS_ASSERT_LESS_THAN(0, i->wall_time);
+      if(ResetPeakRss())
+        TS_ASSERT_LESS_THAN(0, i->peak_rss);
+    }
+
+    WriteBenchmarkCsv(records, "/tmp/"+username+"/Benchmark/cost.csv");
+    WriteBenchmarkJson(records, "/tmp/"+username+"/Benchmark/cost.json");
+
+    const char* baseline_path = getenv("BENCHMARK_BASELINE");
+    if(baseline_path){
+      std::vector<BenchmarkRecord> baseline = ReadBenchmarkCsv(baseline_path);
+      TS_ASSERT(!baseline.empty());
+      TS_ASSERT_EQUALS(CompareBenchmarks(records, baseline, 0.05), 0u);
+    }
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
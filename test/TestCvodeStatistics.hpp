@@ -0,0 +1,56 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "Simulation.hpp"
+#include <fstream>
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "beeler_reuter_model_1977Cvode.hpp"
+
+/*Check the per-pace CVODE statistics recorded by Simulation add up, and print where the solver spends its steps*/
+
+class TestCvodeStatistics : public CxxTest::TestSuite
+{
+public:
+  void TestPaceStatistics(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    const unsigned int paces = 20;
+    const unsigned int history_size = 5;
+
+    Simulation simulation(p_model, 1000);
+    simulation.SetPaceCvodeStatisticsHistory(history_size);
+
+    CvodeStatistics sum;
+    for(unsigned int i = 0; i < paces; i++){
+      simulation.RunPace();
+      const PaceCvodeStatistics& statistics = simulation.rGetLastPaceCvodeStatistics();
+      TS_ASSERT_EQUALS(statistics.pace, i);
+      TS_ASSERT(statistics.during_stimulus.steps > 0);
+      TS_ASSERT(statistics.after_stimulus.steps > 0);
+      TS_ASSERT(statistics.GetTotal().rhs_evaluations >= statistics.GetTotal().steps);
+      TS_ASSERT(statistics.after_stimulus.last_step_size > 0);
+      std::cout << "pace " << i << " steps " << statistics.during_stimulus.steps << " + " << statistics.after_stimulus.steps
+                << " rhs " << statistics.GetTotal().rhs_evaluations << " error test failures " << statistics.GetTotal().error_test_failures << "\n";
+      sum += statistics.GetTotal();
+    }
+
+    TS_ASSERT_EQUALS(simulation.GetTotalCvodeStatistics().steps, sum.steps);
+    TS_ASSERT_EQUALS(simulation.GetTotalCvodeStatistics().rhs_evaluations, sum.rhs_evaluations);
+    TS_ASSERT_EQUALS(simulation.GetTotalCvodeStatistics().nonlinear_iterations, sum.nonlinear_iterations);
+
+    const boost::circular_buffer<PaceCvodeStatistics>& history = simulation.rGetPaceCvodeStatisticsHistory();
+    TS_ASSERT_EQUALS(history.size(), history_size);
+    TS_ASSERT_EQUALS(history.front().pace, paces - history_size);
+    TS_ASSERT_EQUALS(history.back().pace, paces - 1);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
@@ -0,0 +1,147 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "Simulation.hpp"
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "ten_tusscher_model_2004_epiCvode.hpp"
+
+/*Fill a decay rate library from one run of ten Tusscher, save and reload it,
+  and start a second run from slightly different initial conditions with it.
+  The second run should make its first jump after a handful of paces. The first
+  run mustn't seed from its own fits, seeded jumps must be checked even when
+  speculating, and jumps that are rolled back mustn't be recorded.*/
+
+class TestDecayRateLibrary : public CxxTest::TestSuite
+{
+private:
+  const double period = 1000;
+  const unsigned int buffer_size = 100;
+  const unsigned int max_paces = 10000;
+
+  unsigned int PaceUntilFinished(SmartSimulation& r_simulation, unsigned int& r_first_jump){
+    unsigned int paces;
+    r_first_jump = max_paces;
+    for(paces = 0; paces < max_paces && !r_simulation.is_finished(); paces++){
+      r_simulation.RunPace();
+      if(r_simulation.GetNumberOfJumps() > 0 && r_first_jump == max_paces)
+        r_first_jump = paces;
+    }
+    return paces;
+  }
+public:
+  void TestSaveAndLoad(){
+    const std::string file_path = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string();
+    DecayRateLibrary library;
+    const DecayRate sodium = {"cytosolic_sodium_concentration", 120.5, 1e-3};
+    const DecayRate potassium = {"cytosolic_potassium_concentration", 300, 2e-2};
+    library.Add("model", 1000, sodium);
+    library.Add("model", 1000, potassium);
+    library.Add("model", 500, sodium);
+    /*Replaces the first record*/
+    const DecayRate faster_sodium = {"cytosolic_sodium_concentration", 100.25, 1e-3};
+    library.Add("model", 1000, faster_sodium);
+    TS_ASSERT_EQUALS(library.GetNumberOfRecords(), 3u);
+    library.Save(file_path);
+
+    const DecayRateLibrary loaded_library(file_path);
+    TS_ASSERT_EQUALS(loaded_library.GetNumberOfRecords(), 3u);
+    const std::vector<DecayRate> rates = loaded_library.Find("model", 1000);
+    TS_ASSERT_EQUALS(rates.size(), 2u);
+    TS_ASSERT_EQUALS(rates[0].variable, "cytosolic_sodium_concentration");
+    TS_ASSERT_EQUALS(rates[0].tau, 100.25);
+    TS_ASSERT_EQUALS(rates[1].amplitude, 2e-2);
+    TS_ASSERT(loaded_library.Find("other model", 1000).empty());
+    boost::filesystem::remove(file_path);
+
+    /*Nothing saved yet is an empty library*/
+    TS_ASSERT_EQUALS(DecayRateLibrary(file_path).GetNumberOfRecords(), 0u);
+  }
+
+  void TestSeededRun(){
+#ifdef CHASTE_CVODE
+    const std::string file_path = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string();
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>();
+    std::vector<double> initial_conditions = p_model->GetStdVecStateVariables();
+    boost::shared_ptr<DecayRateLibrary> p_library(new DecayRateLibrary(file_path));
+
+    SmartSimulation simulation(p_model, period);
+    simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    simulation.SetDecayRateLibrary(p_library);
+    simulation.Initialise(buffer_size, 0.9);
+    unsigned int first_jump;
+    const unsigned int paces = PaceUntilFinished(simulation, first_jump);
+    TS_ASSERT(simulation.is_finished());
+    /*The library was empty when the run started, however many rates it fitted since*/
+    TS_ASSERT_EQUALS(simulation.GetNumberOfSeededJumps(), 0u);
+    TS_ASSERT_LESS_THAN(0u, p_library->GetNumberOfRecords());
+    p_library->Save(file_path);
+
+    /*A nearby start, as in a sweep*/
+    const unsigned int sodium_index = p_model->GetSystemInformation()->GetStateVariableIndex("cytosolic_sodium_concentration");
+    initial_conditions[sodium_index] *= 1.1;
+    p_model->SetStateVariables(initial_conditions);
+    SmartSimulation seeded_simulation(p_model, period);
+    seeded_simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    seeded_simulation.SetDecayRateLibrary(boost::shared_ptr<DecayRateLibrary>(new DecayRateLibrary(file_path)));
+    seeded_simulation.Initialise(buffer_size, 0.9);
+    unsigned int seeded_first_jump;
+    const unsigned int seeded_paces = PaceUntilFinished(seeded_simulation, seeded_first_jump);
+
+    std::cout << "Unseeded: " << paces << " paces, first jump after " << first_jump << "\n"
+              << "Seeded: " << seeded_paces << " paces, first jump after " << seeded_first_jump << ", "
+              << seeded_simulation.GetNumberOfSeededJumps() << " seeded jumps\n";
+    TS_ASSERT(seeded_simulation.is_finished());
+    TS_ASSERT_LESS_THAN(0u, seeded_simulation.GetNumberOfSeededJumps());
+    TS_ASSERT_LESS_THAN(seeded_first_jump, buffer_size);
+
+    /*Seeded jumps aren't raced, so one that moves the voltage too far is rolled
+      back even when speculating. An integration constant 100mV out makes every
+      jump do that.*/
+    p_model->SetStateVariables(initial_conditions);
+    p_model->SetIntegrationConstant(p_model->CalculateAnalyticVoltage() + 100);
+    SmartSimulation speculative_simulation(p_model, period);
+    speculative_simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    speculative_simulation.SetDecayRateLibrary(boost::shared_ptr<DecayRateLibrary>(new DecayRateLibrary(file_path)));
+    speculative_simulation.SetSpeculativePaces(5);
+    speculative_simulation.Initialise(buffer_size, 0.9);
+    for(unsigned int pace = 0; pace < seeded_first_jump + 5; pace++)
+      speculative_simulation.RunPace();
+    TS_ASSERT_LESS_THAN(0u, speculative_simulation.GetNumberOfRejectedJumps());
+    TS_ASSERT_EQUALS(speculative_simulation.GetNumberOfSeededJumps(), 0u);
+    TS_ASSERT_EQUALS(speculative_simulation.GetNumberOfJumps(), 0u);
+    boost::filesystem::remove(file_path);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestRejectedJumpsNotRecorded(){
+#ifdef CHASTE_CVODE
+    /*An integration constant 100mV out puts the analytic voltage far from the
+      real one, so the voltage check rolls back every jump*/
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>();
+    p_model->SetIntegrationConstant(p_model->CalculateAnalyticVoltage() + 100);
+    TS_ASSERT_LESS_THAN(5, std::abs(p_model->CalculateAnalyticVoltage() - p_model->GetStdVecStateVariables()[p_model->GetVoltageIndex()]));
+    boost::shared_ptr<DecayRateLibrary> p_library(new DecayRateLibrary());
+
+    SmartSimulation simulation(p_model, period);
+    simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    simulation.SetDecayRateLibrary(p_library);
+    simulation.Initialise(buffer_size, 0.9);
+    for(unsigned int pace = 0; pace < 5*buffer_size && !simulation.is_finished(); pace++)
+      simulation.RunPace();
+    TS_ASSERT_LESS_THAN(0u, simulation.GetNumberOfRejectedJumps());
+    TS_ASSERT_EQUALS(p_library->GetNumberOfRecords(), 0u);
+    TS_ASSERT_EQUALS(simulation.GetNumberOfSeededJumps(), 0u);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
@@ -0,0 +1,105 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "SimulationTools.hpp"
+#include "DenseTrace.hpp"
+#include "Simulation.hpp"
+#include <fstream>
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "ten_tusscher_model_2004_epiCvode.hpp"
+
+/*Check a trace built from CVODE's internal steps matches Compute() at its sampling
+  times, then read APDs from it at the sampling rates TestAPD uses without solving again.
+  Then check Simulation's pace to pace trace norm agrees with CalculatePaceMrms.*/
+
+class TestDenseTrace : public CxxTest::TestSuite
+{
+public:
+  void TestDenseOutput(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>();
+    boost::shared_ptr<RegularStimulus> p_regular_stim = p_model->UseCellMLDefaultStimulus();
+    const double period = 500;
+    const double duration = p_regular_stim->GetDuration();
+    const double sampling_timestep = 0.01;
+    p_regular_stim->SetPeriod(period);
+    p_regular_stim->SetStartTime(0);
+    p_model->SetMaxTimestep(1000);
+    p_model->SetMaxSteps(1e5);
+    p_model->SetTolerances(1e-12, 1e-12);
+
+    const std::vector<double> initial_conditions = p_model->GetStdVecStateVariables();
+
+    DenseTrace trace;
+    SolveAndRecordSteps(p_model, 0, duration, trace);
+    SolveAndRecordSteps(p_model, duration, period, trace);
+    const std::vector<double> final_states = p_model->GetStdVecStateVariables();
+    TS_ASSERT_EQUALS(trace.GetStartTime(), 0);
+    TS_ASSERT_EQUALS(trace.GetEndTime(), period);
+    TS_ASSERT_LESS_THAN(mrms(final_states, trace.GetStateVariables(period)), 1e-10);
+    TS_ASSERT_THROWS_ANYTHING(trace.GetValue(0, period + 1));
+
+    /*The same pace sampled by CVODE stopping at every sampling time*/
+    p_model->SetStateVariables(initial_conditions);
+    OdeSolution solution = p_model->Compute(0, duration, sampling_timestep);
+    std::vector<std::vector<double>> state_variables = solution.rGetSolutions();
+    std::vector<double> times = solution.rGetTimes();
+    solution = p_model->Compute(duration, period, sampling_timestep);
+    state_variables.insert(state_variables.end(), ++solution.rGetSolutions().begin(), solution.rGetSolutions().end());
+    times.insert(times.end(), ++solution.rGetTimes().begin(), solution.rGetTimes().end());
+
+    const std::vector<std::vector<double>> dense_state_variables = trace.GetStateVariables(times);
+    const double difference = mrmsTrace(state_variables, dense_state_variables);
+    std::cout << trace.GetNumberOfSteps() << " internal steps for " << times.size() << " samples, mrms difference " << difference << "\n";
+    TS_ASSERT_LESS_THAN(difference, 1e-6);
+
+    /*One solve, read at every sampling rate*/
+    const unsigned int voltage_index = p_model->GetSystemInformation()->GetStateVariableIndex("membrane_voltage");
+    const std::vector<double> sampling_timesteps = {1, 0.1, 0.01, 0.001};
+    std::vector<double> apds;
+    for(unsigned int i = 0; i < sampling_timesteps.size(); i++){
+      std::vector<double> sampling_times = GetSamplingTimes(0, duration, sampling_timesteps[i]);
+      const std::vector<double> after_stimulus = GetSamplingTimes(duration, period, sampling_timesteps[i]);
+      sampling_times.insert(sampling_times.end(), ++after_stimulus.begin(), after_stimulus.end());
+      CellProperties cell_props(trace.GetVariable(voltage_index, sampling_times), sampling_times);
+      apds.push_back(cell_props.GetLastActionPotentialDuration(90));
+      std::cout << "sampling timestep " << sampling_timesteps[i] << " APD90 " << apds.back() << "\n";
+    }
+    TS_ASSERT_DELTA(apds[2], apds[3], 0.01);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestTraceNorm(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>();
+    const double period = 1000;
+    Simulation simulation(p_model, period);
+    simulation.SetTraceNorm(true);
+    const double duration = boost::static_pointer_cast<RegularStimulus>(p_model->GetStimulusFunction())->GetDuration();
+
+    /*Keep the state at the start of each pace so the same two paces can be solved again and sampled*/
+    std::vector<std::vector<double>> initial_states = {simulation.GetStateVariables()};
+    simulation.RunPace();
+    TS_ASSERT(std::isnan(simulation.GetTraceMrms()));
+    initial_states.push_back(simulation.GetStateVariables());
+    for(unsigned int i = 0; i < 5; i++){
+      simulation.RunPace();
+      const double sampled_mrms = CalculatePaceMrms(p_model, initial_states[i], initial_states[i+1], period, duration);
+      std::cout << "pace " << i + 1 << " trace mrms " << simulation.GetTraceMrms() << " sampled mrms " << sampled_mrms << "\n";
+      TS_ASSERT_DELTA(simulation.GetTraceMrms()/sampled_mrms, 1, 0.1);
+      initial_states.push_back(simulation.GetStateVariables());
+    }
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
@@ -0,0 +1,126 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "DiagnosticsSink.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <thread>
+#include <cstdlib>
+
+/*Several threads write to the asynchronous sink at once. Every write it
+  accepts must reach its file, in the order each thread made them, by the time
+  Flush returns, and every write it can't queue must be counted as dropped.*/
+
+class TestDiagnosticsSink : public CxxTest::TestSuite
+{
+private:
+  const unsigned int number_of_producers = 4;
+
+  /*Each producer appends numbered lines to its own file and to a shared one*/
+  void Produce(AsyncFileDiagnosticsSink& r_sink, unsigned int producer, unsigned int messages){
+    for(unsigned int i = 0; i < messages; i++){
+      const std::string line = std::to_string(producer) + " " + std::to_string(i) + "\n";
+      r_sink.Write("producer_" + std::to_string(producer) + ".txt", line, true);
+      r_sink.Write("shared/all.txt", line, true);
+    }
+  }
+
+  void RunProducers(AsyncFileDiagnosticsSink& r_sink, unsigned int messages){
+    std::vector<std::thread> producers;
+    for(unsigned int producer = 0; producer < number_of_producers; producer++)
+      producers.push_back(std::thread(&TestDiagnosticsSink::Produce, this, std::ref(r_sink), producer, messages));
+    for(auto i = producers.begin(); i != producers.end(); i++)
+      i->join();
+  }
+
+  /*The message numbers each producer got into the file, in file order*/
+  std::vector<std::vector<unsigned int>> ReadLines(const boost::filesystem::path& r_path){
+    std::vector<std::vector<unsigned int>> lines(number_of_producers);
+    std::ifstream file_in(r_path.string());
+    unsigned int producer, message;
+    while(file_in >> producer >> message){
+      TS_ASSERT_LESS_THAN(producer, number_of_producers);
+      if(producer < number_of_producers)
+        lines[producer].push_back(message);
+    }
+    return lines;
+  }
+
+  void CheckInOrder(const std::vector<unsigned int>& r_messages){
+    for(unsigned int i = 1; i < r_messages.size(); i++)
+      TS_ASSERT_LESS_THAN(r_messages[i - 1], r_messages[i]);
+  }
+public:
+  void TestNothingLostOrReordered(){
+    const boost::filesystem::path root = boost::filesystem::temp_directory_path()/boost::filesystem::unique_path("diagnostics_%%%%%%");
+    const unsigned int messages = 2000;
+    {
+      /*Room for everything, so nothing may be dropped*/
+      AsyncFileDiagnosticsSink sink(root.string(), 2*number_of_producers*messages);
+      RunProducers(sink, messages);
+      sink.Flush();
+      TS_ASSERT_EQUALS(sink.GetNumberDropped(), 0u);
+      TS_ASSERT_EQUALS(sink.GetNumberWritten(), 2*number_of_producers*messages);
+
+      /*Flush has drained the queue, so the files are complete while the sink is still running*/
+      const std::vector<std::vector<unsigned int>> shared_lines = ReadLines(root/"shared"/"all.txt");
+      for(unsigned int producer = 0; producer < number_of_producers; producer++){
+        const std::vector<unsigned int> own_lines = ReadLines(root/("producer_" + std::to_string(producer) + ".txt"))[producer];
+        TS_ASSERT_EQUALS(own_lines.size(), messages);
+        TS_ASSERT_EQUALS(shared_lines[producer].size(), messages);
+        for(unsigned int i = 0; i < own_lines.size() && i < messages; i++)
+          TS_ASSERT_EQUALS(own_lines[i], i);
+        CheckInOrder(shared_lines[producer]);
+      }
+
+      /*A write that replaces the file after appends to it leaves only itself*/
+      sink.Write("replaced.txt", "0 0\n", true);
+      sink.Write("replaced.txt", "1 1\n", false);
+      sink.Flush();
+      const std::vector<std::vector<unsigned int>> replaced_lines = ReadLines(root/"replaced.txt");
+      TS_ASSERT(replaced_lines[0].empty());
+      TS_ASSERT_EQUALS(replaced_lines[1].size(), 1u);
+    }
+    boost::filesystem::remove_all(root);
+  }
+
+  void TestOverflowIsCounted(){
+    const boost::filesystem::path root = boost::filesystem::temp_directory_path()/boost::filesystem::unique_path("diagnostics_%%%%%%");
+    const unsigned int messages = 20000;
+    {
+      /*Far more writes than a tiny queue can hold between the writer's batches*/
+      AsyncFileDiagnosticsSink sink(root.string(), 4);
+      RunProducers(sink, messages);
+      sink.Flush();
+      const size_t dropped = sink.GetNumberDropped();
+      std::cout << "Dropped " << dropped << " of " << 2*number_of_producers*messages << " writes\n";
+      TS_ASSERT_LESS_THAN(0u, dropped);
+      TS_ASSERT_EQUALS(sink.GetNumberWritten() + dropped, 2*number_of_producers*messages);
+
+      /*What did get through is still in order, and is exactly what wasn't dropped*/
+      size_t lines_on_disk = 0;
+      const std::vector<std::vector<unsigned int>> shared_lines = ReadLines(root/"shared"/"all.txt");
+      for(unsigned int producer = 0; producer < number_of_producers; producer++){
+        const std::vector<unsigned int> own_lines = ReadLines(root/("producer_" + std::to_string(producer) + ".txt"))[producer];
+        CheckInOrder(own_lines);
+        CheckInOrder(shared_lines[producer]);
+        lines_on_disk += own_lines.size() + shared_lines[producer].size();
+      }
+      TS_ASSERT_EQUALS(lines_on_disk + dropped, 2*number_of_producers*messages);
+    }
+    boost::filesystem::remove_all(root);
+  }
+
+  void TestDefaultRoot(){
+    setenv("CHASTE_DIAGNOSTICS_DIR", "/some/where", 1);
+    TS_ASSERT_EQUALS(GetDefaultDiagnosticsRoot(), "/some/where");
+    unsetenv("CHASTE_DIAGNOSTICS_DIR");
+    TS_ASSERT_DIFFERS(GetDefaultDiagnosticsRoot(), "/some/where");
+    TS_ASSERT_DIFFERS(GetDefaultDiagnosticsRoot(), "");
+  }
+};
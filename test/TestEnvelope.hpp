@@ -0,0 +1,56 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "EnvelopeSimulation.hpp"
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "beeler_reuter_model_1977Cvode.hpp"
+
+/*Pace to steady state with envelope steps and compare with pacing every beat:
+  the steady state should be the same and take far fewer paces to reach*/
+
+class TestEnvelope : public CxxTest::TestSuite
+{
+private:
+  const double period = 1000;
+  const double duration = 2;
+  const unsigned int max_paces = 10000;
+public:
+  void TestEnvelopeFollowing(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    Simulation simulation(p_model, period);
+    unsigned int paces;
+    for(paces = 0; paces < max_paces && !simulation.is_finished(); paces++)
+      simulation.RunPace();
+    TS_ASSERT(simulation.is_finished());
+
+    boost::shared_ptr<AbstractCvodeCell> p_envelope_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    EnvelopeSimulation envelope_simulation(p_envelope_model, period);
+    while(envelope_simulation.GetNumberOfPacesRun() < max_paces && !envelope_simulation.is_finished())
+      envelope_simulation.RunEnvelopeStep();
+    TS_ASSERT(envelope_simulation.is_finished());
+
+    std::cout << "Every beat: " << paces << " paces\n"
+              << "Envelope: " << envelope_simulation.GetNumberOfPacesRun() << " paces, "
+              << envelope_simulation.GetNumberOfEnvelopeSteps() << " steps over " << envelope_simulation.GetNumberOfPacesSkipped()
+              << " paces, " << envelope_simulation.GetNumberOfRejectedSteps() << " rejected\n";
+    TS_ASSERT_LESS_THAN(envelope_simulation.GetNumberOfPacesRun(), paces);
+
+    const double state_difference = mrms(simulation.GetStateVariables(), envelope_simulation.GetStateVariables());
+    const double apd = CalculateAPD(p_model, period, duration, 90);
+    const double envelope_apd = CalculateAPD(p_envelope_model, period, duration, 90);
+    std::cout << "mrms between steady states " << state_difference << ", APD90s " << apd << " and " << envelope_apd << "\n";
+    TS_ASSERT_LESS_THAN(state_difference, 1e-4);
+    TS_ASSERT_DELTA(apd, envelope_apd, 1e-1);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
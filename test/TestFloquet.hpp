@@ -0,0 +1,121 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "FloquetAnalysis.hpp"
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "beeler_reuter_model_1977Cvode.hpp"
+
+/*Check the eigenvalue routines on small matrices with known answers, then find
+  the leading Floquet multiplier of Beeler-Reuter's steady state and compare it
+  with how fast pacing actually converged*/
+
+class TestFloquet : public CxxTest::TestSuite
+{
+private:
+  const double period = 1000;
+  const unsigned int max_paces = 10000;
+public:
+  void TestEigenvalues(){
+    /*A rotation and scaling (eigenvalues 0.5 +/- 0.5i) next to a real eigenvalue of 0.9*/
+    const std::vector<std::vector<double>> matrix = {{0.5, -0.5, 1}, {0.5, 0.5, 2}, {0, 0, 0.9}};
+    std::vector<std::complex<double>> eigenvalues = CalculateEigenvalues(matrix);
+    TS_ASSERT_EQUALS(eigenvalues.size(), 3u);
+    std::sort(eigenvalues.begin(), eigenvalues.end(), [](std::complex<double> a, std::complex<double> b){return a.imag() < b.imag();});
+    TS_ASSERT_DELTA(eigenvalues[0].real(), 0.5, 1e-10);
+    TS_ASSERT_DELTA(eigenvalues[0].imag(), -0.5, 1e-10);
+    TS_ASSERT_DELTA(eigenvalues[1].real(), 0.9, 1e-10);
+    TS_ASSERT_DELTA(eigenvalues[1].imag(), 0, 1e-10);
+    TS_ASSERT_DELTA(eigenvalues[2].imag(), 0.5, 1e-10);
+
+    /*A v = 0.9 v*/
+    const std::vector<std::complex<double>> eigenvector = CalculateEigenvector(matrix, 0.9);
+    for(unsigned int i = 0; i < 3; i++){
+      std::complex<double> product = 0;
+      for(unsigned int j = 0; j < 3; j++)
+        product += matrix[i][j]*eigenvector[j];
+      TS_ASSERT_DELTA(std::abs(product - 0.9*eigenvector[i]), 0, 1e-8);
+    }
+
+    /*A symmetric matrix with eigenvalues 1, 2, ..., 6*/
+    const unsigned int n = 6;
+    std::vector<std::vector<double>> symmetric(n, std::vector<double>(n, 0.0));
+    for(unsigned int i = 0; i < n; i++)
+      symmetric[i][i] = 1 + i;
+    /*Conjugated by a Householder reflection so it isn't already diagonal*/
+    std::vector<double> v = {1, -2, 0.5, 3, 1, -1};
+    double v_norm2 = 0;
+    for(unsigned int i = 0; i < n; i++)
+      v_norm2 += v[i]*v[i];
+    std::vector<std::vector<double>> reflection(n, std::vector<double>(n));
+    for(unsigned int i = 0; i < n; i++)
+      for(unsigned int j = 0; j < n; j++)
+        reflection[i][j] = (i == j) - 2*v[i]*v[j]/v_norm2;
+    std::vector<std::vector<double>> conjugated(n, std::vector<double>(n, 0.0));
+    for(unsigned int i = 0; i < n; i++)
+      for(unsigned int j = 0; j < n; j++)
+        for(unsigned int k = 0; k < n; k++)
+          conjugated[i][j] += reflection[i][k]*symmetric[k][k]*reflection[k][j];
+    eigenvalues = CalculateEigenvalues(conjugated);
+    std::sort(eigenvalues.begin(), eigenvalues.end(), [](std::complex<double> a, std::complex<double> b){return a.real() < b.real();});
+    for(unsigned int i = 0; i < n; i++){
+      TS_ASSERT_DELTA(eigenvalues[i].real(), 1 + i, 1e-9);
+      TS_ASSERT_DELTA(eigenvalues[i].imag(), 0, 1e-9);
+    }
+  }
+
+  void TestBeelerReuter(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    Simulation simulation(p_model, period);
+    /*The mrms between paces shrinks like the largest multiplier to the power of the pace*/
+    std::vector<double> mrms_history;
+    for(unsigned int paces = 0; paces < max_paces && !simulation.is_finished(); paces++){
+      simulation.RunPace();
+      mrms_history.push_back(simulation.GetMrms());
+    }
+    TS_ASSERT(simulation.is_finished());
+    mrms_history.pop_back();
+    const unsigned int span = 20;
+    TS_ASSERT_LESS_THAN(span, mrms_history.size());
+    const double observed_rate = pow(mrms_history.back()/mrms_history[mrms_history.size() - 1 - span], 1.0/span);
+
+    /*Neither a pace map nor the whole analysis moves the simulation on*/
+    const std::vector<double> steady_state = simulation.GetStateVariables();
+    const unsigned int paces_solved = simulation.GetNumberOfPacesSolved();
+    const long rhs_evaluations = simulation.GetTotalCvodeStatistics().rhs_evaluations;
+    std::vector<double> perturbed_state = steady_state;
+    perturbed_state[0] += 1;
+    const std::vector<double> image = simulation.ApplyPaceMap(perturbed_state);
+    TS_ASSERT_LESS_THAN(0, mrms(image, perturbed_state));
+    TS_ASSERT(simulation.GetStateVariables() == steady_state);
+    TS_ASSERT_EQUALS(simulation.GetNumberOfPacesSolved(), paces_solved);
+
+    const std::vector<FloquetMode> modes = CalculateFloquetModes(simulation, 3, 8, 2);
+    TS_ASSERT(simulation.GetStateVariables() == steady_state);
+    TS_ASSERT_EQUALS(simulation.GetNumberOfPacesSolved(), paces_solved);
+    TS_ASSERT_EQUALS(simulation.GetTotalCvodeStatistics().rhs_evaluations, rhs_evaluations);
+    /*Still finished: GetMrms is NaN once a simulation has converged*/
+    TS_ASSERT(std::isnan(simulation.GetMrms()));
+    TS_ASSERT_EQUALS(modes.size(), 3u);
+    for(auto i = modes.begin(); i != modes.end(); i++)
+      std::cout << "multiplier " << i->multiplier << " |" << std::abs(i->multiplier) << "|, decays in " << i->GetDecayPaces()
+                << " paces, residual " << i->residual << "\n";
+    std::cout << "observed rate " << observed_rate << "\n";
+
+    TS_ASSERT_LESS_THAN(std::abs(modes[0].multiplier), 1);
+    for(unsigned int i = 1; i < modes.size(); i++)
+      TS_ASSERT_LESS_THAN_EQUALS(std::abs(modes[i].multiplier), std::abs(modes[i-1].multiplier));
+    TS_ASSERT_DELTA(std::abs(modes[0].multiplier), observed_rate, 0.05);
+    TS_ASSERT(simulation.is_finished());
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
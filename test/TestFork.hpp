@@ -0,0 +1,176 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "Simulation.hpp"
+#include <fstream>
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "beeler_reuter_model_1977Cvode.hpp"
+
+/*Check a forked simulation paces exactly like the original without touching it,
+  then run SmartSimulation with every jump raced against a fork that doesn't jump,
+  and check a jump that loses the race leaves the baseline's state with the work
+  of both sides counted, and carries on pacing its own model when the race was
+  run on approach solver paces*/
+
+class TestFork : public CxxTest::TestSuite
+{
+public:
+  void TestForkIsIndependent(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    Simulation simulation(p_model, 1000);
+    for(unsigned int i = 0; i < 3; i++)
+      simulation.RunPace();
+
+    Simulation fork = simulation.Fork();
+    const std::vector<double> states_at_fork = simulation.GetStateVariables();
+    TS_ASSERT_EQUALS(mrms(states_at_fork, fork.GetStateVariables()), 0);
+
+    for(unsigned int i = 0; i < 2; i++)
+      fork.RunPace();
+    TS_ASSERT_EQUALS(mrms(states_at_fork, simulation.GetStateVariables()), 0);
+    TS_ASSERT_EQUALS(mrms(states_at_fork, p_model->GetStdVecStateVariables()), 0);
+
+    for(unsigned int i = 0; i < 2; i++)
+      simulation.RunPace();
+    TS_ASSERT_LESS_THAN(mrms(simulation.GetStateVariables(), fork.GetStateVariables()), 1e-10);
+    TS_ASSERT_DELTA(simulation.GetMrms(), fork.GetMrms(), 1e-10);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestSpeculativeJumps(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    const unsigned int max_paces = 5000;
+    SmartSimulation simulation(p_model, 1000);
+    simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    simulation.Initialise(50, 0.9);
+    simulation.SetSpeculativePaces(5);
+
+    unsigned int paces;
+    for(paces = 0; paces < max_paces && !simulation.is_finished(); paces++)
+      simulation.RunPace();
+    std::cout << "Speculative SmartSimulation finished after " << paces << " calls to RunPace\n";
+    TS_ASSERT(simulation.is_finished());
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestRejectedSpeculation(){
+#ifdef CHASTE_CVODE
+    const unsigned int speculative_paces = 5;
+    const unsigned int max_paces = 5000;
+    const unsigned int history_capacity = 10000;
+    /*Jumping ten times as far as the fit suggests overshoots badly, so the baseline wins*/
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    SmartSimulation simulation(p_model, 1000);
+    simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    simulation.Initialise(50, 10);
+    simulation.SetSpeculativePaces(speculative_paces);
+    simulation.SetPaceCvodeStatisticsHistory(history_capacity);
+
+    /*The same simulation never jumping*/
+    boost::shared_ptr<AbstractCvodeCell> p_plain_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    SmartSimulation plain(p_plain_model, 1000);
+    plain.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    plain.Initialise(50, 10);
+    plain.SetMaximumJumps(0);
+    plain.SetPaceCvodeStatisticsHistory(history_capacity);
+
+    unsigned int paces_before_jump = 0;
+    while(simulation.GetNumberOfJumps() == 0 && paces_before_jump < max_paces && !simulation.is_finished()){
+      simulation.RunPace();
+      paces_before_jump++;
+    }
+    TS_ASSERT_EQUALS(simulation.GetNumberOfJumps(), 1u);
+    TS_ASSERT_EQUALS(simulation.GetNumberOfRejectedJumps(), 1u);
+    /*The call that jumped paced the baseline speculative_paces times*/
+    paces_before_jump--;
+    for(unsigned int i = 0; i < paces_before_jump + speculative_paces; i++)
+      plain.RunPace();
+    TS_ASSERT_LESS_THAN(mrms(simulation.GetStateVariables(), plain.GetStateVariables()), 1e-10);
+    TS_ASSERT_LESS_THAN(mrms(simulation.GetStateVariables(), p_model->GetStdVecStateVariables()), 1e-10);
+
+    /*Every pace solved is in the history, numbered in turn: the paces before the
+      jump, then the candidate's, then the baseline's*/
+    const boost::circular_buffer<PaceCvodeStatistics>& r_history = simulation.rGetPaceCvodeStatisticsHistory();
+    const boost::circular_buffer<PaceCvodeStatistics>& r_plain_history = plain.rGetPaceCvodeStatisticsHistory();
+    TS_ASSERT_EQUALS(r_plain_history.size(), paces_before_jump + speculative_paces);
+    TS_ASSERT_LESS_THAN(r_plain_history.size(), r_history.size());
+    const unsigned int candidate_paces = r_history.size() - r_plain_history.size();
+    long steps = 0, rhs_evaluations = 0, candidate_steps = 0;
+    for(unsigned int i = 0; i < r_history.size(); i++){
+      TS_ASSERT_EQUALS(r_history[i].pace, i);
+      steps += r_history[i].GetTotal().steps;
+      rhs_evaluations += r_history[i].GetTotal().rhs_evaluations;
+      if(i < paces_before_jump)
+        TS_ASSERT_EQUALS(r_history[i].GetTotal().steps, r_plain_history[i].GetTotal().steps);
+      else if(i < paces_before_jump + candidate_paces)
+        candidate_steps += r_history[i].GetTotal().steps;
+      else
+        TS_ASSERT_EQUALS(r_history[i].GetTotal().steps, r_plain_history[i - candidate_paces].GetTotal().steps);
+    }
+    const CvodeStatistics totals = simulation.GetTotalCvodeStatistics();
+    TS_ASSERT_EQUALS(totals.steps, steps);
+    TS_ASSERT_EQUALS(totals.rhs_evaluations, rhs_evaluations);
+    TS_ASSERT_LESS_THAN(0, candidate_steps);
+    TS_ASSERT_EQUALS(totals.steps, plain.GetTotalCvodeStatistics().steps + candidate_steps);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestRejectedSpeculationWithApproachSolver(){
+#ifdef CHASTE_CVODE
+    const unsigned int speculative_paces = 5;
+    const unsigned int max_paces = 5000;
+    const unsigned int paces_after_jump = 3;
+    /*A handoff mrms of 0 keeps Rush-Larsen on, so the race and the paces after it are all approach paces*/
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    SmartSimulation simulation(p_model, 1000);
+    simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    simulation.Initialise(50, 10);
+    simulation.SetSpeculativePaces(speculative_paces);
+    simulation.SetRushLarsenApproach(0);
+
+    boost::shared_ptr<AbstractCvodeCell> p_plain_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    SmartSimulation plain(p_plain_model, 1000);
+    plain.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    plain.Initialise(50, 10);
+    plain.SetMaximumJumps(0);
+    plain.SetRushLarsenApproach(0);
+
+    unsigned int paces_before_jump = 0;
+    while(simulation.GetNumberOfJumps() == 0 && paces_before_jump < max_paces && !simulation.is_finished()){
+      simulation.RunPace();
+      paces_before_jump++;
+    }
+    TS_ASSERT_EQUALS(simulation.GetNumberOfRejectedJumps(), 1u);
+    TS_ASSERT(simulation.IsUsingApproachSolver());
+
+    /*The paces after the rejected jump move the simulation's own model, in step with the plain run*/
+    const std::vector<double> state_after_race = simulation.GetStateVariables();
+    for(unsigned int i = 0; i < paces_after_jump; i++){
+      simulation.RunPace();
+      TS_ASSERT_LESS_THAN(0, simulation.rGetLastPaceCvodeStatistics().GetTotal().rhs_evaluations);
+    }
+    TS_ASSERT_LESS_THAN(0, mrms(state_after_race, p_model->GetStdVecStateVariables()));
+    TS_ASSERT_LESS_THAN(mrms(simulation.GetStateVariables(), p_model->GetStdVecStateVariables()), 1e-10);
+    for(unsigned int i = 0; i < paces_before_jump - 1 + speculative_paces + paces_after_jump; i++)
+      plain.RunPace();
+    TS_ASSERT_LESS_THAN(mrms(simulation.GetStateVariables(), plain.GetStateVariables()), 1e-10);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
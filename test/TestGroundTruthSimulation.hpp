@@ -7,6 +7,7 @@
 #include "Shannon2004Cvode.hpp"
 #include "FakePetscSetup.hpp"
 #include "SimulationTools.hpp"
+#include "TraceFile.hpp"
 #include <boost/filesystem.hpp>
 #include <fstream>
 
@@ -105,6 +106,13 @@ public:
 
     std::vector<double> voltages = GetNthVariable(final_trace, voltage_index);
     
+    /*Keep the whole final pace as a compressed binary trace*/
+    std::string trace_path = "/tmp/"+username+"/"+model_name+(period==500 ? "/GroundTruth2Hz" : "/GroundTruth1Hz")+"/final_trace.bin";
+    TraceWriter trace_writer(trace_path, state_variable_names);
+    for(unsigned int i = 0; i < times.size(); i++)
+      trace_writer.AddRow(times[i], final_trace[i]);
+    trace_writer.Close();
+
     /*Output terminal state variables to file*/
     for(unsigned int i = 0; i < final_trace[0].size(); i++){
       variables_file << final_trace.back()[i] << " ";
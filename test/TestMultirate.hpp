@@ -0,0 +1,121 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "Simulation.hpp"
+#include "MultirateSolver.hpp"
+#include "RushLarsen.hpp"
+#include <algorithm>
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "ten_tusscher_model_2004_epiCvode.hpp"
+#include "ohara_rudy_2011_endoCvode.hpp"
+
+/*Split the ten Tusscher and O'Hara-Rudy models into fast and slow variables,
+  then solve a pace with the multirate solver and compare it, and the work it
+  took, with fixed-step Rush-Larsen and with CVODE. It has to take less work
+  than Rush-Larsen, and less than CVODE for O'Hara-Rudy's 41 variables.*/
+
+class TestMultirate : public CxxTest::TestSuite
+{
+private:
+  const double period = 1000;
+
+  void ComparePace(boost::shared_ptr<AbstractCvodeCell> p_model){
+    const std::string name = p_model->GetSystemInformation()->GetSystemName();
+    Simulation simulation(p_model, period);
+    const std::vector<double> initial_conditions = simulation.GetStateVariables();
+    simulation.RunPace();
+    const std::vector<double> cvode_states = simulation.GetStateVariables();
+    const long cvode_evaluations = simulation.rGetLastPaceCvodeStatistics().GetTotal().rhs_evaluations;
+
+    p_model->SetStateVariables(initial_conditions);
+    boost::shared_ptr<MultirateSolver> p_multirate(new MultirateSolver(p_model));
+    for(auto i = p_multirate->rGetSlowIndices().begin(); i != p_multirate->rGetSlowIndices().end(); i++)
+      std::cout << name << ": " << p_model->rGetStateVariableNames()[*i] << " is slow\n";
+    TS_ASSERT_LESS_THAN(0u, p_multirate->rGetSlowIndices().size());
+    Simulation multirate_simulation(p_model, period);
+    multirate_simulation.SetApproachSolver(p_multirate, 0);
+    multirate_simulation.RunPace();
+    const double multirate_difference = mrms(cvode_states, multirate_simulation.GetStateVariables());
+
+    p_model->SetStateVariables(initial_conditions);
+    boost::shared_ptr<RushLarsenSolver> p_rush_larsen(new RushLarsenSolver(p_model));
+    Simulation rush_larsen_simulation(p_model, period);
+    rush_larsen_simulation.SetApproachSolver(p_rush_larsen, 0);
+    rush_larsen_simulation.RunPace();
+    const double rush_larsen_difference = mrms(cvode_states, rush_larsen_simulation.GetStateVariables());
+
+    std::cout << name << ": right hand side evaluations for one pace\n"
+              << "  CVODE " << cvode_evaluations << "\n"
+              << "  Rush-Larsen " << p_rush_larsen->GetNumberOfRhsEvaluations() << ", mrms from CVODE " << rush_larsen_difference << "\n"
+              << "  multirate " << p_multirate->GetNumberOfRhsEvaluations() << " (" << p_multirate->GetNumberOfMacroSteps() << " macro, "
+              << p_multirate->GetNumberOfMicroSteps() << " micro, " << p_multirate->GetNumberOfRejectedSteps() << " rejected steps), mrms from CVODE "
+              << multirate_difference << "\n";
+    TS_ASSERT_LESS_THAN(multirate_difference, 1e-2);
+
+    /*The pace's statistics are the approach solver's work, not CVODE's counters from the pace before*/
+    const CvodeStatistics multirate_statistics = multirate_simulation.rGetLastPaceCvodeStatistics().GetTotal();
+    TS_ASSERT_EQUALS(multirate_statistics.rhs_evaluations, (long)p_multirate->GetNumberOfRhsEvaluations());
+    TS_ASSERT_EQUALS(multirate_statistics.steps, (long)(p_multirate->GetNumberOfMacroSteps() + p_multirate->GetNumberOfMicroSteps()));
+    TS_ASSERT_EQUALS(multirate_statistics.error_test_failures, (long)p_multirate->GetNumberOfRejectedSteps());
+    TS_ASSERT_EQUALS(multirate_statistics.jacobian_evaluations, 0);
+    TS_ASSERT_EQUALS(multirate_simulation.GetTotalCvodeStatistics().rhs_evaluations, multirate_statistics.rhs_evaluations);
+    TS_ASSERT_EQUALS(rush_larsen_simulation.rGetLastPaceCvodeStatistics().GetTotal().rhs_evaluations, (long)p_rush_larsen->GetNumberOfRhsEvaluations());
+    TS_ASSERT_LESS_THAN(p_multirate->GetNumberOfMacroSteps(), p_multirate->GetNumberOfMicroSteps());
+    TS_ASSERT_LESS_THAN(p_multirate->GetNumberOfRhsEvaluations(), p_rush_larsen->GetNumberOfRhsEvaluations());
+    /*The saving over CVODE is for the big models, where each of CVODE's finite
+      difference Jacobians costs an evaluation per state variable*/
+    if(p_model->GetNumberOfStateVariables() >= 40)
+      TS_ASSERT_LESS_THAN((long)p_multirate->GetNumberOfRhsEvaluations(), cvode_evaluations);
+  }
+public:
+  void TestTenTusscher(){
+#ifdef CHASTE_CVODE
+    ComparePace(CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>());
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestOHaraRudy(){
+#ifdef CHASTE_CVODE
+    ComparePace(CreateCvodeCell<Cellohara_rudy_2011_endoFromCellMLCvode>());
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestNamedSlowVariables(){
+#ifdef CHASTE_CVODE
+    /*The same split given by name, and kept by forks*/
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>();
+    const std::vector<std::string> slow_variable_names = {"cytosolic_sodium_concentration", "cytosolic_potassium_concentration"};
+    boost::shared_ptr<MultirateSolver> p_multirate(new MultirateSolver(p_model, slow_variable_names));
+    TS_ASSERT_EQUALS(p_multirate->rGetSlowIndices().size(), 2u);
+
+    Simulation simulation(p_model, period);
+    simulation.SetApproachSolver(p_multirate, 1e-4);
+    simulation.RunPace();
+    Simulation fork = simulation.Fork();
+    simulation.RunPace();
+    fork.RunPace();
+    TS_ASSERT(fork.IsUsingApproachSolver());
+    TS_ASSERT(!fork.IsUsingRushLarsen());
+    TS_ASSERT_EQUALS(fork.GetNumberOfApproachPaces(), 2u);
+    TS_ASSERT_EQUALS(fork.GetNumberOfRushLarsenPaces(), 0u);
+    /*The fork counts its own solver's work*/
+    TS_ASSERT_LESS_THAN(0, fork.rGetLastPaceCvodeStatistics().GetTotal().steps);
+    TS_ASSERT_EQUALS(fork.rGetLastPaceCvodeStatistics().GetTotal().jacobian_evaluations, 0);
+    /*The fork's solver starts its step sizes again, so only agrees to within the tolerances*/
+    TS_ASSERT_LESS_THAN(mrms(simulation.GetStateVariables(), fork.GetStateVariables()), 1e-3);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
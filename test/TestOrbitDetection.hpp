@@ -0,0 +1,99 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "Simulation.hpp"
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "beeler_reuter_model_1977Cvode.hpp"
+#include "ten_tusscher_model_2004_epiCvode.hpp"
+
+/*Pace until a steady state or an orbit is found. At 1Hz Beeler-Reuter settles
+  to a period-1 steady state as before. Paced faster than its action potential
+  is long it only responds to every other stimulus (2:1 block), a period-2 orbit
+  that a period-1 check would never see converge.*/
+
+class TestOrbitDetection : public CxxTest::TestSuite
+{
+private:
+  const unsigned int max_paces = 5000;
+  const unsigned int max_period = 4;
+  const unsigned int stall_window = 500;
+
+  unsigned int PaceUntilFinished(Simulation& r_simulation){
+    unsigned int paces;
+    for(paces = 0; paces < max_paces && !r_simulation.is_finished(); paces++)
+      r_simulation.RunPace();
+    return paces;
+  }
+
+  void PrintOrbit(Simulation& r_simulation, const std::string& name, unsigned int paces){
+    std::cout << name << ": outcome " << int(r_simulation.GetOutcome()) << " after " << paces << " paces, period " << r_simulation.GetOrbitPeriod() << "\n";
+    if(r_simulation.GetOrbitPeriod() == 0)
+      return;
+    const std::vector<BeatBiomarkers> biomarkers = r_simulation.GetOrbitBiomarkers();
+    for(unsigned int i = 0; i < biomarkers.size(); i++)
+      std::cout << "  beat " << i << ": APD90 " << biomarkers[i].apd << " peak " << biomarkers[i].peak_voltage
+                << " rest " << biomarkers[i].resting_voltage << " dV/dt max " << biomarkers[i].max_upstroke_velocity << "\n";
+  }
+public:
+  void TestPeriodOne(){
+#ifdef CHASTE_CVODE
+    /*Orbit detection doesn't change how a period-1 run ends*/
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    Simulation simulation(p_model, 1000);
+    const std::vector<double> initial_conditions = simulation.GetStateVariables();
+    const unsigned int paces = PaceUntilFinished(simulation);
+
+    p_model->SetStateVariables(initial_conditions);
+    Simulation detecting_simulation(p_model, 1000);
+    detecting_simulation.SetOrbitDetection(max_period, stall_window);
+    const unsigned int detecting_paces = PaceUntilFinished(detecting_simulation);
+    PrintOrbit(detecting_simulation, "Beeler-Reuter at 1000ms", detecting_paces);
+
+    TS_ASSERT_EQUALS(paces, detecting_paces);
+    TS_ASSERT(detecting_simulation.GetOutcome() == PacingOutcome::Converged);
+    TS_ASSERT_EQUALS(detecting_simulation.GetOrbitPeriod(), 1u);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestBlock(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    Simulation simulation(p_model, 200);
+    simulation.SetOrbitDetection(max_period, stall_window);
+    const unsigned int paces = PaceUntilFinished(simulation);
+    PrintOrbit(simulation, "Beeler-Reuter at 200ms", paces);
+
+    TS_ASSERT(simulation.is_finished());
+    TS_ASSERT_LESS_THAN(paces, max_paces);
+    TS_ASSERT(simulation.GetOutcome() == PacingOutcome::PeriodicOrbit);
+    TS_ASSERT_EQUALS(simulation.GetOrbitPeriod(), 2u);
+    TS_ASSERT_EQUALS(simulation.GetOrbitBiomarkers().size(), 2u);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestFastPacing(){
+#ifdef CHASTE_CVODE
+    /*Whatever ten Tusscher does at 300ms, it's found without using up the budget*/
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>();
+    Simulation simulation(p_model, 300);
+    simulation.SetOrbitDetection(max_period, stall_window);
+    const unsigned int paces = PaceUntilFinished(simulation);
+    PrintOrbit(simulation, "ten Tusscher at 300ms", paces);
+    TS_ASSERT(simulation.is_finished());
+    TS_ASSERT(simulation.GetOutcome() != PacingOutcome::Running);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
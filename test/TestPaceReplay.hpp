@@ -0,0 +1,112 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "Simulation.hpp"
+#include "PaceReplay.hpp"
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "beeler_reuter_model_1977Cvode.hpp"
+
+/*Record Beeler-Reuter pacing to steady state once, then replay extrapolation
+  strategies against the recording and compare with running SmartSimulation*/
+
+class NeverJump : public AbstractReplayStrategy{
+public:
+  bool Jump(const std::vector<std::vector<double>>& r_states, std::vector<double>& r_state){
+    return false;
+  }
+};
+
+class TestPaceReplay : public CxxTest::TestSuite
+{
+private:
+  const double period = 1000;
+  const unsigned int max_paces = 10000;
+
+  std::string Record(boost::shared_ptr<AbstractCvodeCell> p_model, unsigned int& r_paces){
+    const std::string file_path = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string();
+    Simulation simulation(p_model, period);
+    simulation.StartPaceRecording(file_path);
+    for(r_paces = 0; r_paces < max_paces && !simulation.is_finished(); r_paces++)
+      simulation.RunPace();
+    simulation.StopPaceRecording();
+    TS_ASSERT(simulation.is_finished());
+    return file_path;
+  }
+public:
+  void TestReplayWithoutJumps(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    unsigned int paces;
+    const std::string file_path = Record(p_model, paces);
+
+    PaceReplay replay(file_path, CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>(), period);
+    boost::filesystem::remove(file_path);
+    TS_ASSERT_EQUALS(replay.GetNumberOfRecordedPaces(), paces);
+    NeverJump strategy;
+    const ReplayResult result = replay.Replay(strategy);
+    /*Exactly the run that was recorded, without solving anything*/
+    TS_ASSERT(result.converged);
+    TS_ASSERT_EQUALS(result.paces, paces);
+    TS_ASSERT_EQUALS(result.verification_paces, 0u);
+    TS_ASSERT_EQUALS(result.error, 0);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestBufferSizes(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    const std::vector<double> initial_conditions = p_model->GetStdVecStateVariables();
+    unsigned int paces;
+    const std::string file_path = Record(p_model, paces);
+    PaceReplay replay(file_path, CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>(), period);
+    boost::filesystem::remove(file_path);
+
+    const std::vector<unsigned int> buffer_sizes = {25, 50, 100};
+    for(auto i = buffer_sizes.begin(); i != buffer_sizes.end(); i++){
+      BufferReplayStrategy strategy(*i, 0.9);
+      const ReplayResult result = replay.Replay(strategy);
+
+      p_model->SetStateVariables(initial_conditions);
+      SmartSimulation simulation(p_model, period);
+      simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+      simulation.Initialise(*i, 0.9);
+      /*A jump doesn't solve a pace, so count the paces solved rather than calls to RunPace*/
+      unsigned int smart_first_jump_pace = 0;
+      for(unsigned int j = 0; j < max_paces && !simulation.is_finished(); j++){
+        simulation.RunPace();
+        if(smart_first_jump_pace == 0 && simulation.GetNumberOfJumps() > 0)
+          smart_first_jump_pace = simulation.GetNumberOfPacesSolved();
+      }
+      const unsigned int smart_paces = simulation.GetNumberOfPacesSolved();
+
+      std::cout << "Buffer " << *i << ": replay " << result.paces << " paces (" << result.verification_paces << " solved), "
+                << result.jumps << " jumps (first at pace " << result.first_jump_pace << "), " << result.rejected_jumps << " rejected, mapping error "
+                << result.max_mapping_error << ", error " << result.error << "; SmartSimulation " << smart_paces << " paces, " << simulation.GetNumberOfJumps()
+                << " jumps (first at pace " << smart_first_jump_pace << "); brute force " << paces << " paces\n";
+      TS_ASSERT(result.converged);
+      TS_ASSERT_LESS_THAN_EQUALS(result.paces, paces);
+      TS_ASSERT_LESS_THAN(result.verification_paces, result.paces);
+      TS_ASSERT_LESS_THAN(result.error, 1e-3);
+      /*Up to its first jump the replay sees exactly the paces SmartSimulation
+        solves, so it has to jump at the same pace. After that it carries on
+        from the nearest recorded pace rather than where the jump went, so only
+        ask that its pace count is within 10% of SmartSimulation's*/
+      TS_ASSERT(simulation.is_finished());
+      TS_ASSERT_LESS_THAN(0u, smart_first_jump_pace);
+      TS_ASSERT_EQUALS(result.first_jump_pace, smart_first_jump_pace);
+      TS_ASSERT_DELTA((double)result.paces, (double)smart_paces, 0.1 * smart_paces);
+    }
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
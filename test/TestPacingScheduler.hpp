@@ -0,0 +1,213 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "Simulation.hpp"
+#include "PacingScheduler.hpp"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "beeler_reuter_model_1977Cvode.hpp"
+#include "ten_tusscher_model_2004_epiCvode.hpp"
+
+/*Check the estimate of remaining paces against what a run actually needs, then
+  schedule a small batch of jobs with budgets and a deadline. Jobs that know
+  exactly how much they have left check the order jobs are run in, and which
+  get a helper thread.*/
+
+/*A job of a fixed number of paces of about a millisecond each, which keeps
+  count of the threads it and every other CountdownJob are using*/
+class CountdownJob{
+public:
+  static std::atomic<int> threads_in_use;
+  static std::atomic<int> peak_threads_in_use;
+  unsigned int remaining;
+  bool helper = false;
+  /*Stands in for a SmartSimulation, whose estimate doesn't allow for its jumps*/
+  bool can_jump = false;
+  CountdownJob(unsigned int paces) : remaining(paces){
+  }
+  bool RunPace(){
+    const int used = (threads_in_use += helper ? 2 : 1);
+    int peak = peak_threads_in_use;
+    while(used > peak && !peak_threads_in_use.compare_exchange_weak(peak, used)){
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    threads_in_use -= helper ? 2 : 1;
+    remaining--;
+    return remaining == 0;
+  }
+  bool is_finished(){
+    return remaining == 0;
+  }
+  PaceEstimate EstimateRemainingPaces(){
+    PaceEstimate estimate;
+    estimate.remaining = estimate.lower = estimate.upper = remaining;
+    return estimate;
+  }
+};
+std::atomic<int> CountdownJob::threads_in_use(0);
+std::atomic<int> CountdownJob::peak_threads_in_use(0);
+
+void SetHelperThread(CountdownJob& r_job, bool helper){
+  r_job.helper = helper;
+}
+bool CanJump(const CountdownJob& r_job){
+  return r_job.can_jump;
+}
+
+class TestPacingScheduler : public CxxTest::TestSuite
+{
+private:
+  const double period = 1000;
+  const unsigned int max_paces = 10000;
+public:
+  void TestEstimateRemainingPaces(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    Simulation simulation(p_model, period);
+    simulation.RunPace();
+    TS_ASSERT(std::isnan(simulation.EstimateRemainingPaces().remaining));
+
+    unsigned int paces;
+    for(paces = 1; paces < 100 && !simulation.is_finished(); paces++)
+      simulation.RunPace();
+    TS_ASSERT(!simulation.is_finished());
+    const PaceEstimate estimate = simulation.EstimateRemainingPaces();
+    unsigned int remaining;
+    for(remaining = 0; remaining < max_paces && !simulation.is_finished(); remaining++)
+      simulation.RunPace();
+    std::cout << "After " << paces << " paces, estimated " << estimate.remaining << " (" << estimate.lower << " to " << estimate.upper
+              << ") more, took " << remaining << "\n";
+    TS_ASSERT(simulation.is_finished());
+    TS_ASSERT_LESS_THAN_EQUALS(estimate.lower, estimate.remaining);
+    TS_ASSERT_LESS_THAN_EQUALS(estimate.remaining, estimate.upper);
+    TS_ASSERT_LESS_THAN(0.5*estimate.lower, remaining);
+    TS_ASSERT_LESS_THAN(remaining, 2*estimate.upper);
+    TS_ASSERT_EQUALS(simulation.EstimateRemainingPaces().remaining, 0);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestSchedule(){
+#ifdef CHASTE_CVODE
+    PacingScheduler scheduler;
+    scheduler.AddJob("Beeler-Reuter", boost::shared_ptr<Simulation>(new Simulation(CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>(), period)), max_paces);
+    boost::shared_ptr<SmartSimulation> p_smart_simulation(new SmartSimulation(CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>(), period));
+    p_smart_simulation->SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    p_smart_simulation->Initialise(50, 0.9);
+    scheduler.AddJob("ten Tusscher", p_smart_simulation, max_paces);
+    /*Nowhere near enough paces*/
+    scheduler.AddJob("ten Tusscher, short budget", boost::shared_ptr<Simulation>(new Simulation(CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>(), period)), 60);
+
+    const std::vector<PacingJobReport> reports = scheduler.Run(2);
+    TS_ASSERT_EQUALS(reports.size(), 3u);
+    for(auto i = reports.begin(); i != reports.end(); i++)
+      std::cout << i->name << ": status " << int(i->status) << " after " << i->paces << " paces, " << i->wall_time << "s\n";
+    TS_ASSERT(reports[0].status == JobStatus::Converged);
+    TS_ASSERT(reports[1].status == JobStatus::Converged);
+    TS_ASSERT(reports[2].status == JobStatus::OutOfBudget || reports[2].status == JobStatus::Abandoned);
+    TS_ASSERT_LESS_THAN_EQUALS(reports[2].paces, 60u);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestLongestFirst(){
+    /*One thread, so no helpers. Each job has a slice to get an estimate, in the
+      order they were added, and then the longest goes until it's nowhere near
+      the longest any more.*/
+    PacingScheduler scheduler(5);
+    scheduler.AddJob("short", boost::shared_ptr<CountdownJob>(new CountdownJob(10)), max_paces);
+    scheduler.AddJob("long", boost::shared_ptr<CountdownJob>(new CountdownJob(100)), max_paces);
+    scheduler.AddJob("medium", boost::shared_ptr<CountdownJob>(new CountdownJob(30)), max_paces);
+    const std::vector<PacingJobReport> reports = scheduler.Run(1);
+    for(auto i = reports.begin(); i != reports.end(); i++)
+      TS_ASSERT(i->status == JobStatus::Converged);
+
+    const std::vector<PacingSlice>& r_slices = scheduler.rGetSlices();
+    TS_ASSERT_EQUALS(r_slices.size(), 2u + 20u + 6u);
+    for(auto i = r_slices.begin(); i != r_slices.end(); i++)
+      TS_ASSERT(!i->helper);
+    TS_ASSERT_EQUALS(r_slices[0].job, 0u);
+    TS_ASSERT_EQUALS(r_slices[1].job, 1u);
+    TS_ASSERT_EQUALS(r_slices[2].job, 2u);
+    /*From 95 paces left down to 45, against medium's 25 and short's 5*/
+    for(unsigned int i = 3; i < 13; i++)
+      TS_ASSERT_EQUALS(r_slices[i].job, 1u);
+    /*Short's last slice waits until the others are down to about its size*/
+    unsigned int short_slices = 0;
+    for(unsigned int i = 0; i < 20; i++)
+      if(r_slices[i].job == 0)
+        short_slices++;
+    TS_ASSERT_EQUALS(short_slices, 1u);
+  }
+
+  void TestHelperThreads(){
+    /*Two threads and two jobs, so no spare thread until the short one is done,
+      and then the long one gets it*/
+    CountdownJob::peak_threads_in_use = 0;
+    PacingScheduler scheduler(5);
+    scheduler.AddJob("short", boost::shared_ptr<CountdownJob>(new CountdownJob(10)), max_paces);
+    scheduler.AddJob("long", boost::shared_ptr<CountdownJob>(new CountdownJob(60)), max_paces);
+    const std::vector<PacingJobReport> reports = scheduler.Run(2);
+    TS_ASSERT(reports[0].status == JobStatus::Converged);
+    TS_ASSERT(reports[1].status == JobStatus::Converged);
+
+    const std::vector<PacingSlice>& r_slices = scheduler.rGetSlices();
+    unsigned int last_short_slice = 0;
+    unsigned int helper_slices = 0;
+    for(unsigned int i = 0; i < r_slices.size(); i++){
+      if(r_slices[i].job == 0){
+        TS_ASSERT(!r_slices[i].helper);
+        last_short_slice = i;
+      }
+      else if(r_slices[i].helper){
+        helper_slices++;
+        TS_ASSERT_LESS_THAN(last_short_slice, i);
+      }
+    }
+    TS_ASSERT_LESS_THAN(0u, helper_slices);
+    /*The helper never takes more threads than there are*/
+    TS_ASSERT_LESS_THAN_EQUALS(CountdownJob::peak_threads_in_use, 2);
+
+    /*Three threads: room for the job and its helper from the start*/
+    PacingScheduler roomy_scheduler(5);
+    roomy_scheduler.AddJob("only", boost::shared_ptr<CountdownJob>(new CountdownJob(20)), max_paces);
+    roomy_scheduler.Run(3);
+    for(auto i = roomy_scheduler.rGetSlices().begin(); i != roomy_scheduler.rGetSlices().end(); i++)
+      TS_ASSERT(i->helper);
+  }
+
+  void TestDeadline(){
+    /*A second's pacing against a fifth of a second. After its first slice, well
+      inside the deadline, the estimate already has the job missing it.*/
+    const double deadline = 0.2;
+    PacingScheduler scheduler(10);
+    scheduler.SetDeadline(deadline);
+    scheduler.AddJob("long", boost::shared_ptr<CountdownJob>(new CountdownJob(1000)), max_paces);
+    std::vector<PacingJobReport> reports = scheduler.Run(1);
+    TS_ASSERT(reports[0].status == JobStatus::Abandoned);
+    TS_ASSERT_EQUALS(reports[0].paces, 10u);
+    TS_ASSERT_LESS_THAN(reports[0].wall_time, deadline);
+
+    /*A job that can jump is paced until the deadline has actually passed*/
+    boost::shared_ptr<CountdownJob> p_jumping_job(new CountdownJob(1000));
+    p_jumping_job->can_jump = true;
+    PacingScheduler jumping_scheduler(10);
+    jumping_scheduler.SetDeadline(deadline);
+    jumping_scheduler.AddJob("long, can jump", p_jumping_job, max_paces);
+    reports = jumping_scheduler.Run(1);
+    TS_ASSERT(reports[0].status == JobStatus::Abandoned);
+    TS_ASSERT_LESS_THAN(10u, reports[0].paces);
+    TS_ASSERT_LESS_THAN(0.5*deadline, reports[0].wall_time);
+  }
+};
@@ -0,0 +1,104 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "Simulation.hpp"
+#include "PeriodicOrbitSolver.hpp"
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "beeler_reuter_model_1977Cvode.hpp"
+#include "ten_tusscher_model_2004_epiCvode.hpp"
+
+/*Find the steady state by collocation and by pacing from the same initial
+  conditions, and check they end in the same state with the same trace, and
+  that collocation took fewer right hand side evaluations. ten Tusscher
+  conserves charge, so collocation has to stay on the same member of the family
+  of periodic states as pacing does. A mesh that can't be refined enough is an
+  error rather than an unconverged answer.*/
+
+class TestPeriodicOrbit : public CxxTest::TestSuite
+{
+private:
+  const double period = 1000;
+  const unsigned int max_paces = 10000;
+
+  void CompareWithPacing(boost::shared_ptr<AbstractCvodeCell> p_model, double tolerance){
+    const std::string model_name = p_model->GetSystemInformation()->GetSystemName();
+    const std::vector<double> initial_conditions = p_model->GetStdVecStateVariables();
+    Simulation simulation(p_model, period);
+    unsigned int paces;
+    for(paces = 0; paces < max_paces && !simulation.is_finished(); paces++)
+      simulation.RunPace();
+    TS_ASSERT(simulation.is_finished());
+    const std::vector<double> paced_state = simulation.GetStateVariables();
+    const double duration = p_model->UseCellMLDefaultStimulus()->GetDuration();
+
+    p_model->SetStateVariables(initial_conditions);
+    PeriodicOrbitSolver solver(p_model, period);
+    TS_ASSERT_THROWS_NOTHING(solver.Solve());
+    const long paced_evaluations = simulation.GetTotalCvodeStatistics().rhs_evaluations;
+    const long collocation_evaluations = solver.GetNumberOfInitialRhsEvaluations() + solver.GetNumberOfRhsEvaluations();
+    std::cout << model_name << ": paced " << paces << " paces (" << paced_evaluations
+              << " rhs evaluations), collocation " << solver.GetNumberOfMeshIntervals() << " intervals, "
+              << solver.GetNumberOfNewtonIterations() << " Newton iterations, " << solver.GetNumberOfRefinements()
+              << " refinements (" << collocation_evaluations << " rhs evaluations, with the initial paces)\n";
+    TS_ASSERT_LESS_THAN(0u, solver.GetNumberOfInitialRhsEvaluations());
+    TS_ASSERT_LESS_THAN(collocation_evaluations, paced_evaluations);
+
+    const std::vector<double> state = solver.GetStateVariables();
+    std::cout << "mrms between the steady states " << mrms(paced_state, state) << "\n";
+    TS_ASSERT_LESS_THAN(mrms(paced_state, state), tolerance);
+    /*The solver leaves the model at its steady state*/
+    TS_ASSERT_EQUALS(mrms(p_model->GetStdVecStateVariables(), state), 0);
+
+    /*One more pace from the collocation state, solved tightly enough not to
+      add errors of its own, comes back to it*/
+    Simulation check(p_model, period, "", 1e-10, 1e-10);
+    check.RunPace();
+    std::cout << "mrms over one more pace " << check.GetMrms() << "\n";
+    TS_ASSERT_LESS_THAN(check.GetMrms(), 1e-6);
+
+    std::vector<double> times;
+    const std::vector<std::vector<double>> trace = solver.GetTrace(times);
+    TS_ASSERT_DELTA(times.back(), period, 1e-9);
+    const std::vector<std::vector<double>> paced_trace = GetDensePace(paced_state, p_model, period, duration).GetStateVariables(times);
+    std::cout << "mrms between the traces " << mrmsTrace(paced_trace, trace) << "\n";
+    TS_ASSERT_LESS_THAN(mrmsTrace(paced_trace, trace), tolerance);
+  }
+public:
+  void TestBeelerReuter(){
+#ifdef CHASTE_CVODE
+    CompareWithPacing(CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>(), 1e-5);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestTenTusscher(){
+#ifdef CHASTE_CVODE
+    /*Pacing stops within the threshold of a slow approach, so further from the true steady state*/
+    CompareWithPacing(CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>(), 1e-4);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestTooFewRefinements(){
+#ifdef CHASTE_CVODE
+    /*No refinements allowed and a mesh tolerance the paced mesh can't meet*/
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    PeriodicOrbitSolver solver(p_model, period, 5, 1e-10, 1e-14);
+    solver.SetMaxRefinements(0);
+    const std::vector<double> state = p_model->GetStdVecStateVariables();
+    TS_ASSERT_THROWS_ANYTHING(solver.Solve());
+    TS_ASSERT(p_model->GetStdVecStateVariables() == state);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
@@ -0,0 +1,165 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "Simulation.hpp"
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "beeler_reuter_model_1977Cvode.hpp"
+
+/*Make a pace fail by handing CVODE a state it can't solve from, and check
+  SmartSimulation works through its recovery strategies, logs them, and only
+  stops extrapolating for a while. Then make the right hand side fail a set
+  number of times, so that a retry of the pace or a damped jump succeeds.*/
+
+class FlakyBeelerReuter : public Cellbeeler_reuter_model_1977FromCellMLCvode{
+public:
+  unsigned int failures_left = 0;
+  using Cellbeeler_reuter_model_1977FromCellMLCvode::Cellbeeler_reuter_model_1977FromCellMLCvode;
+  /*CVODE can't go on from a failed first evaluation, so each failure sinks one attempt at a pace*/
+  void EvaluateYDerivatives(double time, const N_Vector rY, N_Vector rDY){
+    if(failures_left > 0){
+      failures_left--;
+      EXCEPTION("Failing on purpose");
+    }
+    Cellbeeler_reuter_model_1977FromCellMLCvode::EvaluateYDerivatives(time, rY, rDY);
+  }
+};
+
+class TestRecovery : public CxxTest::TestSuite
+{
+private:
+  const double period = 1000;
+  const unsigned int buffer_size = 50;
+  const unsigned int max_paces = 5000;
+
+  void BreakState(boost::shared_ptr<AbstractCvodeCell> p_model){
+    std::vector<double> state = p_model->GetStdVecStateVariables();
+    state[p_model->GetVoltageIndex()] = NAN;
+    p_model->SetStateVariables(state);
+  }
+public:
+  void TestSuspendExtrapolation(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    SmartSimulation simulation(p_model, period);
+    simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    RecoveryPolicy policy;
+    policy.suspension_paces = 20;
+    simulation.SetRecoveryPolicy(policy);
+    simulation.Initialise(buffer_size, 0.9);
+    for(unsigned int i = 0; i < 5; i++)
+      simulation.RunPace();
+    const std::vector<double> state_before_failure = simulation.GetStateVariables();
+
+    BreakState(p_model);
+    TS_ASSERT_THROWS_NOTHING(simulation.RunPace());
+    const std::vector<RecoveryEvent>& r_log = simulation.rGetRecoveryLog();
+    TS_ASSERT_LESS_THAN_EQUALS(2u, r_log.size());
+    TS_ASSERT(r_log.front().strategy == RecoveryStrategy::Refine);
+    TS_ASSERT(!r_log.front().succeeded);
+    TS_ASSERT(r_log.back().strategy == RecoveryStrategy::Suspend);
+    for(auto i = r_log.begin(); i != r_log.end(); i++)
+      std::cout << "pace " << i->pace << " strategy " << int(i->strategy) << (i->succeeded ? " succeeded" : " failed") << "\n";
+
+    /*Back where the failed pace started, as no jump led to it, rather than at the start of the run*/
+    TS_ASSERT_EQUALS(mrms(state_before_failure, simulation.GetStateVariables()), 0);
+    TS_ASSERT_EQUALS(mrms(state_before_failure, p_model->GetStdVecStateVariables()), 0);
+    TS_ASSERT_EQUALS(simulation.GetSuspendedUntil(), simulation.GetPace() + policy.suspension_paces);
+
+    /*No jumps while suspended, and extrapolating again once the suspension is over*/
+    while(simulation.GetPace() < simulation.GetSuspendedUntil() && !simulation.is_finished())
+      simulation.RunPace();
+    TS_ASSERT_EQUALS(simulation.GetNumberOfJumps(), 0u);
+    unsigned int paces;
+    for(paces = 0; paces < max_paces && !simulation.is_finished(); paces++)
+      simulation.RunPace();
+    TS_ASSERT(simulation.is_finished());
+    TS_ASSERT_LESS_THAN(0u, simulation.GetNumberOfJumps());
+    for(auto i = r_log.begin(); i != r_log.end(); i++)
+      TS_ASSERT(i->strategy != RecoveryStrategy::Disable);
+    std::cout << "Finished after another " << paces << " paces\n";
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestDisableAfterRepeatedFailures(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    SmartSimulation simulation(p_model, period);
+    simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    RecoveryPolicy policy;
+    policy.max_failures = 2;
+    simulation.SetRecoveryPolicy(policy);
+    simulation.Initialise(buffer_size, 0.9);
+    simulation.RunPace();
+
+    BreakState(p_model);
+    simulation.RunPace();
+    TS_ASSERT(simulation.rGetRecoveryLog().back().strategy == RecoveryStrategy::Suspend);
+    BreakState(p_model);
+    simulation.RunPace();
+    TS_ASSERT(simulation.rGetRecoveryLog().back().strategy == RecoveryStrategy::Disable);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestRefine(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<FlakyBeelerReuter> p_model = boost::static_pointer_cast<FlakyBeelerReuter>(CreateCvodeCell<FlakyBeelerReuter>());
+    SmartSimulation simulation(p_model, period);
+    simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    simulation.Initialise(buffer_size, 0.9);
+    simulation.RunPace();
+
+    /*The pace fails once, and the careful retry of it goes through*/
+    const unsigned int pace = simulation.GetPace();
+    p_model->failures_left = 1;
+    simulation.RunPace();
+    const std::vector<RecoveryEvent>& r_log = simulation.rGetRecoveryLog();
+    TS_ASSERT_EQUALS(r_log.size(), 1u);
+    TS_ASSERT(r_log.front().strategy == RecoveryStrategy::Refine);
+    TS_ASSERT(r_log.front().succeeded);
+    TS_ASSERT_EQUALS(simulation.GetPace(), pace + 1);
+    TS_ASSERT_EQUALS(simulation.GetSuspendedUntil(), 0u);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestDampJump(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<FlakyBeelerReuter> p_model = boost::static_pointer_cast<FlakyBeelerReuter>(CreateCvodeCell<FlakyBeelerReuter>());
+    SmartSimulation simulation(p_model, period);
+    simulation.SetDiagnosticsSink(boost::shared_ptr<AbstractDiagnosticsSink>(new NullDiagnosticsSink()));
+    simulation.Initialise(buffer_size, 0.9);
+    for(unsigned int paces = 0; paces < max_paces && simulation.GetNumberOfJumps() == 0 && !simulation.is_finished(); paces++)
+      simulation.RunPace();
+    TS_ASSERT_EQUALS(simulation.GetNumberOfJumps(), 1u);
+    const std::vector<double> jumped_state = simulation.GetStateVariables();
+
+    /*The pace after the jump and its retry both fail, and half the jump goes through*/
+    p_model->failures_left = 2;
+    simulation.RunPace();
+    const std::vector<RecoveryEvent>& r_log = simulation.rGetRecoveryLog();
+    TS_ASSERT_EQUALS(r_log.size(), 2u);
+    TS_ASSERT(r_log.front().strategy == RecoveryStrategy::Refine);
+    TS_ASSERT(!r_log.front().succeeded);
+    TS_ASSERT(r_log.back().strategy == RecoveryStrategy::DampJump);
+    TS_ASSERT(r_log.back().succeeded);
+    TS_ASSERT_EQUALS(simulation.GetSuspendedUntil(), 0u);
+    TS_ASSERT_EQUALS(simulation.GetNumberOfJumps(), 1u);
+    TS_ASSERT_LESS_THAN(0, mrms(jumped_state, simulation.GetStateVariables()));
+    TS_ASSERT(std::isfinite(simulation.GetStateVariables()[p_model->GetVoltageIndex()]));
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
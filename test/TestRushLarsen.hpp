@@ -0,0 +1,177 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "Simulation.hpp"
+#include "RushLarsen.hpp"
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "beeler_reuter_model_1977Cvode.hpp"
+
+/*Find the gates of the Beeler-Reuter model, check a Rush-Larsen pace against
+  CVODE and that its work is what gets counted for the pace, then pace to steady
+  state with a Rush-Larsen approach and a CVODE finish and compare with pacing
+  on CVODE all the way. The approach saves CVODE paces, but at the 0.01 ms step
+  its own paces cost far more, so only the CVODE part is checked to be cheaper.*/
+
+class StepCounter : public AbstractStepObserver{
+public:
+  unsigned int steps = 0;
+  void ObserveStep(const CvodeStep& r_step){
+    steps++;
+  }
+};
+
+class TestRushLarsen : public CxxTest::TestSuite
+{
+private:
+  const double period = 1000;
+  const unsigned int max_paces = 10000;
+public:
+  void TestGates(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    RushLarsenSolver solver(p_model);
+    const std::vector<std::string>& names = p_model->rGetStateVariableNames();
+    for(auto i = solver.rGetGateIndices().begin(); i != solver.rGetGateIndices().end(); i++)
+      std::cout << names[*i] << " is a gate\n";
+    /*x1, m, h, j, d and f, but not the voltage or calcium*/
+    TS_ASSERT_EQUALS(solver.rGetGateIndices().size(), 6u);
+    const std::vector<unsigned int>& gates = solver.rGetGateIndices();
+    TS_ASSERT(std::find(gates.begin(), gates.end(), p_model->GetVoltageIndex()) == gates.end());
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestOnePace(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    Simulation simulation(p_model, period);
+    const std::vector<double> initial_conditions = simulation.GetStateVariables();
+    simulation.RunPace();
+    const std::vector<double> cvode_states = simulation.GetStateVariables();
+
+    p_model->SetStateVariables(initial_conditions);
+    Simulation rush_larsen_simulation(p_model, period);
+    rush_larsen_simulation.SetRushLarsenApproach(0);
+    rush_larsen_simulation.RunPace();
+    TS_ASSERT(rush_larsen_simulation.IsUsingRushLarsen());
+    const double difference = mrms(cvode_states, rush_larsen_simulation.GetStateVariables());
+    std::cout << "mrms between a Rush-Larsen and a CVODE pace " << difference << "\n";
+    TS_ASSERT_LESS_THAN(difference, 1e-2);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestApproachPaceStatistics(){
+#ifdef CHASTE_CVODE
+    const double timestep = 0.01;
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    Simulation simulation(p_model, period);
+    const double duration = boost::static_pointer_cast<RegularStimulus>(p_model->GetStimulusFunction())->GetDuration();
+    boost::shared_ptr<StepCounter> p_counter(new StepCounter());
+    simulation.AddStepObserver(p_counter);
+    simulation.SetTraceNorm(true);
+
+    /*A CVODE pace first, so there are counters left over for an approach pace to misread*/
+    simulation.RunPace();
+    const CvodeStatistics cvode_statistics = simulation.GetTotalCvodeStatistics();
+    const unsigned int cvode_steps = p_counter->steps;
+    TS_ASSERT_LESS_THAN(0u, cvode_steps);
+
+    /*A handoff of 0 keeps the Rush-Larsen solver on*/
+    boost::shared_ptr<RushLarsenSolver> p_solver(new RushLarsenSolver(p_model, timestep));
+    const long setup_evaluations = p_solver->GetNumberOfRhsEvaluations();
+    simulation.SetApproachSolver(p_solver, 0);
+    const long steps_during_stimulus = std::lround(duration/timestep);
+    const long steps_per_pace = std::lround(period/timestep);
+    for(unsigned int pace = 0; pace < 3; pace++){
+      simulation.RunPace();
+      TS_ASSERT(simulation.IsUsingRushLarsen());
+      const PaceCvodeStatistics& r_statistics = simulation.rGetLastPaceCvodeStatistics();
+      TS_ASSERT_EQUALS(r_statistics.pace, pace + 1);
+      TS_ASSERT_EQUALS(r_statistics.during_stimulus.steps, steps_during_stimulus);
+      TS_ASSERT_EQUALS(r_statistics.GetTotal().steps, steps_per_pace);
+      /*Two evaluations a step, as the model has gates, and the setup on the first pace*/
+      TS_ASSERT_EQUALS(r_statistics.GetTotal().rhs_evaluations, 2*steps_per_pace + (pace == 0 ? setup_evaluations : 0));
+      TS_ASSERT_EQUALS(r_statistics.GetTotal().jacobian_evaluations, 0);
+      TS_ASSERT_DELTA(r_statistics.after_stimulus.last_step_size, timestep, 1e-12);
+    }
+    const CvodeStatistics total_statistics = simulation.GetTotalCvodeStatistics();
+    TS_ASSERT_EQUALS(total_statistics.rhs_evaluations - cvode_statistics.rhs_evaluations, (long)p_solver->GetNumberOfRhsEvaluations());
+    TS_ASSERT_EQUALS(total_statistics.steps - cvode_statistics.steps, 3*steps_per_pace);
+    TS_ASSERT_EQUALS(total_statistics.jacobian_evaluations, cvode_statistics.jacobian_evaluations);
+
+    /*Approach paces have no CVODE steps to show the observers or the trace norm*/
+    TS_ASSERT_EQUALS(p_counter->steps, cvode_steps);
+    TS_ASSERT(std::isnan(simulation.GetTraceMrms()));
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestHybridPacing(){
+#ifdef CHASTE_CVODE
+    const double handoff = 1e-4;
+
+    boost::shared_ptr<AbstractCvodeCell> p_cvode_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    Simulation cvode_simulation(p_cvode_model, period);
+    const double duration = boost::static_pointer_cast<RegularStimulus>(p_cvode_model->GetStimulusFunction())->GetDuration();
+    auto start = std::chrono::steady_clock::now();
+    unsigned int cvode_paces;
+    for(cvode_paces = 0; cvode_paces < max_paces && !cvode_simulation.is_finished(); cvode_paces++)
+      cvode_simulation.RunPace();
+    const double cvode_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    TS_ASSERT(cvode_simulation.is_finished());
+
+    boost::shared_ptr<AbstractCvodeCell> p_hybrid_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    Simulation hybrid_simulation(p_hybrid_model, period);
+    hybrid_simulation.SetRushLarsenApproach(handoff);
+    hybrid_simulation.SetPaceCvodeStatisticsHistory(max_paces);
+    start = std::chrono::steady_clock::now();
+    unsigned int hybrid_paces;
+    for(hybrid_paces = 0; hybrid_paces < max_paces && !hybrid_simulation.is_finished(); hybrid_paces++)
+      hybrid_simulation.RunPace();
+    const double hybrid_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    TS_ASSERT(hybrid_simulation.is_finished());
+    TS_ASSERT(!hybrid_simulation.IsUsingRushLarsen());
+
+    const unsigned int rush_larsen_paces = hybrid_simulation.GetNumberOfRushLarsenPaces();
+    const long cvode_rhs_evaluations = cvode_simulation.GetTotalCvodeStatistics().rhs_evaluations;
+    const long hybrid_rhs_evaluations = hybrid_simulation.GetTotalCvodeStatistics().rhs_evaluations;
+    long hybrid_cvode_rhs_evaluations = 0;
+    const boost::circular_buffer<PaceCvodeStatistics>& r_history = hybrid_simulation.rGetPaceCvodeStatisticsHistory();
+    for(auto i = r_history.begin(); i != r_history.end(); i++)
+      if(i->pace >= rush_larsen_paces)
+        hybrid_cvode_rhs_evaluations += i->GetTotal().rhs_evaluations;
+    std::cout << "CVODE: " << cvode_paces << " paces, " << cvode_rhs_evaluations << " rhs evaluations in " << cvode_seconds << "s\n"
+              << "Hybrid: " << rush_larsen_paces << " Rush-Larsen and " << hybrid_paces - rush_larsen_paces << " CVODE paces, "
+              << hybrid_rhs_evaluations << " rhs evaluations (" << hybrid_cvode_rhs_evaluations << " by CVODE) in " << hybrid_seconds << "s\n";
+    TS_ASSERT_LESS_THAN(0u, rush_larsen_paces);
+    /*CVODE starts the hybrid run closer to the limit cycle, so it has less to do*/
+    TS_ASSERT_LESS_THAN(hybrid_paces - rush_larsen_paces, cvode_paces);
+    TS_ASSERT_LESS_THAN(0, hybrid_cvode_rhs_evaluations);
+    TS_ASSERT_LESS_THAN(hybrid_cvode_rhs_evaluations, cvode_rhs_evaluations);
+
+    /*Both finish on CVODE's limit cycle*/
+    const double state_difference = mrms(cvode_simulation.GetStateVariables(), hybrid_simulation.GetStateVariables());
+    const double cvode_apd = CalculateAPD(p_cvode_model, period, duration, 90);
+    const double hybrid_apd = CalculateAPD(p_hybrid_model, period, duration, 90);
+    std::cout << "mrms between steady states " << state_difference << ", APD90s " << cvode_apd << " and " << hybrid_apd << "\n";
+    TS_ASSERT_LESS_THAN(state_difference, 1e-4);
+    TS_ASSERT_DELTA(cvode_apd, hybrid_apd, 1e-1);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
@@ -0,0 +1,85 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "SteadyStateSensitivity.hpp"
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "beeler_reuter_model_1977Cvode.hpp"
+
+/*Work out how Beeler-Reuter's steady state biomarkers move with every
+  parameter from one steady state, then check each of APD90, peak voltage and
+  upstroke velocity against re-pacing the model to steady state either side
+  of the parameter it is most sensitive to*/
+
+class TestSteadyStateSensitivity : public CxxTest::TestSuite
+{
+private:
+  const double period = 1000;
+  const unsigned int max_paces = 10000;
+
+  /*Pace from initial_conditions to steady state with one parameter changed, and return the steady state's biomarkers*/
+  BeatBiomarkers GetSteadyStateBiomarkers(const std::vector<double>& initial_conditions, const std::string& parameter, double value){
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    p_model->SetStateVariables(initial_conditions);
+    Simulation simulation(p_model, period);
+    simulation.SetParameter(parameter, value);
+    for(unsigned int paces = 0; paces < max_paces && !simulation.is_finished(); paces++)
+      simulation.RunPace();
+    TS_ASSERT(simulation.is_finished());
+    return simulation.GetBiomarkers(simulation.GetStateVariables());
+  }
+public:
+  void TestBeelerReuter(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellbeeler_reuter_model_1977FromCellMLCvode>();
+    const std::vector<double> initial_conditions = p_model->GetStdVecStateVariables();
+    Simulation simulation(p_model, period);
+    for(unsigned int paces = 0; paces < max_paces && !simulation.is_finished(); paces++)
+      simulation.RunPace();
+    TS_ASSERT(simulation.is_finished());
+    const std::vector<double> steady_state = simulation.GetStateVariables();
+
+    const std::vector<std::string>& r_names = p_model->rGetParameterNames();
+    TS_ASSERT_LESS_THAN(0u, r_names.size());
+    const SteadyStateSensitivities sensitivities = CalculateSteadyStateSensitivities(simulation, r_names, 4);
+    TS_ASSERT_EQUALS(sensitivities.parameters.size(), r_names.size());
+    TS_ASSERT_LESS_THAN(mrms(steady_state, sensitivities.steady_state), 1e-5);
+    /*The simulation is left where it was*/
+    TS_ASSERT_EQUALS(mrms(steady_state, simulation.GetStateVariables()), 0);
+
+    const std::vector<std::pair<std::string, double BeatBiomarkers::*>> biomarkers = {{"APD90", &BeatBiomarkers::apd},
+                                                                                       {"peak voltage", &BeatBiomarkers::peak_voltage},
+                                                                                       {"max upstroke velocity", &BeatBiomarkers::max_upstroke_velocity}};
+    for(auto i = biomarkers.begin(); i != biomarkers.end(); i++){
+      const double BeatBiomarkers::* p_biomarker = i->second;
+      std::cout << i->first << " " << sensitivities.biomarkers.*p_biomarker << "\n";
+
+      /*The parameter that changes the biomarker the most for the same relative change*/
+      unsigned int most_sensitive = 0;
+      for(unsigned int k = 0; k < sensitivities.parameters.size(); k++){
+        const ParameterSensitivity& r_sensitivity = sensitivities.parameters[k];
+        std::cout << "  " << r_sensitivity.parameter << " = " << r_sensitivity.value << ": d/dp " << r_sensitivity.biomarker_derivatives.*p_biomarker << "\n";
+        if(std::abs(r_sensitivity.biomarker_derivatives.*p_biomarker*r_sensitivity.value) >
+           std::abs(sensitivities.parameters[most_sensitive].biomarker_derivatives.*p_biomarker*sensitivities.parameters[most_sensitive].value))
+          most_sensitive = k;
+      }
+
+      /*Central difference of two full runs to steady state, 1% either side*/
+      const ParameterSensitivity& r_sensitivity = sensitivities.parameters[most_sensitive];
+      const double step = 0.01*r_sensitivity.value;
+      const double brute_force = (GetSteadyStateBiomarkers(initial_conditions, r_sensitivity.parameter, r_sensitivity.value + step).*p_biomarker -
+                                  GetSteadyStateBiomarkers(initial_conditions, r_sensitivity.parameter, r_sensitivity.value - step).*p_biomarker)/(2*step);
+      std::cout << "Re-pacing " << r_sensitivity.parameter << ": d/dp " << brute_force << "\n";
+      TS_ASSERT_DELTA(r_sensitivity.biomarker_derivatives.*p_biomarker, brute_force, 0.05*std::abs(brute_force));
+    }
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
@@ -0,0 +1,125 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "Simulation.hpp"
+#include "StepObserver.hpp"
+#include <fstream>
+
+/* These header files are generated from the cellml files provided at github.com/chaste/cellml */
+
+#include "ten_tusscher_model_2004_epiCvode.hpp"
+
+/*Run several streaming reductions on one integration of a pace and check them
+  against the same pace from Compute(), then check observing a solve doesn't
+  change it*/
+
+class CountingObserver : public AbstractStepObserver{
+public:
+  unsigned int steps = 0;
+  std::vector<double> times;
+  CountingObserver(double _sampling_timestep) : AbstractStepObserver(_sampling_timestep){
+  }
+  void ObserveStep(const CvodeStep& r_step){
+    steps++;
+    AbstractStepObserver::ObserveStep(r_step);
+  }
+  void Observe(double time, const std::vector<double>& r_state_variables){
+    times.push_back(time);
+  }
+};
+
+class TestStepObserver : public CxxTest::TestSuite
+{
+public:
+  void TestStreamingReductions(){
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<AbstractCvodeCell> p_model = CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>();
+    const double period = 1000;
+    const double sampling_timestep = 0.1;
+    Simulation simulation(p_model, period);
+    const double duration = boost::static_pointer_cast<RegularStimulus>(p_model->GetStimulusFunction())->GetDuration();
+    const unsigned int voltage_index = p_model->GetSystemInformation()->GetStateVariableIndex("membrane_voltage");
+    const std::vector<double> initial_conditions = simulation.GetStateVariables();
+
+    boost::shared_ptr<ExtremaObserver> p_extrema(new ExtremaObserver(voltage_index));
+    boost::shared_ptr<ThresholdCrossingObserver> p_crossings(new ThresholdCrossingObserver(voltage_index, -30));
+    boost::shared_ptr<RunningMrmsObserver> p_mrms(new RunningMrmsObserver(initial_conditions, sampling_timestep));
+    boost::shared_ptr<CountingObserver> p_counter(new CountingObserver(sampling_timestep));
+    simulation.AddStepObserver(p_extrema);
+    simulation.AddStepObserver(p_crossings);
+    simulation.AddStepObserver(p_mrms);
+    simulation.AddStepObserver(p_counter);
+    simulation.RunPace();
+
+    /*One integration served every observer*/
+    TS_ASSERT_EQUALS(p_counter->steps, simulation.rGetLastPaceCvodeStatistics().GetTotal().steps);
+
+    /*The same pace, sampled by CVODE stopping at every sampling time*/
+    const std::vector<double> final_states = simulation.GetStateVariables();
+    p_model->SetStateVariables(initial_conditions);
+    OdeSolution solution = p_model->Compute(0, duration, sampling_timestep);
+    std::vector<std::vector<double>> state_variables = solution.rGetSolutions();
+    std::vector<double> times = solution.rGetTimes();
+    solution = p_model->Compute(duration, period, sampling_timestep);
+    state_variables.insert(state_variables.end(), ++solution.rGetSolutions().begin(), solution.rGetSolutions().end());
+    times.insert(times.end(), ++solution.rGetTimes().begin(), solution.rGetTimes().end());
+
+    TS_ASSERT_EQUALS(p_counter->times.size(), times.size());
+    for(unsigned int i = 0; i < std::min(times.size(), p_counter->times.size()); i++)
+      TS_ASSERT_DELTA(p_counter->times[i], times[i], 1e-10);
+
+    const std::vector<double> voltages = GetNthVariable(state_variables, voltage_index);
+    const double sampled_maximum = *std::max_element(voltages.begin(), voltages.end());
+    const double sampled_minimum = *std::min_element(voltages.begin(), voltages.end());
+    std::cout << "peak " << p_extrema->GetMaximum() << " at " << p_extrema->GetMaximumTime() << " sampled peak " << sampled_maximum << "\n";
+    /*The streaming peak is found between samples as well, so it can only be higher*/
+    TS_ASSERT_LESS_THAN_EQUALS(sampled_maximum, p_extrema->GetMaximum() + 1e-3);
+    TS_ASSERT_DELTA(p_extrema->GetMaximum(), sampled_maximum, 1);
+    TS_ASSERT_DELTA(p_extrema->GetMinimum(), sampled_minimum, 1e-2);
+
+    TS_ASSERT_EQUALS(p_crossings->rGetUpwardCrossings().size(), 1u);
+    TS_ASSERT_EQUALS(p_crossings->rGetDownwardCrossings().size(), 1u);
+
+    std::vector<std::vector<double>> reference(times.size(), initial_conditions);
+    TS_ASSERT_DELTA(p_mrms->GetMrms(), mrmsTrace(reference, state_variables), 1e-6);
+    TS_ASSERT_LESS_THAN(mrms(final_states, p_model->GetStdVecStateVariables()), 1e-5);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestSameIntegrationAsSolveAndUpdateState(){
+#ifdef CHASTE_CVODE
+    /*Two models that have never been solved, one observed and one not*/
+    boost::shared_ptr<AbstractCvodeCell> p_observed = CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>();
+    boost::shared_ptr<AbstractCvodeCell> p_plain = CreateCvodeCell<Cellten_tusscher_model_2004_epiFromCellMLCvode>();
+    const double period = 1000;
+    const double duration = boost::static_pointer_cast<RegularStimulus>(p_observed->GetStimulusFunction())->GetDuration();
+    boost::shared_ptr<CountingObserver> p_counter(new CountingObserver(0));
+
+    /*The stimulus and the rest of the pace, then carrying on from there without observers*/
+    SolveAndObserve(p_observed, 0, duration, {p_counter});
+    p_plain->SolveAndUpdateState(0, duration);
+    SolveAndObserve(p_observed, duration, period, {p_counter});
+    p_plain->SolveAndUpdateState(duration, period);
+    const CvodeStatistics observed_statistics = GetCvodeStatistics(p_observed);
+    const CvodeStatistics plain_statistics = GetCvodeStatistics(p_plain);
+    TS_ASSERT_EQUALS(observed_statistics.steps, plain_statistics.steps);
+    TS_ASSERT_EQUALS(observed_statistics.rhs_evaluations, plain_statistics.rhs_evaluations);
+    TS_ASSERT_LESS_THAN(0u, p_counter->steps);
+    TS_ASSERT_LESS_THAN(mrms(p_observed->GetStdVecStateVariables(), p_plain->GetStdVecStateVariables()), 1e-12);
+
+    p_observed->SolveAndUpdateState(period, period + 100);
+    p_plain->SolveAndUpdateState(period, period + 100);
+    TS_ASSERT_EQUALS(GetCvodeStatistics(p_observed).steps, GetCvodeStatistics(p_plain).steps);
+    TS_ASSERT_LESS_THAN(mrms(p_observed->GetStdVecStateVariables(), p_plain->GetStdVecStateVariables()), 1e-12);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
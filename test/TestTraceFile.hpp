@@ -0,0 +1,117 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "TraceFile.hpp"
+#include <boost/filesystem.hpp>
+#include <cstring>
+#include <random>
+#include <limits>
+
+/*Write columns the compression finds awkward - NaN, signed zeros, infinities,
+  denormals, huge jumps and random bit patterns - alongside a smooth one, and
+  check every value comes back bit for bit, whole and a time window at a time*/
+
+class TestTraceFile : public CxxTest::TestSuite
+{
+private:
+  const unsigned int chunk_size = 64;
+  const unsigned int rows = 1000;
+
+  bool SameBits(double a, double b){
+    return std::memcmp(&a, &b, sizeof(double)) == 0;
+  }
+
+  void CheckSameBits(const std::vector<double>& r_expected, const std::vector<double>& r_actual){
+    TS_ASSERT_EQUALS(r_expected.size(), r_actual.size());
+    unsigned int mismatches = 0;
+    for(unsigned int i = 0; i < std::min(r_expected.size(), r_actual.size()); i++){
+      if(!SameBits(r_expected[i], r_actual[i]))
+        mismatches++;
+    }
+    TS_ASSERT_EQUALS(mismatches, 0u);
+  }
+
+  /*Non-decreasing times with repeats and a large gap, and one column per awkward case*/
+  void MakeTrace(std::vector<double>& r_times, std::vector<std::vector<double>>& r_columns){
+    std::mt19937_64 generator(1);
+    const std::vector<double> special = {0.0, -0.0, NAN, -NAN, INFINITY, -INFINITY, std::numeric_limits<double>::denorm_min(),
+                                         -std::numeric_limits<double>::max(), 1e300, -1e-300, 1.0};
+    r_times.resize(rows);
+    r_columns.assign(4, std::vector<double>(rows));
+    for(unsigned int i = 0; i < rows; i++){
+      r_times[i] = i < rows/2 ? 0.01*(i - i%3) : 1e6 + 0.25*i;
+      r_columns[0][i] = -85 + 120*exp(-0.01*i)*sin(0.05*i);
+      r_columns[1][i] = special[(i*i)%special.size()];
+      r_columns[2][i] = i%100 < 50 ? 0.0 : -0.0;
+      const uint64_t bits = generator();
+      std::memcpy(&r_columns[3][i], &bits, sizeof(double));
+    }
+  }
+
+  std::vector<double> Select(const std::vector<double>& r_times, const std::vector<double>& r_values, double start_time, double end_time){
+    std::vector<double> selected;
+    for(unsigned int i = 0; i < r_times.size(); i++){
+      if(r_times[i] >= start_time && r_times[i] <= end_time)
+        selected.push_back(r_values[i]);
+    }
+    return selected;
+  }
+public:
+  void TestRoundTrip(){
+    const boost::filesystem::path file_path = boost::filesystem::temp_directory_path()/boost::filesystem::unique_path("trace_%%%%%%.bin");
+    const std::vector<std::string> names = {"smooth", "special", "zeros", "random"};
+    std::vector<double> times;
+    std::vector<std::vector<double>> columns;
+    MakeTrace(times, columns);
+    {
+      TraceWriter writer(file_path.string(), names, chunk_size);
+      for(unsigned int i = 0; i < rows; i++)
+        writer.AddRow(times[i], {columns[0][i], columns[1][i], columns[2][i], columns[3][i]});
+    }
+
+    TraceReader reader(file_path.string());
+    TS_ASSERT(reader.rGetVariableNames() == names);
+    TS_ASSERT_EQUALS(reader.GetVariableIndex("zeros"), 2u);
+    TS_ASSERT_THROWS_ANYTHING(reader.GetVariableIndex("missing"));
+    TS_ASSERT_EQUALS(reader.GetNumberOfRows(), rows);
+    CheckSameBits(times, reader.GetTimes());
+    for(unsigned int j = 0; j < names.size(); j++)
+      CheckSameBits(columns[j], reader.GetVariable(j));
+
+    /*Windows inside one chunk, across chunk boundaries, over the gap, on repeated times, and past either end*/
+    const std::vector<std::pair<double, double>> windows = {{0.5, 0.55}, {0.6, 1.3}, {3, 1e6 + 200}, {times[3], times[3]},
+                                                            {times[chunk_size], times[2*chunk_size - 1]}, {-1, 0.1}, {1e6 + 240, 1e7}, {2e7, 3e7}};
+    for(auto i = windows.begin(); i != windows.end(); i++){
+      CheckSameBits(Select(times, times, i->first, i->second), reader.GetTimes(i->first, i->second));
+      for(unsigned int j = 0; j < names.size(); j++)
+        CheckSameBits(Select(times, columns[j], i->first, i->second), reader.GetVariable(j, i->first, i->second));
+    }
+    TS_ASSERT(reader.GetTimes(2e7, 3e7).empty());
+    TS_ASSERT_THROWS_ANYTHING(reader.GetVariable(names.size()));
+    boost::filesystem::remove(file_path);
+  }
+
+  void TestTimesMustNotDecrease(){
+    const boost::filesystem::path file_path = boost::filesystem::temp_directory_path()/boost::filesystem::unique_path("trace_%%%%%%.bin");
+    {
+      TraceWriter writer(file_path.string(), {"v"}, chunk_size);
+      writer.AddRow(1, {0});
+      writer.AddRow(1, {1});
+      TS_ASSERT_THROWS_ANYTHING(writer.AddRow(0.5, {2}));
+      TS_ASSERT_THROWS_ANYTHING(writer.AddRow(NAN, {2}));
+      TS_ASSERT_THROWS_ANYTHING(writer.AddRow(2, {2, 3}));
+      /*Also across a chunk boundary*/
+      for(unsigned int i = 0; i < chunk_size; i++)
+        writer.AddRow(2 + i, {double(i)});
+      TS_ASSERT_THROWS_ANYTHING(writer.AddRow(1.5, {2}));
+    }
+    TraceReader reader(file_path.string());
+    TS_ASSERT_EQUALS(reader.GetNumberOfRows(), 2 + chunk_size);
+    boost::filesystem::remove(file_path);
+  }
+};
@@ -0,0 +1,108 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "Tracing.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+/*Check scoped tracing records nested scopes inside each other, keeps each
+  thread's events in its own buffer, only allocates what it uses, and writes
+  one complete event per scope in Chrome's trace format*/
+
+class TestTracing : public CxxTest::TestSuite
+{
+private:
+  std::string ReadFile(const std::string& file_path){
+    std::ifstream file_in(file_path);
+    std::stringstream contents;
+    contents << file_in.rdbuf();
+    return contents.str();
+  }
+
+  unsigned int CountOccurrences(const std::string& text, const std::string& pattern){
+    unsigned int count = 0;
+    for(size_t i = text.find(pattern); i != std::string::npos; i = text.find(pattern, i + 1))
+      count++;
+    return count;
+  }
+public:
+  void TestNestingAndThreads(){
+#ifdef CHASTE_PROJECT_TRACING
+    ClearTrace();
+    TraceBuffer& r_buffer = GetThreadTraceBuffer();
+    {
+      TRACE_SCOPE("outer");
+      {
+        TRACE_SCOPE("inner");
+      }
+    }
+    /*Events are recorded as scopes close, so the inner one first, and inside the outer one*/
+    TS_ASSERT_EQUALS(r_buffer.GetSize(), 2u);
+    const TraceEvent& r_inner = r_buffer.rGetEvent(0);
+    const TraceEvent& r_outer = r_buffer.rGetEvent(1);
+    TS_ASSERT_EQUALS(std::string(r_inner.name), "inner");
+    TS_ASSERT_EQUALS(std::string(r_outer.name), "outer");
+    TS_ASSERT_LESS_THAN_EQUALS(r_outer.start, r_inner.start);
+    TS_ASSERT_LESS_THAN_EQUALS(r_inner.start + r_inner.duration, r_outer.start + r_outer.duration);
+
+    /*Each thread records into its own buffer*/
+    const unsigned int events_per_thread = 3*TraceBuffer::chunk_size/2;
+    std::vector<TraceBuffer*> thread_buffers(2);
+    std::vector<std::thread> threads;
+    for(unsigned int t = 0; t < thread_buffers.size(); t++){
+      threads.push_back(std::thread([&, t](){
+        thread_buffers[t] = &GetThreadTraceBuffer();
+        for(unsigned int i = 0; i < events_per_thread; i++){
+          TRACE_SCOPE("worker");
+        }
+      }));
+    }
+    for(auto i = threads.begin(); i != threads.end(); i++)
+      i->join();
+    TS_ASSERT_DIFFERS(thread_buffers[0], thread_buffers[1]);
+    TS_ASSERT_DIFFERS(thread_buffers[0]->GetThreadIndex(), thread_buffers[1]->GetThreadIndex());
+    for(unsigned int t = 0; t < thread_buffers.size(); t++){
+      TS_ASSERT_DIFFERS(thread_buffers[t], &r_buffer);
+      TS_ASSERT_EQUALS(thread_buffers[t]->GetSize(), events_per_thread);
+      TS_ASSERT_EQUALS(thread_buffers[t]->GetNumberDropped(), 0u);
+      /*Storage grows a chunk at a time rather than up front*/
+      TS_ASSERT_EQUALS(thread_buffers[t]->GetAllocatedSize(), 2*TraceBuffer::chunk_size);
+    }
+    TS_ASSERT_EQUALS(r_buffer.GetSize(), 2u);
+    TS_ASSERT_EQUALS(r_buffer.GetAllocatedSize(), TraceBuffer::chunk_size);
+
+    /*One complete event per scope, each with the thread it ran on*/
+    boost::filesystem::path file_path = boost::filesystem::temp_directory_path()/boost::filesystem::unique_path("trace_%%%%.json");
+    WriteChromeTrace(file_path.string());
+    const std::string trace = ReadFile(file_path.string());
+    boost::filesystem::remove(file_path);
+    TS_ASSERT_EQUALS(trace.find("{\"traceEvents\": ["), 0u);
+    TS_ASSERT_EQUALS(trace.substr(trace.size() - 4), "\n]}\n");
+    TS_ASSERT_EQUALS(CountOccurrences(trace, "\"ph\": \"X\""), 2 + 2*events_per_thread);
+    TS_ASSERT_EQUALS(CountOccurrences(trace, "\"name\": \"inner\", \"ph\": \"X\", \"pid\": 0, \"tid\": " + std::to_string(r_buffer.GetThreadIndex()) + ","), 1u);
+    TS_ASSERT_EQUALS(CountOccurrences(trace, "\"name\": \"outer\""), 1u);
+    for(unsigned int t = 0; t < thread_buffers.size(); t++)
+      TS_ASSERT_EQUALS(CountOccurrences(trace, "\"name\": \"worker\", \"ph\": \"X\", \"pid\": 0, \"tid\": " + std::to_string(thread_buffers[t]->GetThreadIndex()) + ","), events_per_thread);
+
+    ClearTrace();
+    TS_ASSERT_EQUALS(r_buffer.GetSize(), 0u);
+#else
+    /*Scopes compile to nothing, and the export is an empty trace*/
+    {
+      TRACE_SCOPE("outer");
+    }
+    boost::filesystem::path file_path = boost::filesystem::temp_directory_path()/boost::filesystem::unique_path("trace_%%%%.json");
+    WriteChromeTrace(file_path.string());
+    TS_ASSERT_EQUALS(ReadFile(file_path.string()), "{\"traceEvents\": []}\n");
+    boost::filesystem::remove(file_path);
+    std::cout << "Tracing is not enabled.\n";
+#endif
+  }
+};